@@ -0,0 +1,556 @@
+/*! \file aio.hpp
+ ** Asynchronous block reader used by ihstream for hum-raw files. A read
+ ** is split into large requests and up to queue depth of them are kept
+ ** in flight, which is what NVMe devices and parallel file systems need
+ ** to reach their bandwidth. Requests go through io_uring (raw system
+ ** calls, no liburing needed) and fall back to a pool of threads doing
+ ** pread where io_uring is not available (old kernels, seccomp, non
+ ** Linux). With O_DIRECT the requests are aligned and staged through
+ ** aligned buffers. Define HUM_NO_IO_URING to build without io_uring.
+ **/
+
+#ifndef AIO_HPP
+
+#define AIO_HPP
+
+#include <vector>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#if defined(__linux__) && defined(__has_include) && !defined(HUM_NO_IO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define HUM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace aio {
+
+  const uint64_t alignment = 4096; /*!< O_DIRECT offset/size/buffer alignment */
+
+#ifdef HUM_IO_URING
+
+  /*! \brief Minimal io_uring submission/completion ring for reads */
+  class uring {
+  public:
+    uring();
+
+    ~uring();
+
+    /*! \brief Set up a ring with entries slots. Returns false
+     **        if io_uring is not available.
+     **/
+    bool init(unsigned entries);
+
+    void close();
+
+    /*! \brief Queue a read of bytes at offset of fd into buf
+     **        tagged with id (id < entries)
+     **/
+    void push(int fd, void *buf, size_t bytes, uint64_t offset, unsigned id);
+
+    /*! \brief Submit the queued reads and wait for one completion */
+    void pop(unsigned &id, int &res);
+
+  private:
+    int _fd;
+    void *_sq_ptr, *_cq_ptr;
+    size_t _sq_bytes, _cq_bytes, _sqe_bytes;
+    unsigned *_sq_tail, *_sq_mask, *_sq_array;
+    unsigned *_cq_head, *_cq_tail, *_cq_mask;
+    struct io_uring_sqe *_sqes;
+    struct io_uring_cqe *_cqes;
+    unsigned _to_submit;
+    std::vector<struct iovec> _iov; /*!< Must live until completion */
+  };
+#endif
+
+  /*! \brief pread fallback: n threads serving a request queue */
+  class threadPool {
+  public:
+    threadPool();
+
+    ~threadPool();
+
+    /*! \brief Start n_thread workers */
+    void init(unsigned n_thread);
+
+    /*! \brief Stop and join the workers */
+    void close();
+
+    /*! \brief Queue a read of bytes at offset of fd into buf */
+    void push(int fd, void *buf, size_t bytes, uint64_t offset, unsigned id);
+
+    /*! \brief Wait for one completion */
+    void pop(unsigned &id, int &res);
+
+  private:
+
+    struct request {
+      int fd;
+      void *buf;
+      size_t bytes;
+      uint64_t offset;
+      unsigned id;
+    };
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _work, _done;
+    std::deque<request> _queue;
+    std::deque< std::pair<unsigned, int> > _complete;
+    std::vector<pthread_t> _threads;
+    bool _stop;
+
+    /*! \brief The worker thread loop */
+    static void *Worker(void *pool);
+  };
+
+  /*! \brief Reads byte ranges of one file keeping up to queue
+   **        depth requests in flight
+   **/
+  class reader {
+  public:
+    reader();
+
+    ~reader();
+
+    /*! \brief Open fname for queue_depth concurrent requests of
+     **        request_bytes each. O_DIRECT is dropped silently if
+     **        the file system does not support it.
+     **/
+    bool open(const char *fname, unsigned queue_depth, bool direct,
+      size_t request_bytes = size_t(1) << 20);
+
+    void close();
+
+    bool isOpen() const;
+
+    /*! \brief True if requests go through io_uring */
+    bool isUring() const;
+
+    /*! \brief True if the file is read bypassing the page cache */
+    bool isDirect() const;
+
+    /*! \brief Reads bytes at offset of the file into data. Returns
+     **        false if a request fails or the file ends before the
+     **        last byte (data is then incomplete).
+     **/
+    bool read(void *data, uint64_t offset, size_t bytes);
+
+  private:
+
+    /*! \brief One request in flight */
+    struct slot {
+      char *dst; /*!< Destination of the wanted bytes */
+      uint64_t offset; /*!< File offset of the request */
+      size_t bytes; /*!< Request length (aligned if direct) */
+      size_t skip; /*!< Leading bytes not wanted (alignment) */
+      size_t want; /*!< Wanted bytes */
+      size_t done; /*!< Bytes read so far */
+    };
+
+    int _fd;
+    unsigned _depth;
+    bool _direct, _use_ring;
+    size_t _request_bytes;
+    std::vector<slot> _slots;
+    std::vector<char *> _staging; /*!< Aligned buffers (direct only) */
+#ifdef HUM_IO_URING
+    uring _ring;
+#endif
+    threadPool _pool;
+
+    /*! \brief Issue (the rest of) the request of slot id */
+    void push(unsigned id);
+
+    /*! \brief Wait for a completed request */
+    void pop(unsigned &id, int &res);
+
+    /// Non copyable
+    reader(const reader &);
+    reader &operator=(const reader &);
+  };
+
+  /***********   Implementation  ****************/
+
+#ifdef HUM_IO_URING
+
+  uring
+  ::uring()
+  : _fd(-1), _sq_ptr(MAP_FAILED), _cq_ptr(MAP_FAILED),
+  _sqes((struct io_uring_sqe *) MAP_FAILED), _to_submit(0) {
+    /* empty */
+  }
+
+  uring
+  ::~uring() {
+    close();
+  }
+
+  bool uring
+  ::init(unsigned entries) {
+    close();
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof (params));
+    _fd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (_fd < 0) return false;
+    _sq_bytes = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+    _cq_bytes = params.cq_off.cqes +
+      params.cq_entries * sizeof (struct io_uring_cqe);
+    _sqe_bytes = params.sq_entries * sizeof (struct io_uring_sqe);
+    _sq_ptr = mmap(0, _sq_bytes, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    _cq_ptr = mmap(0, _cq_bytes, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+    _sqes = (struct io_uring_sqe *) mmap(0, _sqe_bytes,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+      IORING_OFF_SQES);
+    if (_sq_ptr == MAP_FAILED || _cq_ptr == MAP_FAILED ||
+      _sqes == MAP_FAILED) {
+      close();
+      return false;
+    }
+    char *sq = static_cast<char *> (_sq_ptr);
+    char *cq = static_cast<char *> (_cq_ptr);
+    _sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    _sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    _sq_array = (unsigned *) (sq + params.sq_off.array);
+    _cq_head = (unsigned *) (cq + params.cq_off.head);
+    _cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    _cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    _cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    _iov.resize(params.sq_entries);
+    _to_submit = 0;
+    return true;
+  }
+
+  void uring
+  ::close() {
+    if (_sqes != MAP_FAILED) munmap(_sqes, _sqe_bytes);
+    if (_cq_ptr != MAP_FAILED) munmap(_cq_ptr, _cq_bytes);
+    if (_sq_ptr != MAP_FAILED) munmap(_sq_ptr, _sq_bytes);
+    if (_fd >= 0) ::close(_fd);
+    _fd = -1;
+    _sq_ptr = _cq_ptr = MAP_FAILED;
+    _sqes = (struct io_uring_sqe *) MAP_FAILED;
+  }
+
+  void uring
+  ::push(int fd, void *buf, size_t bytes, uint64_t offset, unsigned id) {
+    assert(id < _iov.size());
+    /// Only this thread moves the tail
+    unsigned tail = *_sq_tail;
+    unsigned idx = tail & *_sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[idx];
+    std::memset(sqe, 0, sizeof (struct io_uring_sqe));
+    _iov[id].iov_base = buf;
+    _iov[id].iov_len = bytes;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) & _iov[id];
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = id;
+    _sq_array[idx] = idx;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    _to_submit++;
+  }
+
+  void uring
+  ::pop(unsigned &id, int &res) {
+    /// Hand new requests to the kernel before harvesting
+    if (_to_submit > 0) {
+      int ret = int(syscall(__NR_io_uring_enter, _fd, _to_submit, 0, 0, NULL, 0));
+      if (ret > 0) _to_submit -= unsigned(ret);
+    }
+    for (;;) {
+      unsigned head = *_cq_head;
+      if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &_cqes[head & *_cq_mask];
+        id = unsigned(cqe->user_data);
+        res = cqe->res;
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+        return;
+      }
+      int ret = int(syscall(__NR_io_uring_enter, _fd, _to_submit, 1,
+        IORING_ENTER_GETEVENTS, NULL, 0));
+      if (ret < 0) {
+        assert(errno == EINTR || errno == EAGAIN);
+        continue;
+      }
+      _to_submit -= unsigned(ret);
+    }
+  }
+#endif
+
+  threadPool
+  ::threadPool()
+  : _stop(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_work, NULL);
+    pthread_cond_init(&_done, NULL);
+  }
+
+  threadPool
+  ::~threadPool() {
+    close();
+    pthread_cond_destroy(&_done);
+    pthread_cond_destroy(&_work);
+    pthread_mutex_destroy(&_mutex);
+  }
+
+  void threadPool
+  ::init(unsigned n_thread) {
+    close();
+    _stop = false;
+    _threads.resize(n_thread);
+    for (unsigned i = 0; i < n_thread; ++i) {
+      int status = pthread_create(&_threads[i], NULL, Worker, this);
+      assert(status == 0);
+    }
+  }
+
+  void threadPool
+  ::close() {
+    if (_threads.empty()) return;
+    pthread_mutex_lock(&_mutex);
+    _stop = true;
+    pthread_cond_broadcast(&_work);
+    pthread_mutex_unlock(&_mutex);
+    for (size_t i = 0; i < _threads.size(); ++i)
+      pthread_join(_threads[i], NULL);
+    _threads.clear();
+    _queue.clear();
+    _complete.clear();
+  }
+
+  void threadPool
+  ::push(int fd, void *buf, size_t bytes, uint64_t offset, unsigned id) {
+    request req;
+    req.fd = fd;
+    req.buf = buf;
+    req.bytes = bytes;
+    req.offset = offset;
+    req.id = id;
+    pthread_mutex_lock(&_mutex);
+    _queue.push_back(req);
+    pthread_cond_signal(&_work);
+    pthread_mutex_unlock(&_mutex);
+  }
+
+  void threadPool
+  ::pop(unsigned &id, int &res) {
+    pthread_mutex_lock(&_mutex);
+    while (_complete.empty())
+      pthread_cond_wait(&_done, &_mutex);
+    id = _complete.front().first;
+    res = _complete.front().second;
+    _complete.pop_front();
+    pthread_mutex_unlock(&_mutex);
+  }
+
+  void *threadPool
+  ::Worker(void *pool) {
+    threadPool &self = *static_cast<threadPool *> (pool);
+    for (;;) {
+      pthread_mutex_lock(&self._mutex);
+      while (self._queue.empty() && self._stop == false)
+        pthread_cond_wait(&self._work, &self._mutex);
+      if (self._queue.empty()) {
+        pthread_mutex_unlock(&self._mutex);
+        return NULL;
+      }
+      request req = self._queue.front();
+      self._queue.pop_front();
+      pthread_mutex_unlock(&self._mutex);
+      /// Same result convention as io_uring (-errno on failure)
+      ssize_t ret = pread(req.fd, req.buf, req.bytes, req.offset);
+      int res = (ret < 0) ? -errno : int(ret);
+      pthread_mutex_lock(&self._mutex);
+      self._complete.push_back(std::make_pair(req.id, res));
+      pthread_cond_signal(&self._done);
+      pthread_mutex_unlock(&self._mutex);
+    }
+  }
+
+  reader
+  ::reader()
+  : _fd(-1), _depth(0), _direct(false), _use_ring(false),
+  _request_bytes(0) {
+    /* empty */
+  }
+
+  reader
+  ::~reader() {
+    close();
+  }
+
+  bool reader
+  ::open(const char *fname, unsigned queue_depth, bool direct,
+    size_t request_bytes) {
+    close();
+    if (direct == true) {
+      _fd = ::open(fname, O_RDONLY | O_DIRECT);
+      /// File system without O_DIRECT (e.g. tmpfs)
+      if (_fd < 0) direct = false;
+    }
+    if (_fd < 0) _fd = ::open(fname, O_RDONLY);
+    if (_fd < 0) return false;
+    _depth = (queue_depth > 0) ? queue_depth : 1;
+    _direct = direct;
+    _request_bytes = (request_bytes + alignment - 1) / alignment * alignment;
+    _slots.resize(_depth);
+    if (_direct == true) {
+      _staging.resize(_depth);
+      for (unsigned i = 0; i < _depth; ++i) {
+        void *buf;
+        int status = posix_memalign(&buf, alignment, _request_bytes + alignment);
+        assert(status == 0);
+        _staging[i] = static_cast<char *> (buf);
+      }
+    }
+#ifdef HUM_IO_URING
+    _use_ring = _ring.init(_depth);
+#endif
+    if (_use_ring == false)
+      _pool.init(_depth);
+    return true;
+  }
+
+  void reader
+  ::close() {
+    if (_fd < 0) return;
+#ifdef HUM_IO_URING
+    _ring.close();
+#endif
+    _pool.close();
+    for (size_t i = 0; i < _staging.size(); ++i)
+      free(_staging[i]);
+    _staging.clear();
+    _slots.clear();
+    ::close(_fd);
+    _fd = -1;
+    _use_ring = false;
+    _direct = false;
+  }
+
+  bool reader
+  ::isOpen() const {
+    return _fd >= 0;
+  }
+
+  bool reader
+  ::isUring() const {
+    return _use_ring;
+  }
+
+  bool reader
+  ::isDirect() const {
+    return _direct;
+  }
+
+  bool reader
+  ::read(void *data, uint64_t offset, size_t bytes) {
+    assert(_fd >= 0);
+    char *dst = static_cast<char *> (data);
+    uint64_t next = offset, end = offset + bytes;
+    unsigned in_flight = 0;
+    bool is_ok = true;
+    std::vector<unsigned> free_ids;
+    for (unsigned i = _depth; i > 0; --i)
+      free_ids.push_back(i - 1);
+    while (next < end || in_flight > 0) {
+      /// Keep the queue full
+      while (next < end && free_ids.empty() == false) {
+        unsigned id = free_ids.back();
+        free_ids.pop_back();
+        slot &s = _slots[id];
+        s.want = size_t(std::min(uint64_t(_request_bytes), end - next));
+        s.dst = dst + (next - offset);
+        s.done = 0;
+        if (_direct == true) {
+          s.offset = next / alignment * alignment;
+          s.skip = size_t(next - s.offset);
+          s.bytes = (s.skip + s.want + alignment - 1) / alignment * alignment;
+        } else {
+          s.offset = next;
+          s.skip = 0;
+          s.bytes = s.want;
+        }
+        push(id);
+        next += s.want;
+        in_flight++;
+      }
+      unsigned id;
+      int res;
+      pop(id, res);
+      slot &s = _slots[id];
+      if (res == -EINTR || res == -EAGAIN) {
+        push(id);
+        continue;
+      }
+      /// A failed request (-errno) or the end of the file (0)
+      /// leaves the slot short
+      size_t start = s.done;
+      if (res > 0) s.done += size_t(res);
+      bool is_short = (s.done < s.skip + s.want);
+      if (res > 0 && is_short == true) {
+        /// Short read, ask for the rest (O_DIRECT from the start of the
+        /// block it stopped in, unaligned offsets are refused)
+        if (_direct == true) s.done = s.done / alignment * alignment;
+        if (s.done > start) {
+          push(id);
+          continue;
+        }
+      }
+      if (is_short == true) {
+        /// The requests in flight still write their buffers, drain them
+        is_ok = false;
+        next = end;
+      } else if (_direct == true && is_ok == true)
+        std::memcpy(s.dst, _staging[id] + s.skip, s.want);
+      free_ids.push_back(id);
+      in_flight--;
+    }
+    return is_ok;
+  }
+
+  void reader
+  ::push(unsigned id) {
+    slot &s = _slots[id];
+    char *buf = (_direct == true) ? _staging[id] : s.dst;
+#ifdef HUM_IO_URING
+    if (_use_ring == true) {
+      _ring.push(_fd, buf + s.done, s.bytes - s.done, s.offset + s.done, id);
+      return;
+    }
+#endif
+    _pool.push(_fd, buf + s.done, s.bytes - s.done, s.offset + s.done, id);
+  }
+
+  void reader
+  ::pop(unsigned &id, int &res) {
+#ifdef HUM_IO_URING
+    if (_use_ring == true) {
+      _ring.pop(id, res);
+      return;
+    }
+#endif
+    _pool.pop(id, res);
+  }
+
+} // end of aio namespace
+
+#endif
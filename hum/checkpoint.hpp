@@ -0,0 +1,527 @@
+/*! \file checkpoint.hpp
+ ** Asynchronous checkpoint/restart of solver state on top of the field
+ ** support of ohstream (see fields.hpp). A checkpoint copies the
+ ** registered arrays (fields, permutation state, ...) into one of two
+ ** staging slots and returns, a background thread then writes the slot to
+ ** its own checkpoint file, serially or through sub-files. With two slots
+ ** the next checkpoint is staged while the previous one drains; the caller
+ ** only blocks when both slots are still waiting to be written.
+ **
+ ** The writer thread issues the sub-file collectives on its own copy of
+ ** the communicator, which needs MPI_THREAD_MULTIPLE. HDF5 is used by
+ ** the writer thread while a checkpoint drains, so unless HDF5 is built
+ ** thread safe the thread writes under the lock of the stream the solver
+ ** does its own HDF5 calls through (set_lock). Without either the
+ ** checkpoints are written by the calling thread, as they are if the
+ ** thread can not be started.
+ **
+ ** Serial checkpoints of a job of several ranks go to one file per rank
+ ** (prefix_<num>_<rank>.hum), each holding the window of its rank.
+ **
+ ** Restart reads every array back from a checkpoint file with the same
+ ** partitioning, every rank opening the file and reading its own window.
+ **/
+
+#ifndef CHECKPOINT_HPP
+
+#define CHECKPOINT_HPP
+
+#include "ohstream.hpp"
+#include "concurrent.hpp"
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+
+namespace checkpoint {
+
+  /*! \brief Name of the checkpoint file number num of prefix */
+  std::string FileName(const std::string &prefix, hsize_t num);
+
+  /*! \brief Name of the serial checkpoint file number num of rank */
+  std::string FileName(const std::string &prefix, hsize_t num, int rank);
+
+  /*! \brief Writes the staged bytes of one array as a field step */
+  template<typename T>
+  void WriteArray(ohstream &out, const std::string &name, hsize_t step,
+    const void *data, hsize_t offset, hsize_t size);
+
+  /*! \brief One registered array and its window on this rank */
+  struct array {
+    std::string name;
+    unsigned centring, nComponents;
+    const void *data; /*!< Solver owned values */
+    size_t elemBytes; /*!< Bytes per entity */
+    hsize_t offset, size; /*!< Window of this rank */
+    void (*write)(ohstream &, const std::string &, hsize_t,
+      const void *, hsize_t, hsize_t);
+  };
+
+  /*! \brief Staged copy of all arrays of one checkpoint */
+  struct slot {
+    std::vector< std::vector<char> > bytes; /*!< One buffer per array */
+    double time;
+    hsize_t num; /*!< Checkpoint number */
+    bool isBusy; /*!< Staged and not yet written */
+  };
+
+  /*! \brief Asynchronous checkpoint writer */
+  class engine {
+  public:
+    engine();
+
+    ~engine();
+
+    /*! \brief Serial checkpoints prefix_<num>.hum (one file
+     **        per rank if MPI runs several)
+     **/
+    void open(const char *prefix);
+
+    /*! \brief Checkpoints split across n_subfile sub-files
+     **        (collective over comm, see ohstream)
+     **/
+    void open(const char *prefix, MPI_Comm &comm, unsigned n_subfile);
+
+    /*! \brief Wait for the pending checkpoints and stop the writer */
+    void close();
+
+    /*! \brief Global number of cells, nodes and faces (sizes
+     **        of the arrays of each centring)
+     **/
+    void set_size(hsize_t n_cell, hsize_t n_node, hsize_t n_face);
+
+    /*! \brief HDF5 calls of the writer thread are made under the
+     **        lock of r, the stream the caller reads through (set
+     **        before open, needed for a writer thread unless HDF5 is
+     **        thread safe)
+     **/
+    void set_lock(concurrent::reader &r);
+
+    /*! \brief Chunking and deflate level of the serial
+     **        checkpoint datasets (see ohstream)
+     **/
+    void set_deflate(hsize_t chunk_size, int level);
+
+    /*! \brief Register the window [offset, offset + size) of an
+     **        array of n_comp values per entity of centring. The
+     **        values are read at every checkpoint.
+     **/
+    template<typename T>
+    void add(const std::string &name, unsigned centring, unsigned n_comp,
+      const T *data, hsize_t offset, hsize_t size);
+
+    /*! \brief Stage all arrays at time and return the checkpoint
+     **        number (written in the background)
+     **/
+    hsize_t write(double time);
+
+    /*! \brief Wait until all staged checkpoints are written */
+    void wait();
+
+    /*! \brief True if checkpoints are written by the writer thread */
+    bool isAsync() const;
+
+    /*! \brief File name of checkpoint num */
+    std::string name(hsize_t num) const;
+
+  private:
+    std::string _prefix;
+    bool _is_open, _is_subfile, _is_async;
+    int _rank; /*!< Of serial files of a job of ranks (else -1) */
+    concurrent::reader *_lock; /*!< Shared HDF5 lock (or NULL) */
+    MPI_Comm _comm; /*!< Private copy for the writer collectives */
+    unsigned _n_subfile;
+    hsize_t _n_cell, _n_node, _n_face;
+    hsize_t _chunk_size;
+    int _deflate_level;
+    std::vector<array> _array;
+    slot _slot[2];
+    unsigned _next; /*!< Slot of the next checkpoint */
+    hsize_t _count; /*!< Checkpoints staged so far */
+    std::deque<unsigned> _queue; /*!< Staged slots in order */
+    pthread_mutex_t _mutex;
+    pthread_cond_t _work, _done;
+    pthread_t _thread;
+    bool _stop;
+
+    engine(const engine &);
+
+    engine &operator=(const engine &);
+
+    /*! \brief Start the writer thread if the thread level and
+     **        the HDF5 library allow
+     **/
+    void start();
+
+    /*! \brief Write slot s (under the shared lock if any) */
+    void flush(slot &s);
+
+    /*! \brief Write slot s to its checkpoint file */
+    void Write(slot &s);
+
+    /*! \brief The writer thread loop */
+    static void *Writer(void *self);
+  };
+
+  /*! \brief Reads the arrays of one checkpoint file */
+  class restart {
+  public:
+    restart();
+
+    explicit restart(const char *fname);
+
+    ~restart();
+
+    void open(const char *fname);
+
+    void close();
+
+    /*! \brief Time of the checkpoint */
+    double time() const;
+
+    /*! \brief True if the checkpoint holds the array name */
+    bool has(const std::string &name) const;
+
+    /*! \brief Read the window [offset, offset + size) of the array
+     **        name (the type and components must match add)
+     **/
+    template<typename T>
+    void read(const std::string &name, T *data, hsize_t offset,
+      hsize_t size);
+
+  private:
+    hid_t _file;
+    fields::infoList _info;
+    fields::nameList _names;
+
+    /*! \brief Array number of name (asserts it exists) */
+    size_t find(const std::string &name) const;
+  };
+
+  /***********   Implementation  ****************/
+
+  std::string FileName(const std::string &prefix, hsize_t num) {
+    std::stringstream cat;
+    cat << prefix << "_" << num << ".hum";
+    return cat.str();
+  }
+
+  std::string FileName(const std::string &prefix, hsize_t num, int rank) {
+    std::stringstream cat;
+    cat << prefix << "_" << num << "_" << rank << ".hum";
+    return cat.str();
+  }
+
+  template<typename T>
+  void WriteArray(ohstream &out, const std::string &name, hsize_t step,
+    const void *data, hsize_t offset, hsize_t size) {
+    out.write_field(name, step, static_cast<const T *> (data),
+      offset, size);
+  }
+
+  engine
+  ::engine()
+  : _is_open(false), _is_subfile(false), _is_async(false), _rank(-1),
+  _lock(NULL), _n_subfile(0), _n_cell(0), _n_node(0), _n_face(0), _chunk_size(0),
+  _deflate_level(0), _next(0), _count(0), _stop(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_work, NULL);
+    pthread_cond_init(&_done, NULL);
+    _slot[0].isBusy = false;
+    _slot[1].isBusy = false;
+  }
+
+  engine
+  ::~engine() {
+    close();
+    pthread_cond_destroy(&_done);
+    pthread_cond_destroy(&_work);
+    pthread_mutex_destroy(&_mutex);
+  }
+
+  void engine
+  ::open(const char *prefix) {
+    close();
+    _prefix = prefix;
+    _is_subfile = false;
+    /// Ranks of a job would all write the same file
+    int is_mpi = 0, n_rank = 1;
+    MPI_Initialized(&is_mpi);
+    if (is_mpi) MPI_Comm_size(MPI_COMM_WORLD, &n_rank);
+    _rank = -1;
+    if (n_rank > 1) MPI_Comm_rank(MPI_COMM_WORLD, &_rank);
+    _is_open = true;
+    start();
+  }
+
+  void engine
+  ::open(const char *prefix, MPI_Comm &comm, unsigned n_subfile) {
+    close();
+    _prefix = prefix;
+    MPI_Comm_dup(comm, &_comm);
+    _n_subfile = n_subfile;
+    _is_subfile = true;
+    _rank = -1;
+    _is_open = true;
+    start();
+  }
+
+  void engine
+  ::close() {
+    if (_is_open == false) return;
+    wait();
+    if (_is_async == true) {
+      pthread_mutex_lock(&_mutex);
+      _stop = true;
+      pthread_cond_signal(&_work);
+      pthread_mutex_unlock(&_mutex);
+      pthread_join(_thread, NULL);
+    }
+    if (_is_subfile == true) MPI_Comm_free(&_comm);
+    _array.clear();
+    for (unsigned i = 0; i < 2; ++i)
+      std::vector< std::vector<char> >().swap(_slot[i].bytes);
+    _is_async = false;
+    _is_subfile = false;
+    _is_open = false;
+    _stop = false;
+    _next = 0;
+    _count = 0;
+  }
+
+  void engine
+  ::set_size(hsize_t n_cell, hsize_t n_node, hsize_t n_face) {
+    _n_cell = n_cell;
+    _n_node = n_node;
+    _n_face = n_face;
+  }
+
+  void engine
+  ::set_lock(concurrent::reader &r) {
+    _lock = &r;
+  }
+
+  void engine
+  ::set_deflate(hsize_t chunk_size, int level) {
+    _chunk_size = chunk_size;
+    _deflate_level = level;
+  }
+
+  template<typename T>
+  void engine
+  ::add(const std::string &name, unsigned centring, unsigned n_comp,
+    const T *data, hsize_t offset, hsize_t size) {
+    /// Arrays can not change while checkpoints are pending
+    wait();
+    array a;
+    a.name = name;
+    a.centring = centring;
+    a.nComponents = n_comp;
+    a.data = data;
+    a.elemBytes = n_comp * sizeof (T);
+    a.offset = offset;
+    a.size = size;
+    a.write = &WriteArray<T>;
+    _array.push_back(a);
+  }
+
+  hsize_t engine
+  ::write(double time) {
+    assert(_is_open);
+    slot &s = _slot[_next];
+    /// Block only if this slot is still draining
+    pthread_mutex_lock(&_mutex);
+    while (s.isBusy == true)
+      pthread_cond_wait(&_done, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+    s.bytes.resize(_array.size());
+    for (size_t i = 0; i < _array.size(); ++i) {
+      const array &a = _array[i];
+      s.bytes[i].resize(a.size * a.elemBytes + 1);
+      if (a.size > 0)
+        std::memcpy(&s.bytes[i][0], a.data, a.size * a.elemBytes);
+    }
+    s.time = time;
+    s.num = _count++;
+    if (_is_async == false) {
+      flush(s);
+      return s.num;
+    }
+    pthread_mutex_lock(&_mutex);
+    s.isBusy = true;
+    _queue.push_back(_next);
+    pthread_cond_signal(&_work);
+    pthread_mutex_unlock(&_mutex);
+    _next ^= 1u;
+    return s.num;
+  }
+
+  void engine
+  ::wait() {
+    pthread_mutex_lock(&_mutex);
+    while (_slot[0].isBusy == true || _slot[1].isBusy == true)
+      pthread_cond_wait(&_done, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+  }
+
+  bool engine
+  ::isAsync() const {
+    return _is_async;
+  }
+
+  std::string engine
+  ::name(hsize_t num) const {
+    if (_rank >= 0) return FileName(_prefix, num, _rank);
+    return FileName(_prefix, num);
+  }
+
+  void engine
+  ::start() {
+    /// HDF5 calls from the writer thread need a thread safe library
+    /// or the lock the caller's HDF5 calls go through (the library
+    /// can only be asked since HDF5 1.8.16, older ones write in the
+    /// calling thread)
+    hbool_t is_safe = false;
+#if H5_VERSION_GE(1,8,16)
+    H5is_library_threadsafe(&is_safe);
+#endif
+    _is_async = (is_safe > 0 || _lock != NULL);
+    /// Collectives from the writer thread need full thread support
+    if (_is_async == true && _is_subfile == true) {
+      int level;
+      MPI_Query_thread(&level);
+      _is_async = (level == MPI_THREAD_MULTIPLE);
+    }
+    if (_is_async == false) return;
+    /// Written by the calling thread if no thread can be started
+    _is_async = (pthread_create(&_thread, NULL, Writer, this) == 0);
+  }
+
+  void engine
+  ::flush(slot &s) {
+    if (_is_async == true && _lock != NULL) {
+      concurrent::hdf5Lock lock(*_lock);
+      Write(s);
+      return;
+    }
+    Write(s);
+  }
+
+  void engine
+  ::Write(slot &s) {
+    std::string fname = name(s.num);
+    ohstream out;
+    if (_is_subfile == true)
+      out.open(fname.c_str(), _comm, _n_subfile);
+    else {
+      /// An old checkpoint of this name would be opened for update
+      std::remove(fname.c_str());
+      out.open(fname.c_str());
+      if (_chunk_size > 0) out.set_deflate(_chunk_size, _deflate_level);
+    }
+    out.set_size(_n_node, _n_face);
+    out.set_cell_size(_n_cell);
+    for (size_t i = 0; i < _array.size(); ++i) {
+      const array &a = _array[i];
+      out.add_field(a.name, a.centring, a.nComponents);
+      hsize_t step = out.append_field_step(a.name, s.time);
+      a.write(out, a.name, step, &s.bytes[i][0], a.offset, a.size);
+    }
+    out.close();
+  }
+
+  void *engine
+  ::Writer(void *self) {
+    engine &e = *static_cast<engine *> (self);
+    for (;;) {
+      pthread_mutex_lock(&e._mutex);
+      while (e._queue.empty() && e._stop == false)
+        pthread_cond_wait(&e._work, &e._mutex);
+      if (e._queue.empty()) {
+        pthread_mutex_unlock(&e._mutex);
+        return NULL;
+      }
+      unsigned i = e._queue.front();
+      e._queue.pop_front();
+      pthread_mutex_unlock(&e._mutex);
+      e.flush(e._slot[i]);
+      pthread_mutex_lock(&e._mutex);
+      e._slot[i].isBusy = false;
+      pthread_cond_broadcast(&e._done);
+      pthread_mutex_unlock(&e._mutex);
+    }
+  }
+
+  restart
+  ::restart()
+  : _file(-1) {
+    /* empty */
+  }
+
+  restart
+  ::restart(const char *fname)
+  : _file(-1) {
+    open(fname);
+  }
+
+  restart
+  ::~restart() {
+    close();
+  }
+
+  void restart
+  ::open(const char *fname) {
+    close();
+    /// Every rank reads its own window, no MPI-IO needed
+    _file = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
+    assert(_file >= 0);
+    fields::Read(_file, _info, _names);
+  }
+
+  void restart
+  ::close() {
+    if (_file >= 0) H5Fclose(_file);
+    _file = -1;
+    _info.clear();
+    _names.clear();
+  }
+
+  double restart
+  ::time() const {
+    assert(_info.empty() == false && _info[0].time.empty() == false);
+    return _info[0].time.back();
+  }
+
+  bool restart
+  ::has(const std::string &name) const {
+    return std::find(_names.begin(), _names.end(), name) != _names.end();
+  }
+
+  template<typename T>
+  void restart
+  ::read(const std::string &name, T *data, hsize_t offset, hsize_t size) {
+    const fields::info &f = _info[find(name)];
+    assert(f.time.empty() == false);
+    if (size == 0) return;
+    h5pp::listString link = fields::StepLink(name, f.time.size() - 1);
+    hid_t dtype = fields::MakeType<T>(f.nComponents);
+    /// Deflated checkpoints are decoded in parallel
+    if (chunkio::TryReadChunked(_file, data, dtype, link, offset, size) == false)
+      h5pp::ReadVectorDataSerial(_file, data, dtype, link, offset, 1, size);
+    H5Tclose(dtype);
+  }
+
+  size_t restart
+  ::find(const std::string &name) const {
+    size_t num = std::find(_names.begin(), _names.end(), name) - _names.begin();
+    assert(num < _names.size());
+    return num;
+  }
+
+} // end of checkpoint namespace
+
+#endif
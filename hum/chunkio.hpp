@@ -0,0 +1,474 @@
+/*! \file chunkio.hpp
+ ** Direct chunk I/O for compressed hum datasets (deflate, delta + bit
+ ** packed integers, see deltapack.hpp, or quantised node coordinates,
+ ** see nodequant.hpp). HDF5 runs its filter pipeline
+ ** on a single thread, so here the raw chunks are moved between file
+ ** and memory by HDF5 while the (de)compression of all the chunks in a
+ ** window runs concurrently using TBB.
+ **/
+
+#ifndef CHUNKIO_HPP
+
+#define CHUNKIO_HPP
+
+#include "h5++.hpp"
+#include "deltapack.hpp"
+#include "nodequant.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <zlib.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace chunkio {
+
+  typedef std::vector<unsigned char> byteBuffer;
+
+  /*! \brief Outcome of a direct chunk read */
+  enum readStatus {
+    readFallback = 0, /*!< Not served, read through HDF5 instead */
+    readDone, /*!< All chunks of the window decoded */
+    readCorrupt /*!< A chunk did not decode, the window is invalid */
+  };
+
+  /*! \brief The (single) filter of a chunked dataset */
+  struct filter {
+    H5Z_filter_t id; /*!< Deflate, deltapack or nodequant filter ID */
+    int level; /*!< Deflate level */
+    unsigned int_bytes, stride; /*!< Packed integer (or quantised
+                                 **  float) size and count */
+    double step; /*!< Lattice step of quantised nodes */
+  };
+
+  /*! \brief Deflate at the given level */
+  filter Deflate(int level);
+
+  /*! \brief Delta + bit packing of stride integers per element */
+  filter Packed(unsigned int_bytes, unsigned stride);
+
+  /*! \brief Nodes of float_bytes per coordinate quantised to a
+   **        lattice of spacing step
+   **/
+  filter Quantised(unsigned float_bytes, double step);
+
+  /*! \brief Rank one chunked data-set creation property list */
+  hid_t MakePlist(hsize_t chunk_size, const filter &f);
+
+  /*! \brief Checks if the rank one data-set is chunked with one
+   **        filter this file can code and returns the chunk size
+   **        (in elements) and the filter
+   **/
+  bool IsFilterChunked(hid_t dset, hsize_t &chunk_size, filter &f);
+
+  /*! \brief The fill value of the dataset as one element of
+   **        mem_dtype, zeros unless the dataset defines one
+   **/
+  byteBuffer FillValue(hid_t dset, hid_t mem_dtype);
+
+  /*! \brief Sets bytes of out to copies of the element fill */
+  void Fill(unsigned char *out, size_t bytes, const byteBuffer &fill);
+
+  /*! \brief Decodes one raw chunk of raw_bytes (stored with the
+   **        filter mask) into chunk_bytes of out. An empty chunk
+   **        (unallocated) decodes to the fill value fill. Returns
+   **        false if the chunk is corrupt.
+   **/
+  bool DecodeChunk(const unsigned char *raw, size_t raw_bytes,
+    uint32_t mask, unsigned char *out, size_t chunk_bytes,
+    const filter &f, const byteBuffer &fill);
+
+  /*! \brief The tbb parallel for functor decoding raw
+   **        chunks into one contiguous output buffer
+   **/
+  struct decodeFunctor {
+  public:
+    /// Constructor
+    decodeFunctor(std::vector<byteBuffer> &raw,
+      std::vector<uint32_t> &mask, unsigned char *out,
+      size_t chunk_bytes, const filter &f, const byteBuffer &fill,
+      byteBuffer &is_valid);
+    /// The tbb parallel for functor
+    void operator()(const tbb::blocked_range<size_t> &range) const;
+
+  private:
+    std::vector<byteBuffer> &_raw;
+    std::vector<uint32_t> &_mask;
+    unsigned char *_out;
+    byteBuffer &_is_valid; /*!< Set per chunk decoded */
+    size_t _chunk_bytes;
+    filter _filter;
+    const byteBuffer &_fill; /*!< Element of unallocated chunks */
+  };
+
+  /*! \brief The tbb parallel for functor coding
+   **        contiguous chunks into separate raw buffers
+   **/
+  struct encodeFunctor {
+  public:
+    /// Constructor
+    encodeFunctor(const unsigned char *in, size_t chunk_bytes,
+      std::vector<byteBuffer> &raw, std::vector<uint32_t> &mask,
+      const filter &f);
+    /// The tbb parallel for functor
+    void operator()(const tbb::blocked_range<size_t> &range) const;
+
+  private:
+    const unsigned char *_in;
+    size_t _chunk_bytes;
+    std::vector<byteBuffer> &_raw;
+    std::vector<uint32_t> &_mask;
+    filter _filter;
+  };
+
+  /*! \brief Reads the window [offset, offset + size) of a filter
+   **        chunked dataset by fetching the raw chunks and
+   **        decoding them in parallel. Returns readFallback (and
+   **        reads nothing) if the dataset layout or type does not
+   **        allow it and readCorrupt if a chunk fails to decode.
+   **/
+  readStatus ReadChunked(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t offset, hsize_t size);
+
+  /*! \brief ReadChunked for readers without a status: returns
+   **        false if the window has to be read through HDF5 and stops
+   **        with an error naming the dataset if a chunk is corrupt
+   **        (HDF5 could not decode it either)
+   **/
+  bool TryReadChunked(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t offset, hsize_t size);
+
+  /*! \brief Writes the window [offset, offset + size) to a chunked
+   **        dataset (created with filter f if necessary). Fully
+   **        covered chunks are coded in parallel and written directly,
+   **        the partial chunks at the ends go through HDF5.
+   **/
+  void WriteChunked(hid_t file, const void *data, hid_t mem_dtype,
+    hid_t file_dtype, h5pp::listString &link, hsize_t offset,
+    hsize_t size, hsize_t file_size, hsize_t chunk_size, const filter &f);
+
+  /*! \brief Writes a hyperslab of a rank one dataset through
+   **        the HDF5 filter pipeline
+   **/
+  void WriteSlab(hid_t dset, const void *data, hid_t mem_dtype,
+    hsize_t offset, hsize_t size);
+
+  /***********   Implementation  ****************/
+
+  filter Deflate(int level) {
+    filter f;
+    f.id = H5Z_FILTER_DEFLATE;
+    f.level = level;
+    f.int_bytes = 0;
+    f.stride = 0;
+    f.step = 0.0;
+    return f;
+  }
+
+  filter Packed(unsigned int_bytes, unsigned stride) {
+    filter f;
+    f.id = deltapack::filterId;
+    f.level = 0;
+    f.int_bytes = int_bytes;
+    f.stride = stride;
+    f.step = 0.0;
+    return f;
+  }
+
+  filter Quantised(unsigned float_bytes, double step) {
+    filter f;
+    f.id = nodequant::filterId;
+    f.level = 0;
+    f.int_bytes = float_bytes;
+    f.stride = 3;
+    f.step = step;
+    return f;
+  }
+
+  hid_t MakePlist(hsize_t chunk_size, const filter &f) {
+    if (f.id == H5Z_FILTER_DEFLATE)
+      return h5pp::MakeDeflatePlist(chunk_size, f.level);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    herr_t status = H5Pset_chunk(dcpl, 1, &chunk_size);
+    assert(status >= 0);
+    if (f.id == nodequant::filterId) {
+      nodequant::Register();
+      unsigned cd_values[3] = {f.int_bytes, 0, 0};
+      nodequant::StepToValues(f.step, cd_values + 1);
+      status = H5Pset_filter(dcpl, nodequant::filterId, H5Z_FLAG_OPTIONAL,
+        3, cd_values);
+    } else {
+      deltapack::Register();
+      unsigned cd_values[2] = {f.int_bytes, f.stride};
+      status = H5Pset_filter(dcpl, deltapack::filterId, H5Z_FLAG_OPTIONAL,
+        2, cd_values);
+    }
+    assert(status >= 0);
+    return dcpl;
+  }
+
+  bool IsFilterChunked(hid_t dset, hsize_t &chunk_size, filter &f) {
+    bool ret = false;
+    hid_t dcpl = H5Dget_create_plist(dset);
+    if (H5Pget_layout(dcpl) == H5D_CHUNKED &&
+      H5Pget_chunk(dcpl, 1, &chunk_size) == 1 &&
+      H5Pget_nfilters(dcpl) == 1) {
+      unsigned flags, config, cd_values[3];
+      size_t n_elmts = 3;
+      H5Z_filter_t id = H5Pget_filter2(dcpl, 0, &flags,
+        &n_elmts, cd_values, 0, NULL, &config);
+      /// Deflate keeps its level in the first value
+      if (id == H5Z_FILTER_DEFLATE && n_elmts >= 1) {
+        f = Deflate(int(cd_values[0]));
+        ret = true;
+      } else if (id == deltapack::filterId && n_elmts == 2) {
+        f = Packed(cd_values[0], cd_values[1]);
+        ret = true;
+      } else if (id == nodequant::filterId && n_elmts == 3) {
+        f = Quantised(cd_values[0], nodequant::ValuesToStep(cd_values + 1));
+        ret = true;
+      }
+    }
+    H5Pclose(dcpl);
+    return ret;
+  }
+
+  decodeFunctor
+  ::decodeFunctor(std::vector<byteBuffer> &raw,
+    std::vector<uint32_t> &mask, unsigned char *out,
+    size_t chunk_bytes, const filter &f, const byteBuffer &fill,
+    byteBuffer &is_valid)
+  : _raw(raw), _mask(mask), _out(out), _is_valid(is_valid),
+  _chunk_bytes(chunk_bytes), _filter(f), _fill(fill) {
+    /* empty */
+  }
+
+  byteBuffer FillValue(hid_t dset, hid_t mem_dtype) {
+    byteBuffer fill(H5Tget_size(mem_dtype), 0);
+    hid_t dcpl = H5Dget_create_plist(dset);
+    H5D_fill_value_t status;
+    /// An undefined fill reads as garbage through HDF5, zeros here
+    if (H5Pfill_value_defined(dcpl, &status) >= 0 &&
+      status == H5D_FILL_VALUE_USER_DEFINED)
+      H5Pget_fill_value(dcpl, mem_dtype, &fill[0]);
+    H5Pclose(dcpl);
+    return fill;
+  }
+
+  void Fill(unsigned char *out, size_t bytes, const byteBuffer &fill) {
+    if (std::count(fill.begin(), fill.end(), 0) == ptrdiff_t(fill.size())) {
+      std::memset(out, 0, bytes);
+      return;
+    }
+    for (size_t i = 0; i < bytes; ++i)
+      out[i] = fill[i % fill.size()];
+  }
+
+  bool DecodeChunk(const unsigned char *raw, size_t raw_bytes,
+    uint32_t mask, unsigned char *out, size_t chunk_bytes,
+    const filter &f, const byteBuffer &fill) {
+    /// Unallocated chunk holds the fill value
+    if (raw_bytes == 0) {
+      Fill(out, chunk_bytes, fill);
+      return true;
+    }
+    /// The filter was skipped for this chunk (optional filter)
+    if (mask & 1u) {
+      if (raw_bytes != chunk_bytes) return false;
+      std::memcpy(out, raw, chunk_bytes);
+      return true;
+    }
+    if (f.id == deltapack::filterId)
+      return deltapack::Decode(raw, raw_bytes, f.int_bytes,
+      f.stride, out, chunk_bytes / f.int_bytes);
+    if (f.id == nodequant::filterId)
+      return nodequant::Decode(raw, raw_bytes, f.int_bytes,
+      f.step, out, chunk_bytes / (3 * f.int_bytes));
+    uLongf out_len = chunk_bytes;
+    int status = uncompress(out, &out_len, raw, raw_bytes);
+    return (status == Z_OK && out_len == chunk_bytes);
+  }
+
+  void decodeFunctor
+  ::operator()(const tbb::blocked_range<size_t> &range) const {
+    for (size_t i = range.begin(); i < range.end(); ++i)
+      _is_valid[i] = DecodeChunk(_raw[i].empty() ? NULL : &_raw[i][0],
+      _raw[i].size(), _mask[i], _out + i * _chunk_bytes, _chunk_bytes,
+      _filter, _fill);
+  }
+
+  encodeFunctor
+  ::encodeFunctor(const unsigned char *in, size_t chunk_bytes,
+    std::vector<byteBuffer> &raw, std::vector<uint32_t> &mask,
+    const filter &f)
+  : _in(in), _chunk_bytes(chunk_bytes), _raw(raw),
+  _mask(mask), _filter(f) {
+    /* empty */
+  }
+
+  void encodeFunctor
+  ::operator()(const tbb::blocked_range<size_t> &range) const {
+    for (size_t i = range.begin(); i < range.end(); ++i) {
+      const unsigned char *in = _in + i * _chunk_bytes;
+      int status = Z_OK;
+      uLongf out_len;
+      if (_filter.id == deltapack::filterId) {
+        size_t n_int = _chunk_bytes / _filter.int_bytes;
+        _raw[i].resize(deltapack::EncodeBound(n_int, _filter.int_bytes));
+        out_len = deltapack::Encode(in, n_int, _filter.int_bytes,
+          _filter.stride, &_raw[i][0]);
+      } else if (_filter.id == nodequant::filterId) {
+        size_t n_node = _chunk_bytes / (3 * _filter.int_bytes);
+        _raw[i].resize(nodequant::EncodeBound(n_node));
+        out_len = nodequant::Encode(in, n_node, _filter.int_bytes,
+          _filter.step, &_raw[i][0]);
+        /// Not representable on the lattice
+        if (out_len == 0) status = Z_DATA_ERROR;
+      } else {
+        out_len = compressBound(_chunk_bytes);
+        _raw[i].resize(out_len);
+        status = compress2(&_raw[i][0], &out_len, in,
+          _chunk_bytes, _filter.level);
+      }
+      /// Store incompressible chunks as is (same as HDF5 does)
+      if (status != Z_OK || out_len >= _chunk_bytes) {
+        _raw[i].assign(in, in + _chunk_bytes);
+        _mask[i] = 1u;
+      } else {
+        _raw[i].resize(out_len);
+        _mask[i] = 0u;
+      }
+    }
+  }
+
+  readStatus ReadChunked(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t offset, hsize_t size) {
+#ifdef H5PP_DIRECT_CHUNK
+    hsize_t chunk_size;
+    filter f;
+    std::string cat = h5pp::ListStringToString(link);
+    assert(h5pp::IsDataset(file, cat.c_str()) == true);
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t file_dtype = H5Dget_type(dset);
+    bool is_raw = (H5Tequal(file_dtype, mem_dtype) > 0);
+    H5Tclose(file_dtype);
+    if (size == 0 || is_raw == false ||
+      IsFilterChunked(dset, chunk_size, f) == false) {
+      H5Dclose(dset);
+      return readFallback;
+    }
+    size_t elem_bytes = H5Tget_size(mem_dtype);
+    size_t chunk_bytes = chunk_size * elem_bytes;
+    hsize_t first = offset / chunk_size;
+    hsize_t last = (offset + size - 1) / chunk_size;
+    size_t n_chunk = last - first + 1;
+    /// Fetch the raw chunks (HDF5 is not thread safe)
+    std::vector<byteBuffer> raw(n_chunk);
+    std::vector<uint32_t> mask(n_chunk);
+    for (size_t i = 0; i < n_chunk; ++i)
+      h5pp::ReadChunkRaw(dset, (first + i) * chunk_size, raw[i], mask[i]);
+    byteBuffer fill = FillValue(dset, mem_dtype);
+    H5Dclose(dset);
+    /// Decode all chunks concurrently
+    byteBuffer window(n_chunk * chunk_bytes), is_valid(n_chunk, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n_chunk),
+      decodeFunctor(raw, mask, &window[0], chunk_bytes, f, fill, is_valid));
+    if (std::find(is_valid.begin(), is_valid.end(), 0) != is_valid.end())
+      return readCorrupt;
+    std::memcpy(data, &window[(offset - first * chunk_size) * elem_bytes],
+      size * elem_bytes);
+    return readDone;
+#else
+    return readFallback;
+#endif
+  }
+
+  bool TryReadChunked(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t offset, hsize_t size) {
+    readStatus status = ReadChunked(file, data, mem_dtype, link,
+      offset, size);
+    if (status == readCorrupt) {
+      std::cerr << "Error: corrupt chunk in "
+        << h5pp::ListStringToString(link) << " reading [" << offset
+        << ", " << offset + size << ")\n";
+      exit(1);
+    }
+    return (status == readDone);
+  }
+
+  void WriteChunked(hid_t file, const void *data, hid_t mem_dtype,
+    hid_t file_dtype, h5pp::listString &link, hsize_t offset,
+    hsize_t size, hsize_t file_size, hsize_t chunk_size, const filter &f) {
+    if (chunk_size > file_size) chunk_size = file_size;
+    hid_t dcpl = MakePlist(chunk_size, f);
+    hid_t dset = h5pp::OpenOrCreateDset(file, file_dtype, link,
+      file_size, dcpl);
+    H5Pclose(dcpl);
+    /// An existing dataset dictates its own chunking and filter
+    filter file_f = f;
+    bool is_direct = IsFilterChunked(dset, chunk_size, file_f) &&
+      (H5Tequal(mem_dtype, file_dtype) > 0);
+#ifndef H5PP_DIRECT_CHUNK
+    is_direct = false;
+#endif
+    /// Chunk range fully covered by the window
+    hsize_t begin = (offset + chunk_size - 1) / chunk_size * chunk_size;
+    hsize_t end = (offset + size) / chunk_size * chunk_size;
+    if (offset + size == file_size) end = offset + size;
+    if (is_direct == false || begin >= end) {
+      WriteSlab(dset, data, mem_dtype, offset, size);
+      H5Dclose(dset);
+      return;
+    }
+    const unsigned char *bytes = static_cast<const unsigned char *> (data);
+    size_t elem_bytes = H5Tget_size(mem_dtype);
+    size_t chunk_bytes = chunk_size * elem_bytes;
+    size_t n_chunk = (end - begin + chunk_size - 1) / chunk_size;
+    /// Partial chunk at the head
+    if (begin > offset)
+      WriteSlab(dset, bytes, mem_dtype, offset, begin - offset);
+    /// Edge chunk of the dataset has to be padded to full size
+    byteBuffer padded;
+    const unsigned char *in = bytes + (begin - offset) * elem_bytes;
+    if ((end - begin) % chunk_size != 0) {
+      padded.assign(n_chunk * chunk_bytes, 0);
+      std::memcpy(&padded[0], in, (end - begin) * elem_bytes);
+      in = &padded[0];
+    }
+#ifdef H5PP_DIRECT_CHUNK
+    /// Code all chunks concurrently then write them out
+    std::vector<byteBuffer> raw(n_chunk);
+    std::vector<uint32_t> mask(n_chunk);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n_chunk),
+      encodeFunctor(in, chunk_bytes, raw, mask, file_f));
+    for (size_t i = 0; i < n_chunk; ++i)
+      h5pp::WriteChunkRaw(dset, begin + i * chunk_size,
+      &raw[i][0], raw[i].size(), mask[i]);
+#endif
+    /// Partial chunk at the tail
+    if (offset + size > end)
+      WriteSlab(dset, bytes + (end - offset) * elem_bytes,
+      mem_dtype, end, offset + size - end);
+    H5Dclose(dset);
+  }
+
+  void WriteSlab(hid_t dset, const void *data, hid_t mem_dtype,
+    hsize_t offset, hsize_t size) {
+    hsize_t stride = 1;
+    hid_t dspace_mem = H5Screate_simple(1, &size, NULL);
+    hid_t dspace_file = H5Dget_space(dset);
+    herr_t status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET,
+      &offset, &stride, &size, NULL);
+    assert(H5Sselect_valid(dspace_file) != 0);
+    status = H5Dwrite(dset, mem_dtype, dspace_mem, dspace_file,
+      H5P_DEFAULT, data);
+    assert(status >= 0);
+    H5Sclose(dspace_mem);
+    H5Sclose(dspace_file);
+  }
+
+} // end of chunkio namespace
+
+#endif
@@ -22,6 +22,8 @@ public:
   ~COBALT();
   /// \brief Start the file parser 
   void Start();
+  /// \brief Also store the cell-face connectivity (polyhedral cells)
+  void set_poly_cell(bool is_on);
 
 private:
   std::ifstream _in_file;
@@ -29,10 +31,15 @@ private:
   size_t _max_bytes;
   //  bool _has_tri, _has_quad, _is_hybrid ;
   std::map< uintT, hsize_t > _n_patch_face_cobalt;
+  std::map< uintT, hsize_t > _n_patch_adjncy_cobalt;
+  hsize_t _n_internal_adjncy;
   std::map< uintT, hsize_t > _patch_offset;
-  typename std::map< uintT, std::vector< face<uintT> > > _patch_face;
+  typename std::map< uintT, faceCSR<uintT> > _patch_face;
   typename std::map< uintT, std::vector< leftRight<uintT> > > _patch_internal_cell;
   hsize_t _count_face, _count_node, _count_internal_face;
+  uintT _max_face_node;
+  bool _is_poly_cell;
+  packedIds<uintT> _cell_left, _cell_right; /*!< All face L/R (poly cells) */
   node<floatT> _min, _max;
 
   /*! \brief Read/write the vertex data and dump 
@@ -43,8 +50,10 @@ private:
   void SecondPass();
   /*! \brief Read/write internal faces and patch faces **/
   void ThirdPass();
+  /*! \brief Build/write the cell-face connectivity **/
+  void FourthPass();
   /*! \brief Read the list of faces from cobalt file **/
-  inline void ReadOneFace(face<uintT> &f, int64_t &left, int64_t &right);
+  inline void ReadOneFace(std::vector<uintT> &f, int64_t &left, int64_t &right);
 #if 0 // No longer necessary
   /*! \brief Check if file has hybrid mesh entities **/
   inline void CheckHybrid(face<uintT> &f);
@@ -80,7 +89,8 @@ COBALT<floatT, uintT>
 //  _has_tri(false), _has_quad(false), _is_hybrid(false),
 _in_file(cFile),
 _max_bytes(size_t(limit * 1024.0e0 * 1024.0e0 * 1024.0e0)),
-_count_face(0), _count_node(0), _count_internal_face(0) {
+_count_face(0), _count_node(0), _count_internal_face(0),
+_max_face_node(0), _is_poly_cell(false) {
   //  _in_file.open( cFile );
   if (_in_file.fail()) {
     std::cerr << "Error: Unable to open " << cFile << "\n";
@@ -105,6 +115,13 @@ void COBALT<floatT, uintT>
   FirstPass();
   SecondPass();
   ThirdPass();
+  if (_is_poly_cell == true) FourthPass();
+}
+
+template < typename floatT, typename uintT >
+void COBALT<floatT, uintT>
+::set_poly_cell(bool is_on) {
+  _is_poly_cell = is_on;
 }
 
 /****** Private Function *******/
@@ -164,19 +181,30 @@ void COBALT<floatT, uintT>
 ::SecondPass() {
   std::cerr << "Pass 2 - Face Data Sizes\n";
   int64_t left, right;
-  face<uintT> temp_face;
+  std::vector<uintT> temp_face;
   _n_face_adjncy = 0;
+  _n_internal_adjncy = 0;
   /// Record the face file pointer
   _face_beg = _in_file.tellg();
   _n_internal_face = 0;
   for (uintT i = 0; i < _n_face; ++i) {
     ReadOneFace(temp_face, left, right);
-    if (right >= 0)
+    if (right >= 0) {
       _n_internal_face++;
-    else
+      _n_internal_adjncy += temp_face.size();
+    } else {
       _n_patch_face_cobalt[ std::abs(right) ]++;
+      _n_patch_adjncy_cobalt[ std::abs(right) ] += temp_face.size();
+    }
     //CheckHybrid( temp_face );
-    _n_face_adjncy += temp_face.bField;
+    _n_face_adjncy += temp_face.size();
+    _max_face_node = std::max(_max_face_node, uintT(temp_face.size()));
+  }
+  /// Polygons with more than 4 nodes only fit the CSR faces
+  if (_max_face_node > 4 && _is_face_csr == false) {
+    std::cerr << "Faces of up to " << _max_face_node
+      << " nodes - storing faces in CSR form\n";
+    set_face_csr(true);
   }
   /// Write the face adjncy data to file
   h5pp::listString link;
@@ -205,25 +233,27 @@ void COBALT<floatT, uintT>
   unsigned chunk_size = GetFaceChunkSize();
   unsigned last_chunk_size = _n_face - num_chunks * chunk_size;
 
-  std::vector< face<uintT> > face_buf;
-  face<uintT> temp_face;
+  faceCSR<uintT> face_buf;
+  std::vector<uintT> temp_face;
   std::vector< leftRight<uintT> > lr_buf;
   int64_t left, right;
 
   _in_file.seekg(_face_beg);
 
-  face_buf.resize(chunk_size);
   lr_buf.resize(chunk_size);
+  if (_is_poly_cell == true) {
+    _cell_left.resize(_n_face);
+    _cell_right.resize(_n_internal_face);
+  }
 
   for (int i = 0; i < num_chunks + 1; ++i) {
-    face<uintT> *facePtr = &face_buf[0];
+    face_buf.clear();
     leftRight<uintT> *ptr_lr = &lr_buf[0];
     if (i == num_chunks) chunk_size = last_chunk_size;
     for (unsigned j = 0; j < chunk_size; ++j) {
       ReadOneFace(temp_face, left, right);
       if (right >= 0) {
-        *(facePtr) = temp_face;
-        ++facePtr;
+        face_buf.append(&temp_face[0], temp_face.size());
 #if 0 // Bad idea
         if (_is_hybrid == true && temp_face.bField == 4)
           std::swap(left, right);
@@ -232,19 +262,24 @@ void COBALT<floatT, uintT>
         ptr_lr->right = right;
         ++ptr_lr;
       } else {
-        _patch_face[std::abs(right)].push_back(temp_face);
+        _patch_face[std::abs(right)].append(&temp_face[0], temp_face.size());
         ptr_lr->left = left;
         ptr_lr->right = 0;
         _patch_internal_cell[std::abs(right)].push_back(*ptr_lr);
       }
     }
     /// Write the face-vertex connectivity
-    hsize_t chunksRead = facePtr - &face_buf[0];
-    if (chunksRead > 0) write(&face_buf[0], _count_face, 1, chunksRead);
+    hsize_t chunksRead = face_buf.size();
+    if (chunksRead > 0) write_faces(face_buf, _count_face);
     _count_face += chunksRead;
     /// Write the face LR cell ID
     chunksRead = ptr_lr - &lr_buf[0];
     if (chunksRead > 0) write(&lr_buf[0], _count_internal_face, 1, chunksRead);
+    if (_is_poly_cell == true)
+      for (hsize_t j = 0; j < chunksRead; ++j) {
+        _cell_left[_count_internal_face + j] = lr_buf[j].left;
+        _cell_right[_count_internal_face + j] = lr_buf[j].right;
+      }
     _count_internal_face += chunksRead;
     /// Write the patch face and internal cell data
     WritePatchFaceUsingOffset();
@@ -254,19 +289,33 @@ void COBALT<floatT, uintT>
   }
 }
 
+template < typename floatT, typename uintT >
+void COBALT<floatT, uintT>
+::FourthPass() {
+  std::cerr << "Pass 4 - Cell Data\n";
+  cellCSR<uintT> cells;
+  cells.build(_cell_left, _cell_right, _n_face, _n_internal_face, _n_cell);
+  _cell_left.clear();
+  _cell_right.clear();
+  write(cells, 0);
+  std::cerr << "Cell adjncy size     = " << cells.faces.size() << "\n";
+}
+
 template < typename floatT, typename uintT >
 inline void COBALT<floatT, uintT>
-::ReadOneFace(face<uintT> &f, int64_t &left, int64_t &right) {
-  _in_file >> f.bField;
-  if (f.bField == 3) {
-    for (int i = f.bField - 1; i >= 0; --i) {
-      _in_file >> f.entityID[i];
-      f.entityID[i]--;
+::ReadOneFace(std::vector<uintT> &f, int64_t &left, int64_t &right) {
+  uintT n_face_node;
+  _in_file >> n_face_node;
+  f.resize(n_face_node);
+  if (n_face_node == 3) {
+    for (int i = n_face_node - 1; i >= 0; --i) {
+      _in_file >> f[i];
+      f[i]--;
     }
   } else {
-    for (int i = 0; i < f.bField; ++i) {
-      _in_file >> f.entityID[i];
-      f.entityID[i]--;
+    for (int i = 0; i < n_face_node; ++i) {
+      _in_file >> f[i];
+      f[i]--;
     }
   }
   _in_file >> left >> right;
@@ -292,6 +341,7 @@ template < typename floatT, typename uintT >
 inline void COBALT<floatT, uintT>
 ::FormPatchInfo() {
   hsize_t offset = _n_internal_face;
+  hsize_t node_offset = _n_internal_adjncy;
   patchBC<uintT> temp_patch;
   for (typename std::map< uintT, hsize_t >::iterator it = _n_patch_face_cobalt.begin();
     it != _n_patch_face_cobalt.end(); ++it) {
@@ -306,7 +356,10 @@ inline void COBALT<floatT, uintT>
     temp_patch.attachedToProcID = 0;
     write(tempStr, temp_patch);
     _patch_offset[ it->first ] = offset;
+    /// Patch faces are written from their own offset (CSR faces)
+    set_face_csr_cursor(offset, node_offset);
     offset += it->second;
+    node_offset += _n_patch_adjncy_cobalt[ it->first ];
   }
 #if 0 // no longer necessary
   if (_is_hybrid == true)
@@ -322,7 +375,7 @@ void COBALT<floatT, uintT>
   typename std::map< uintT, hsize_t >::iterator it;
   for (it = _patch_offset.begin(); it != _patch_offset.end(); ++it) {
     if (_patch_face[it->first].size() > 0) {
-      write(&(_patch_face[it->first][0]), it->second, 1, _patch_face[it->first].size());
+      write_faces(_patch_face[it->first], it->second);
     }
   }
 }
@@ -334,6 +387,9 @@ void COBALT<floatT, uintT>
   for (it = _patch_offset.begin(); it != _patch_offset.end(); ++it) {
     if (_patch_internal_cell[it->first].size() > 0) {
       write(&(_patch_internal_cell[it->first][0]), it->second, 1, _patch_face[it->first].size());
+      if (_is_poly_cell == true)
+        for (size_t j = 0; j < _patch_internal_cell[it->first].size(); ++j)
+          _cell_left[it->second + j] = _patch_internal_cell[it->first][j].left;
     }
   }
 }
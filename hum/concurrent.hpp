@@ -0,0 +1,359 @@
+/*! \file concurrent.hpp
+ ** Concurrent readers for one hum file. HDF5 serialises every call under
+ ** its global lock (or is not thread safe at all), so threads streaming
+ ** different windows of a file wait on each other. Here the layout of
+ ** every rank one dataset is resolved once through HDF5 (file address of
+ ** contiguous data, address, size and filter mask of every chunk) and
+ ** hyperslab reads are then served with pread on a plain file descriptor
+ ** from any number of threads. Chunks written with a filter chunkio.hpp
+ ** can code (deflate, delta + bit packed integers, quantised nodes) are
+ ** decoded by the reading thread. Chunk indices need HDF5 1.10.5, with
+ ** older versions only contiguous datasets are served. Everything else
+ ** is left to HDF5 under the reader lock.
+ **/
+
+#ifndef CONCURRENT_HPP
+
+#define CONCURRENT_HPP
+
+#include "chunkio.hpp"
+#include <map>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Chunk addresses can be queried since HDF5 1.10.5
+#if H5_VERSION_GE(1,10,5)
+#define CONCURRENT_CHUNK_INDEX
+#endif
+
+namespace concurrent {
+
+  /*! \brief Where the elements of one rank one dataset are in the file */
+  struct layout {
+    hid_t dtype; /*!< Stored type (a reader copies only this type) */
+    size_t elem_bytes; /*!< Stored element size */
+    hsize_t n_elem; /*!< Dataset length */
+    haddr_t addr; /*!< File offset of contiguous data (else HADDR_UNDEF) */
+    hsize_t chunk_size; /*!< Elements per chunk (chunked only) */
+    bool is_filtered; /*!< Chunks are coded with filter */
+    chunkio::filter filter;
+    std::vector<haddr_t> chunk_addr; /*!< File offsets, HADDR_UNDEF if not
+                                      **  allocated */
+    std::vector<hsize_t> chunk_bytes; /*!< Stored size of every chunk */
+    std::vector<uint32_t> chunk_mask; /*!< Filter mask of every chunk */
+    chunkio::byteBuffer fill; /*!< Element read from unallocated chunks */
+  };
+
+  /*! \brief pread access to the resolved datasets of one file */
+  class reader {
+  public:
+    reader();
+
+    ~reader();
+
+    /*! \brief Resolve the datasets of the open HDF5 file and open
+     **        it for pread. Returns false if the file driver does not
+     **        map addresses to file offsets (only sec2 does).
+     **/
+    bool open(hid_t file);
+
+    void close();
+
+    bool isOpen() const;
+
+    /*! \brief Thread safe read of the elements [offset, offset + size)
+     **        of the dataset cat into data, laid out as mem_dtype.
+     **        Returns false (and reads nothing) if the dataset was
+     **        not resolved or is not stored as mem_dtype. A chunk
+     **        that does not decode stops with an error.
+     **/
+    bool read(const std::string &cat, void *data, hid_t mem_dtype,
+      hsize_t offset, hsize_t size);
+
+    /*! \brief The (recursive) lock serialising HDF5 calls */
+    void lock();
+
+    void unlock();
+
+  private:
+    int _fd;
+    std::map<std::string, layout> _layout;
+    pthread_mutex_t _h5_mutex;
+
+    reader(const reader &);
+
+    reader &operator=(const reader &);
+
+    /*! \brief Resolve all datasets below the group cat */
+    void ResolveGroup(hid_t file, const std::string &cat);
+
+    /*! \brief Resolve the dataset cat, false if it can not be served */
+    bool Resolve(hid_t file, const std::string &cat, layout &l);
+
+    /*! \brief Read a window of a chunked dataset */
+    chunkio::readStatus ReadChunked(const layout &l, unsigned char *data,
+      hsize_t offset, hsize_t size) const;
+
+    /*! \brief pread all bytes at the file address */
+    bool ReadAt(void *buf, size_t bytes, haddr_t addr) const;
+  };
+
+  /*! \brief Holds the reader lock for a scope (open or not, so
+   **        streamer threads doing I/O on a read-write file are
+   **        serialised too)
+   **/
+  class hdf5Lock {
+  public:
+    explicit hdf5Lock(reader &r);
+
+    ~hdf5Lock();
+
+  private:
+    reader *_reader;
+  };
+
+  /***********   Implementation  ****************/
+
+  reader
+  ::reader()
+  : _fd(-1) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_h5_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+  }
+
+  reader
+  ::~reader() {
+    close();
+    pthread_mutex_destroy(&_h5_mutex);
+  }
+
+  bool reader
+  ::open(hid_t file) {
+    close();
+    hid_t fapl = H5Fget_access_plist(file);
+    bool is_sec2 = (H5Pget_driver(fapl) == H5FD_SEC2);
+    H5Pclose(fapl);
+    if (is_sec2 == false) return false;
+    ssize_t len = H5Fget_name(file, NULL, 0);
+    std::vector<char> buf(len + 1);
+    H5Fget_name(file, &buf[0], len + 1);
+    _fd = ::open(&buf[0], O_RDONLY);
+    if (_fd < 0) return false;
+    ResolveGroup(file, "/");
+    return true;
+  }
+
+  void reader
+  ::close() {
+    if (_fd >= 0) ::close(_fd);
+    _fd = -1;
+    std::map<std::string, layout>::iterator it;
+    for (it = _layout.begin(); it != _layout.end(); ++it)
+      H5Tclose(it->second.dtype);
+    _layout.clear();
+  }
+
+  bool reader
+  ::isOpen() const {
+    return _fd >= 0;
+  }
+
+  void reader
+  ::lock() {
+    pthread_mutex_lock(&_h5_mutex);
+  }
+
+  void reader
+  ::unlock() {
+    pthread_mutex_unlock(&_h5_mutex);
+  }
+
+  void reader
+  ::ResolveGroup(hid_t file, const std::string &cat) {
+    hid_t group = H5Gopen2(file, cat.c_str(), H5P_DEFAULT);
+    H5G_info_t ginfo;
+    herr_t status = H5Gget_info(group, &ginfo);
+    assert(status >= 0);
+    for (hsize_t i = 0; i < ginfo.nlinks; ++i) {
+      ssize_t size = H5Lget_name_by_idx(group, ".", H5_INDEX_NAME,
+        H5_ITER_INC, i, NULL, 0, H5P_DEFAULT);
+      std::vector<char> name(size + 1);
+      H5Lget_name_by_idx(group, ".", H5_INDEX_NAME, H5_ITER_INC, i,
+        &name[0], name.size(), H5P_DEFAULT);
+      std::string child = (cat == "/") ? cat + &name[0] : cat + "/" + &name[0];
+      H5O_info_t object;
+      if (H5Oget_info_by_name(file, child.c_str(), &object, H5P_DEFAULT) < 0)
+        continue;
+      if (object.type == H5O_TYPE_GROUP)
+        ResolveGroup(file, child);
+      else if (object.type == H5O_TYPE_DATASET) {
+        layout l;
+        if (Resolve(file, child, l) == true)
+          _layout[child] = l;
+      }
+    }
+    H5Gclose(group);
+  }
+
+  bool reader
+  ::Resolve(hid_t file, const std::string &cat, layout &l) {
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t dspace = H5Dget_space(dset);
+    bool ret = (H5Sget_simple_extent_ndims(dspace) == 1);
+    if (ret == true)
+      H5Sget_simple_extent_dims(dspace, &l.n_elem, NULL);
+    /// Kept to compare with the memory type of every read
+    l.dtype = H5Dget_type(dset);
+    l.elem_bytes = H5Tget_size(l.dtype);
+    hid_t dcpl = H5Dget_create_plist(dset);
+    H5D_layout_t type = H5Pget_layout(dcpl);
+    l.addr = HADDR_UNDEF;
+    l.chunk_size = 0;
+    l.is_filtered = false;
+    l.filter = chunkio::Deflate(0);
+    if (ret == true && type == H5D_CONTIGUOUS) {
+      l.addr = H5Dget_offset(dset);
+      ret = (H5Pget_nfilters(dcpl) == 0) && (l.addr != HADDR_UNDEF);
+    } else if (ret == true && type == H5D_CHUNKED) {
+#ifdef CONCURRENT_CHUNK_INDEX
+      if (H5Pget_nfilters(dcpl) == 0)
+        ret = (H5Pget_chunk(dcpl, 1, &l.chunk_size) == 1);
+      else
+        ret = l.is_filtered = chunkio::IsFilterChunked(dset,
+          l.chunk_size, l.filter);
+      /// Chunk addresses are relative to the end of the user block
+      /// (contiguous data offsets are not)
+      hid_t fcpl = H5Fget_create_plist(file);
+      hsize_t userblock = 0;
+      H5Pget_userblock(fcpl, &userblock);
+      H5Pclose(fcpl);
+      hsize_t n_chunk = (l.chunk_size > 0) ?
+        (l.n_elem + l.chunk_size - 1) / l.chunk_size : 0;
+      l.chunk_addr.assign(n_chunk, HADDR_UNDEF);
+      l.chunk_bytes.assign(n_chunk, 0);
+      l.chunk_mask.assign(n_chunk, 0);
+      l.fill = chunkio::FillValue(dset, l.dtype);
+      for (hsize_t i = 0; ret == true && i < n_chunk; ++i) {
+        hsize_t chunk_offset = i * l.chunk_size;
+        unsigned mask = 0;
+        haddr_t addr = HADDR_UNDEF;
+        hsize_t nbytes = 0;
+        if (H5Dget_chunk_info_by_coord(dset, &chunk_offset, &mask,
+          &addr, &nbytes) < 0)
+          continue;
+        l.chunk_addr[i] = addr + userblock;
+        l.chunk_bytes[i] = nbytes;
+        l.chunk_mask[i] = mask;
+      }
+#else
+      ret = false;
+#endif
+    } else
+      ret = false;
+    if (ret == false) H5Tclose(l.dtype);
+    H5Pclose(dcpl);
+    H5Sclose(dspace);
+    H5Dclose(dset);
+    return ret;
+  }
+
+  bool reader
+  ::read(const std::string &cat, void *data, hid_t mem_dtype,
+    hsize_t offset, hsize_t size) {
+    if (_fd < 0) return false;
+    std::map<std::string, layout>::const_iterator it = _layout.find(cat);
+    if (it == _layout.end()) return false;
+    const layout &l = it->second;
+    if (offset + size > l.n_elem) return false;
+    /// Bytes are copied as stored, so the caller has to lay out the
+    /// elements exactly as the file (same size is not enough)
+    lock();
+    bool is_same = (H5Tequal(l.dtype, mem_dtype) > 0);
+    unlock();
+    if (is_same == false) return false;
+    if (size == 0) return true;
+    if (l.addr != HADDR_UNDEF)
+      return ReadAt(data, size * l.elem_bytes, l.addr + offset * l.elem_bytes);
+    chunkio::readStatus status = ReadChunked(l,
+      static_cast<unsigned char *> (data), offset, size);
+    if (status == chunkio::readCorrupt) {
+      std::cerr << "Error: corrupt chunk in " << cat << " reading ["
+        << offset << ", " << offset + size << ")\n";
+      exit(1);
+    }
+    return (status == chunkio::readDone);
+  }
+
+  chunkio::readStatus reader
+  ::ReadChunked(const layout &l, unsigned char *data,
+    hsize_t offset, hsize_t size) const {
+    size_t chunk_bytes = l.chunk_size * l.elem_bytes;
+    hsize_t first = offset / l.chunk_size;
+    hsize_t last = (offset + size - 1) / l.chunk_size;
+    chunkio::byteBuffer raw, chunk;
+    for (hsize_t c = first; c <= last; ++c) {
+      /// Part [begin, end) of chunk c inside the window
+      hsize_t begin = std::max(offset, c * l.chunk_size);
+      hsize_t end = std::min(offset + size, (c + 1) * l.chunk_size);
+      unsigned char *out = data + (begin - offset) * l.elem_bytes;
+      size_t out_bytes = (end - begin) * l.elem_bytes;
+      haddr_t addr = l.chunk_addr[c];
+      bool is_plain = (l.is_filtered == false) || (l.chunk_mask[c] & 1u);
+      if (addr == HADDR_UNDEF) {
+        chunkio::Fill(out, out_bytes, l.fill);
+      } else if (is_plain == true) {
+        /// Stored as is, read only the part needed
+        if (ReadAt(out, out_bytes,
+          addr + (begin - c * l.chunk_size) * l.elem_bytes) == false)
+          return chunkio::readFallback;
+      } else {
+        raw.resize(l.chunk_bytes[c]);
+        chunk.resize(chunk_bytes);
+        if (ReadAt(&raw[0], raw.size(), addr) == false)
+          return chunkio::readFallback;
+        if (chunkio::DecodeChunk(&raw[0], raw.size(), l.chunk_mask[c],
+          &chunk[0], chunk_bytes, l.filter, l.fill) == false)
+          return chunkio::readCorrupt;
+        std::memcpy(out, &chunk[(begin - c * l.chunk_size) * l.elem_bytes],
+          out_bytes);
+      }
+    }
+    return chunkio::readDone;
+  }
+
+  bool reader
+  ::ReadAt(void *buf, size_t bytes, haddr_t addr) const {
+    char *pos = static_cast<char *> (buf);
+    off_t at = off_t(addr);
+    while (bytes > 0) {
+      ssize_t n = ::pread(_fd, pos, bytes, at);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      pos += n;
+      at += n;
+      bytes -= size_t(n);
+    }
+    return true;
+  }
+
+  hdf5Lock
+  ::hdf5Lock(reader &r)
+  : _reader(&r) {
+    _reader->lock();
+  }
+
+  hdf5Lock
+  ::~hdf5Lock() {
+    _reader->unlock();
+  }
+
+} // end of concurrent namespace
+
+#endif
@@ -15,13 +15,28 @@ namespace hum {
   const char *faceLink[] = {"Faces", "FaceLRCell", "BitField",
     "EntityID", "Left", "Right"};
   ///
+  const char *faceCSRLink[] = {"FaceNodeOffsets", "FaceNodes"};
+  ///
+  const char *cellCSRLink[] = {"CellFaceOffsets", "CellFaces"};
+  ///
   const char *patchLink[] = {"Patches", "PatchInfo", "", "",
     "BCType", "StartFace", "FaceCount", "ProcID"};
   ///
+  const char *patchTableLink[] = {"PatchTable", "PatchNames"};
+  ///
   const char *AABBLink[] = {"Min", "Max"};
   ///
   const char *miscLink[] = {"NumCells", "FaceAdjncySize", "NumInternalFaces", "IntegerT"};
   ///
   const char *cellCacheLink[] = {"Cache", "cellFace", "cellCell"};
+  ///
+  const char *subFileLink[] = {"SubFileIndex", "NumSubFiles", "GlobalSize"};
+  ///
+  const char *fieldLink[] = {"Fields", "Time", "Centring", "Components", "Step"};
+  ///
+  const char *nodeSeriesLink[] = {"NodeSeries", "Time", "Keyframe", "",
+    "Step"};
+  ///
+  const char *hashLink[] = {"ContentHash", "Data", "Sources", "SourceHash"};
 }
 
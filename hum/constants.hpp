@@ -16,13 +16,28 @@ namespace hum {
     BCTYPE = 4, START_FACE = 5, FACE_COUNT = 6, PROC_ID = 7
   };
 
+  enum fieldLinkType {
+    STEP = 4
+  };
+
+  enum hashLinkType {
+    ENTRY_DATA = 1, ENTRY_SOURCES = 2, ENTRY_HASH = 3
+  };
+
   extern const char *nodeLink[];
   extern const char *edgeLink[];
   extern const char *faceLink[];
+  extern const char *faceCSRLink[];
+  extern const char *cellCSRLink[];
   extern const char *patchLink[];
+  extern const char *patchTableLink[];
   extern const char *AABBLink[];
   extern const char *miscLink[];
   extern const char *cellCacheLink[];
+  extern const char *subFileLink[];
+  extern const char *fieldLink[];
+  extern const char *nodeSeriesLink[];
+  extern const char *hashLink[];
 
 } // End of hum namespace
 
@@ -0,0 +1,365 @@
+/*! \file deltapack.hpp
+ ** Delta + zigzag + bit packing of integer connectivity (faces, face
+ ** left/right cells, CSR offsets and IDs). Once a mesh is SFC ordered
+ ** a field of a record is close to the same field of the previous
+ ** record, so every integer is stored as its difference to the integer
+ ** one record (stride) back, zigzag mapped to be unsigned. Blocks of
+ ** 128 such values keep their minimum and are bit packed with the width
+ ** of the largest remaining value. 32-bit blocks use a four lane
+ ** (vertical) layout so SSE2 unpacks, unzigzags and prefix sums four
+ ** values per instruction; 64-bit blocks are a plain bit stream.
+ **
+ ** Every chunk is coded on its own and the codec is registered as an
+ ** (optional) HDF5 filter, so any read of a packed dataset works. The
+ ** direct chunk path of chunkio decodes whole windows using TBB.
+ **/
+
+#ifndef DELTAPACK_HPP
+
+#define DELTAPACK_HPP
+
+#include "h5++.hpp"
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace deltapack {
+
+  /*! HDF5 filter ID (range of unregistered local filters) **/
+  const H5Z_filter_t filterId = 32850;
+
+  /*! Integers per bit packed block **/
+  const size_t blockSize = 128;
+
+  /*! Chunk header bytes (number of packed integers) **/
+  const size_t headerSize = 8;
+
+  /*! \brief Register the HDF5 filter (once per process) */
+  void Register();
+
+  /*! \brief True if the (file) type is one integer or a compound of
+   **        integers (or integer arrays) of one size without padding.
+   **        Returns the integer size and the integers per element.
+   **/
+  bool IsPackable(hid_t dtype, unsigned &int_bytes, unsigned &stride);
+
+  /*! \brief Largest coded size of n_int integers */
+  size_t EncodeBound(size_t n_int, unsigned int_bytes);
+
+  /*! \brief Code n_int integers of int_bytes each whose delta is
+   **        taken stride integers back. Returns the coded size.
+   **/
+  size_t Encode(const void *in, size_t n_int, unsigned int_bytes,
+    unsigned stride, unsigned char *out);
+
+  /*! \brief Decode in_bytes of coded data into n_int integers.
+   **        Returns false if the data does not match.
+   **/
+  bool Decode(const unsigned char *in, size_t in_bytes, unsigned int_bytes,
+    unsigned stride, void *out, size_t n_int);
+
+  /*! \brief The HDF5 filter callback (cd_values = int_bytes, stride) */
+  size_t Filter(unsigned flags, size_t cd_nelmts, const unsigned cd_values[],
+    size_t nbytes, size_t *buf_size, void **buf);
+
+  /***********   Implementation  ****************/
+
+  template <typename uintT>
+  inline uintT ZigZag(uintT d) {
+    return (d << 1) ^ (uintT(0) - (d >> (8 * sizeof (uintT) - 1)));
+  }
+
+  template <typename uintT>
+  inline uintT UnZigZag(uintT z) {
+    return (z >> 1) ^ (uintT(0) - (z & 1));
+  }
+
+  inline unsigned BitWidth(uint64_t v) {
+    unsigned b = 0;
+    while (v != 0) {
+      ++b;
+      v >>= 1;
+    }
+    return b;
+  }
+
+  /// Block of 32-bit values: lane j % 4 holds value j at bit (j / 4) * b
+  inline void PackBlock(const uint32_t *v, unsigned b, unsigned char *out) {
+    uint32_t word[4 * 32] = {0};
+    for (size_t j = 0; j < blockSize && b > 0; ++j) {
+      unsigned bit = unsigned(j >> 2) * b, w = bit >> 5, sh = bit & 31;
+      size_t lane = j & 3;
+      word[4 * w + lane] |= v[j] << sh;
+      if (sh + b > 32)
+        word[4 * (w + 1) + lane] |= v[j] >> (32 - sh);
+    }
+    std::memcpy(out, word, 16 * b);
+  }
+
+  inline void UnpackBlock(const unsigned char *in, unsigned b, uint32_t *v) {
+    uint32_t word[4 * 32];
+    std::memcpy(word, in, 16 * b);
+    uint32_t mask = (b == 32) ? ~uint32_t(0) : (uint32_t(1) << b) - 1;
+    for (size_t j = 0; j < blockSize; ++j) {
+      if (b == 0) {
+        v[j] = 0;
+        continue;
+      }
+      unsigned bit = unsigned(j >> 2) * b, w = bit >> 5, sh = bit & 31;
+      size_t lane = j & 3;
+      uint32_t x = word[4 * w + lane] >> sh;
+      if (sh + b > 32)
+        x |= word[4 * (w + 1) + lane] << (32 - sh);
+      v[j] = x & mask;
+    }
+  }
+
+  /// Block of 64-bit values: value j at bit j * b of the stream
+  inline void PackBlock(const uint64_t *v, unsigned b, unsigned char *out) {
+    uint64_t word[2 * 64] = {0};
+    for (size_t j = 0; j < blockSize && b > 0; ++j) {
+      unsigned bit = unsigned(j) * b, w = bit >> 6, sh = bit & 63;
+      word[w] |= v[j] << sh;
+      if (sh + b > 64)
+        word[w + 1] |= v[j] >> (64 - sh);
+    }
+    std::memcpy(out, word, 16 * b);
+  }
+
+  inline void UnpackBlock(const unsigned char *in, unsigned b, uint64_t *v) {
+    uint64_t word[2 * 64];
+    std::memcpy(word, in, 16 * b);
+    uint64_t mask = (b == 64) ? ~uint64_t(0) : (uint64_t(1) << b) - 1;
+    for (size_t j = 0; j < blockSize; ++j) {
+      if (b == 0) {
+        v[j] = 0;
+        continue;
+      }
+      unsigned bit = unsigned(j) * b, w = bit >> 6, sh = bit & 63;
+      uint64_t x = word[w] >> sh;
+      if (sh + b > 64)
+        x |= word[w + 1] << (64 - sh);
+      v[j] = x & mask;
+    }
+  }
+
+  /// Decode the m values of the block starting at out[base]
+  template <typename uintT>
+  void DecodeBlock(const unsigned char *in, unsigned b, uintT lo,
+    unsigned stride, uintT *out, size_t base, size_t m) {
+    uintT z[blockSize];
+    UnpackBlock(in, b, z);
+    for (size_t j = 0; j < m; ++j) {
+      size_t i = base + j;
+      uintT d = UnZigZag<uintT>(uintT(z[j] + lo));
+      out[i] = (i >= stride) ? uintT(out[i - stride] + d) : d;
+    }
+  }
+
+#ifdef __SSE2__
+
+  /// Four values per step for full 32-bit blocks of stride 1, 2 or 4
+  inline void DecodeBlock(const unsigned char *in, unsigned b, uint32_t lo,
+    unsigned stride, uint32_t *out, size_t base, size_t m) {
+    if (m != blockSize || (stride != 1 && stride != 2 && stride != 4)) {
+      DecodeBlock<uint32_t>(in, b, lo, stride, out, base, m);
+      return;
+    }
+    const __m128i *word = reinterpret_cast<const __m128i *> (in);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i vlo = _mm_set1_epi32(int(lo));
+    const __m128i mask = _mm_set1_epi32(b == 32 ? -1 : int((1u << b) - 1));
+    __m128i prev = (base >= 4) ?
+      _mm_loadu_si128(reinterpret_cast<const __m128i *> (out + base - 4)) : zero;
+    for (unsigned k = 0; k < blockSize / 4; ++k) {
+      __m128i v = zero;
+      if (b > 0) {
+        unsigned bit = k * b, w = bit >> 5, sh = bit & 31;
+        v = _mm_srl_epi32(_mm_loadu_si128(word + w), _mm_cvtsi32_si128(sh));
+        if (sh + b > 32)
+          v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(word + w + 1),
+          _mm_cvtsi32_si128(32 - sh)));
+        v = _mm_and_si128(v, mask);
+      }
+      v = _mm_add_epi32(v, vlo);
+      v = _mm_xor_si128(_mm_srli_epi32(v, 1),
+        _mm_sub_epi32(zero, _mm_and_si128(v, one)));
+      /// In register prefix sum over the stride
+      if (stride == 1) {
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(prev, _MM_SHUFFLE(3, 3, 3, 3)));
+      } else if (stride == 2) {
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(prev, _MM_SHUFFLE(3, 2, 3, 2)));
+      } else
+        v = _mm_add_epi32(v, prev);
+      _mm_storeu_si128(reinterpret_cast<__m128i *> (out + base + 4 * k), v);
+      prev = v;
+    }
+  }
+#endif
+
+  template <typename uintT>
+  size_t EncodeInts(const uintT *in, size_t n, unsigned stride,
+    unsigned char *out) {
+    unsigned char *pos = out;
+    uint64_t n_int = n;
+    std::memcpy(pos, &n_int, headerSize);
+    pos += headerSize;
+    uintT z[blockSize];
+    for (size_t base = 0; base < n; base += blockSize) {
+      size_t m = std::min(blockSize, n - base);
+      uintT lo = ~uintT(0), hi = 0;
+      for (size_t j = 0; j < m; ++j) {
+        size_t i = base + j;
+        uintT prev = (i >= stride) ? in[i - stride] : uintT(0);
+        z[j] = ZigZag<uintT>(uintT(in[i] - prev));
+        lo = std::min(lo, z[j]);
+        hi = std::max(hi, z[j]);
+      }
+      /// Padding takes the minimum so it costs no bits
+      for (size_t j = m; j < blockSize; ++j) z[j] = lo;
+      for (size_t j = 0; j < blockSize; ++j) z[j] -= lo;
+      unsigned b = BitWidth(hi - lo);
+      *pos++ = (unsigned char) b;
+      std::memcpy(pos, &lo, sizeof (uintT));
+      pos += sizeof (uintT);
+      PackBlock(z, b, pos);
+      pos += 16 * b;
+    }
+    return pos - out;
+  }
+
+  template <typename uintT>
+  bool DecodeInts(const unsigned char *in, size_t in_bytes,
+    unsigned stride, uintT *out, size_t n) {
+    const unsigned char *pos = in, *end = in + in_bytes;
+    uint64_t n_int = 0;
+    if (in_bytes < headerSize) return false;
+    std::memcpy(&n_int, pos, headerSize);
+    pos += headerSize;
+    if (n_int != n) return false;
+    for (size_t base = 0; base < n; base += blockSize) {
+      if (pos + 1 + sizeof (uintT) > end) return false;
+      unsigned b = *pos++;
+      uintT lo;
+      std::memcpy(&lo, pos, sizeof (uintT));
+      pos += sizeof (uintT);
+      if (b > 8 * sizeof (uintT) || pos + 16 * b > end) return false;
+      DecodeBlock(pos, b, lo, stride, out, base,
+        std::min(blockSize, n - base));
+      pos += 16 * b;
+    }
+    return true;
+  }
+
+  size_t EncodeBound(size_t n_int, unsigned int_bytes) {
+    size_t n_block = (n_int + blockSize - 1) / blockSize;
+    return headerSize + n_block * (1 + int_bytes + 16 * 8 * int_bytes);
+  }
+
+  size_t Encode(const void *in, size_t n_int, unsigned int_bytes,
+    unsigned stride, unsigned char *out) {
+    if (int_bytes == 4)
+      return EncodeInts(static_cast<const uint32_t *> (in), n_int, stride, out);
+    assert(int_bytes == 8);
+    return EncodeInts(static_cast<const uint64_t *> (in), n_int, stride, out);
+  }
+
+  bool Decode(const unsigned char *in, size_t in_bytes, unsigned int_bytes,
+    unsigned stride, void *out, size_t n_int) {
+    if (int_bytes == 4)
+      return DecodeInts(in, in_bytes, stride, static_cast<uint32_t *> (out), n_int);
+    if (int_bytes == 8)
+      return DecodeInts(in, in_bytes, stride, static_cast<uint64_t *> (out), n_int);
+    return false;
+  }
+
+  size_t Filter(unsigned flags, size_t cd_nelmts, const unsigned cd_values[],
+    size_t nbytes, size_t *buf_size, void **buf) {
+    if (cd_nelmts < 2) return 0;
+    unsigned int_bytes = cd_values[0], stride = cd_values[1];
+    if (flags & H5Z_FLAG_REVERSE) {
+      uint64_t n_int = 0;
+      if (nbytes < headerSize) return 0;
+      std::memcpy(&n_int, *buf, headerSize);
+      size_t out_bytes = n_int * int_bytes;
+      void *out = H5allocate_memory(out_bytes, false);
+      if (out == NULL) return 0;
+      if (Decode(static_cast<unsigned char *> (*buf), nbytes, int_bytes,
+        stride, out, n_int) == false) {
+        H5free_memory(out);
+        return 0;
+      }
+      H5free_memory(*buf);
+      *buf = out;
+      *buf_size = out_bytes;
+      return out_bytes;
+    }
+    size_t n_int = nbytes / int_bytes;
+    size_t bound = EncodeBound(n_int, int_bytes);
+    unsigned char *out = static_cast<unsigned char *>
+      (H5allocate_memory(bound, false));
+    if (out == NULL) return 0;
+    size_t out_bytes = Encode(*buf, n_int, int_bytes, stride, out);
+    /// Not worth it, the chunk is stored as is (optional filter)
+    if (out_bytes >= nbytes) {
+      H5free_memory(out);
+      return 0;
+    }
+    H5free_memory(*buf);
+    *buf = out;
+    *buf_size = bound;
+    return out_bytes;
+  }
+
+  void Register() {
+    if (H5Zfilter_avail(filterId) > 0) return;
+    H5Z_class2_t filter_class;
+    filter_class.version = H5Z_CLASS_T_VERS;
+    filter_class.id = filterId;
+    filter_class.encoder_present = 1;
+    filter_class.decoder_present = 1;
+    filter_class.name = "hum delta + bit pack";
+    filter_class.can_apply = NULL;
+    filter_class.set_local = NULL;
+    filter_class.filter = Filter;
+    herr_t status = H5Zregister(&filter_class);
+    assert(status >= 0);
+  }
+
+  bool IsPackable(hid_t dtype, unsigned &int_bytes, unsigned &stride) {
+    size_t size = H5Tget_size(dtype);
+    if (H5Tget_class(dtype) == H5T_INTEGER) {
+      int_bytes = unsigned(size);
+      stride = 1;
+      return int_bytes == 4 || int_bytes == 8;
+    }
+    if (H5Tget_class(dtype) != H5T_COMPOUND) return false;
+    int_bytes = 0;
+    size_t n_int = 0;
+    for (int i = 0; i < H5Tget_nmembers(dtype); ++i) {
+      hid_t member = H5Tget_member_type(dtype, i);
+      hid_t base = (H5Tget_class(member) == H5T_ARRAY) ?
+        H5Tget_super(member) : H5Tcopy(member);
+      bool is_int = (H5Tget_class(base) == H5T_INTEGER);
+      size_t base_size = H5Tget_size(base);
+      n_int += H5Tget_size(member) / base_size;
+      H5Tclose(base);
+      H5Tclose(member);
+      if (is_int == false || (int_bytes != 0 && base_size != int_bytes))
+        return false;
+      int_bytes = unsigned(base_size);
+    }
+    stride = unsigned(n_int);
+    return (int_bytes == 4 || int_bytes == 8) && n_int * int_bytes == size;
+  }
+
+} // end of deltapack namespace
+
+#endif
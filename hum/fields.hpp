@@ -0,0 +1,148 @@
+/*! \file fields.hpp
+ ** Solution fields stored next to the mesh. Every field is a group
+ ** Fields/<name> holding its centring and component count as attributes,
+ ** a Time dataset with one entry per step and one dataset per step
+ ** (Step0, Step1, ...) of nComponents values per entity in entity (SFC)
+ ** order. The step datasets are chunked so windows of any step are read
+ ** like the mesh datasets, and new steps are appended without touching
+ ** the mesh or the earlier steps.
+ **/
+
+#ifndef FIELDS_HPP
+
+#define FIELDS_HPP
+
+#include "types.hpp"
+#include <vector>
+#include <string>
+#include <sstream>
+
+namespace fields {
+
+  /// Entities the field values belong to
+  enum centringType {
+    CELL = 0, NODE = 1, FACE = 2
+  };
+
+  /// Default number of entities per chunk of a step dataset
+  const hsize_t defaultChunk = 16384;
+
+  /// Steps per chunk of the (extendible) Time dataset of a field
+  const hsize_t timeChunk = 256;
+
+  /*! \brief Metadata of one field */
+  struct info {
+    unsigned centring; /*!< One of centringType */
+    unsigned nComponents; /*!< Values per entity */
+    std::vector<double> time; /*!< Time of every step */
+  };
+
+  typedef std::vector< info > infoList;
+  typedef std::vector< std::string > nameList;
+
+  /*! \brief Link of the group of the field name */
+  h5pp::listString GroupLink(const std::string &name);
+
+  /*! \brief Link of the dataset of step of the field name */
+  h5pp::listString StepLink(const std::string &name, hsize_t step);
+
+  /*! \brief HDF5 type of the values of one entity (nComponents
+   **        floatT, the caller closes it)
+   **/
+  template<typename floatT>
+  hid_t MakeType(unsigned n_comp);
+
+  /*! \brief True if the file holds any field */
+  bool IsField(hid_t file);
+
+  /*! \brief Read the metadata of all fields (in name order) */
+  void Read(hid_t file, infoList &info, nameList &names);
+
+  /*! \brief (Re)write the metadata of all fields. The step
+   **        datasets are written separately.
+   **/
+  void Write(hid_t file, const infoList &info, const nameList &names);
+
+  /***********   Implementation  ****************/
+
+  h5pp::listString GroupLink(const std::string &name) {
+    h5pp::listString link;
+    link.push_back(hum::fieldLink[hum::PRIMARY]);
+    link.push_back(name);
+    return link;
+  }
+
+  h5pp::listString StepLink(const std::string &name, hsize_t step) {
+    std::stringstream cat;
+    cat << hum::fieldLink[hum::STEP] << step;
+    h5pp::listString link = GroupLink(name);
+    link.push_back(cat.str());
+    return link;
+  }
+
+  template<typename floatT>
+  hid_t MakeType(unsigned n_comp) {
+    assert(n_comp > 0);
+    hsize_t dims = n_comp;
+    return H5Tarray_create2(h5pp::GetHDF5Type<floatT>(), 1, &dims);
+  }
+
+  bool IsField(hid_t file) {
+    return h5pp::IsValidLink(file, hum::fieldLink[hum::PRIMARY]);
+  }
+
+  void Read(hid_t file, infoList &info, nameList &names) {
+    info.clear();
+    names.clear();
+    if (IsField(file) == false) return;
+    h5pp::listString link;
+    link.push_back(hum::fieldLink[hum::PRIMARY]);
+    hsize_t nfield = h5pp::GetSubGroupSize(file, link);
+    info.resize(nfield);
+    names.resize(nfield);
+    for (hsize_t i = 0; i < nfield; ++i) {
+      names[i] = h5pp::GetSubGroupName(file, i, link);
+      h5pp::listString group = GroupLink(names[i]);
+      group.push_back(hum::fieldLink[hum::FIELD]);
+      info[i].centring = h5pp::ReadAttribute<unsigned>(file, group);
+      group.pop_back();
+      group.push_back(hum::fieldLink[hum::ENTITY]);
+      info[i].nComponents = h5pp::ReadAttribute<unsigned>(file, group);
+      group.pop_back();
+      /// The step times
+      group.push_back(hum::fieldLink[hum::SECONDARY]);
+      hsize_t nstep = 0;
+      if (h5pp::IsValidLink(file, group) == true)
+        nstep = h5pp::GetVectorLength<hsize_t>(file, group);
+      info[i].time.resize(nstep);
+      if (nstep > 0)
+        h5pp::ReadVectorDataSerial(file, &info[i].time[0],
+        H5T_NATIVE_DOUBLE, group, 0, 1, nstep);
+    }
+  }
+
+  void Write(hid_t file, const infoList &info, const nameList &names) {
+    assert(info.size() == names.size());
+    hid_t dtype = H5T_NATIVE_DOUBLE;
+    for (size_t i = 0; i < names.size(); ++i) {
+      h5pp::listString link = GroupLink(names[i]);
+      h5pp::CreateGroup(file, link);
+      /// The layout of a field never changes once written
+      link.push_back(hum::fieldLink[hum::FIELD]);
+      if (h5pp::IsAttribute<unsigned>(file, link) == false)
+        h5pp::WriteAttribute(file, link, info[i].centring);
+      link.pop_back();
+      link.push_back(hum::fieldLink[hum::ENTITY]);
+      if (h5pp::IsAttribute<unsigned>(file, link) == false)
+        h5pp::WriteAttribute(file, link, info[i].nComponents);
+      link.pop_back();
+      /// One time per step of this field, extended as steps are added
+      link.push_back(hum::fieldLink[hum::SECONDARY]);
+      hsize_t nstep = info[i].time.size();
+      h5pp::WriteExtendible(file, nstep ? &info[i].time[0] : NULL,
+        dtype, dtype, link, nstep, timeChunk);
+    }
+  }
+}
+
+#endif
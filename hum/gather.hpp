@@ -0,0 +1,273 @@
+/*! \file gather.hpp
+ ** Coalesced gather reads of scattered dataset entries. HDF5 handles a
+ ** point selection element by element, so here the index list is sorted,
+ ** duplicates are dropped and indices closer than a gap are merged into
+ ** contiguous runs. The runs are read in bulk into one buffer and the
+ ** values are scattered back into the order of the list using TBB.
+ **/
+
+#ifndef GATHER_HPP
+
+#define GATHER_HPP
+
+#include "h5++.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace gather {
+
+  /*! Default merge gap in elements: up to this many unwanted
+   ** entries are read to join two neighbouring runs **/
+  const hsize_t defaultGap = 64;
+
+  /*! \brief Sorted, merged runs covering an index list and the
+   **        position of each run in the contiguous gather buffer
+   **/
+  class plan {
+  public:
+    /// Constructor
+    plan();
+
+    /*! \brief Sorts and merges the indices of list into runs. Runs
+     **        separated by at most max_gap entries are joined.
+     **/
+    void build(const hsize_t *list, hsize_t listSize, hsize_t max_gap);
+
+    /// Number of runs
+    size_t nRun() const;
+
+    /// First dataset index of run r
+    hsize_t start(size_t r) const;
+
+    /// Number of entries in run r
+    hsize_t count(size_t r) const;
+
+    /// Position of run r in the gather buffer
+    hsize_t base(size_t r) const;
+
+    /// Total entries read (the gather buffer size)
+    hsize_t bufferSize() const;
+
+    /// Position of a listed dataset index in the gather buffer
+    hsize_t position(hsize_t index) const;
+
+  private:
+    std::vector<hsize_t> _start, _count, _base;
+  };
+
+  /*! \brief The tbb parallel for functor copying the gathered
+   **        values back into the order of the index list
+   **/
+  struct scatterFunctor {
+  public:
+    /// Constructor
+    scatterFunctor(const plan &runs, const unsigned char *buffer,
+      size_t elem_bytes, const hsize_t *list, unsigned char *out);
+    /// The tbb parallel for functor
+    void operator()(const tbb::blocked_range<hsize_t> &range) const;
+
+  private:
+    const plan &_runs;
+    const unsigned char *_buffer;
+    size_t _elem_bytes;
+    const hsize_t *_list;
+    unsigned char *_out;
+  };
+
+  /*! \brief Reads the entries list[0 .. listSize) of a rank one
+   **        dataset into data (serial mode). Each merged run is one
+   **        hyperslab read into the gather buffer.
+   **/
+  void ReadSerial(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t listSize, const hsize_t *list,
+    hsize_t max_gap);
+
+  /*! \brief Reads the entries list[0 .. listSize) of a rank one
+   **        dataset into data (parallel mode). The merged runs are
+   **        one union of hyperslabs read with a single (possibly
+   **        collective) transfer, so every rank takes part even with
+   **        no data.
+   **/
+  void ReadParallel(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t listSize, const hsize_t *list,
+    hsize_t max_gap, H5FD_mpio_xfer_t xfer_mode);
+
+  /*! \brief Selects all runs of the plan in the file dataspace */
+  void SelectRuns(hid_t dspace_file, const plan &runs);
+
+  /*! \brief Copies the gathered values back in list order */
+  void Scatter(const plan &runs, const unsigned char *buffer,
+    size_t elem_bytes, hsize_t listSize, const hsize_t *list,
+    void *data);
+
+  /***********   Implementation  ****************/
+
+  plan
+  ::plan() {
+    /* empty */
+  }
+
+  void plan
+  ::build(const hsize_t *list, hsize_t listSize, hsize_t max_gap) {
+    _start.clear();
+    _count.clear();
+    _base.clear();
+    if (listSize == 0) return;
+    std::vector<hsize_t> sorted(list, list + listSize);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    hsize_t begin = sorted[0], end = sorted[0] + 1, total = 0;
+    for (size_t i = 1; i < sorted.size(); ++i) {
+      if (sorted[i] - end <= max_gap) {
+        end = sorted[i] + 1;
+        continue;
+      }
+      _start.push_back(begin);
+      _count.push_back(end - begin);
+      _base.push_back(total);
+      total += end - begin;
+      begin = sorted[i];
+      end = sorted[i] + 1;
+    }
+    _start.push_back(begin);
+    _count.push_back(end - begin);
+    _base.push_back(total);
+  }
+
+  size_t plan
+  ::nRun() const {
+    return _start.size();
+  }
+
+  hsize_t plan
+  ::start(size_t r) const {
+    return _start[r];
+  }
+
+  hsize_t plan
+  ::count(size_t r) const {
+    return _count[r];
+  }
+
+  hsize_t plan
+  ::base(size_t r) const {
+    return _base[r];
+  }
+
+  hsize_t plan
+  ::bufferSize() const {
+    if (_start.empty()) return 0;
+    return _base.back() + _count.back();
+  }
+
+  hsize_t plan
+  ::position(hsize_t index) const {
+    /// The run is the last one starting at or before index
+    size_t r = std::upper_bound(_start.begin(), _start.end(), index)
+      - _start.begin() - 1;
+    assert(index >= _start[r] && index - _start[r] < _count[r]);
+    return _base[r] + (index - _start[r]);
+  }
+
+  scatterFunctor
+  ::scatterFunctor(const plan &runs, const unsigned char *buffer,
+    size_t elem_bytes, const hsize_t *list, unsigned char *out)
+  : _runs(runs), _buffer(buffer), _elem_bytes(elem_bytes),
+  _list(list), _out(out) {
+    /* empty */
+  }
+
+  void scatterFunctor
+  ::operator()(const tbb::blocked_range<hsize_t> &range) const {
+    for (hsize_t i = range.begin(); i < range.end(); ++i)
+      std::memcpy(_out + i * _elem_bytes,
+      _buffer + _runs.position(_list[i]) * _elem_bytes, _elem_bytes);
+  }
+
+  void Scatter(const plan &runs, const unsigned char *buffer,
+    size_t elem_bytes, hsize_t listSize, const hsize_t *list,
+    void *data) {
+    tbb::parallel_for(tbb::blocked_range<hsize_t>(0, listSize),
+      scatterFunctor(runs, buffer, elem_bytes, list,
+      static_cast<unsigned char *> (data)));
+  }
+
+  void ReadSerial(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t listSize, const hsize_t *list,
+    hsize_t max_gap) {
+    if (listSize == 0) return;
+    plan runs;
+    runs.build(list, listSize, max_gap);
+    size_t elem_bytes = H5Tget_size(mem_dtype);
+    std::vector<unsigned char> buffer(runs.bufferSize() * elem_bytes);
+    herr_t status;
+    std::string cat = h5pp::ListStringToString(link);
+    assert(h5pp::IsDataset(file, cat.c_str()) == true);
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t dspace_file = H5Dget_space(dset);
+    /// One dataset handle, one hyperslab per run
+    for (size_t r = 0; r < runs.nRun(); ++r) {
+      hsize_t offset = runs.start(r), size = runs.count(r);
+      hid_t dspace_mem = H5Screate_simple(1, &size, NULL);
+      status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET, &offset,
+        NULL, &size, NULL);
+      assert(H5Sselect_valid(dspace_file) != 0);
+      status = H5Dread(dset, mem_dtype, dspace_mem, dspace_file,
+        H5P_DEFAULT, &buffer[runs.base(r) * elem_bytes]);
+      assert(status >= 0);
+      H5Sclose(dspace_mem);
+    }
+    H5Sclose(dspace_file);
+    H5Dclose(dset);
+    Scatter(runs, &buffer[0], elem_bytes, listSize, list, data);
+  }
+
+  void SelectRuns(hid_t dspace_file, const plan &runs) {
+    herr_t status;
+    for (size_t r = 0; r < runs.nRun(); ++r) {
+      hsize_t offset = runs.start(r), size = runs.count(r);
+      status = H5Sselect_hyperslab(dspace_file,
+        (r == 0) ? H5S_SELECT_SET : H5S_SELECT_OR, &offset, NULL, &size, NULL);
+      assert(status >= 0);
+    }
+  }
+
+  void ReadParallel(hid_t file, void *data, hid_t mem_dtype,
+    h5pp::listString &link, hsize_t listSize, const hsize_t *list,
+    hsize_t max_gap, H5FD_mpio_xfer_t xfer_mode) {
+    plan runs;
+    runs.build(list, listSize, max_gap);
+    hsize_t n_read = runs.bufferSize();
+    size_t elem_bytes = H5Tget_size(mem_dtype);
+    std::vector<unsigned char> buffer(n_read * elem_bytes + 1);
+    herr_t status;
+    std::string cat = h5pp::ListStringToString(link);
+    assert(h5pp::IsDataset(file, cat.c_str()) == true);
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t dspace_file = H5Dget_space(dset);
+    /// The runs are in file order, so the union of their hyperslabs
+    /// fills the gather buffer run after run
+    hid_t dspace_mem = H5Screate_simple(1, &n_read, NULL);
+    /// Collective calls require every rank even with nothing to read
+    if (n_read > 0)
+      SelectRuns(dspace_file, runs);
+    else
+      h5pp::SelectNone(dspace_mem, dspace_file);
+    assert(H5Sselect_valid(dspace_file) != 0);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(plist_id, xfer_mode);
+    status = H5Dread(dset, mem_dtype, dspace_mem, dspace_file,
+      plist_id, &buffer[0]);
+    assert(status >= 0);
+    H5Pclose(plist_id);
+    H5Sclose(dspace_mem);
+    H5Sclose(dspace_file);
+    H5Dclose(dset);
+    Scatter(runs, &buffer[0], elem_bytes, listSize, list, data);
+  }
+}
+
+#endif
@@ -12,10 +12,17 @@
 #include<mpi.h>
 #include<list>
 #include<string>
+#include<vector>
 #include<sstream>
 #include<cassert>
+#include<stdint.h>
 #include<hdf5.h>
 
+/// Direct chunk read/write appeared in HDF5 1.10.2
+#if H5_VERSION_GE(1,10,2)
+#define H5PP_DIRECT_CHUNK
+#endif
+
 namespace h5pp {
   typedef std::list<std::string> listString;
   typedef std::list<std::string>::iterator listString_it;
@@ -402,6 +409,83 @@ namespace h5pp {
     }
   }
 
+  /*! \brief Empty selection in memory and file for ranks which
+   **        take part in a collective transfer without any data
+   **/
+  void SelectNone(hid_t &dspace_mem, hid_t &dspace_file) {
+    herr_t status = H5Sselect_none(dspace_mem);
+    assert(status >= 0);
+    status = H5Sselect_none(dspace_file);
+    assert(status >= 0);
+  }
+
+  /*! \brief MPI-IO tuning passed when opening a file in parallel.
+   **        Zero valued hints are left to the MPI-IO implementation.
+   **        In collective mode every rank of the communicator must
+   **        take part in each read/write (possibly with no data).
+   **/
+  struct mpioHints {
+  public:
+    bool collective; /*!< Collective instead of independent transfers */
+    int cb_nodes; /*!< Number of collective buffering aggregators */
+    hsize_t cb_buffer_size; /*!< Collective buffer size in bytes */
+    int striping_factor; /*!< Lustre stripe count (new files) */
+    hsize_t striping_unit; /*!< Lustre stripe size in bytes (new files) */
+    hsize_t alignment; /*!< Align HDF5 objects to this many bytes */
+
+    mpioHints()
+    : collective(false), cb_nodes(0), cb_buffer_size(0),
+    striping_factor(0), striping_unit(0), alignment(0) {
+      /* empty */
+    }
+
+    /*! \brief The HDF5 transfer mode for the hints */
+    H5FD_mpio_xfer_t xfer_mode() const {
+      return (collective == true) ? H5FD_MPIO_COLLECTIVE : H5FD_MPIO_INDEPENDENT;
+    }
+  };
+
+  /*! \brief Sets one integer valued MPI_Info key if value is non zero
+   **/
+  void SetInfoHint(MPI_Info &info, const char *key, hsize_t value) {
+    if (value == 0) return;
+    std::stringstream cat;
+    cat << value;
+    MPI_Info_set(info, const_cast<char *> (key),
+      const_cast<char *> (cat.str().c_str()));
+  }
+
+  /*! \brief Creates the MPI-IO file access property list using the
+   **        hints. Caller closes the returned property list.
+   **/
+  hid_t MakeMPIOPlist(MPI_Comm &comm, const mpioHints &hints) {
+    MPI_Info info;
+    MPI_Info_create(&info);
+    if (hints.collective == true) {
+      MPI_Info_set(info, const_cast<char *> ("romio_cb_read"),
+        const_cast<char *> ("enable"));
+      MPI_Info_set(info, const_cast<char *> ("romio_cb_write"),
+        const_cast<char *> ("enable"));
+    }
+    SetInfoHint(info, "cb_nodes", hints.cb_nodes);
+    SetInfoHint(info, "cb_buffer_size", hints.cb_buffer_size);
+    SetInfoHint(info, "striping_factor", hints.striping_factor);
+    SetInfoHint(info, "striping_unit", hints.striping_unit);
+    hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_mpio(plist_id, comm, info);
+    MPI_Info_free(&info);
+    if (hints.alignment > 0)
+      H5Pset_alignment(plist_id, hints.alignment, hints.alignment);
+#if H5_VERSION_GE(1,10,0)
+    /// Metadata is read once and broadcast instead of by every rank
+    if (hints.collective == true) {
+      H5Pset_all_coll_metadata_ops(plist_id, 1);
+      H5Pset_coll_metadata_write(plist_id, 1);
+    }
+#endif
+    return plist_id;
+  }
+
   /*! \brief Read node information from hum using a offset/stride  
    **        Assumes data has enough space of size
    **    (parallel version)
@@ -410,7 +494,8 @@ namespace h5pp {
   void ReadVectorData
   (
     hid_t file, T *data, hid_t mem_dtype, h5pp::listString &link,
-    hsize_t offset, hsize_t stride, hsize_t size
+    hsize_t offset, hsize_t stride, hsize_t size,
+    H5FD_mpio_xfer_t xfer_mode = H5FD_MPIO_INDEPENDENT
     ) {
     // Variables used in local function
     herr_t status;
@@ -422,13 +507,17 @@ namespace h5pp {
     assert(h5pp::IsDataset(file, cat.c_str()) == true);
     dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
     dspace_file = H5Dget_space(dset);
-    status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET, &offset,
+    /// Collective calls require every rank even with nothing to read
+    if (size > 0)
+      status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET, &offset,
       &stride, &size, NULL);
+    else
+      SelectNone(dspace_mem, dspace_file);
     assert(H5Sselect_valid(dspace_file) != 0);
     // Read data from file to memory 
 
     hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
+    H5Pset_dxpl_mpio(plist_id, xfer_mode);
     status = H5Dread(dset, mem_dtype, dspace_mem, dspace_file,
       plist_id, data);
     H5Pclose(plist_id);
@@ -450,7 +539,8 @@ namespace h5pp {
   void ReadVectorData
   (
     hid_t &file, T *data, hid_t &mem_dtype,
-    listString &link, hsize_t listSize, hsize_t *list
+    listString &link, hsize_t listSize, hsize_t *list,
+    H5FD_mpio_xfer_t xfer_mode = H5FD_MPIO_INDEPENDENT
     ) {
     // Variables used in local function
     herr_t status;
@@ -462,11 +552,14 @@ namespace h5pp {
     assert(IsDataset(file, cat.c_str()) == true);
     dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
     dspace_file = H5Dget_space(dset);
-    status = H5Sselect_elements(dspace_file, H5S_SELECT_SET, listSize, list);
+    if (listSize > 0)
+      status = H5Sselect_elements(dspace_file, H5S_SELECT_SET, listSize, list);
+    else
+      SelectNone(dspace_mem, dspace_file);
     assert(H5Sselect_valid(dspace_file) != 0);
     // Read data from file to memory
     hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
+    H5Pset_dxpl_mpio(plist_id, xfer_mode);
     status = H5Dread(dset, mem_dtype, dspace_mem, dspace_file,
       plist_id, data);
     H5Pclose(plist_id);
@@ -594,7 +687,8 @@ namespace h5pp {
   (
     hid_t &file, T *data, hid_t &mem_dtype, hid_t &file_dtype,
     h5pp::listString &link, hsize_t offset,
-    hsize_t stride, hsize_t mem_size, hsize_t file_size
+    hsize_t stride, hsize_t mem_size, hsize_t file_size,
+    H5FD_mpio_xfer_t xfer_mode = H5FD_MPIO_INDEPENDENT
     ) {
     /// Write the chunk to the file
     herr_t status;
@@ -615,12 +709,15 @@ namespace h5pp {
       dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
       dspace_file = H5Dget_space(dset);
     }
-    status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET, &offset,
+    if (mem_size > 0)
+      status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET, &offset,
       &stride, &mem_size, NULL);
+    else
+      SelectNone(dspace_mem, dspace_file);
     assert(H5Sselect_valid(dspace_file) != 0);
 
     hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
+    H5Pset_dxpl_mpio(plist_id, xfer_mode);
     status = H5Dwrite(dset, mem_dtype, dspace_mem, dspace_file,
       plist_id, data);
     H5Pclose(plist_id);
@@ -635,10 +732,11 @@ namespace h5pp {
    **/
   template<class T>
   void WriteDset(hid_t &file, hid_t &dset, hid_t &dspace_mem,
-    hid_t &dtype, hid_t &dspace_file, T *vector) {
+    hid_t &dtype, hid_t &dspace_file, T *vector,
+    H5FD_mpio_xfer_t xfer_mode = H5FD_MPIO_INDEPENDENT) {
     herr_t status;
     hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
+    H5Pset_dxpl_mpio(plist_id, xfer_mode);
     status = H5Dwrite(dset, dtype, dspace_mem, dspace_file,
       plist_id, vector);
     assert(status <= 0);
@@ -650,15 +748,192 @@ namespace h5pp {
    **/
   template<class T>
   void ReadDset(hid_t &file, hid_t &dset, hid_t &dspace_mem,
-    hid_t &dtype, hid_t &dspace_file, T *vector) {
+    hid_t &dtype, hid_t &dspace_file, T *vector,
+    H5FD_mpio_xfer_t xfer_mode = H5FD_MPIO_INDEPENDENT) {
     herr_t status;
     hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
+    H5Pset_dxpl_mpio(plist_id, xfer_mode);
     status = H5Dread(dset, dtype, dspace_mem, dspace_file,
       plist_id, vector);
     assert(status <= 0);
     H5Pclose(plist_id);
   }
+  /*! \brief Opens the rank one data-set given by link and creates
+   **        it using the creation property list dcpl if it does
+   **        not exist in the file
+   **/
+  hid_t OpenOrCreateDset(hid_t &file, hid_t &file_dtype, listString &link,
+    hsize_t file_size, hid_t dcpl) {
+    hid_t dset, dspace;
+    std::string cat = ListStringToString(link);
+    CreateGroupForDset(file, link);
+    if (IsValidLink(file, link) == false) {
+      dspace = H5Screate_simple(1, &file_size, NULL);
+      dset = H5Dcreate(file, cat.c_str(), file_dtype,
+        dspace, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+      H5Sclose(dspace);
+    } else
+      dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    assert(dset >= 0);
+    return dset;
+  }
+
+  /*! \brief Writes size elements as the whole of a chunked rank one
+   **        dataset with unlimited extent. The dataset is resized in
+   **        place (H5Dset_extent) whenever its length changes, so
+   **        rewriting it as it grows leaves no unused space behind. A
+   **        fixed size dataset of an older file is replaced once.
+   **/
+  template < typename T >
+  void WriteExtendible
+  (
+    hid_t &file, const T *data, hid_t mem_dtype, hid_t file_dtype,
+    h5pp::listString &link, hsize_t size, hsize_t chunk_size
+    ) {
+    herr_t status;
+    hid_t dset = -1;
+    std::string cat = h5pp::ListStringToString(link);
+    if (IsValidLink(file, link) == true) {
+      dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+      hid_t dspace = H5Dget_space(dset);
+      hsize_t max_size = 0;
+      H5Sget_simple_extent_dims(dspace, NULL, &max_size);
+      H5Sclose(dspace);
+      if (max_size != H5S_UNLIMITED) {
+        H5Dclose(dset);
+        H5Ldelete(file, cat.c_str(), H5P_DEFAULT);
+        dset = -1;
+      }
+    }
+    if (dset < 0) {
+      CreateGroupForDset(file, link);
+      hsize_t zero = 0, unlimited = H5S_UNLIMITED;
+      hid_t dspace = H5Screate_simple(1, &zero, &unlimited);
+      hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+      status = H5Pset_chunk(dcpl, 1, &chunk_size);
+      assert(status >= 0);
+      dset = H5Dcreate(file, cat.c_str(), file_dtype, dspace,
+        H5P_DEFAULT, dcpl, H5P_DEFAULT);
+      H5Pclose(dcpl);
+      H5Sclose(dspace);
+    }
+    assert(dset >= 0);
+    status = H5Dset_extent(dset, &size);
+    assert(status >= 0);
+    if (size > 0) {
+      status = H5Dwrite(dset, mem_dtype, H5S_ALL, H5S_ALL,
+        H5P_DEFAULT, data);
+      assert(status >= 0);
+    }
+    H5Dclose(dset);
+  }
+
+  /*! \brief Creates a rank one chunked data-set creation property
+   **        list which compresses every chunk using deflate
+   **/
+  hid_t MakeDeflatePlist(hsize_t chunk_size, int level) {
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    herr_t status = H5Pset_chunk(dcpl, 1, &chunk_size);
+    assert(status >= 0);
+    status = H5Pset_deflate(dcpl, level);
+    assert(status >= 0);
+    return dcpl;
+  }
+
+  /*! \brief Checks if the rank one data-set is chunked with deflate as
+   **        its only filter and returns the chunk size (in elements)
+   **/
+  bool IsDeflateChunked(hid_t dset, hsize_t &chunk_size) {
+    bool ret = false;
+    hid_t dcpl = H5Dget_create_plist(dset);
+    if (H5Pget_layout(dcpl) == H5D_CHUNKED &&
+      H5Pget_chunk(dcpl, 1, &chunk_size) == 1 &&
+      H5Pget_nfilters(dcpl) == 1) {
+      unsigned flags, config;
+      size_t n_elmts = 0;
+      H5Z_filter_t filter = H5Pget_filter2(dcpl, 0, &flags,
+        &n_elmts, NULL, 0, NULL, &config);
+      ret = (filter == H5Z_FILTER_DEFLATE);
+    }
+    H5Pclose(dcpl);
+    return ret;
+  }
+
+  /*! \brief Returns the size in bytes of one element of the
+   **        data-set given by link
+   **/
+  size_t GetDsetTypeSize(hid_t &file, listString &link) {
+    std::string cat = ListStringToString(link);
+    assert(IsDataset(file, cat.c_str()) == true);
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t dtype = H5Dget_type(dset);
+    size_t ret = H5Tget_size(dtype);
+    H5Tclose(dtype);
+    H5Dclose(dset);
+    return ret;
+  }
+
+  /*! \brief Returns the byte offset of the data-set given by link in
+   **        the file if its raw data can be used in memory as is:
+   **        contiguous, allocated, unfiltered, stored with mem_dtype
+   **        and opened with the default (sec2) driver. Otherwise
+   **        returns false.
+   **/
+  bool GetRawOffset(hid_t &file, listString &link, hid_t mem_dtype,
+    haddr_t &offset) {
+    std::string cat = ListStringToString(link);
+    if (IsDataset(file, cat.c_str()) == false) return false;
+    hid_t fapl = H5Fget_access_plist(file);
+    bool is_sec2 = (H5Pget_driver(fapl) == H5FD_SEC2);
+    H5Pclose(fapl);
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t dcpl = H5Dget_create_plist(dset);
+    hid_t file_dtype = H5Dget_type(dset);
+    offset = H5Dget_offset(dset);
+    bool ret = is_sec2 && (H5Pget_layout(dcpl) == H5D_CONTIGUOUS) &&
+      (H5Pget_nfilters(dcpl) == 0) && (offset != HADDR_UNDEF) &&
+      (H5Tequal(file_dtype, mem_dtype) > 0);
+    H5Tclose(file_dtype);
+    H5Pclose(dcpl);
+    H5Dclose(dset);
+    return ret;
+  }
+
+#ifdef H5PP_DIRECT_CHUNK
+  /*! \brief Reads the raw (still filtered) chunk starting at element
+   **        chunk_offset into buf bypassing the filter pipeline.
+   **        An unallocated chunk is returned as an empty buffer.
+   **/
+  void ReadChunkRaw(hid_t dset, hsize_t chunk_offset,
+    std::vector<unsigned char> &buf, uint32_t &filter_mask) {
+    hsize_t nbytes = 0;
+    filter_mask = 0;
+    herr_t status;
+    /// An unallocated chunk is not an error, it reads as the fill value
+    H5E_BEGIN_TRY {
+      status = H5Dget_chunk_storage_size(dset, &chunk_offset, &nbytes);
+    } H5E_END_TRY;
+    buf.resize(nbytes);
+    if (status < 0 || nbytes == 0) {
+      buf.clear();
+      return;
+    }
+    status = H5Dread_chunk(dset, H5P_DEFAULT, &chunk_offset,
+      &filter_mask, &buf[0]);
+    assert(status >= 0);
+  }
+
+  /*! \brief Writes an already filtered chunk starting at element
+   **        chunk_offset bypassing the filter pipeline
+   **/
+  void WriteChunkRaw(hid_t dset, hsize_t chunk_offset,
+    const unsigned char *buf, size_t nbytes, uint32_t filter_mask) {
+    herr_t status = H5Dwrite_chunk(dset, H5P_DEFAULT, filter_mask,
+      &chunk_offset, nbytes, buf);
+    assert(status >= 0);
+  }
+#endif
+
   /*! \brief Returns the HDF5 type of the 
    **        template type T
    **/
@@ -0,0 +1,524 @@
+/*! \file hashcache.hpp
+ ** Content hashes of the primary datasets and a cache of data derived
+ ** from them (cell centroids, SFC permutations, connectivity caches).
+ ** The hash of a dataset is taken over its values as read in the native
+ ** type, so a deflated, packed or plain copy of the same mesh hashes the
+ ** same. The dataset is hashed in fixed blocks, blocks of a window
+ ** concurrently (TBB) and blocks of a file across the ranks of a
+ ** communicator, and the block hashes are hashed once more. The hash is
+ ** stored as the ContentHash attribute of the dataset and dropped by every
+ ** write through the hum streams, a missing attribute means "hash again".
+ **
+ ** A cache entry Cache/<name> holds the derived Data, the packed names of
+ ** the datasets it was built from (Sources) and their hashes at the time
+ ** (SourceHash). The cache lives in the hum file or in a sidecar file, an
+ ** entry is valid while all its sources still hash the same.
+ **/
+
+#ifndef HASHCACHE_HPP
+
+#define HASHCACHE_HPP
+
+#include "types.hpp"
+#include "chunkio.hpp"
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace hashcache {
+
+  typedef std::vector< std::string > nameList;
+  typedef std::vector< uint64_t > hashList;
+
+  /// Bytes hashed per block (the unit of parallel work)
+  const size_t blockBytes = size_t(1) << 20;
+
+  /// Blocks read per window of the streaming pass
+  const hsize_t windowBlocks = 64;
+
+  /*! \brief MurmurHash64A of bytes */
+  uint64_t HashBytes(const void *data, size_t bytes, uint64_t seed);
+
+  /*! \brief The tbb parallel for functor hashing
+   **        the blocks of one window
+   **/
+  struct hashFunctor {
+  public:
+    /// Constructor
+    hashFunctor(const unsigned char *window, size_t window_bytes,
+      size_t block_bytes, hsize_t first_block, uint64_t *hash);
+    /// The tbb parallel for functor
+    void operator()(const tbb::blocked_range<size_t> &range) const;
+
+  private:
+    const unsigned char *_window;
+    size_t _window_bytes, _block_bytes;
+    hsize_t _first_block;
+    uint64_t *_hash;
+  };
+
+  /*! \brief True if every prefix of link exists (h5pp::IsValidLink
+   **        only looks at the last one)
+   **/
+  bool IsLink(hid_t file, const h5pp::listString &link);
+
+  /*! \brief Link of the hash attribute of the dataset link */
+  h5pp::listString HashLink(const std::string &link);
+
+  /*! \brief Number of blocks the dataset link is hashed in
+   **        and the element count and size it is read with
+   **/
+  hsize_t NumBlocks(hid_t file, const std::string &link,
+    hsize_t &n_elem, size_t &elem_bytes);
+
+  /*! \brief Hashes of blocks [first, first + count) of the dataset */
+  void HashBlocks(hid_t file, const std::string &link,
+    hsize_t first, hsize_t count, uint64_t *hash);
+
+  /*! \brief The content hash from all the block hashes */
+  uint64_t Combine(const hashList &blocks, hsize_t n_elem,
+    size_t elem_bytes);
+
+  /*! \brief Content hash of the dataset link */
+  uint64_t Hash(hid_t file, const std::string &link);
+
+  /*! \brief Content hash of the dataset link, the blocks split across
+   **        the ranks of comm (every rank opened the file itself)
+   **/
+  uint64_t Hash(hid_t file, const std::string &link, MPI_Comm comm);
+
+  /*! \brief Reads the stored hash, false if there is none */
+  bool ReadHash(hid_t file, const std::string &link, uint64_t &hash);
+
+  /*! \brief Stores the hash as an attribute of the dataset */
+  void WriteHash(hid_t file, const std::string &link, uint64_t hash);
+
+  /*! \brief Drops the stored hash (the dataset is being written) */
+  void Invalidate(hid_t file, h5pp::listString &link);
+
+  /*! \brief The primary datasets of the file */
+  nameList PrimaryPaths(hid_t file);
+
+  /*! \brief Drops the stored hashes of all primary datasets */
+  void InvalidatePrimary(hid_t file);
+
+  /*! \brief The derived-data cache of a hum file */
+  class cache {
+  public:
+    /// Cache in the hum file itself (opened read-write to store)
+    cache(hid_t file);
+
+    /// Cache in the sidecar file cache_fname (created if missing)
+    cache(hid_t source, const char *cache_fname);
+
+    /// Destructor (closes a sidecar)
+    ~cache();
+
+    /// Hash of the source dataset link (stored if the file is writable)
+    uint64_t source_hash(const std::string &link);
+
+    /// True if the entry exists and none of its sources changed
+    bool is_valid(const std::string &name);
+
+    /// Reads a valid entry, false (data untouched) if missing or stale
+    template<typename T>
+    bool load(const std::string &name, std::vector<T> &data);
+
+    /// (Re)builds the entry name from data derived from sources
+    template<typename T>
+    void store(const std::string &name, const std::vector<T> &data,
+      const nameList &sources);
+
+    /// Names of all entries
+    nameList entries();
+
+    /// Sources of the entry name
+    nameList sources(const std::string &name);
+
+    /// Removes the entry name
+    void remove(const std::string &name);
+
+  private:
+    hid_t _source, _cache;
+    bool _is_sidecar;
+    std::map< std::string, uint64_t > _hash; /*!< Memoised source hashes */
+
+    /// Link of the entry dataset (Data, Sources or SourceHash)
+    h5pp::listString entry_link(const std::string &name,
+      hum::hashLinkType type);
+  };
+
+  /***********   Implementation  ****************/
+
+  uint64_t HashBytes(const void *data, size_t bytes, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (bytes * m);
+    const unsigned char *p = (const unsigned char *) data;
+    const unsigned char *end = p + (bytes & ~size_t(7));
+    for (; p != end; p += 8) {
+      uint64_t k;
+      std::memcpy(&k, p, 8);
+      k *= m;
+      k ^= k >> r;
+      k *= m;
+      h ^= k;
+      h *= m;
+    }
+    switch (bytes & 7) {
+      case 7: h ^= uint64_t(p[6]) << 48; // fall through
+      case 6: h ^= uint64_t(p[5]) << 40; // fall through
+      case 5: h ^= uint64_t(p[4]) << 32; // fall through
+      case 4: h ^= uint64_t(p[3]) << 24; // fall through
+      case 3: h ^= uint64_t(p[2]) << 16; // fall through
+      case 2: h ^= uint64_t(p[1]) << 8; // fall through
+      case 1: h ^= uint64_t(p[0]);
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+  }
+
+  hashFunctor
+  ::hashFunctor(const unsigned char *window, size_t window_bytes,
+    size_t block_bytes, hsize_t first_block, uint64_t *hash)
+  : _window(window), _window_bytes(window_bytes),
+  _block_bytes(block_bytes), _first_block(first_block), _hash(hash) {
+    /* empty */
+  }
+
+  void hashFunctor
+  ::operator()(const tbb::blocked_range<size_t> &range) const {
+    for (size_t i = range.begin(); i != range.end(); ++i) {
+      size_t begin = i * _block_bytes;
+      size_t bytes = std::min(_block_bytes, _window_bytes - begin);
+      /// Seeded with the block number, swapped blocks hash different
+      _hash[i] = HashBytes(_window + begin, bytes, _first_block + i);
+    }
+  }
+
+  bool IsLink(hid_t file, const h5pp::listString &link) {
+    std::string cat;
+    h5pp::listString::const_iterator it;
+    for (it = link.begin(); it != link.end(); ++it) {
+      cat += "/" + *it;
+      if (H5Lexists(file, cat.c_str(), H5P_DEFAULT) <= 0) return false;
+    }
+    return true;
+  }
+
+  h5pp::listString HashLink(const std::string &link) {
+    h5pp::listString ret;
+    ret.push_back(link);
+    ret.push_back(hum::hashLink[hum::PRIMARY]);
+    return ret;
+  }
+
+  hsize_t NumBlocks(hid_t file, const std::string &link,
+    hsize_t &n_elem, size_t &elem_bytes) {
+    h5pp::listString dlink;
+    dlink.push_back(link);
+    n_elem = h5pp::GetVectorLength<hsize_t>(file, dlink);
+    hid_t dset = H5Dopen2(file, link.c_str(), H5P_DEFAULT);
+    hid_t file_dtype = H5Dget_type(dset);
+    hid_t mem_dtype = H5Tget_native_type(file_dtype, H5T_DIR_ASCEND);
+    elem_bytes = H5Tget_size(mem_dtype);
+    H5Tclose(mem_dtype);
+    H5Tclose(file_dtype);
+    H5Dclose(dset);
+    hsize_t block_elems = std::max(blockBytes / elem_bytes, size_t(1));
+    return (n_elem + block_elems - 1) / block_elems;
+  }
+
+  void HashBlocks(hid_t file, const std::string &link,
+    hsize_t first, hsize_t count, uint64_t *hash) {
+    hsize_t n_elem;
+    size_t elem_bytes;
+    hsize_t n_block = NumBlocks(file, link, n_elem, elem_bytes);
+    assert(first + count <= n_block);
+    if (count == 0) return;
+    hsize_t block_elems = std::max(blockBytes / elem_bytes, size_t(1));
+    size_t block_bytes = block_elems * elem_bytes;
+    hid_t dset = H5Dopen2(file, link.c_str(), H5P_DEFAULT);
+    hid_t file_dtype = H5Dget_type(dset);
+    hid_t mem_dtype = H5Tget_native_type(file_dtype, H5T_DIR_ASCEND);
+    H5Tclose(file_dtype);
+    H5Dclose(dset);
+    h5pp::listString dlink;
+    dlink.push_back(link);
+    std::vector<unsigned char> window
+      (std::min(windowBlocks * block_elems, n_elem) * elem_bytes);
+    for (hsize_t b = first; b < first + count; b += windowBlocks) {
+      hsize_t nb = std::min(windowBlocks, first + count - b);
+      hsize_t offset = b * block_elems;
+      hsize_t size = std::min(nb * block_elems, n_elem - offset);
+      size_t bytes = size * elem_bytes;
+      /// Compound padding is left alone by HDF5, keep it deterministic
+      std::memset(&window[0], 0, bytes);
+      if (chunkio::TryReadChunked(file, &window[0], mem_dtype, dlink,
+        offset, size) == false)
+        h5pp::ReadVectorDataSerial(file, &window[0], mem_dtype, dlink,
+        offset, 1, size);
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, nb),
+        hashFunctor(&window[0], bytes, block_bytes, b, hash + (b - first)));
+    }
+    H5Tclose(mem_dtype);
+  }
+
+  uint64_t Combine(const hashList &blocks, hsize_t n_elem,
+    size_t elem_bytes) {
+    uint64_t shape[2] = {n_elem, elem_bytes};
+    uint64_t seed = HashBytes(shape, sizeof (shape), 0);
+    if (blocks.empty() == true) return seed;
+    return HashBytes(&blocks[0], blocks.size() * sizeof (uint64_t), seed);
+  }
+
+  uint64_t Hash(hid_t file, const std::string &link) {
+    hsize_t n_elem;
+    size_t elem_bytes;
+    hashList blocks(NumBlocks(file, link, n_elem, elem_bytes));
+    if (blocks.empty() == false)
+      HashBlocks(file, link, 0, blocks.size(), &blocks[0]);
+    return Combine(blocks, n_elem, elem_bytes);
+  }
+
+  uint64_t Hash(hid_t file, const std::string &link, MPI_Comm comm) {
+    int rank, nproc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nproc);
+    hsize_t n_elem;
+    size_t elem_bytes;
+    hsize_t n_block = NumBlocks(file, link, n_elem, elem_bytes);
+    /// Contiguous block ranges, the first n_block % nproc get one more
+    std::vector<int> counts(nproc), displs(nproc);
+    for (int i = 0; i < nproc; ++i) {
+      counts[i] = int(n_block / nproc + ((hsize_t(i) < n_block % nproc) ? 1 : 0));
+      displs[i] = (i == 0) ? 0 : displs[i - 1] + counts[i - 1];
+    }
+    hashList mine(counts[rank] + 1), blocks(n_block + 1);
+    HashBlocks(file, link, displs[rank], counts[rank], &mine[0]);
+    MPI_Allgatherv(&mine[0], counts[rank], MPI_UNSIGNED_LONG_LONG,
+      &blocks[0], &counts[0], &displs[0], MPI_UNSIGNED_LONG_LONG, comm);
+    blocks.pop_back();
+    return Combine(blocks, n_elem, elem_bytes);
+  }
+
+  bool ReadHash(hid_t file, const std::string &link, uint64_t &hash) {
+    if (h5pp::IsDataset(file, link.c_str()) == false) return false;
+    h5pp::listString attr = HashLink(link);
+    if (h5pp::IsAttribute<uint64_t>(file, attr) == false) return false;
+    hash = h5pp::ReadAttribute<uint64_t>(file, attr);
+    return true;
+  }
+
+  void WriteHash(hid_t file, const std::string &link, uint64_t hash) {
+    /// HDF5 can not rewrite an attribute in place, drop it first
+    h5pp::listString dlink;
+    dlink.push_back(link);
+    Invalidate(file, dlink);
+    h5pp::listString attr = HashLink(link);
+    h5pp::WriteAttribute(file, attr, hash);
+  }
+
+  void Invalidate(hid_t file, h5pp::listString &link) {
+    if (IsLink(file, link) == false) return;
+    std::string cat = h5pp::ListStringToString(link);
+    if (h5pp::IsDataset(file, cat.c_str()) == false) return;
+    if (H5Aexists_by_name(file, cat.c_str(), hum::hashLink[hum::PRIMARY],
+      H5P_DEFAULT) > 0)
+      H5Adelete_by_name(file, cat.c_str(), hum::hashLink[hum::PRIMARY],
+      H5P_DEFAULT);
+  }
+
+  nameList PrimaryPaths(hid_t file) {
+    const char *paths[] = {
+      hum::nodeLink[hum::PRIMARY], hum::faceLink[hum::PRIMARY],
+      hum::faceLink[hum::SECONDARY], hum::faceCSRLink[hum::PRIMARY],
+      hum::faceCSRLink[hum::SECONDARY], hum::cellCSRLink[hum::PRIMARY],
+      hum::cellCSRLink[hum::SECONDARY], hum::patchTableLink[hum::PRIMARY],
+      hum::patchTableLink[hum::SECONDARY]
+    };
+    nameList ret;
+    for (size_t i = 0; i < sizeof (paths) / sizeof (paths[0]); ++i)
+      if (h5pp::IsDataset(file, paths[i]) == true)
+        ret.push_back(paths[i]);
+    return ret;
+  }
+
+  void InvalidatePrimary(hid_t file) {
+    nameList paths = PrimaryPaths(file);
+    for (size_t i = 0; i < paths.size(); ++i) {
+      h5pp::listString link;
+      link.push_back(paths[i]);
+      Invalidate(file, link);
+    }
+  }
+
+  cache
+  ::cache(hid_t file)
+  : _source(file), _cache(file), _is_sidecar(false) {
+    /* empty */
+  }
+
+  cache
+  ::cache(hid_t source, const char *cache_fname)
+  : _source(source), _is_sidecar(true) {
+    H5E_BEGIN_TRY {
+      _cache = H5Fopen(cache_fname, H5F_ACC_RDWR, H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (_cache < 0)
+      _cache = H5Fcreate(cache_fname, H5F_ACC_TRUNC, H5P_DEFAULT,
+      H5P_DEFAULT);
+    assert(_cache >= 0);
+  }
+
+  cache
+  ::~cache() {
+    if (_is_sidecar == true) H5Fclose(_cache);
+  }
+
+  uint64_t cache
+  ::source_hash(const std::string &link) {
+    std::map< std::string, uint64_t >::iterator it = _hash.find(link);
+    if (it != _hash.end()) return it->second;
+    uint64_t hash;
+    if (ReadHash(_source, link, hash) == false) {
+      hash = Hash(_source, link);
+      unsigned intent;
+      H5Fget_intent(_source, &intent);
+      if ((intent & H5F_ACC_RDWR) != 0) WriteHash(_source, link, hash);
+    }
+    _hash[link] = hash;
+    return hash;
+  }
+
+  bool cache
+  ::is_valid(const std::string &name) {
+    h5pp::listString link = entry_link(name, hum::ENTRY_HASH);
+    if (IsLink(_cache, link) == false) return false;
+    nameList src = sources(name);
+    hashList hash(src.size() + 1);
+    if (src.empty() == false)
+      h5pp::ReadVectorDataSerial(_cache, &hash[0],
+      h5pp::GetHDF5Type<uint64_t>(), link, 0, 1, src.size());
+    for (size_t i = 0; i < src.size(); ++i)
+      if (h5pp::IsDataset(_source, src[i].c_str()) == false ||
+        source_hash(src[i]) != hash[i])
+        return false;
+    return true;
+  }
+
+  template<typename T>
+  bool cache
+  ::load(const std::string &name, std::vector<T> &data) {
+    if (is_valid(name) == false) return false;
+    h5pp::listString link = entry_link(name, hum::ENTRY_DATA);
+    data.clear();
+    /// Empty data is stored as no dataset
+    if (IsLink(_cache, link) == false) return true;
+    hsize_t size = h5pp::GetVectorLength<hsize_t>(_cache, link);
+    data.resize(size);
+    if (size > 0)
+      h5pp::ReadVectorDataSerial(_cache, &data[0], h5pp::GetHDF5Type<T>(),
+      link, 0, 1, size);
+    return true;
+  }
+
+  template<typename T>
+  void cache
+  ::store(const std::string &name, const std::vector<T> &data,
+    const nameList &sources) {
+    assert(sources.empty() == false);
+    /// Hash the sources first, a stale entry is never left behind
+    hashList hash(sources.size());
+    std::vector<char> packed;
+    for (size_t i = 0; i < sources.size(); ++i) {
+      hash[i] = source_hash(sources[i]);
+      packed.insert(packed.end(), sources[i].begin(), sources[i].end());
+      packed.push_back('\0');
+    }
+    remove(name);
+    h5pp::listString link = entry_link(name, hum::ENTRY_DATA);
+    h5pp::CreateGroupForDset(_cache, link);
+    hsize_t size = data.size();
+    if (size > 0) {
+      hid_t dtype = H5Tcopy(h5pp::GetHDF5Type<T>());
+      h5pp::WriteVectorDataSerial(_cache, &data[0], dtype, dtype,
+        link, 0, 1, size, size);
+      H5Tclose(dtype);
+    }
+    /// Source links in the order of the hashes written below
+    hid_t char_dtype = H5T_NATIVE_CHAR;
+    hsize_t n_char = packed.size();
+    link = entry_link(name, hum::ENTRY_SOURCES);
+    h5pp::WriteVectorDataSerial(_cache, &packed[0], char_dtype, char_dtype,
+      link, 0, 1, n_char, n_char);
+    /// Written last, it marks the entry complete
+    hid_t hash_dtype = H5Tcopy(h5pp::GetHDF5Type<uint64_t>());
+    hsize_t n_src = sources.size();
+    link = entry_link(name, hum::ENTRY_HASH);
+    h5pp::WriteVectorDataSerial(_cache, &hash[0], hash_dtype, hash_dtype,
+      link, 0, 1, n_src, n_src);
+    H5Tclose(hash_dtype);
+  }
+
+  nameList cache
+  ::entries() {
+    nameList ret;
+    h5pp::listString link;
+    link.push_back(hum::cellCacheLink[hum::PRIMARY]);
+    if (h5pp::IsValidLink(_cache, link) == false) return ret;
+    hsize_t n = h5pp::GetSubGroupSize(_cache, link);
+    for (hsize_t i = 0; i < n; ++i) {
+      std::string name = h5pp::GetSubGroupName(_cache, i, link);
+      /// Only groups with source hashes are cache entries
+      h5pp::listString hlink = entry_link(name, hum::ENTRY_HASH);
+      if (IsLink(_cache, hlink) == true)
+        ret.push_back(name);
+    }
+    return ret;
+  }
+
+  nameList cache
+  ::sources(const std::string &name) {
+    nameList ret;
+    h5pp::listString link = entry_link(name, hum::ENTRY_SOURCES);
+    if (IsLink(_cache, link) == false) return ret;
+    hsize_t n_char = h5pp::GetVectorLength<hsize_t>(_cache, link);
+    std::vector<char> packed(n_char + 1, '\0');
+    if (n_char > 0)
+      h5pp::ReadVectorDataSerial(_cache, &packed[0], H5T_NATIVE_CHAR,
+      link, 0, 1, n_char);
+    for (hsize_t i = 0; i < n_char; i += ret.back().size() + 1)
+      ret.push_back(std::string(&packed[i]));
+    return ret;
+  }
+
+  void cache
+  ::remove(const std::string &name) {
+    h5pp::listString link;
+    link.push_back(hum::cellCacheLink[hum::PRIMARY]);
+    link.push_back(name);
+    std::string cat = h5pp::ListStringToString(link);
+    if (IsLink(_cache, link) == true)
+      H5Ldelete(_cache, cat.c_str(), H5P_DEFAULT);
+  }
+
+  h5pp::listString cache
+  ::entry_link(const std::string &name, hum::hashLinkType type) {
+    h5pp::listString link;
+    link.push_back(hum::cellCacheLink[hum::PRIMARY]);
+    link.push_back(name);
+    link.push_back(hum::hashLink[type]);
+    return link;
+  }
+}
+
+#endif
@@ -0,0 +1,459 @@
+/*! \file humraw.hpp
+ ** The hum-raw container. It stores the same schema as an HDF5 hum file
+ ** (nodes, faces, face left/right cells, patch table, AABB and the size
+ ** attributes) as one flat native endian binary: a fixed header holding
+ ** the version and an offset table, followed by page aligned sections.
+ ** A file is opened with a single mmap and the sections are used in
+ ** place, no metadata parsing or type conversion is needed. ihstream
+ ** detects the format by its magic and reads/writes it through the same
+ ** interface as an HDF5 hum file.
+ **/
+
+#ifndef HUMRAW_HPP
+
+#define HUMRAW_HPP
+
+#include "types.hpp"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace humraw {
+
+  const char magic[8] = {'H', 'U', 'M', 'R', 'A', 'W', '\0', '\0'};
+  const uint32_t version = 1;
+  const uint32_t byteOrder = 0x01020304; /*!< Detects foreign endianness */
+  const uint64_t alignment = 4096; /*!< Sections start on page boundaries */
+  const size_t patchNameSize = 64;
+
+  enum sectionType {
+    NODES = 0, FACES = 1, LEFT_RIGHT = 2, PATCHES = 3, N_SECTION = 4
+  };
+
+  /*! \brief Entry of the offset table */
+  struct section {
+    uint64_t offset; /*!< Byte offset from the start of the file */
+    uint64_t count; /*!< Number of elements */
+  };
+
+  /*! \brief The fixed size file header
+   **        WARNING: Append new fields only and bump the version.
+   **/
+  struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t intSize; /*!< sizeof uintT of faces/left-right */
+    uint32_t floatSize; /*!< sizeof floatT of nodes */
+    uint64_t nCell;
+    uint64_t nInternalFace;
+    uint64_t nFaceAdjncy;
+    double min[3]; /*!< AABB */
+    double max[3];
+    section table[N_SECTION];
+  };
+
+  /*! \brief One entry of the patch table section */
+  struct patchRecord {
+    char name[patchNameSize];
+    patchBC<uint64_t> info;
+  };
+
+  /*! \brief True if the file starts with the hum-raw magic */
+  bool IsRaw(const char *fname) {
+    char buf[sizeof (magic)];
+    int fd = ::open(fname, O_RDONLY);
+    if (fd < 0) return false;
+    ssize_t len = ::read(fd, buf, sizeof (buf));
+    ::close(fd);
+    return len == ssize_t(sizeof (buf)) &&
+      std::memcmp(buf, magic, sizeof (magic)) == 0;
+  }
+
+  /*! \brief Clears the header and sets the identification fields */
+  void InitHeader(header &head, int int_size, int float_size) {
+    std::memset(&head, 0, sizeof (header));
+    std::memcpy(head.magic, magic, sizeof (magic));
+    head.version = version;
+    head.byteOrder = byteOrder;
+    head.intSize = int_size;
+    head.floatSize = float_size;
+  }
+
+  /*! \brief Maps a hum link to its section (N_SECTION if none) */
+  sectionType LinkSection(h5pp::listString &link) {
+    if (link.size() != 1) return N_SECTION;
+    if (link.back() == hum::nodeLink[hum::PRIMARY]) return NODES;
+    if (link.back() == hum::faceLink[hum::PRIMARY]) return FACES;
+    if (link.back() == hum::faceLink[hum::SECONDARY]) return LEFT_RIGHT;
+    return N_SECTION;
+  }
+
+  /*! \brief HDF5 memory type of the elements stored in a section
+   **        (caller closes the returned type)
+   **/
+  hid_t SectionType(const header &head, sectionType sec) {
+    hid_t dtype = -1;
+    bool is64 = (head.intSize > 4);
+    switch (sec) {
+      case NODES:
+        if (head.floatSize > 4) {
+          H5TNode<double> H5T;
+          dtype = H5Tcopy(H5T.mem_t());
+        } else {
+          H5TNode<float> H5T;
+          dtype = H5Tcopy(H5T.mem_t());
+        }
+        break;
+      case FACES:
+        if (is64) {
+          H5TFace<uint64_t> H5T;
+          dtype = H5Tcopy(H5T.mem_t());
+        } else {
+          H5TFace<uint32_t> H5T;
+          dtype = H5Tcopy(H5T.mem_t());
+        }
+        break;
+      case LEFT_RIGHT:
+        if (is64) {
+          H5TLeftRight<uint64_t> H5T;
+          dtype = H5Tcopy(H5T.mem_t());
+        } else {
+          H5TLeftRight<uint32_t> H5T;
+          dtype = H5Tcopy(H5T.mem_t());
+        }
+        break;
+      default:
+        assert(false && "section has no HDF5 type");
+    }
+    return dtype;
+  }
+
+  /*! \brief Size in bytes of one element of a section */
+  size_t ElementSize(const header &head, sectionType sec) {
+    if (sec == PATCHES) return sizeof (patchRecord);
+    hid_t dtype = SectionType(head, sec);
+    size_t ret = H5Tget_size(dtype);
+    H5Tclose(dtype);
+    return ret;
+  }
+
+  /*! \brief True if the header describes a file of bytes: known
+   **        integer and float sizes and every section inside the file
+   **/
+  bool IsValidLayout(const header &head, uint64_t bytes);
+
+  /*! \brief Fills the section offsets from the section counts
+   **        and returns the total file size
+   **/
+  uint64_t Layout(header &head) {
+    uint64_t end = sizeof (header);
+    for (unsigned i = 0; i < N_SECTION; ++i) {
+      sectionType sec = static_cast<sectionType> (i);
+      head.table[i].offset = (end + alignment - 1) / alignment * alignment;
+      end = head.table[i].offset + head.table[i].count * ElementSize(head, sec);
+    }
+    return end;
+  }
+
+  bool IsValidLayout(const header &head, uint64_t bytes) {
+    if ((head.intSize != 4 && head.intSize != 8) ||
+      (head.floatSize != 4 && head.floatSize != 8))
+      return false;
+    for (unsigned i = 0; i < N_SECTION; ++i) {
+      sectionType sec = static_cast<sectionType> (i);
+      uint64_t offset = head.table[i].offset, count = head.table[i].count;
+      uint64_t elem = ElementSize(head, sec);
+      if (offset < sizeof (header) || offset > bytes) return false;
+      /// Checked by division, count * elem may overflow
+      if (count > (bytes - offset) / elem) return false;
+    }
+    return true;
+  }
+
+  /*! \brief A hum-raw file mapped into memory */
+  class image {
+  public:
+    /*! \brief Empty image */
+    image();
+
+    /*! \brief Unmaps the file */
+    ~image();
+
+    /*! \brief Creates (truncates) fname laid out for the header
+     **        (intSize, floatSize and section counts set) mapped
+     **        for writing
+     **/
+    bool create(const char *fname, header &head);
+
+    /*! \brief Maps an existing file, writes go to the file
+     **        in read_write mode. Returns false if fname is not a
+     **        valid hum-raw file of this version or its sections do
+     **        not fit in the file (truncated or corrupt).
+     **/
+    bool open(const char *fname, bool read_write);
+
+    /*! \brief Flushes (read_write mode) and unmaps the file */
+    void close();
+
+    /*! \brief Flushes the mapped pages to the file */
+    void sync();
+
+    bool isOpen() const;
+
+    bool isWritable() const;
+
+    /*! \brief The mapped file name */
+    const std::string &name() const;
+
+    header &head();
+
+    /*! \brief Start of the given section */
+    void *section(sectionType sec);
+
+    /*! \brief The patch table (head().table[PATCHES].count long) */
+    patchRecord *patches();
+
+    /*! \brief True if the section is stored with mem_dtype
+     **        (the section can be used in place)
+     **/
+    bool isNative(sectionType sec, hid_t mem_dtype);
+
+    /*! \brief Reads using offset/stride converting to mem_dtype */
+    void read(void *data, hid_t mem_dtype, sectionType sec,
+      hsize_t offset, hsize_t stride, hsize_t size);
+
+    /*! \brief Reads using a list converting to mem_dtype */
+    void read(void *data, hid_t mem_dtype, sectionType sec,
+      hsize_t listSize, hsize_t *list);
+
+    /*! \brief Writes using offset/stride converting from mem_dtype */
+    void write(const void *data, hid_t mem_dtype, sectionType sec,
+      hsize_t offset, hsize_t stride, hsize_t size);
+
+  private:
+    void *_base; /*!< Start of the mapping */
+    uint64_t _bytes; /*!< Length of the mapping */
+    bool _writable;
+    std::string _name;
+
+    /*! \brief Maps the whole file behind fd */
+    bool map(int fd, uint64_t bytes, bool read_write);
+
+    /*! \brief Moves size elements between memory and the section.
+     **        Element i is at list[i] if list is given else at
+     **        offset + i * stride.
+     **/
+    void transfer(void *data, hid_t mem_dtype, sectionType sec,
+      hsize_t size, const hsize_t *list, hsize_t offset,
+      hsize_t stride, bool to_file);
+
+    /// Non copyable
+    image(const image &);
+    image &operator=(const image &);
+  };
+
+  /***********   Implementation  ****************/
+
+  image
+  ::image()
+  : _base(0), _bytes(0), _writable(false) {
+    /* empty */
+  }
+
+  image
+  ::~image() {
+    close();
+  }
+
+  bool image
+  ::create(const char *fname, header &head) {
+    close();
+    uint64_t bytes = Layout(head);
+    int fd = ::open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, bytes) != 0 || map(fd, bytes, true) == false) {
+      ::close(fd);
+      return false;
+    }
+    ::close(fd);
+    std::memcpy(_base, &head, sizeof (header));
+    _name = fname;
+    return true;
+  }
+
+  bool image
+  ::open(const char *fname, bool read_write) {
+    close();
+    struct stat st;
+    int fd = ::open(fname, (read_write == true) ? O_RDWR : O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < sizeof (header) ||
+      map(fd, st.st_size, read_write) == false) {
+      ::close(fd);
+      return false;
+    }
+    ::close(fd);
+    const header &file_head = head();
+    if (std::memcmp(file_head.magic, magic, sizeof (magic)) != 0 ||
+      file_head.version != version || file_head.byteOrder != byteOrder ||
+      IsValidLayout(file_head, st.st_size) == false) {
+      close();
+      return false;
+    }
+    _name = fname;
+    return true;
+  }
+
+  void image
+  ::close() {
+    if (_base == 0) return;
+    if (_writable == true) sync();
+    munmap(_base, _bytes);
+    _base = 0;
+    _bytes = 0;
+    _writable = false;
+    _name.clear();
+  }
+
+  void image
+  ::sync() {
+    if (_base != 0 && _writable == true)
+      msync(_base, _bytes, MS_SYNC);
+  }
+
+  bool image
+  ::isOpen() const {
+    return _base != 0;
+  }
+
+  bool image
+  ::isWritable() const {
+    return _writable;
+  }
+
+  const std::string &image
+  ::name() const {
+    return _name;
+  }
+
+  header &image
+  ::head() {
+    assert(_base != 0);
+    return *static_cast<header *> (_base);
+  }
+
+  void *image
+  ::section(sectionType sec) {
+    assert(sec < N_SECTION);
+    return static_cast<char *> (_base) + head().table[sec].offset;
+  }
+
+  patchRecord *image
+  ::patches() {
+    return static_cast<patchRecord *> (section(PATCHES));
+  }
+
+  bool image
+  ::isNative(sectionType sec, hid_t mem_dtype) {
+    if (sec >= PATCHES) return false;
+    hid_t dtype = SectionType(head(), sec);
+    bool ret = (H5Tequal(dtype, mem_dtype) > 0);
+    H5Tclose(dtype);
+    return ret;
+  }
+
+  void image
+  ::read(void *data, hid_t mem_dtype, sectionType sec,
+    hsize_t offset, hsize_t stride, hsize_t size) {
+    transfer(data, mem_dtype, sec, size, NULL, offset, stride, false);
+  }
+
+  void image
+  ::read(void *data, hid_t mem_dtype, sectionType sec,
+    hsize_t listSize, hsize_t *list) {
+    transfer(data, mem_dtype, sec, listSize, list, 0, 1, false);
+  }
+
+  void image
+  ::write(const void *data, hid_t mem_dtype, sectionType sec,
+    hsize_t offset, hsize_t stride, hsize_t size) {
+    assert(_writable);
+    transfer(const_cast<void *> (data), mem_dtype, sec, size,
+      NULL, offset, stride, true);
+  }
+
+  bool image
+  ::map(int fd, uint64_t bytes, bool read_write) {
+    int prot = (read_write == true) ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *base = mmap(0, bytes, prot, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) return false;
+    _base = base;
+    _bytes = bytes;
+    _writable = read_write;
+    return true;
+  }
+
+  void image
+  ::transfer(void *data, hid_t mem_dtype, sectionType sec,
+    hsize_t size, const hsize_t *list, hsize_t offset,
+    hsize_t stride, bool to_file) {
+    assert(_base != 0 && sec < PATCHES);
+    if (size == 0) return;
+    hid_t file_dtype = SectionType(head(), sec);
+    size_t file_bytes = H5Tget_size(file_dtype);
+    size_t mem_bytes = H5Tget_size(mem_dtype);
+    bool is_native = (H5Tequal(file_dtype, mem_dtype) > 0);
+    char *base = static_cast<char *> (section(sec));
+    char *mem = static_cast<char *> (data);
+    hsize_t count = head().table[sec].count;
+    assert((list != NULL) || offset + (size - 1) * stride < count);
+    /// Contiguous window stored in the memory type
+    if (is_native == true && list == NULL && stride == 1) {
+      if (to_file == true)
+        std::memcpy(base + offset * file_bytes, mem, size * file_bytes);
+      else
+        std::memcpy(mem, base + offset * file_bytes, size * file_bytes);
+      H5Tclose(file_dtype);
+      return;
+    }
+    /// Conversion buffer holds either representation
+    std::vector<char> buf, bkg;
+    char *elems = mem;
+    if (is_native == false) {
+      buf.resize(size * std::max(file_bytes, mem_bytes));
+      bkg.resize(buf.size());
+      elems = &buf[0];
+      if (to_file == true) {
+        std::memcpy(elems, mem, size * mem_bytes);
+        herr_t status = H5Tconvert(mem_dtype, file_dtype, size, elems,
+          &bkg[0], H5P_DEFAULT);
+        assert(status >= 0);
+      }
+    }
+    for (hsize_t i = 0; i < size; ++i) {
+      hsize_t idx = (list != NULL) ? list[i] : offset + i * stride;
+      assert(idx < count);
+      if (to_file == true)
+        std::memcpy(base + idx * file_bytes, elems + i * file_bytes, file_bytes);
+      else
+        std::memcpy(elems + i * file_bytes, base + idx * file_bytes, file_bytes);
+    }
+    if (is_native == false && to_file == false) {
+      herr_t status = H5Tconvert(file_dtype, mem_dtype, size, elems,
+        &bkg[0], H5P_DEFAULT);
+      assert(status >= 0);
+      std::memcpy(mem, elems, size * mem_bytes);
+    }
+    H5Tclose(file_dtype);
+  }
+
+} // end of humraw namespace
+
+#endif
@@ -9,7 +9,18 @@
 #define IHSTREAM_HPP
 
 #include "types.hpp"
+#include "chunkio.hpp"
+#include "concurrent.hpp"
+#include "mappedSpan.hpp"
+#include "humraw.hpp"
+#include "aio.hpp"
+#include "gather.hpp"
+#include "patchtable.hpp"
+#include "fields.hpp"
+#include "nodeseries.hpp"
+#include "hashcache.hpp"
 #include <vector>
+#include <algorithm>
 
 namespace OF {
   template<typename floatT, typename uintT, typename HashFun>
@@ -18,6 +29,17 @@ namespace OF {
   class cdimm;
 }
 
+namespace pipeline {
+  template<typename uintT>
+  struct faceNodes;
+  template<typename uintT>
+  struct faceLeftRight;
+  template<typename floatT>
+  struct nodes;
+  template<typename uintT>
+  struct faceZip;
+}
+
 /*! \brief hum input file stream class
  **        It provides stream access to the hum
  **        file very similar to C++ ofstream
@@ -32,6 +54,9 @@ class ihstream {
   template<typename T>
   friend class nodeStreamer;
 
+  template<typename T>
+  friend class faceZipStreamer;
+
   template<typename floatT, typename uintT, typename HashFun>
   friend class OF::dimm;
 
@@ -40,6 +65,18 @@ class ihstream {
 
   friend class patchInfo;
 
+  template<typename uintT>
+  friend struct pipeline::faceNodes;
+
+  template<typename uintT>
+  friend struct pipeline::faceLeftRight;
+
+  template<typename floatT>
+  friend struct pipeline::nodes;
+
+  template<typename uintT>
+  friend struct pipeline::faceZip;
+
 public:
   /*! \brief Empty construcor */
   ihstream();
@@ -53,24 +90,48 @@ public:
   /*! \brief hum output file for serial write */
   ihstream(const char *fname, bool read_write);
 
+  /*! \brief hum file loaded whole into memory (HDF5 core driver)
+   **        In read_write mode the image is written back on close */
+  ihstream(const char *fname, bool read_write, bool in_memory);
+
   /*! \brief hum output file for serial write */
   ihstream(const char *fname, MPI_Comm &comm);
 
   /*! \brief hum output file for serial write */
   ihstream(const char *fname, MPI_Comm &comm, bool read_write);
 
+  /*! \brief hum file opened in parallel using MPI-IO hints
+   **        (collective or independent transfers) */
+  ihstream(const char *fname, MPI_Comm &comm, const h5pp::mpioHints &hints);
+
+  /*! \brief hum file opened in parallel using MPI-IO hints
+   **        (collective or independent transfers) */
+  ihstream(const char *fname, MPI_Comm &comm,
+    const h5pp::mpioHints &hints, bool read_write);
+
   /*! \brief Open hum output file for serial write */
   void open(const char *fname);
 
   /*! \brief Open hum output file for serial write */
   void open(const char *fname, bool read_write);
 
+  /*! \brief Open hum file whole into memory (HDF5 core driver)
+   **        In read_write mode the image is written back on close */
+  void open(const char *fname, bool read_write, bool in_memory);
+
   /*! \brief Open hum output file for serial write */
   void open(const char *fname, MPI_Comm &comm);
 
   /*! \brief Open hum output file for serial write */
   void open(const char *fname, MPI_Comm &comm, bool read_write);
 
+  /*! \brief Open hum file in parallel using MPI-IO hints */
+  void open(const char *fname, MPI_Comm &comm, const h5pp::mpioHints &hints);
+
+  /*! \brief Open hum file in parallel using MPI-IO hints */
+  void open(const char *fname, MPI_Comm &comm,
+    const h5pp::mpioHints &hints, bool read_write);
+
   /*! \brief Close hum output file */
   void close();
 
@@ -83,6 +144,9 @@ public:
   /*! Get the integer size of gids in hum */
   int &get_int_size();
 
+  /*! Get the float size of the node coordinates in hum */
+  int &get_float_size();
+
   /*! Get total faces in file **/
   hsize_t &nFace();
 
@@ -98,12 +162,53 @@ public:
   /*! Get total faces in file **/
   hsize_t nPatch();
 
+  /*! Get the number of sub-files behind the datasets (0 if none) **/
+  unsigned nSubFile();
+
   /*! Get patch info by giving its index **/
   const patchBC<hsize_t> &get_patch_info(hsize_t num) const;
 
   /*! Get patch name by giving its index **/
   const std::string &get_patch_name(hsize_t num) const;
 
+  /*! Get patch index by giving its name (nPatch() if missing) **/
+  hsize_t get_patch_num(const std::string &name) const;
+
+  /*! Get total solution fields in file **/
+  hsize_t nField();
+
+  /*! Get field centring, components and step times by giving its index **/
+  const fields::info &get_field_info(hsize_t num) const;
+
+  /*! Get field name by giving its index **/
+  const std::string &get_field_name(hsize_t num) const;
+
+  /*! Get field index by giving its name (nField() if missing) **/
+  hsize_t get_field_num(const std::string &name) const;
+
+  /*! Get the number of entities (cells, nodes or faces) of a field **/
+  hsize_t get_field_size(hsize_t num);
+
+  /*! \brief Read the values of the entities [offset, offset + size)
+   **        (nComponents each) of step of the field num
+   **/
+  template < typename floatT >
+  void read_field(hsize_t num, hsize_t step, floatT *data,
+    hsize_t offset, hsize_t size);
+
+  /*! Get the number of steps of the node time series **/
+  hsize_t nNodeStep();
+
+  /*! Get the time and keyframe of every step of the node series **/
+  const nodeseries::info &get_node_series() const;
+
+  /*! \brief Read the node window [offset, offset + size) of step of
+   **        the node time series (keyframe plus difference)
+   **/
+  template < typename floatT >
+  void read_node_step(hsize_t step, node<floatT> *data, hsize_t offset,
+    hsize_t size);
+
   /*! \brief Read all nodes from hum file **/
   template < typename floatT >
   void read(node<floatT> *data);
@@ -116,6 +221,47 @@ public:
   template < typename uintT >
   void read(leftRight<uintT> *data);
 
+  /*! \brief Read a contiguous window of nodes from hum file **/
+  template < typename floatT >
+  void read(node<floatT> *data, hsize_t offset, hsize_t size);
+
+  /*! \brief Read a contiguous window of faces from hum file **/
+  template < typename uintT >
+  void read(face<uintT> *data, hsize_t offset, hsize_t size);
+
+  /*! \brief Read a contiguous window of face LR cells from hum file **/
+  template < typename uintT >
+  void read(leftRight<uintT> *data, hsize_t offset, hsize_t size);
+
+  /*! \brief Read a contiguous window of faces in CSR form (works
+   **        for both face layouts of the file)
+   **/
+  template < typename uintT >
+  void read(faceCSR<uintT> &csr, hsize_t offset, hsize_t size);
+
+  /*! \brief True if the faces are stored in CSR form
+   **        (FaceNodeOffsets/FaceNodes instead of Faces)
+   **/
+  bool is_face_csr() const;
+
+  /*! \brief Read a contiguous window of polyhedral cells
+   **        (cell-face connectivity) in CSR form
+   **/
+  template < typename uintT >
+  void read(cellCSR<uintT> &csr, hsize_t offset, hsize_t size);
+
+  /*! \brief Writes a window of polyhedral cells read from offset
+   **        back (r/w mode). The cell offsets are rewritten too so
+   **        a whole table may be renumbered.
+   **/
+  template < typename uintT >
+  void write(cellCSR<uintT> &csr, hsize_t offset);
+
+  /*! \brief True if the file holds the cell-face connectivity
+   **        (CellFaceOffsets/CellFaces)
+   **/
+  bool is_poly_cell() const;
+
   /*! \brief Read node information from hum using   list
    **        uses the link information stored in the humT
    **/
@@ -126,6 +272,21 @@ public:
   template < typename floatT >
   void read(node<floatT> &min, node<floatT> &max);
 
+  /*! \brief Zero-copy view of all nodes. The file is memory mapped
+   **        (read-only or copy-on-write) when the dataset layout
+   **        allows it, otherwise the view holds a normal read.
+   **/
+  template < typename floatT >
+  void map(mappedSpan< node<floatT> > &view, bool copy_on_write = false);
+
+  /*! \brief Zero-copy view of all faces (see nodes) **/
+  template < typename uintT >
+  void map(mappedSpan< face<uintT> > &view, bool copy_on_write = false);
+
+  /*! \brief Zero-copy view of all face LR cells (see nodes) **/
+  template < typename uintT >
+  void map(mappedSpan< leftRight<uintT> > &view, bool copy_on_write = false);
+
   /*! Write node values to hum file **/
   template<typename floatT>
   void write(node<floatT> *n);
@@ -133,18 +294,72 @@ public:
   /*! Return the file hid_t */
   hid_t &file();
 
+  /*! \brief Toggle parallel decompression of deflate, packed or
+   **        quantised chunked datasets using direct chunk reads (serial mode only)
+   **/
+  void set_parallel_inflate(bool is_on);
+
+  /*! \brief Read contiguous windows of a hum-raw file through
+   **        io_uring (or a pread thread pool) keeping queue_depth
+   **        requests in flight, optionally bypassing the page cache
+   **        with O_DIRECT. A queue_depth of 0 turns it off. Has no
+   **        effect on HDF5 files.
+   **/
+  void set_async_io(unsigned queue_depth, bool direct = false);
+
+  /*! \brief Merge gap (in entries) of list based reads. Listed
+   **        indices closer than the gap are read as one run
+   **        (serial mode only).
+   **/
+  void set_gather_gap(hsize_t gap);
+
+  /*! \brief Toggle concurrent reads. The dataset layouts are resolved
+   **        once and windows of contiguous or chunked (plain, deflate,
+   **        packed or quantised) datasets are then read with pread, so
+   **        any number of threads can read at the same time. Other
+   **        reads go through HDF5 one thread at a time. Needs a serial
+   **        read-only HDF5 file (no effect otherwise).
+   **/
+  void set_concurrent_read(bool is_on);
+
+  /*! \brief The concurrent reader. Another thread making HDF5
+   **        calls while this stream is read holds its lock
+   **        (concurrent::hdf5Lock), reads and writes of the stream
+   **        take it too. It serves pread reads only if concurrent
+   **        reads are on.
+   **/
+  concurrent::reader &get_reader();
+
   /** Protected members **/
 protected:
   hid_t _file; /*!< The hdf5 file handle */
   hsize_t _n_cell, _n_face, _n_node; /*!<  */
   hsize_t _n_internal_face, _n_face_adjncy; /*!<  */
-  patchBCMap<hsize_t>::Type _patch; /*!<  */
   bool _is_open, _is_parallel; /*!<  */
-  hsize_t _max_patch_face;
-  std::vector< patchBC<hsize_t> > _patch_info_by_num;
-  std::vector< std::string > _patch_name_by_num;
+  /// Patch metadata is loaded on first use (see load_patches)
+  mutable bool _is_patch_loaded;
+  mutable hsize_t _max_patch_face;
+  mutable patchtable::infoList _patch_info_by_num;
+  mutable patchtable::nameList _patch_name_by_num;
+  mutable patchtable::index _patch_index; /*!< Patch name to number */
+  /// Field metadata is loaded on first use (see load_fields)
+  mutable bool _is_field_loaded;
+  mutable fields::infoList _field_info_by_num;
+  mutable fields::nameList _field_name_by_num;
+  mutable nodeseries::info _node_series; /*!< Loaded with the fields */
   MPI_Comm _mpi_comm;
   int _int_size;
+  bool _par_inflate; /*!< Inflate chunks using TBB */
+  H5FD_mpio_xfer_t _xfer_mode; /*!< MPI-IO transfer mode */
+  bool _is_raw; /*!< File is a memory mapped hum-raw container */
+  bool _is_face_csr; /*!< Faces are stored in CSR form */
+  size_t _face_offset_size; /*!< Stored size of the CSR face offsets */
+  bool _is_poly_cell; /*!< Cell-face connectivity is stored */
+  humraw::image _raw; /*!< The hum-raw mapping */
+  aio::reader _aio; /*!< Asynchronous reader of hum-raw files */
+  hsize_t _gather_gap; /*!< Merge gap of list based reads */
+  concurrent::reader _concurrent; /*!< pread access for concurrent reads */
+  int _float_size;
 
   /** Private members **/
 private:
@@ -154,6 +369,34 @@ private:
   /*! \brief Read all entity sizes from hum file */
   void read_size();
 
+  /*! \brief Read all entity sizes from the hum-raw header */
+  void read_raw_size();
+
+  /*! \brief Read the patch metadata (once) and index it by name */
+  void load_patches() const;
+
+  /*! \brief Read the field and node series metadata (once) */
+  void load_fields() const;
+
+  /*! \brief Largest face count of all patches */
+  hsize_t max_patch_face() const;
+
+  /*! \brief True if the file was opened for writing */
+  bool is_read_write();
+
+  /*! \brief Open the file serially (HDF5 or hum-raw) */
+  void open_serial(const char *fname, unsigned h5_mode);
+
+  /*! \brief Map a hum-raw file */
+  void open_raw(const char *fname, unsigned h5_mode);
+
+  /*! \brief Open the file using the core (in-memory) driver */
+  void open_core(const char *fname, unsigned h5_mode);
+
+  /*! \brief Open the file using the MPI-IO driver */
+  void open_parallel(const char *fname, MPI_Comm &comm,
+    const h5pp::mpioHints &hints, unsigned h5_mode);
+
   /*! \brief Read node information from hum using offset/stride 
    **        uses the link information stored in the humT
    **/
@@ -180,6 +423,10 @@ private:
   template < typename T, typename humT >
   void read(T *data, h5pp::listString &link, hsize_t listSize, hsize_t *list);
 
+  /*! \brief Map (or read) the whole dataset of humT into view */
+  template < typename T, typename humT >
+  void map(mappedSpan<T> &view, hsize_t size, bool copy_on_write);
+
   /*! \brief Read node information from hum using a list */
   template < typename T >
   void read(T *data, h5pp::listString &link,
@@ -200,6 +447,13 @@ private:
   template< typename uintT >
   void write(leftRight<uintT> *lr, hsize_t offset, hsize_t stride, hsize_t size);
 
+  /*! \brief Writes back the node IDs of the first size faces of a
+   **        CSR window read from offset (r/w mode). Face node
+   **        counts can not change in place.
+   **/
+  template< typename uintT >
+  void write(faceCSR<uintT> &csr, hsize_t offset, hsize_t size);
+
   /*! \brief Writes the faceL/R info to file (r/w mode) */
   template< typename uintT >
   void write(node<uintT> *n, hsize_t offset, hsize_t stride, hsize_t size);
@@ -225,7 +479,11 @@ ihstream
 : _n_cell(0), _n_face(0),
 _n_node(0), _n_internal_face(0),
 _n_face_adjncy(0), _is_open(false),
-_is_parallel(false), _int_size(0) {
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_int_size(0), _par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
   // Empty
 }
 
@@ -239,9 +497,12 @@ ihstream
 : _n_cell(0), _n_face(0),
 _n_node(0), _n_internal_face(0),
 _n_face_adjncy(0), _is_open(true),
-_is_parallel(false) {
-  _file = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
-  read_size();
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
+  open_serial(fname, H5F_ACC_RDONLY);
 }
 
 ihstream
@@ -249,89 +510,148 @@ ihstream
 : _n_cell(0), _n_face(0),
 _n_node(0), _n_internal_face(0),
 _n_face_adjncy(0), _is_open(true),
-_is_parallel(false) {
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
   unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
-  _file = H5Fopen(fname, h5_mode, H5P_DEFAULT);
-  read_size();
+  open_serial(fname, h5_mode);
+}
+
+ihstream
+::ihstream(const char *fname, bool read_write, bool in_memory)
+: _n_cell(0), _n_face(0),
+_n_node(0), _n_internal_face(0),
+_n_face_adjncy(0), _is_open(false),
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
+  unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
+  if (in_memory == true)
+    open_core(fname, h5_mode);
+  else
+    open_serial(fname, h5_mode);
 }
 
 ihstream
 ::ihstream(const char *fname, MPI_Comm &comm)
 : _n_cell(0), _n_face(0),
 _n_node(0), _n_internal_face(0),
-_n_face_adjncy(0), _is_open(true),
-_is_parallel(true),
-_mpi_comm(comm) {
-  hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
-  H5Pset_fapl_mpio(plist_id, comm, MPI_INFO_NULL);
-  _file = H5Fopen(fname, H5F_ACC_RDONLY, plist_id);
-  H5Pclose(plist_id);
-  read_size();
+_n_face_adjncy(0), _is_open(false),
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
+  open_parallel(fname, comm, h5pp::mpioHints(), H5F_ACC_RDONLY);
 }
 
 ihstream
 ::ihstream(const char *fname, MPI_Comm &comm, bool read_write)
 : _n_cell(0), _n_face(0),
 _n_node(0), _n_internal_face(0),
-_n_face_adjncy(0), _is_open(true),
-_is_parallel(true),
-_mpi_comm(comm) {
-  hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
-  H5Pset_fapl_mpio(plist_id, comm, MPI_INFO_NULL);
+_n_face_adjncy(0), _is_open(false),
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
   unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
-  _file = H5Fopen(fname, h5_mode, plist_id);
-  H5Pclose(plist_id);
-  read_size();
+  open_parallel(fname, comm, h5pp::mpioHints(), h5_mode);
+}
+
+ihstream
+::ihstream(const char *fname, MPI_Comm &comm, const h5pp::mpioHints &hints)
+: _n_cell(0), _n_face(0),
+_n_node(0), _n_internal_face(0),
+_n_face_adjncy(0), _is_open(false),
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
+  open_parallel(fname, comm, hints, H5F_ACC_RDONLY);
+}
+
+ihstream
+::ihstream(const char *fname, MPI_Comm &comm,
+  const h5pp::mpioHints &hints, bool read_write)
+: _n_cell(0), _n_face(0),
+_n_node(0), _n_internal_face(0),
+_n_face_adjncy(0), _is_open(false),
+_is_parallel(false), _is_patch_loaded(false), _is_field_loaded(false),
+_par_inflate(false),
+_xfer_mode(H5FD_MPIO_INDEPENDENT), _is_raw(false),
+_is_face_csr(false), _face_offset_size(0), _is_poly_cell(false),
+_gather_gap(gather::defaultGap) {
+  unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
+  open_parallel(fname, comm, hints, h5_mode);
 }
 
 void ihstream
 ::open(const char *fname) {
   close();
-  _file = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
-  _is_open = true;
-  read_size();
+  open_serial(fname, H5F_ACC_RDONLY);
 }
 
 void ihstream
 ::open(const char *fname, bool read_write) {
   close();
   unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
-  _file = H5Fopen(fname, h5_mode, H5P_DEFAULT);
-  _is_open = true;
-  read_size();
+  open_serial(fname, h5_mode);
+}
+
+void ihstream
+::open(const char *fname, bool read_write, bool in_memory) {
+  if (in_memory == false) {
+    open(fname, read_write);
+    return;
+  }
+  close();
+  unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
+  open_core(fname, h5_mode);
 }
 
 void ihstream
 ::open(const char *fname, MPI_Comm &comm) {
   close();
-  _mpi_comm = comm;
-  hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
-  H5Pset_fapl_mpio(plist_id, comm, MPI_INFO_NULL);
-  _file = H5Fopen(fname, H5F_ACC_RDONLY, plist_id);
-  H5Pclose(plist_id);
-  _is_open = true;
-  read_size();
-  _is_parallel = true;
+  open_parallel(fname, comm, h5pp::mpioHints(), H5F_ACC_RDONLY);
 }
 
 void ihstream
 ::open(const char *fname, MPI_Comm &comm, bool read_write) {
   close();
-  _mpi_comm = comm;
-  hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
-  H5Pset_fapl_mpio(plist_id, comm, MPI_INFO_NULL);
   unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
-  _file = H5Fopen(fname, h5_mode, plist_id);
-  H5Pclose(plist_id);
-  _is_open = true;
-  read_size();
-  _is_parallel = true;
+  open_parallel(fname, comm, h5pp::mpioHints(), h5_mode);
+}
+
+void ihstream
+::open(const char *fname, MPI_Comm &comm, const h5pp::mpioHints &hints) {
+  close();
+  open_parallel(fname, comm, hints, H5F_ACC_RDONLY);
+}
+
+void ihstream
+::open(const char *fname, MPI_Comm &comm,
+  const h5pp::mpioHints &hints, bool read_write) {
+  close();
+  unsigned h5_mode = (read_write == true) ? H5F_ACC_RDWR : H5F_ACC_RDONLY;
+  open_parallel(fname, comm, hints, h5_mode);
 }
 
 void ihstream
 ::close() {
   if (_is_open == true) {
-    H5Fclose(_file);
+    if (_is_raw == true) {
+      _aio.close();
+      _raw.close();
+    } else {
+      _concurrent.close();
+      H5Fclose(_file);
+    }
     set();
   }
 }
@@ -351,6 +671,11 @@ int &ihstream
   return _int_size;
 }
 
+int &ihstream
+::get_float_size() {
+  return _float_size;
+}
+
 hsize_t &ihstream
 ::nFace() {
   return _n_face;
@@ -373,19 +698,129 @@ hsize_t &ihstream
 
 hsize_t ihstream
 ::nPatch() {
-  return _patch.size();
+  load_patches();
+  return _patch_info_by_num.size();
+}
+
+unsigned ihstream
+::nSubFile() {
+  if (_is_raw == true) return 0;
+  h5pp::listString link;
+  link.push_back(hum::subFileLink[hum::SECONDARY]);
+  if (h5pp::IsAttribute<unsigned>(_file, link) == false)
+    return 0;
+  return h5pp::ReadAttribute<unsigned>(_file, link);
 }
 
 const patchBC<hsize_t> &ihstream
 ::get_patch_info(hsize_t num) const {
+  load_patches();
   return _patch_info_by_num[num];
 }
 
 const std::string &ihstream
 ::get_patch_name(hsize_t num) const {
+  load_patches();
   return _patch_name_by_num[num];
 }
 
+hsize_t ihstream
+::get_patch_num(const std::string &name) const {
+  load_patches();
+  return _patch_index.find(_patch_name_by_num, name);
+}
+
+hsize_t ihstream
+::nField() {
+  load_fields();
+  return _field_info_by_num.size();
+}
+
+const fields::info &ihstream
+::get_field_info(hsize_t num) const {
+  load_fields();
+  return _field_info_by_num[num];
+}
+
+const std::string &ihstream
+::get_field_name(hsize_t num) const {
+  load_fields();
+  return _field_name_by_num[num];
+}
+
+hsize_t ihstream
+::get_field_num(const std::string &name) const {
+  load_fields();
+  /// Fields are kept in name order
+  fields::nameList::const_iterator it = std::lower_bound
+    (
+    _field_name_by_num.begin(), _field_name_by_num.end(), name
+    );
+  if (it == _field_name_by_num.end() || *it != name)
+    return _field_name_by_num.size();
+  return it - _field_name_by_num.begin();
+}
+
+hsize_t ihstream
+::get_field_size(hsize_t num) {
+  unsigned centring = get_field_info(num).centring;
+  if (centring == fields::NODE) return _n_node;
+  if (centring == fields::FACE) return _n_face;
+  return _n_cell;
+}
+
+template < typename floatT >
+void ihstream
+::read_field(hsize_t num, hsize_t step, floatT *data,
+  hsize_t offset, hsize_t size) {
+  const fields::info &f = get_field_info(num);
+  assert(step < f.time.size() && offset + size <= get_field_size(num));
+  h5pp::listString link = fields::StepLink(_field_name_by_num[num], step);
+  hid_t dtype;
+  {
+    concurrent::hdf5Lock lock(_concurrent);
+    dtype = fields::MakeType<floatT>(f.nComponents);
+  }
+  read(data, dtype, link, offset, 1, size);
+  concurrent::hdf5Lock lock(_concurrent);
+  H5Tclose(dtype);
+}
+
+hsize_t ihstream
+::nNodeStep() {
+  load_fields();
+  return _node_series.time.size();
+}
+
+const nodeseries::info &ihstream
+::get_node_series() const {
+  load_fields();
+  return _node_series;
+}
+
+template < typename floatT >
+void ihstream
+::read_node_step(hsize_t step, node<floatT> *data, hsize_t offset,
+  hsize_t size) {
+  const nodeseries::info &series = get_node_series();
+  assert(step < series.time.size() && offset + size <= _n_node);
+  hsize_t key = series.keyframe[step];
+  h5pp::listString link = nodeseries::StepLink(key);
+  if (key == step) {
+    read< node<floatT>, H5TNode<floatT> >(data, link, offset, 1, size);
+    return;
+  }
+  if (size == 0) return;
+  /// Keyframe plus difference in double, rounded once
+  std::vector< node<double> > key_nodes(size), delta(size);
+  read< node<double>, H5TNode<double> >(&key_nodes[0], link, offset, 1, size);
+  link = nodeseries::StepLink(step);
+  read< node<double>, H5TNode<double> >(&delta[0], link, offset, 1, size);
+  for (hsize_t i = 0; i < size; ++i)
+    for (unsigned c = 0; c < 3; ++c)
+      data[i].xyz[c] = floatT(key_nodes[i].xyz[c] + delta[i].xyz[c]);
+}
+
 template < typename floatT >
 void ihstream
 ::read(node<floatT> *data) {
@@ -395,7 +830,7 @@ void ihstream
 template < typename uintT >
 void ihstream
 ::read(face<uintT> *data) {
-  read< face<uintT>, H5TFace<uintT> >(data, 0, 1, _n_face);
+  read(data, 0, _n_face);
 }
 
 template < typename uintT >
@@ -404,10 +839,112 @@ void ihstream
   read< leftRight<uintT>, H5TLeftRight<uintT> >(data, 0, 1, _n_face);
 }
 
+template < typename floatT >
+void ihstream
+::read(node<floatT> *data, hsize_t offset, hsize_t size) {
+  read< node<floatT>, H5TNode<floatT> >(data, offset, 1, size);
+}
+
+template < typename uintT >
+void ihstream
+::read(face<uintT> *data, hsize_t offset, hsize_t size) {
+  if (_is_face_csr == true) {
+    faceCSR<uintT> csr;
+    read(csr, offset, size);
+    csr.unpack(data, size);
+  } else
+    read< face<uintT>, H5TFace<uintT> >(data, offset, 1, size);
+}
+
+template < typename uintT >
+void ihstream
+::read(leftRight<uintT> *data, hsize_t offset, hsize_t size) {
+  read< leftRight<uintT>, H5TLeftRight<uintT> >(data, offset, 1, size);
+}
+
+template < typename uintT >
+void ihstream
+::read(faceCSR<uintT> &csr, hsize_t offset, hsize_t size) {
+  if (_is_face_csr == false) {
+    std::vector< face<uintT> > window(size);
+    if (size > 0)
+      read< face<uintT>, H5TFace<uintT> >(&window[0], offset, 1, size);
+    /// Positions are window relative without a global node array
+    csr.pack(window.empty() ? NULL : &window[0], size, 0);
+    return;
+  }
+  h5pp::listString link;
+  /// The offsets then the nodes they span
+  link.push_back(hum::faceCSRLink[hum::PRIMARY]);
+  csr.offsets.resize(size + 1);
+  if (_face_offset_size < sizeof (uint64_t)) {
+    /// Stored at 32 bits while FaceAdjncySize fits
+    std::vector<uint32_t> narrow(size + 1);
+    read(&narrow[0], link, offset, 1, size + 1);
+    std::copy(narrow.begin(), narrow.end(), csr.offsets.begin());
+  } else
+    read(&csr.offsets[0], link, offset, 1, size + 1);
+  link.pop_back();
+  link.push_back(hum::faceCSRLink[hum::SECONDARY]);
+  csr.nodes.resize(csr.offsets[size] - csr.offsets[0]);
+  if (csr.nodes.empty() == false)
+    read(&csr.nodes[0], link, csr.offsets[0], 1, csr.nodes.size());
+}
+
+bool ihstream
+::is_face_csr() const {
+  return _is_face_csr;
+}
+
+template < typename uintT >
+void ihstream
+::read(cellCSR<uintT> &csr, hsize_t offset, hsize_t size) {
+  assert(_is_poly_cell == true);
+  h5pp::listString link;
+  /// The offsets then the faces they span
+  link.push_back(hum::cellCSRLink[hum::PRIMARY]);
+  csr.offsets.resize(size + 1);
+  read(&csr.offsets[0], link, offset, 1, size + 1);
+  link.pop_back();
+  link.push_back(hum::cellCSRLink[hum::SECONDARY]);
+  csr.faces.resize(csr.offsets[size] - csr.offsets[0]);
+  if (csr.faces.empty() == false)
+    read(&csr.faces[0], link, csr.offsets[0], 1, csr.faces.size());
+}
+
+template < typename uintT >
+void ihstream
+::write(cellCSR<uintT> &csr, hsize_t offset) {
+  assert(_is_poly_cell == true);
+  hsize_t size = csr.size();
+  if (size == 0) return;
+  h5pp::listString link;
+  link.push_back(hum::cellCSRLink[hum::PRIMARY]);
+  write(&csr.offsets[0], link, offset, 1, size + 1, _n_cell + 1);
+  link.pop_back();
+  link.push_back(hum::cellCSRLink[hum::SECONDARY]);
+  if (csr.faces.empty() == false)
+    write(&csr.faces[0], link, csr.offsets[0], 1, csr.faces.size(),
+    _n_face + _n_internal_face);
+}
+
+bool ihstream
+::is_poly_cell() const {
+  return _is_poly_cell;
+}
+
 /*! \brief Read Bounding box information **/
 template < typename floatT >
 void ihstream
 ::read(node<floatT> &min, node<floatT> &max) {
+  if (_is_raw == true) {
+    for (unsigned i = 0; i < 3; ++i) {
+      min.xyz[i] = floatT(_raw.head().min[i]);
+      max.xyz[i] = floatT(_raw.head().max[i]);
+    }
+    return;
+  }
+  concurrent::hdf5Lock lock(_concurrent);
   H5TNode<floatT> my_h5t;
   h5pp::listString link;
   /// Read AABB min attribute
@@ -419,6 +956,28 @@ void ihstream
   h5pp::ReadAttribute(_file, link, max, my_h5t.mem_t());
 }
 
+template < typename floatT >
+void ihstream
+::map(mappedSpan< node<floatT> > &view, bool copy_on_write) {
+  map< node<floatT>, H5TNode<floatT> >(view, _n_node, copy_on_write);
+}
+
+template < typename uintT >
+void ihstream
+::map(mappedSpan< face<uintT> > &view, bool copy_on_write) {
+  /// CSR faces have no fixed size records to map
+  if (_is_face_csr == true)
+    read(view.allocate(_n_face), 0, _n_face);
+  else
+    map< face<uintT>, H5TFace<uintT> >(view, _n_face, copy_on_write);
+}
+
+template < typename uintT >
+void ihstream
+::map(mappedSpan< leftRight<uintT> > &view, bool copy_on_write) {
+  map< leftRight<uintT>, H5TLeftRight<uintT> >(view, _n_face, copy_on_write);
+}
+
 /*** Private member functions *****/
 void ihstream
 ::set() {
@@ -429,20 +988,116 @@ void ihstream
   _n_face_adjncy = 0;
   _is_open = false;
   _is_parallel = false;
+  _xfer_mode = H5FD_MPIO_INDEPENDENT;
+  _is_raw = false;
+  _is_face_csr = false;
+  _face_offset_size = 0;
+  _is_poly_cell = false;
+  _is_patch_loaded = false;
+  _max_patch_face = 0;
+  _patch_info_by_num.clear();
+  _patch_name_by_num.clear();
+  _patch_index.clear();
+  _is_field_loaded = false;
+  _field_info_by_num.clear();
+  _field_name_by_num.clear();
+  _node_series.time.clear();
+  _node_series.keyframe.clear();
+}
+
+void ihstream
+::open_serial(const char *fname, unsigned h5_mode) {
+  if (humraw::IsRaw(fname) == true) {
+    open_raw(fname, h5_mode);
+    return;
+  }
+  _file = H5Fopen(fname, h5_mode, H5P_DEFAULT);
+  _is_open = true;
+  read_size();
+}
+
+void ihstream
+::open_raw(const char *fname, unsigned h5_mode) {
+  if (_raw.open(fname, h5_mode == H5F_ACC_RDWR) == false) {
+    std::cerr << "Error: " << fname << " is not a hum-raw file of version "
+      << humraw::version << " or is truncated or corrupt\n";
+    exit(1);
+  }
+  _file = -1;
+  _is_raw = true;
+  _is_open = true;
+  read_size();
+}
+
+void ihstream
+::open_core(const char *fname, unsigned h5_mode) {
+  /// A hum-raw file is mapped, it needs no in-memory image
+  if (humraw::IsRaw(fname) == true) {
+    open_raw(fname, h5_mode);
+    return;
+  }
+  /// Grow the image in 64 MB steps and write it back on close
+  /// only if the file was opened for writing
+  hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
+  hbool_t backing_store = (h5_mode == H5F_ACC_RDWR);
+  H5Pset_fapl_core(plist_id, size_t(64) << 20, backing_store);
+  _file = H5Fopen(fname, h5_mode, plist_id);
+  H5Pclose(plist_id);
+  assert(_file >= 0);
+  _is_open = true;
+  read_size();
+}
+
+void ihstream
+::open_parallel(const char *fname, MPI_Comm &comm,
+  const h5pp::mpioHints &hints, unsigned h5_mode) {
+  _mpi_comm = comm;
+  /// Every rank maps a hum-raw file, reads need no MPI-IO
+  if (humraw::IsRaw(fname) == true) {
+    open_raw(fname, h5_mode);
+    return;
+  }
+  hid_t plist_id = h5pp::MakeMPIOPlist(comm, hints);
+  _file = H5Fopen(fname, h5_mode, plist_id);
+  H5Pclose(plist_id);
+  /// Writes of windows are independent, the content hashes are
+  /// dropped once here by all the ranks (collectively)
+  if (h5_mode == H5F_ACC_RDWR) hashcache::InvalidatePrimary(_file);
+  _is_open = true;
+  _is_parallel = true;
+  _xfer_mode = hints.xfer_mode();
+  read_size();
 }
 
 void ihstream
 ::read_size() {
   if (_is_open == false) return;
+  if (_is_raw == true) {
+    read_raw_size();
+    return;
+  }
+  /// Packed connectivity and quantised nodes are read through the filters
+  deltapack::Register();
+  nodequant::Register();
   h5pp::listString link;
   /// Get _n_node
   link.push_back(hum::nodeLink[hum::PRIMARY]);
   _n_node = h5pp::GetVectorLength<hsize_t>(_file, link);
+  /// Get the float size (nodes are floatT[3])
+  _float_size = int(h5pp::GetDsetTypeSize(_file, link) / 3);
   link.pop_back();
-  /// Get _n_face
-  link.push_back(hum::faceLink[hum::PRIMARY]);
-  _n_face = h5pp::GetVectorLength<hsize_t>(_file, link);
+  /// Get _n_face (CSR faces have one more offset than faces)
+  _is_face_csr = h5pp::IsValidLink(_file, hum::faceCSRLink[hum::PRIMARY]);
+  if (_is_face_csr == true) {
+    link.push_back(hum::faceCSRLink[hum::PRIMARY]);
+    _n_face = h5pp::GetVectorLength<hsize_t>(_file, link) - 1;
+    _face_offset_size = h5pp::GetDsetTypeSize(_file, link);
+  } else {
+    link.push_back(hum::faceLink[hum::PRIMARY]);
+    _n_face = h5pp::GetVectorLength<hsize_t>(_file, link);
+  }
   link.pop_back();
+  _is_poly_cell = h5pp::IsValidLink(_file, hum::cellCSRLink[hum::PRIMARY]);
   /// Get _n_internal_face
   link.push_back(hum::miscLink[hum::FIELD]);
   _n_internal_face = h5pp::ReadAttribute<hsize_t>(_file, link);
@@ -465,43 +1120,92 @@ void ihstream
     << "_n_node = " << _n_node << "\n"
     << "_n_internal_face = " << _n_internal_face << std::endl;
 #endif
-  //// Read patch information
-  link.push_back(hum::patchLink[hum::PRIMARY]);
-  hsize_t npatch = h5pp::GetSubGroupSize(_file, link);
+}
+
+void ihstream
+::read_raw_size() {
+  humraw::header &head = _raw.head();
+  _n_node = head.table[humraw::NODES].count;
+  _n_face = head.table[humraw::FACES].count;
+  _n_internal_face = head.nInternalFace;
+  _n_cell = head.nCell;
+  _n_face_adjncy = head.nFaceAdjncy;
+  _int_size = head.intSize;
+  _float_size = head.floatSize;
+}
+
+void ihstream
+::load_patches() const {
+  if (_is_patch_loaded == true) return;
+  assert(_is_open);
+  /// Concurrent readers may race for the first load
+  concurrent::hdf5Lock lock(const_cast<concurrent::reader &> (_concurrent));
+  if (_is_patch_loaded == true) return;
+  if (_is_raw == true) {
+    /// The hum-raw patch section
+    humraw::image &raw = const_cast<humraw::image &> (_raw);
+    hsize_t npatch = raw.head().table[humraw::PATCHES].count;
+    humraw::patchRecord *record = raw.patches();
+    _patch_info_by_num.resize(npatch);
+    _patch_name_by_num.resize(npatch);
+    for (hsize_t i = 0; i < npatch; ++i) {
+      _patch_name_by_num[i].assign(record[i].name,
+        strnlen(record[i].name, humraw::patchNameSize));
+      _patch_info_by_num[i].bcType = record[i].info.bcType;
+      _patch_info_by_num[i].startFace = record[i].info.startFace;
+      _patch_info_by_num[i].faceCount = record[i].info.faceCount;
+      _patch_info_by_num[i].attachedToProcID = record[i].info.attachedToProcID;
+    }
+  } else
+    patchtable::Read(_file, _patch_info_by_num, _patch_name_by_num);
   _max_patch_face = 0;
-  _patch_info_by_num.reserve(npatch);
-  _patch_name_by_num.reserve(npatch);
-  for (hsize_t i = 0; i < npatch; ++i) {
-    std::string patch_name = h5pp::GetSubGroupName(_file, i, link);
-    link.push_back(patch_name);
-    link.push_back(hum::patchLink[hum::SECONDARY]);
-    read< patchBC<hsize_t>, H5TPatch<hsize_t> >
-      (
-      &_patch[patch_name], link, 0, 1, 1
-      );
-
-    _patch_info_by_num.push_back(_patch[patch_name]);
-    _patch_name_by_num.push_back(patch_name);
-#if 0 /// Debug print
-    std::cerr << patch_name << " "
-      << _patch[patch_name].startFace
-      << " " << _patch[patch_name].faceCount
-      << "\n";
-#endif
-    link.pop_back();
-    link.pop_back();
-    if (_patch[patch_name].faceCount > _max_patch_face)
-      _max_patch_face = _patch[patch_name].faceCount;
+  for (hsize_t i = 0; i < _patch_info_by_num.size(); ++i)
+    if (_patch_info_by_num[i].faceCount > _max_patch_face)
+      _max_patch_face = _patch_info_by_num[i].faceCount;
+  _patch_index.build(_patch_name_by_num);
+  _is_patch_loaded = true;
+}
+
+void ihstream
+::load_fields() const {
+  if (_is_field_loaded == true) return;
+  assert(_is_open);
+  concurrent::hdf5Lock lock(const_cast<concurrent::reader &> (_concurrent));
+  if (_is_field_loaded == true) return;
+  /// hum-raw files carry the mesh only
+  if (_is_raw == false) {
+    fields::Read(_file, _field_info_by_num, _field_name_by_num);
+    nodeseries::Read(_file, _node_series);
   }
+  _is_field_loaded = true;
+}
+
+hsize_t ihstream
+::max_patch_face() const {
+  load_patches();
+  return _max_patch_face;
+}
+
+bool ihstream
+::is_read_write() {
+  if (_is_raw == true)
+    return _raw.isWritable();
+  unsigned intent;
+  herr_t err = H5Fget_intent(_file, &intent);
+  assert(err >= 0);
+  return intent == H5F_ACC_RDWR;
 }
 
 template < typename T, typename humT >
 void ihstream
 ::read(T *data, hsize_t offset,
   hsize_t stride, hsize_t size) {
-  humT H5T;
   h5pp::listString link;
-  link.push_back(H5T.linkStr());
+  {
+    concurrent::hdf5Lock lock(_concurrent);
+    humT H5T;
+    link.push_back(H5T.linkStr());
+  }
   read<T, humT>(data, link, offset, stride, size);
 }
 
@@ -509,8 +1213,16 @@ template < typename T, typename humT >
 void ihstream
 ::read(T *data, h5pp::listString &link, hsize_t offset,
   hsize_t stride, hsize_t size) {
-  humT H5T;
-  read(data, H5T.mem_t(), link, offset, stride, size);
+  hid_t mem_dtype;
+  {
+    concurrent::hdf5Lock lock(_concurrent);
+    humT H5T;
+    mem_dtype = H5Tcopy(H5T.mem_t());
+  }
+  /// Not under the lock, a pread of the window runs concurrently
+  read(data, mem_dtype, link, offset, stride, size);
+  concurrent::hdf5Lock lock(_concurrent);
+  H5Tclose(mem_dtype);
 }
 
 template < typename T >
@@ -525,6 +1237,31 @@ void ihstream
 ::read(T *data, hid_t mem_dtype, h5pp::listString &link,
   hsize_t offset, hsize_t stride, hsize_t size) {
   assert(_is_open);
+  if (_is_raw == true) {
+    concurrent::hdf5Lock lock(_concurrent);
+    humraw::sectionType sec = humraw::LinkSection(link);
+    if (_aio.isOpen() == true && stride == 1 && _raw.isNative(sec, mem_dtype)) {
+      size_t elem_bytes = H5Tget_size(mem_dtype);
+      assert(offset + size <= _raw.head().table[sec].count);
+      uint64_t begin = _raw.head().table[sec].offset + offset * elem_bytes;
+      if (_aio.read(data, begin, size * elem_bytes) == false) {
+        std::cerr << "Error: asynchronous read of " << _raw.name()
+          << " failed at bytes [" << begin << ", "
+          << begin + size * elem_bytes << ")\n";
+        exit(1);
+      }
+    } else
+      _raw.read(data, mem_dtype, sec, offset, stride, size);
+    return;
+  }
+  if (stride == 1 && _concurrent.read(h5pp::ListStringToString(link),
+    data, mem_dtype, offset, size))
+    return;
+  concurrent::hdf5Lock lock(_concurrent);
+  /// Try the direct chunk read with parallel decoding first
+  if (_par_inflate == true && _is_parallel == false && stride == 1 &&
+    chunkio::TryReadChunked(_file, data, mem_dtype, link, offset, size))
+    return;
   if (_is_parallel == false)
     h5pp::ReadVectorDataSerial
     (
@@ -535,7 +1272,7 @@ void ihstream
     h5pp::ReadVectorData
     (
     _file, data, mem_dtype, link,
-    offset, stride, size
+    offset, stride, size, _xfer_mode
     );
 }
 
@@ -567,20 +1304,58 @@ void ihstream
 ::read(T *data, hid_t &mem_dtype, h5pp::listString &link,
   hsize_t listSize, hsize_t *list) {
   assert(_is_open);
-  if (_is_parallel == false)
-    h5pp::ReadVectorDataSerial
+  concurrent::hdf5Lock lock(_concurrent);
+  if (_is_raw == true)
+    _raw.read(data, mem_dtype, humraw::LinkSection(link), listSize, list);
+  else if (_is_parallel == false)
+    gather::ReadSerial
     (
     _file, data, mem_dtype,
-    link, listSize, list
+    link, listSize, list, _gather_gap
     );
   else
-    h5pp::ReadVectorData
+    gather::ReadParallel
     (
     _file, data, mem_dtype,
-    link, listSize, list
+    link, listSize, list, _gather_gap, _xfer_mode
     );
 }
 
+template < typename T, typename humT >
+void ihstream
+::map(mappedSpan<T> &view, hsize_t size, bool copy_on_write) {
+  assert(_is_open);
+  concurrent::hdf5Lock lock(_concurrent);
+  humT H5T;
+  haddr_t offset = 0;
+  bool can_map = false;
+  std::string fname;
+  h5pp::listString link;
+  link.push_back(H5T.linkStr());
+  if (sizeof (T) != H5Tget_size(H5T.mem_t())) {
+    /* no mapping */
+  } else if (_is_raw == true) {
+    humraw::sectionType sec = humraw::LinkSection(link);
+    can_map = _raw.isNative(sec, H5T.mem_t());
+    offset = _raw.head().table[sec].offset;
+    fname = _raw.name();
+  } else if (_is_parallel == false &&
+    h5pp::GetRawOffset(_file, link, H5T.mem_t(), offset)) {
+    /// Make sure pending writes are in the file before mapping
+    H5Fflush(_file, H5F_SCOPE_LOCAL);
+    ssize_t len = H5Fget_name(_file, NULL, 0);
+    std::vector<char> buf(len + 1);
+    H5Fget_name(_file, &buf[0], len + 1);
+    fname = &buf[0];
+    can_map = true;
+  }
+  if (can_map == true &&
+    view.map(fname.c_str(), offset, size, copy_on_write) == true)
+    return;
+  /// Fall back to reading the dataset
+  read<T, humT>(view.allocate(size), link, 0, 1, size);
+}
+
 /*! Write node values to hum file **/
 template<typename floatT>
 void ihstream
@@ -597,12 +1372,41 @@ void ihstream
 template< typename uintT >
 void ihstream
 ::write(face<uintT> *f, hsize_t offset, hsize_t stride, hsize_t size) {
-  write< face<uintT>, H5TFace<uint> >
+  if (_is_face_csr == true) {
+    assert(stride == 1);
+    faceCSR<uintT> csr;
+    read(csr, offset, size);
+    for (hsize_t i = 0; i < size; ++i) {
+      assert(f[i].bField == csr.count(i));
+      std::copy(f[i].entityID, f[i].entityID + f[i].bField, csr.nodesOf(i));
+    }
+    write(csr, offset, size);
+    return;
+  }
+  write< face<uintT>, H5TFace<uintT> >
     (
     f, offset, stride, size, _n_face
     );
 }
 
+/*! \brief Writes back the face nodes of a CSR window (r/w mode) */
+template< typename uintT >
+void ihstream
+::write(faceCSR<uintT> &csr, hsize_t offset, hsize_t size) {
+  if (size == 0) return;
+  if (_is_face_csr == false) {
+    std::vector< face<uintT> > window(size);
+    csr.unpack(&window[0], size);
+    write(&window[0], offset, 1, size);
+    return;
+  }
+  h5pp::listString link;
+  link.push_back(hum::faceCSRLink[hum::SECONDARY]);
+  hsize_t n_node = csr.offsets[size] - csr.offsets[0];
+  if (n_node > 0)
+    write(&csr.nodes[0], link, csr.offsets[0], 1, n_node, _n_face_adjncy);
+}
+
 /*! \brief Writes the faceL/R info to file (r/w mode) */
 template< typename uintT >
 void ihstream
@@ -628,20 +1432,29 @@ template< typename T, typename humT >
 void ihstream
 ::write(T *data, hsize_t offset, hsize_t stride, hsize_t mem_size, hsize_t file_size) {
   assert(_is_open);
+  concurrent::hdf5Lock lock(_concurrent);
   humT H5T;
   h5pp::listString link;
   link.push_back(H5T.linkStr());
-  if (_is_parallel == false)
+  if (_is_raw == true) {
+    assert(file_size == _raw.head().table[humraw::LinkSection(link)].count);
+    _raw.write(data, H5T.mem_t(), humraw::LinkSection(link),
+      offset, stride, mem_size);
+    /// O_DIRECT reads do not see dirty pages of the mapping
+    if (_aio.isDirect() == true) _raw.sync();
+  } else if (_is_parallel == false) {
+    /// The stored content hash no longer holds
+    hashcache::Invalidate(_file, link);
     h5pp::WriteVectorDataSerial
     (
     _file, data, H5T.mem_t(), H5T.file_t(),
     link, offset, stride, mem_size, file_size
     );
-  else
+  } else
     h5pp::WriteVectorData
     (
     _file, data, H5T.mem_t(), H5T.file_t(),
-    link, offset, stride, mem_size, file_size
+    link, offset, stride, mem_size, file_size, _xfer_mode
     );
 }
 
@@ -653,18 +1466,24 @@ void ihstream
 ::write(T *data, h5pp::listString &link, hsize_t offset,
   hsize_t stride, hsize_t mem_size, hsize_t file_size) {
   assert(_is_open);
+  concurrent::hdf5Lock lock(_concurrent);
   hid_t type = H5Tcopy(h5pp::GetHDF5Type<T>());
-  if (_is_parallel == false)
+  if (_is_raw == true) {
+    _raw.write(data, type, humraw::LinkSection(link),
+      offset, stride, mem_size);
+    if (_aio.isDirect() == true) _raw.sync();
+  } else if (_is_parallel == false) {
+    hashcache::Invalidate(_file, link);
     h5pp::WriteVectorDataSerial
     (
     _file, data, type, type,
     link, offset, stride, mem_size, file_size
     );
-  else
+  } else
     h5pp::WriteVectorData
     (
     _file, data, type, type,
-    link, offset, stride, mem_size, file_size
+    link, offset, stride, mem_size, file_size, _xfer_mode
     );
   H5Tclose(type);
 }
@@ -675,5 +1494,48 @@ hid_t &ihstream
 ::file() {
   return _file;
 }
+
+/*! \brief Toggle parallel decompression of deflate chunked datasets
+ */
+void ihstream
+::set_parallel_inflate(bool is_on) {
+  _par_inflate = is_on;
+}
+
+/*! \brief Toggle concurrent (pread) reads of HDF5 files
+ */
+void ihstream
+::set_concurrent_read(bool is_on) {
+  _concurrent.close();
+  if (is_on == false || _is_open == false || _is_raw == true ||
+    _is_parallel == true || is_read_write() == true)
+    return;
+  _concurrent.open(_file);
+}
+
+/*! \brief Return the concurrent reader
+ */
+concurrent::reader &ihstream
+::get_reader() {
+  return _concurrent;
+}
+
+/*! \brief Toggle asynchronous reads of hum-raw files
+ */
+void ihstream
+::set_async_io(unsigned queue_depth, bool direct) {
+  _aio.close();
+  if (_is_raw == true && queue_depth > 0) {
+    bool is_open = _aio.open(_raw.name().c_str(), queue_depth, direct);
+    assert(is_open);
+  }
+}
+
+/*! \brief Set the merge gap of list based reads
+ */
+void ihstream
+::set_gather_gap(hsize_t gap) {
+  _gather_gap = gap;
+}
 #endif
 
@@ -0,0 +1,175 @@
+/*! \file mappedSpan.hpp
+ ** A view of a contiguous hum dataset. When the dataset is stored
+ ** contiguous, unfiltered and with the memory layout of T, the view is
+ ** a memory map of the file itself (read-only or copy-on-write) so the
+ ** data is not copied and processes on a node share the page cache.
+ ** Otherwise the view owns a buffer filled by a normal read.
+ **/
+
+#ifndef MAPPED_SPAN_HPP
+
+#define MAPPED_SPAN_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+template<typename T>
+class mappedSpan {
+public:
+  /*! \brief Empty view */
+  mappedSpan();
+
+  /*! \brief Unmaps/releases the view */
+  ~mappedSpan();
+
+  /*! \brief Map size elements of the file starting at the byte
+   **        offset. Returns false if the file cannot be mapped.
+   **/
+  bool map(const char *fname, size_t offset, size_t size,
+    bool copy_on_write);
+
+  /*! \brief Fall back to an owned buffer of size elements */
+  T *allocate(size_t size);
+
+  /*! \brief Release the mapping or the owned buffer */
+  void clear();
+
+  /*! \brief True if the view is a memory map of the file */
+  bool isMapped() const;
+
+  /*! \brief True if the view can be modified (copy-on-write
+   **        map or owned buffer)
+   **/
+  bool isWritable() const;
+
+  size_t size() const;
+
+  const T *data() const;
+
+  const T &operator[](size_t i) const;
+
+  /*! \brief Mutable access (copy-on-write map or owned buffer) */
+  T *writable();
+
+private:
+  void *_base; /*!< Page aligned start of the mapping */
+  size_t _map_bytes; /*!< Length of the mapping */
+  T *_ptr;
+  size_t _size;
+  bool _writable;
+  std::vector<T> _buf; /*!< Owned buffer if not mapped */
+
+  /// Non copyable
+  mappedSpan(const mappedSpan &);
+  mappedSpan &operator=(const mappedSpan &);
+};
+
+template<typename T>
+mappedSpan<T>
+::mappedSpan()
+: _base(0), _map_bytes(0), _ptr(0),
+_size(0), _writable(false) {
+  /* empty */
+}
+
+template<typename T>
+mappedSpan<T>
+::~mappedSpan() {
+  clear();
+}
+
+template<typename T>
+bool mappedSpan<T>
+::map(const char *fname, size_t offset, size_t size, bool copy_on_write) {
+  clear();
+  if (size == 0) return false;
+  int fd = ::open(fname, O_RDONLY);
+  if (fd < 0) return false;
+  /// The mapping has to start on a page boundary
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t start = offset / page * page;
+  _map_bytes = offset - start + size * sizeof (T);
+  int prot = (copy_on_write == true) ? PROT_READ | PROT_WRITE : PROT_READ;
+  int flags = (copy_on_write == true) ? MAP_PRIVATE : MAP_SHARED;
+  void *base = mmap(0, _map_bytes, prot, flags, fd, start);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    _map_bytes = 0;
+    return false;
+  }
+  /// Streaming passes read the whole dataset front to back
+  madvise(base, _map_bytes, MADV_SEQUENTIAL);
+  _base = base;
+  _ptr = reinterpret_cast<T *> (static_cast<char *> (base) + offset - start);
+  _size = size;
+  _writable = copy_on_write;
+  return true;
+}
+
+template<typename T>
+T *mappedSpan<T>
+::allocate(size_t size) {
+  clear();
+  _buf.resize(size);
+  _size = size;
+  _ptr = (size > 0) ? &_buf[0] : 0;
+  _writable = true;
+  return _ptr;
+}
+
+template<typename T>
+void mappedSpan<T>
+::clear() {
+  if (_base != 0)
+    munmap(_base, _map_bytes);
+  std::vector<T>().swap(_buf);
+  _base = 0;
+  _map_bytes = 0;
+  _ptr = 0;
+  _size = 0;
+  _writable = false;
+}
+
+template<typename T>
+bool mappedSpan<T>
+::isMapped() const {
+  return _base != 0;
+}
+
+template<typename T>
+bool mappedSpan<T>
+::isWritable() const {
+  return _writable;
+}
+
+template<typename T>
+size_t mappedSpan<T>
+::size() const {
+  return _size;
+}
+
+template<typename T>
+const T *mappedSpan<T>
+::data() const {
+  return _ptr;
+}
+
+template<typename T>
+const T &mappedSpan<T>
+::operator[](size_t i) const {
+  return _ptr[i];
+}
+
+template<typename T>
+T *mappedSpan<T>
+::writable() {
+  assert(_writable);
+  return _ptr;
+}
+
+#endif
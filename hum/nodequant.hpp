@@ -0,0 +1,280 @@
+/*! \file nodequant.hpp
+ ** Lossy fixed point storage of node coordinates. Every coordinate is
+ ** rounded to the nearest point k * step of a lattice of spacing
+ ** step = 2 * tolerance, so the error stays within the tolerance and a
+ ** decoded coordinate codes back to the same k (nodes can be read,
+ ** permuted and written again without drifting). Within a chunk the
+ ** x, y and z lattice indices are separate streams kept relative to
+ ** their minimum (the chunk bounding box) and bit packed in blocks of
+ ** 128 with the width the box needs, using the four lane layout of
+ ** deltapack.hpp. SSE2 unpacks and converts four coordinates per step.
+ ** Once the nodes are SFC ordered a chunk spans a small box, which is
+ ** where most of the savings come from.
+ **
+ ** The codec is an (optional) HDF5 filter on the Nodes dataset, so any
+ ** read returns the dequantised floatT values and all computations stay
+ ** in floating point. Chunks that can not be represented (non finite
+ ** values, boxes of more than 2^32 steps) are stored as is.
+ **/
+
+#ifndef NODEQUANT_HPP
+
+#define NODEQUANT_HPP
+
+#include "deltapack.hpp"
+#include <cmath>
+#include <limits>
+
+namespace nodequant {
+
+  /*! HDF5 filter ID (range of unregistered local filters) **/
+  const H5Z_filter_t filterId = 32851;
+
+  /*! Chunk header bytes (number of nodes then the lattice
+   **  index base and bit width of each axis)
+   **/
+  const size_t headerSize = 8 + 3 * 9;
+
+  /*! Largest lattice index magnitude (exact in double) **/
+  const double maxIndex = 4503599627370496.0;
+
+  /*! \brief Register the HDF5 filter (once per process) */
+  void Register();
+
+  /*! \brief The filter cd_values of the lattice step */
+  void StepToValues(double step, unsigned *cd_values);
+
+  /*! \brief The lattice step of the filter cd_values */
+  double ValuesToStep(const unsigned *cd_values);
+
+  /*! \brief Largest coded size of n_node nodes */
+  size_t EncodeBound(size_t n_node);
+
+  /*! \brief Code n_node nodes of float_bytes per coordinate onto
+   **        the lattice of spacing step. Returns the coded size or
+   **        zero if the nodes can not be represented.
+   **/
+  size_t Encode(const void *in, size_t n_node, unsigned float_bytes,
+    double step, unsigned char *out);
+
+  /*! \brief Decode in_bytes of coded data into n_node nodes.
+   **        Returns false if the data does not match.
+   **/
+  bool Decode(const unsigned char *in, size_t in_bytes,
+    unsigned float_bytes, double step, void *out, size_t n_node);
+
+  /*! \brief The HDF5 filter callback
+   **        (cd_values = float_bytes, step low word, step high word)
+   **/
+  size_t Filter(unsigned flags, size_t cd_nelmts, const unsigned cd_values[],
+    size_t nbytes, size_t *buf_size, void **buf);
+
+  /***********   Implementation  ****************/
+
+  /// Coordinates (base + q) * step of a packed block of indices q
+  inline void DecodeBlock(const unsigned char *in, unsigned b,
+    int64_t base, double step, double *x) {
+#ifdef __SSE2__
+    const __m128i *word = reinterpret_cast<const __m128i *> (in);
+    const __m128i mask = _mm_set1_epi32(b == 32 ? -1 : int((1u << b) - 1));
+    /// Flip the sign bit so the indices convert as signed integers
+    const __m128i sign = _mm_set1_epi32(int(0x80000000u));
+    const __m128d shift = _mm_set1_pd(double(base) + 2147483648.0);
+    const __m128d vstep = _mm_set1_pd(step);
+    for (unsigned k = 0; k < deltapack::blockSize / 4; ++k) {
+      __m128i v = _mm_setzero_si128();
+      if (b > 0) {
+        unsigned bit = k * b, w = bit >> 5, sh = bit & 31;
+        v = _mm_srl_epi32(_mm_loadu_si128(word + w), _mm_cvtsi32_si128(sh));
+        if (sh + b > 32)
+          v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(word + w + 1),
+          _mm_cvtsi32_si128(32 - sh)));
+        v = _mm_and_si128(v, mask);
+      }
+      v = _mm_xor_si128(v, sign);
+      __m128d lo = _mm_cvtepi32_pd(v);
+      __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(v, 8));
+      _mm_storeu_pd(x + 4 * k, _mm_mul_pd(_mm_add_pd(lo, shift), vstep));
+      _mm_storeu_pd(x + 4 * k + 2, _mm_mul_pd(_mm_add_pd(hi, shift), vstep));
+    }
+#else
+    uint32_t q[deltapack::blockSize];
+    deltapack::UnpackBlock(in, b, q);
+    for (size_t j = 0; j < deltapack::blockSize; ++j)
+      x[j] = double(base + int64_t(q[j])) * step;
+#endif
+  }
+
+  template <typename floatT>
+  size_t EncodeNodes(const floatT *in, size_t n, double step,
+    unsigned char *out) {
+    if (!(step > 0.0)) return 0;
+    unsigned char *pos = out;
+    uint64_t n_node = n;
+    std::memcpy(pos, &n_node, 8);
+    pos += 8;
+    /// Lattice box of the chunk
+    int64_t lo[3], hi[3];
+    for (unsigned a = 0; a < 3; ++a) {
+      lo[a] = (n > 0) ? std::numeric_limits<int64_t>::max() : 0;
+      hi[a] = (n > 0) ? std::numeric_limits<int64_t>::min() : 0;
+    }
+    for (size_t i = 0; i < 3 * n; ++i) {
+      double k = std::floor(double(in[i]) / step + 0.5);
+      if (!(std::fabs(k) < maxIndex)) return 0;
+      lo[i % 3] = std::min(lo[i % 3], int64_t(k));
+      hi[i % 3] = std::max(hi[i % 3], int64_t(k));
+    }
+    unsigned b[3];
+    for (unsigned a = 0; a < 3; ++a) {
+      uint64_t range = uint64_t(hi[a] - lo[a]);
+      if (range > 0xffffffffull) return 0;
+      b[a] = deltapack::BitWidth(range);
+      std::memcpy(pos, &lo[a], 8);
+      pos += 8;
+      *pos++ = (unsigned char) b[a];
+    }
+    /// Index streams of x then y then z
+    uint32_t q[deltapack::blockSize];
+    for (unsigned a = 0; a < 3; ++a) {
+      for (size_t base = 0; base < n; base += deltapack::blockSize) {
+        size_t m = std::min(deltapack::blockSize, n - base);
+        for (size_t j = 0; j < m; ++j) {
+          double k = std::floor(double(in[3 * (base + j) + a]) / step + 0.5);
+          q[j] = uint32_t(int64_t(k) - lo[a]);
+        }
+        for (size_t j = m; j < deltapack::blockSize; ++j) q[j] = 0;
+        deltapack::PackBlock(q, b[a], pos);
+        pos += 16 * b[a];
+      }
+    }
+    return pos - out;
+  }
+
+  template <typename floatT>
+  bool DecodeNodes(const unsigned char *in, size_t in_bytes, double step,
+    floatT *out, size_t n) {
+    const unsigned char *pos = in;
+    uint64_t n_node = 0;
+    if (in_bytes < headerSize) return false;
+    std::memcpy(&n_node, pos, 8);
+    pos += 8;
+    if (n_node != n) return false;
+    int64_t lo[3];
+    unsigned b[3];
+    size_t n_block = (n + deltapack::blockSize - 1) / deltapack::blockSize;
+    size_t expect = headerSize;
+    for (unsigned a = 0; a < 3; ++a) {
+      std::memcpy(&lo[a], pos, 8);
+      pos += 8;
+      b[a] = *pos++;
+      if (b[a] > 32) return false;
+      expect += n_block * 16 * b[a];
+    }
+    if (expect != in_bytes) return false;
+    double x[deltapack::blockSize];
+    for (unsigned a = 0; a < 3; ++a) {
+      for (size_t base = 0; base < n; base += deltapack::blockSize) {
+        size_t m = std::min(deltapack::blockSize, n - base);
+        DecodeBlock(pos, b[a], lo[a], step, x);
+        for (size_t j = 0; j < m; ++j)
+          out[3 * (base + j) + a] = floatT(x[j]);
+        pos += 16 * b[a];
+      }
+    }
+    return true;
+  }
+
+  void StepToValues(double step, unsigned *cd_values) {
+    uint64_t bits;
+    std::memcpy(&bits, &step, 8);
+    cd_values[0] = unsigned(bits & 0xffffffffull);
+    cd_values[1] = unsigned(bits >> 32);
+  }
+
+  double ValuesToStep(const unsigned *cd_values) {
+    uint64_t bits = (uint64_t(cd_values[1]) << 32) | uint64_t(cd_values[0]);
+    double step;
+    std::memcpy(&step, &bits, 8);
+    return step;
+  }
+
+  size_t EncodeBound(size_t n_node) {
+    size_t n_block = (n_node + deltapack::blockSize - 1) / deltapack::blockSize;
+    return headerSize + 3 * n_block * 16 * 32;
+  }
+
+  size_t Encode(const void *in, size_t n_node, unsigned float_bytes,
+    double step, unsigned char *out) {
+    if (float_bytes == 8)
+      return EncodeNodes(static_cast<const double *> (in), n_node, step, out);
+    assert(float_bytes == 4);
+    return EncodeNodes(static_cast<const float *> (in), n_node, step, out);
+  }
+
+  bool Decode(const unsigned char *in, size_t in_bytes,
+    unsigned float_bytes, double step, void *out, size_t n_node) {
+    if (float_bytes == 8)
+      return DecodeNodes(in, in_bytes, step, static_cast<double *> (out), n_node);
+    if (float_bytes == 4)
+      return DecodeNodes(in, in_bytes, step, static_cast<float *> (out), n_node);
+    return false;
+  }
+
+  size_t Filter(unsigned flags, size_t cd_nelmts, const unsigned cd_values[],
+    size_t nbytes, size_t *buf_size, void **buf) {
+    if (cd_nelmts < 3) return 0;
+    unsigned float_bytes = cd_values[0];
+    double step = ValuesToStep(cd_values + 1);
+    if (flags & H5Z_FLAG_REVERSE) {
+      uint64_t n_node = 0;
+      if (nbytes < headerSize) return 0;
+      std::memcpy(&n_node, *buf, 8);
+      size_t out_bytes = n_node * 3 * float_bytes;
+      void *out = H5allocate_memory(out_bytes, false);
+      if (out == NULL) return 0;
+      if (Decode(static_cast<unsigned char *> (*buf), nbytes, float_bytes,
+        step, out, n_node) == false) {
+        H5free_memory(out);
+        return 0;
+      }
+      H5free_memory(*buf);
+      *buf = out;
+      *buf_size = out_bytes;
+      return out_bytes;
+    }
+    size_t n_node = nbytes / (3 * float_bytes);
+    size_t bound = EncodeBound(n_node);
+    unsigned char *out = static_cast<unsigned char *>
+      (H5allocate_memory(bound, false));
+    if (out == NULL) return 0;
+    size_t out_bytes = Encode(*buf, n_node, float_bytes, step, out);
+    /// Not representable or not worth it, stored as is (optional filter)
+    if (out_bytes == 0 || out_bytes >= nbytes) {
+      H5free_memory(out);
+      return 0;
+    }
+    H5free_memory(*buf);
+    *buf = out;
+    *buf_size = bound;
+    return out_bytes;
+  }
+
+  void Register() {
+    if (H5Zfilter_avail(filterId) > 0) return;
+    H5Z_class2_t filter_class;
+    filter_class.version = H5Z_CLASS_T_VERS;
+    filter_class.id = filterId;
+    filter_class.encoder_present = 1;
+    filter_class.decoder_present = 1;
+    filter_class.name = "hum node quantise";
+    filter_class.can_apply = NULL;
+    filter_class.set_local = NULL;
+    filter_class.filter = Filter;
+    herr_t status = H5Zregister(&filter_class);
+    assert(status >= 0);
+  }
+
+} // end of nodequant namespace
+
+#endif
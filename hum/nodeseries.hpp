@@ -0,0 +1,106 @@
+/*! \file nodeseries.hpp
+ ** Time dependent node coordinates of moving or deforming meshes. The
+ ** group NodeSeries holds the Time of every step, the Keyframe step every
+ ** step is stored against and one dataset per step (Step0, Step1, ...).
+ ** A keyframe step stores the nodes whole, any other step stores the
+ ** difference to its keyframe, chunked and either quantised (nodequant,
+ ** chunks that did not move code to a header only) or deflated. Any step
+ ** is read from at most two datasets, and appending steps leaves the mesh
+ ** and the earlier steps untouched.
+ **/
+
+#ifndef NODESERIES_HPP
+
+#define NODESERIES_HPP
+
+#include "types.hpp"
+#include <vector>
+#include <string>
+#include <sstream>
+
+namespace nodeseries {
+
+  /// Default number of nodes per chunk of a step dataset
+  const hsize_t defaultChunk = 16384;
+
+  /// Default number of steps from one keyframe to the next
+  const hsize_t defaultInterval = 16;
+
+  /// Steps per chunk of the (extendible) Time and Keyframe datasets
+  const hsize_t metaChunk = 256;
+
+  /*! \brief Metadata of the node time series */
+  struct info {
+    std::vector<double> time; /*!< Time of every step */
+    std::vector<hsize_t> keyframe; /*!< Keyframe step of every step */
+  };
+
+  /*! \brief Link of the dataset of step */
+  h5pp::listString StepLink(hsize_t step);
+
+  /*! \brief True if the file holds a node time series */
+  bool IsSeries(hid_t file);
+
+  /*! \brief Read the series metadata (empty if none) */
+  void Read(hid_t file, info &series);
+
+  /*! \brief (Re)write the series metadata. The step datasets
+   **        are written separately.
+   **/
+  void Write(hid_t file, const info &series);
+
+  /***********   Implementation  ****************/
+
+  h5pp::listString StepLink(hsize_t step) {
+    std::stringstream cat;
+    cat << hum::nodeSeriesLink[hum::STEP] << step;
+    h5pp::listString link;
+    link.push_back(hum::nodeSeriesLink[hum::PRIMARY]);
+    link.push_back(cat.str());
+    return link;
+  }
+
+  bool IsSeries(hid_t file) {
+    return h5pp::IsValidLink(file, hum::nodeSeriesLink[hum::PRIMARY]);
+  }
+
+  void Read(hid_t file, info &series) {
+    series.time.clear();
+    series.keyframe.clear();
+    if (IsSeries(file) == false) return;
+    h5pp::listString link;
+    link.push_back(hum::nodeSeriesLink[hum::PRIMARY]);
+    link.push_back(hum::nodeSeriesLink[hum::SECONDARY]);
+    if (h5pp::IsValidLink(file, link) == false) return;
+    hsize_t nstep = h5pp::GetVectorLength<hsize_t>(file, link);
+    series.time.resize(nstep);
+    series.keyframe.resize(nstep);
+    if (nstep == 0) return;
+    h5pp::ReadVectorDataSerial(file, &series.time[0], H5T_NATIVE_DOUBLE,
+      link, 0, 1, nstep);
+    link.pop_back();
+    link.push_back(hum::nodeSeriesLink[hum::FIELD]);
+    h5pp::ReadVectorDataSerial(file, &series.keyframe[0],
+      h5pp::GetHDF5Type<hsize_t>(), link, 0, 1, nstep);
+  }
+
+  void Write(hid_t file, const info &series) {
+    assert(series.time.size() == series.keyframe.size());
+    hsize_t nstep = series.time.size();
+    h5pp::listString link;
+    link.push_back(hum::nodeSeriesLink[hum::PRIMARY]);
+    h5pp::CreateGroup(file, link);
+    /// Appending a step extends Time and Keyframe by one entry
+    link.push_back(hum::nodeSeriesLink[hum::SECONDARY]);
+    h5pp::WriteExtendible(file, nstep ? &series.time[0] : NULL,
+      H5T_NATIVE_DOUBLE, H5T_NATIVE_DOUBLE, link, nstep, metaChunk);
+    link.pop_back();
+    hid_t key_dtype = H5Tcopy(h5pp::GetHDF5Type<hsize_t>());
+    link.push_back(hum::nodeSeriesLink[hum::FIELD]);
+    h5pp::WriteExtendible(file, nstep ? &series.keyframe[0] : NULL,
+      key_dtype, key_dtype, link, nstep, metaChunk);
+    H5Tclose(key_dtype);
+  }
+}
+
+#endif
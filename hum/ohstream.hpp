@@ -11,10 +11,17 @@
 #define OHSTREAM_HPP
 
 #include "types.hpp"
+#include "chunkio.hpp"
+#include "subfile.hpp"
+#include "patchtable.hpp"
+#include "fields.hpp"
+#include "nodeseries.hpp"
+#include "hashcache.hpp"
 #include <iostream>
 #include <sstream>
 #include <cassert>
 #include <fstream>
+#include <limits>
 
 /*! \brief hum output file stream class
  **        It provides stream access to the hum
@@ -31,12 +38,80 @@ public:
   /*! \brief hum output file for serial write */
   ohstream(const char *fname);
 
+  /*! \brief hum output file split across n_subfile sub-files */
+  ohstream(const char *fname, MPI_Comm &comm, unsigned n_subfile);
+
   /*! \brief Open hum output file for serial write */
   void open(const char *fname);
 
+  /*! \brief Open hum output file split across n_subfile sub-files.
+   **        Ranks are grouped in contiguous blocks, one aggregator per
+   **        group, and every dataset write is collective over the group.
+   **        The master file (attributes, patches) lives on rank 0 only.
+   **/
+  void open(const char *fname, MPI_Comm &comm, unsigned n_subfile);
+
+  /*! \brief Set the global entity sizes (needed by writers other
+   **        than the mesh converters before windowed writes)
+   **/
+  void set_size(hsize_t n_node, hsize_t n_face);
+
+  /*! \brief Set the global entity sizes including the total number
+   **        of face nodes (needed for CSR faces)
+   **/
+  void set_size(hsize_t n_node, hsize_t n_face, hsize_t n_face_adjncy);
+
+  /*! \brief Set the global number of cells (needed for cell
+   **        fields of files written without the converters)
+   **/
+  void set_cell_size(hsize_t n_cell);
+
+  /*! \brief Store faces in CSR form: FaceNodeOffsets (n_face + 1)
+   **        and FaceNodes (FaceAdjncySize) instead of fixed size
+   **        Faces records. The offsets are stored at the integer
+   **        size of the mesh, 64-bit if FaceAdjncySize does not fit. Face windows must continue where an
+   **        earlier window ended, or at a position set using
+   **        set_face_csr_cursor.
+   **/
+  void set_face_csr(bool is_on);
+
+  /*! \brief Declare that the face window starting at face_offset
+   **        has its first node at node_offset (CSR faces)
+   **/
+  void set_face_csr_cursor(hsize_t face_offset, hsize_t node_offset);
+
+  /*! Return the (master) file hid_t */
+  hid_t &file();
+
   /*! \brief Close hum output file */
   void close();
 
+  /*! \brief Write datasets chunked and deflate compressed. Whole
+   **        chunks are compressed in parallel and written directly
+   **        (chunk_size = 0 restores contiguous datasets)
+   **/
+  void set_deflate(hsize_t chunk_size, int level);
+
+  /*! \brief Write the integer (connectivity) datasets delta + bit
+   **        packed in chunks of chunk_size entities, coded in parallel
+   **        and written directly. Nodes keep the deflate setting
+   **        (chunk_size = 0 turns packing off).
+   **/
+  void set_packing(hsize_t chunk_size);
+
+  /*! \brief Store the node coordinates in single precision
+   **        (read back as any floatT)
+   **/
+  void set_node_float(bool is_on);
+
+  /*! \brief Store the node coordinates quantised to a lattice of
+   **        spacing 2 * tolerance (errors stay within tolerance, plus
+   **        the float rounding of single precision nodes) in chunks of
+   **        chunk_size nodes coded in parallel. Overrides deflate for
+   **        the nodes (chunk_size = 0 turns it off).
+   **/
+  void set_node_quantise(hsize_t chunk_size, double tolerance);
+
   /*! Write node values to hum file **/
   template<typename floatT>
   void write(node<floatT> *n);
@@ -57,7 +132,32 @@ public:
   template<typename uintT>
   void write(leftRight<uintT> *n, hsize_t offset, hsize_t stride, hsize_t size);
 
-  /*! Write PatchBC information **/
+  /*! Write a CSR window of faces starting at face offset **/
+  template<typename uintT>
+  void write(faceCSR<uintT> &csr, hsize_t offset);
+
+  /*! \brief Write a CSR window of polyhedral cells starting at
+   **        cell offset (CellFaceOffsets/CellFaces, the cell-face
+   **        array is nFace + nInternalFace long)
+   **/
+  template<typename uintT>
+  void write(cellCSR<uintT> &csr, hsize_t offset);
+
+  /*! \brief Set the cell and internal face counts and write them,
+   **        the face adjacency size and the integer size (uintT) as
+   **        the mesh attributes. For writers other than the mesh
+   **        converters, after set_size.
+   **/
+  template<typename uintT>
+  void write_mesh_size(hsize_t n_cell, hsize_t n_internal_face);
+
+  /*! Write the bounding box of the nodes **/
+  template<typename floatT>
+  void write(node<floatT> &min, node<floatT> &max);
+
+  /*! \brief Write PatchBC information. Patches are collected and
+   **        stored as a single table (sorted by name) on close.
+   **/
   template<typename uintT>
   void write(std::string &patchName, patchBC<uintT> &patch);
 
@@ -69,6 +169,54 @@ public:
     hsize_t offset, hsize_t stride, hsize_t size
     );
 
+  /*! \brief Entities per chunk of the field step datasets
+   **        (deflated at the deflate level if set_deflate is on)
+   **/
+  void set_field_chunk(hsize_t chunk_size);
+
+  /*! \brief Declare the field name of n_comp values per cell, node
+   **        or face (fields::centringType). Fields of an existing
+   **        file are known already and keep their layout.
+   **/
+  void add_field(const std::string &name, unsigned centring,
+    unsigned n_comp);
+
+  /*! \brief Append a step at time to the field name and return its
+   **        number. Field metadata is written on close.
+   **/
+  hsize_t append_field_step(const std::string &name, double time);
+
+  /*! \brief Write the values of the entities [offset, offset + size)
+   **        (n_comp each) of step of the field name. Sub-filed
+   **        writes are collective over the aggregator group.
+   **/
+  template<typename floatT>
+  void write_field(const std::string &name, hsize_t step,
+    const floatT *data, hsize_t offset, hsize_t size);
+
+  /*! \brief Store moving node coordinates as a time series with a
+   **        keyframe every keyframe_interval steps and the other
+   **        steps as differences to their keyframe, quantised to
+   **        within tolerance (0 keeps them exact and deflates them)
+   **        in chunks of chunk_size nodes
+   **/
+  void set_node_series(hsize_t keyframe_interval, double tolerance,
+    hsize_t chunk_size = nodeseries::defaultChunk);
+
+  /*! \brief Append a node step at time and return its number.
+   **        The first step after opening is always a keyframe.
+   **/
+  hsize_t append_node_step(double time);
+
+  /*! \brief Write the node window [offset, offset + size) of step.
+   **        Every rank writes the same windows at every step (the
+   **        keyframe of a window is kept to code its differences).
+   **        Sub-filed writes are collective over the aggregator group.
+   **/
+  template<typename floatT>
+  void write_node_step(hsize_t step, node<floatT> *n, hsize_t offset,
+    hsize_t size);
+
   /** Private memebers **/
 private:
   /*! \brief Make class member values to default */
@@ -115,13 +263,85 @@ protected:
   hsize_t _n_cell, _n_face, _n_node; /*!<  */
   hsize_t _n_internal_face, _n_face_adjncy; /*!<  */
   std::map< std::string, hsize_t > _n_patch_face; /*!<  */
+  patchBCMap<hsize_t>::Type _patch; /*!< Patches written on close */
+  size_t _patch_int_size; /*!< Integer size of the patch table */
+  bool _is_patch_dirty; /*!< Patch table needs to be written */
+  bool _is_face_csr; /*!< Faces are stored in CSR form */
+  std::map< hsize_t, hsize_t > _csr_cursor; /*!< Face -> first node position */
   bool _is_open; /*!<  */
   int _int_size;
+  hsize_t _chunk_size; /*!< Chunk size of compressed datasets */
+  int _deflate_level; /*!< Deflate compression level */
+  hsize_t _pack_chunk_size; /*!< Chunk size of packed integer datasets */
+  bool _is_node_float; /*!< Nodes are stored in single precision */
+  hsize_t _node_chunk_size; /*!< Chunk size of quantised nodes */
+  double _node_tolerance; /*!< Error bound of quantised nodes */
+  bool _is_subfile; /*!< Datasets are split across sub-files */
+  unsigned _n_subfile; /*!< Total number of sub-files */
+  MPI_Comm _mpi_comm, _agg_comm; /*!< All ranks, ranks of my aggregator */
+  hid_t _sub_file; /*!< My sub-file (aggregator ranks only) */
+  std::string _fname; /*!< The master file name */
+  std::map< std::string, subfile::extentList > _extents; /*!< Blocks in my sub-file */
+  std::map< std::string, hsize_t > _global_size; /*!< Global dataset sizes */
+  std::map< std::string, fields::info > _field; /*!< Fields written on close */
+  bool _is_field_dirty; /*!< Field metadata needs to be written */
+  hsize_t _field_chunk_size; /*!< Chunk size of the field steps */
+  nodeseries::info _node_series; /*!< Node steps written on close */
+  bool _is_node_series_dirty; /*!< Node series needs to be written */
+  bool _has_keyframe; /*!< A keyframe was appended since open */
+  hsize_t _keyframe_interval; /*!< Steps from one keyframe to the next */
+  double _series_tolerance; /*!< Error bound of node differences */
+  hsize_t _series_chunk_size; /*!< Chunk size of the node steps */
+  std::map< hsize_t, std::vector<double> > _keyframe; /*!< Window -> keyframe */
+
+  /*! \brief Gather the window of every rank in the group
+   **        and append it to the sub-file of the aggregator
+   **        (new datasets are created with dcpl, see AppendBlock)
+   **/
+  void write_subfile(const void *data, hid_t mem_dtype, hid_t file_dtype,
+    h5pp::listString &link, hsize_t offset, hsize_t mem_size,
+    hsize_t file_size, hid_t dcpl = H5P_DEFAULT);
+
+  /*! \brief Write the sub-file indices and the virtual view */
+  void close_subfile();
+
+  /*! \brief Write a node window using the node storage settings */
+  template<typename floatT>
+  void write_node(node<floatT> *n, hsize_t offset, hsize_t stride,
+    hsize_t size);
+
+  /*! \brief Write the collected patches as one table */
+  void write_patches();
+
+  /*! \brief Number of entities of a field of centring */
+  hsize_t field_size(unsigned centring) const;
+
+  /*! \brief Write the metadata of all fields */
+  void write_fields();
+
+  /*! \brief Write the metadata of the node series */
+  void write_node_series();
+
+  /*! \brief Pack a face window into CSR form and write it */
+  template<typename uintT>
+  void write_csr(face<uintT> *n, hsize_t offset, hsize_t size);
+
+  /*! \brief Write a face window whose offsets start at zero in
+   **        either face layout. CSR windows are moved to the node
+   **        position of the face cursor (offsets changed in place).
+   **/
+  template<typename uintT>
+  void write_faces(faceCSR<uintT> &csr, hsize_t offset);
 };
 
 /***********   Implementation of template class  ****************/
 
-ohstream::ohstream() {
+ohstream::ohstream()
+: _chunk_size(0), _deflate_level(0), _pack_chunk_size(0),
+_is_node_float(false), _node_chunk_size(0), _node_tolerance(0.0),
+_is_subfile(false), _n_subfile(0), _field_chunk_size(fields::defaultChunk),
+_keyframe_interval(nodeseries::defaultInterval), _series_tolerance(0.0),
+_series_chunk_size(nodeseries::defaultChunk) {
   set();
 }
 
@@ -129,13 +349,31 @@ ohstream::~ohstream() {
   close();
 }
 
-ohstream::ohstream(const char *fname) {
+ohstream::ohstream(const char *fname)
+: _chunk_size(0), _deflate_level(0), _pack_chunk_size(0),
+_is_node_float(false), _node_chunk_size(0), _node_tolerance(0.0),
+_is_subfile(false), _n_subfile(0), _field_chunk_size(fields::defaultChunk),
+_keyframe_interval(nodeseries::defaultInterval), _series_tolerance(0.0),
+_series_chunk_size(nodeseries::defaultChunk) {
   set();
   open(fname);
 }
 
+ohstream::ohstream(const char *fname, MPI_Comm &comm, unsigned n_subfile)
+: _chunk_size(0), _deflate_level(0), _pack_chunk_size(0),
+_is_node_float(false), _node_chunk_size(0), _node_tolerance(0.0),
+_is_subfile(false), _n_subfile(0), _field_chunk_size(fields::defaultChunk),
+_keyframe_interval(nodeseries::defaultInterval), _series_tolerance(0.0),
+_series_chunk_size(nodeseries::defaultChunk) {
+  set();
+  open(fname, comm, n_subfile);
+}
+
 void ohstream::open(const char *fname) {
   close();
+  /// Packed datasets of an existing file need the filters
+  deltapack::Register();
+  nodequant::Register();
   std::ifstream test_f(fname);
   if (test_f.fail()) {
     _file = H5Fcreate(fname, H5F_ACC_TRUNC,
@@ -149,45 +387,234 @@ void ohstream::open(const char *fname) {
   }
 }
 
+void ohstream::open(const char *fname, MPI_Comm &comm, unsigned n_subfile) {
+  close();
+  int rank, nproc;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  assert(n_subfile > 0 && n_subfile <= unsigned(nproc));
+  _mpi_comm = comm;
+  _n_subfile = n_subfile;
+  _is_subfile = true;
+  _fname = fname;
+  /// Contiguous rank blocks share one aggregator (node-local
+  /// when ranks are packed by node)
+  int color = int((long long) rank * n_subfile / nproc);
+  MPI_Comm_split(comm, color, rank, &_agg_comm);
+  int agg_rank;
+  MPI_Comm_rank(_agg_comm, &agg_rank);
+  _sub_file = -1;
+  if (agg_rank == 0)
+    _sub_file = H5Fcreate(subfile::SubFileName(_fname, color).c_str(),
+    H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  _file = -1;
+  if (rank == 0)
+    _file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  _is_open = true;
+}
+
 void ohstream::close() {
   if (_is_open == true) {
-    H5Fclose(_file);
+    if (_is_patch_dirty == true)
+      write_patches();
+    if (_is_field_dirty == true)
+      write_fields();
+    if (_is_node_series_dirty == true)
+      write_node_series();
+    if (_is_subfile == true)
+      close_subfile();
+    else
+      H5Fclose(_file);
     set();
   }
 }
 
+void ohstream::set_size(hsize_t n_node, hsize_t n_face) {
+  _n_node = n_node;
+  _n_face = n_face;
+}
+
+void ohstream::set_size(hsize_t n_node, hsize_t n_face,
+  hsize_t n_face_adjncy) {
+  set_size(n_node, n_face);
+  _n_face_adjncy = n_face_adjncy;
+}
+
+void ohstream::set_face_csr(bool is_on) {
+  _is_face_csr = is_on;
+  _csr_cursor.clear();
+  if (is_on == true) _csr_cursor[0] = 0;
+}
+
+void ohstream::set_face_csr_cursor(hsize_t face_offset, hsize_t node_offset) {
+  _csr_cursor[face_offset] = node_offset;
+}
+
+void ohstream::set_cell_size(hsize_t n_cell) {
+  _n_cell = n_cell;
+}
+
+hid_t &ohstream::file() {
+  return _file;
+}
+
+void ohstream::set_deflate(hsize_t chunk_size, int level) {
+  _chunk_size = chunk_size;
+  _deflate_level = level;
+}
+
+void ohstream::set_packing(hsize_t chunk_size) {
+  _pack_chunk_size = chunk_size;
+}
+
+void ohstream::set_node_float(bool is_on) {
+  _is_node_float = is_on;
+}
+
+void ohstream::set_node_quantise(hsize_t chunk_size, double tolerance) {
+  assert(chunk_size == 0 || tolerance > 0.0);
+  _node_chunk_size = chunk_size;
+  _node_tolerance = tolerance;
+}
+
 template<typename floatT>
 void ohstream::write(node<floatT> *n) {
-  write< node<floatT>, H5TNode<floatT> >
-    (
-    n, 0, 1, _n_node, _n_node
-    );
+  write_node(n, 0, 1, _n_node);
 }
 
 template<typename uintT>
 void ohstream::write(face<uintT> *n) {
-  write< face<uintT>, H5TFace<uintT> >
-    (
-    n, 0, 1, _n_face, _n_face
-    );
+  write(n, 0, 1, _n_face);
 }
 
 template<typename floatT>
 void ohstream::write(node<floatT> *n, hsize_t offset, hsize_t stride, hsize_t size) {
-  write< node<floatT>, H5TNode<floatT> >
-    (
-    n, offset, stride, size, _n_node
-    );
+  write_node(n, offset, stride, size);
 }
 
 template<typename uintT>
 void ohstream::write(face<uintT> *n, hsize_t offset, hsize_t stride, hsize_t size) {
+  if (_is_face_csr == true) {
+    assert(stride == 1);
+    write_csr(n, offset, size);
+    return;
+  }
   write< face<uintT>, H5TFace<uintT> >
     (
     n, offset, stride, size, _n_face
     );
 }
 
+template<typename uintT>
+void ohstream::write_csr(face<uintT> *n, hsize_t offset, hsize_t size) {
+  faceCSR<uintT> csr;
+  csr.pack(n, size, 0);
+  write_faces(csr, offset);
+}
+
+template<typename uintT>
+void ohstream::write_faces(faceCSR<uintT> &csr, hsize_t offset) {
+  hsize_t size = csr.size();
+  if (_is_face_csr == false) {
+    std::vector< face<uintT> > window(size);
+    csr.unpack(window.empty() ? NULL : &window[0], size);
+    if (size > 0)
+      write< face<uintT>, H5TFace<uintT> >
+      (
+      &window[0], offset, 1, size, _n_face
+      );
+    return;
+  }
+  std::map< hsize_t, hsize_t >::iterator it = _csr_cursor.find(offset);
+  assert(it != _csr_cursor.end());
+  uint64_t first_node = it->second;
+  for (hsize_t i = 0; i <= size; ++i)
+    csr.offsets[i] += first_node;
+  /// The next window carries on from here
+  _csr_cursor.erase(it);
+  _csr_cursor[offset + size] = csr.offsets[size];
+  write(csr, offset);
+}
+
+template<typename uintT>
+void ohstream::write(faceCSR<uintT> &csr, hsize_t offset) {
+  assert(_n_face_adjncy > 0);
+  hsize_t size = csr.size();
+  h5pp::listString link;
+  /// Windows share their boundary offset, only the first
+  /// window writes offset zero (no overlap between ranks)
+  link.push_back(hum::faceCSRLink[hum::PRIMARY]);
+  hsize_t first = (offset == 0) ? 0 : 1;
+  if (sizeof (uintT) < sizeof (uint64_t) &&
+    _n_face_adjncy <= std::numeric_limits<uintT>::max()) {
+    /// The offsets fit the width of the node IDs
+    std::vector<uintT> narrow(csr.offsets.begin() + first, csr.offsets.end());
+    if (narrow.empty() == false)
+      write(&narrow[0], link, offset + first, 1, narrow.size(), _n_face + 1);
+  } else if (size + 1 > first)
+    write(&csr.offsets[first], link, offset + first, 1, size + 1 - first,
+    _n_face + 1);
+  link.pop_back();
+  link.push_back(hum::faceCSRLink[hum::SECONDARY]);
+  if (csr.nodes.empty() == false)
+    write(&csr.nodes[0], link, csr.offsets[0], 1, csr.nodes.size(),
+    _n_face_adjncy);
+}
+
+template<typename uintT>
+void ohstream::write(cellCSR<uintT> &csr, hsize_t offset) {
+  hsize_t n_cell_adjncy = _n_face + _n_internal_face;
+  assert(n_cell_adjncy > 0);
+  hsize_t size = csr.size();
+  h5pp::listString link;
+  /// Same window rule as the CSR faces
+  link.push_back(hum::cellCSRLink[hum::PRIMARY]);
+  if (offset == 0)
+    write(&csr.offsets[0], link, 0, 1, size + 1, _n_cell + 1);
+  else if (size > 0)
+    write(&csr.offsets[1], link, offset + 1, 1, size, _n_cell + 1);
+  link.pop_back();
+  link.push_back(hum::cellCSRLink[hum::SECONDARY]);
+  if (csr.faces.empty() == false)
+    write(&csr.faces[0], link, csr.offsets[0], 1, csr.faces.size(),
+    n_cell_adjncy);
+}
+
+template<typename uintT>
+void ohstream::write_mesh_size(hsize_t n_cell, hsize_t n_internal_face) {
+  _n_cell = n_cell;
+  _n_internal_face = n_internal_face;
+  _int_size = sizeof (uintT);
+  /// Sub-files carry no attributes, the sizes go to the master file
+  if (_file < 0) return;
+  h5pp::listString link;
+  link.push_back(hum::miscLink[hum::PRIMARY]);
+  h5pp::WriteAttribute(_file, link, _n_cell);
+  link.pop_back();
+  link.push_back(hum::miscLink[hum::SECONDARY]);
+  h5pp::WriteAttribute(_file, link, _n_face_adjncy);
+  link.pop_back();
+  link.push_back(hum::miscLink[hum::FIELD]);
+  h5pp::WriteAttribute(_file, link, _n_internal_face);
+  link.pop_back();
+  /// The attribute type carries the integer size
+  link.push_back(hum::miscLink[hum::ENTITY]);
+  uintT IntegerT = sizeof (uintT);
+  h5pp::WriteAttribute(_file, link, IntegerT);
+}
+
+template<typename floatT>
+void ohstream::write(node<floatT> &min, node<floatT> &max) {
+  if (_file < 0) return;
+  H5TNode<floatT> H5T;
+  h5pp::listString link;
+  link.push_back(hum::AABBLink[hum::PRIMARY]);
+  h5pp::WriteAttribute(_file, link, min, H5T.mem_t());
+  link.pop_back();
+  link.push_back(hum::AABBLink[hum::SECONDARY]);
+  h5pp::WriteAttribute(_file, link, max, H5T.mem_t());
+}
+
 template<typename uintT>
 void ohstream::write(leftRight<uintT> *n, hsize_t offset, hsize_t stride, hsize_t size) {
   write< leftRight<uintT>, H5TLeftRight<uintT> >
@@ -198,16 +625,15 @@ void ohstream::write(leftRight<uintT> *n, hsize_t offset, hsize_t stride, hsize_
 
 template<typename uintT>
 void ohstream::write(std::string &patchName, patchBC<uintT> &patch) {
-  h5pp::listString link;
-  H5TPatch<uintT> H5T;
-  link.push_back(hum::patchLink[hum::PRIMARY]);
-  link.push_back(patchName);
-  link.push_back(H5T.linkStr());
-  h5pp::WriteVectorDataSerial
-    (
-    _file, &patch, H5T.mem_t(), H5T.file_t(),
-    link, 0, 1, 1, 1
-    );
+  patchBC<hsize_t> &entry = _patch[patchName];
+  entry.bcType = patch.bcType;
+  entry.startFace = patch.startFace;
+  entry.faceCount = patch.faceCount;
+  entry.attachedToProcID = patch.attachedToProcID;
+  _n_patch_face[patchName] = patch.faceCount;
+  if (sizeof (uintT) > _patch_int_size)
+    _patch_int_size = sizeof (uintT);
+  _is_patch_dirty = true;
 }
 
 template<typename uintT>
@@ -232,14 +658,220 @@ void ohstream::write
   H5Tclose(dtype);
 }
 
+void ohstream::set_field_chunk(hsize_t chunk_size) {
+  assert(chunk_size > 0);
+  _field_chunk_size = chunk_size;
+}
+
+void ohstream::add_field(const std::string &name, unsigned centring,
+  unsigned n_comp) {
+  assert(centring <= fields::FACE && n_comp > 0);
+  std::map< std::string, fields::info >::iterator it = _field.find(name);
+  if (it != _field.end()) {
+    assert(it->second.centring == centring);
+    assert(it->second.nComponents == n_comp);
+    return;
+  }
+  fields::info &entry = _field[name];
+  entry.centring = centring;
+  entry.nComponents = n_comp;
+  _is_field_dirty = true;
+}
+
+hsize_t ohstream::append_field_step(const std::string &name, double time) {
+  std::map< std::string, fields::info >::iterator it = _field.find(name);
+  assert(it != _field.end());
+  it->second.time.push_back(time);
+  _is_field_dirty = true;
+  return it->second.time.size() - 1;
+}
+
+template<typename floatT>
+void ohstream::write_field(const std::string &name, hsize_t step,
+  const floatT *data, hsize_t offset, hsize_t size) {
+  assert(_is_open);
+  std::map< std::string, fields::info >::iterator it = _field.find(name);
+  assert(it != _field.end() && step < it->second.time.size());
+  hsize_t file_size = field_size(it->second.centring);
+  assert(file_size > 0 && offset + size <= file_size);
+  hid_t dtype = fields::MakeType<floatT>(it->second.nComponents);
+  h5pp::listString link = fields::StepLink(name, step);
+  if (_is_subfile == true)
+    write_subfile(data, dtype, dtype, link, offset, size, file_size);
+  else if (_chunk_size > 0)
+    chunkio::WriteChunked
+    (
+    _file, data, dtype, dtype, link, offset, size, file_size,
+    _field_chunk_size, chunkio::Deflate(_deflate_level)
+    );
+  else {
+    /// Plain chunks, a step is read in windows like the mesh
+    hsize_t chunk_size = std::min(_field_chunk_size, file_size);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    herr_t status = H5Pset_chunk(dcpl, 1, &chunk_size);
+    assert(status >= 0);
+    hid_t dset = h5pp::OpenOrCreateDset(_file, dtype, link, file_size, dcpl);
+    H5Pclose(dcpl);
+    if (size > 0)
+      chunkio::WriteSlab(dset, data, dtype, offset, size);
+    H5Dclose(dset);
+  }
+  H5Tclose(dtype);
+}
+
+void ohstream::set_node_series(hsize_t keyframe_interval, double tolerance,
+  hsize_t chunk_size) {
+  assert(keyframe_interval > 0 && tolerance >= 0.0 && chunk_size > 0);
+  _keyframe_interval = keyframe_interval;
+  _series_tolerance = tolerance;
+  _series_chunk_size = chunk_size;
+}
+
+hsize_t ohstream::append_node_step(double time) {
+  hsize_t step = _node_series.time.size();
+  /// Differences need a keyframe written in this session
+  bool is_key = (_has_keyframe == false) ||
+    (step - _node_series.keyframe.back() >= _keyframe_interval);
+  _node_series.time.push_back(time);
+  _node_series.keyframe.push_back(is_key ? step : _node_series.keyframe.back());
+  if (is_key == true) {
+    _keyframe.clear();
+    _has_keyframe = true;
+  }
+  _is_node_series_dirty = true;
+  return step;
+}
+
+template<typename floatT>
+void ohstream::write_node_step(hsize_t step, node<floatT> *n,
+  hsize_t offset, hsize_t size) {
+  assert(_is_open && step < _node_series.time.size());
+  assert(offset + size <= _n_node);
+  h5pp::listString link = nodeseries::StepLink(step);
+  if (_node_series.keyframe[step] == step) {
+    /// Keep the keyframe of this window then store it whole
+    std::vector<double> &key = _keyframe[offset];
+    key.resize(3 * size);
+    for (hsize_t i = 0; i < size; ++i)
+      for (unsigned c = 0; c < 3; ++c)
+        key[3 * i + c] = n[i].xyz[c];
+    H5TNode<floatT> H5T;
+    write(n, H5T.mem_t(), H5T.file_t(), link, offset, 1, size, _n_node);
+    return;
+  }
+  std::map< hsize_t, std::vector<double> >::iterator it = _keyframe.find(offset);
+  assert(it != _keyframe.end() && it->second.size() == 3 * size);
+  std::vector< node<double> > delta(size);
+  for (hsize_t i = 0; i < size; ++i)
+    for (unsigned c = 0; c < 3; ++c)
+      delta[i].xyz[c] = double(n[i].xyz[c]) - it->second[3 * i + c];
+  H5TNode<double> H5T;
+  node<double> *data = delta.empty() ? NULL : &delta[0];
+  /// Differences are coded the same in sub-files
+  chunkio::filter f = (_series_tolerance > 0.0) ?
+    chunkio::Quantised(sizeof (double), 2.0 * _series_tolerance) :
+    chunkio::Deflate((_deflate_level > 0) ? _deflate_level : 1);
+  if (_is_subfile == true) {
+    hid_t dcpl = chunkio::MakePlist(_series_chunk_size, f);
+    write_subfile(data, H5T.mem_t(), H5T.file_t(), link, offset, size,
+      _n_node, dcpl);
+    H5Pclose(dcpl);
+  } else if (size > 0)
+    chunkio::WriteChunked
+    (
+    _file, data, H5T.mem_t(), H5T.file_t(), link, offset, size, _n_node,
+    _series_chunk_size, f
+    );
+}
+
 /*** Private function members ***/
 void ohstream::set() {
   _n_cell = 0;
   _n_face = 0;
   _n_node = 0;
   _n_internal_face = 0;
+  _n_face_adjncy = 0;
   _is_open = false;
   _int_size = 0;
+  _n_patch_face.clear();
+  _patch.clear();
+  _patch_int_size = 0;
+  _is_patch_dirty = false;
+  _is_face_csr = false;
+  _csr_cursor.clear();
+  _field.clear();
+  _is_field_dirty = false;
+  _node_series.time.clear();
+  _node_series.keyframe.clear();
+  _is_node_series_dirty = false;
+  _has_keyframe = false;
+  _keyframe.clear();
+}
+
+template<typename floatT>
+void ohstream::write_node(node<floatT> *n, hsize_t offset,
+  hsize_t stride, hsize_t size) {
+  H5TNode<floatT> H5T;
+  H5TNode<float> H5T_single;
+  hid_t &file_dtype = (_is_node_float == true) ?
+    H5T_single.file_t() : H5T.file_t();
+  h5pp::listString link;
+  link.push_back(H5T.linkStr());
+  if (_node_chunk_size > 0 && _is_subfile == false && stride == 1) {
+    hashcache::Invalidate(_file, link);
+    chunkio::WriteChunked
+    (
+    _file, n, H5T.mem_t(), file_dtype, link, offset, size,
+    _n_node, _node_chunk_size,
+    chunkio::Quantised(H5Tget_size(file_dtype) / 3, 2.0 * _node_tolerance)
+    );
+  } else
+    write(n, H5T.mem_t(), file_dtype, link, offset, stride, size, _n_node);
+}
+
+void ohstream::write_patches() {
+  /// The patch table is written once, by the rank owning _file
+  if (_file < 0) return;
+  patchtable::infoList info;
+  patchtable::nameList names;
+  info.reserve(_patch.size());
+  names.reserve(_patch.size());
+  patchBCMap<hsize_t>::itType it;
+  for (it = _patch.begin(); it != _patch.end(); ++it) {
+    names.push_back(it->first);
+    info.push_back(it->second);
+  }
+  patchtable::WriteTable(_file, info, names, _patch_int_size);
+  _is_patch_dirty = false;
+}
+
+hsize_t ohstream::field_size(unsigned centring) const {
+  if (centring == fields::NODE) return _n_node;
+  if (centring == fields::FACE) return _n_face;
+  return _n_cell;
+}
+
+void ohstream::write_fields() {
+  /// Field names, centrings and step times live in the master file
+  if (_file < 0) return;
+  fields::infoList info;
+  fields::nameList names;
+  info.reserve(_field.size());
+  names.reserve(_field.size());
+  std::map< std::string, fields::info >::iterator it;
+  for (it = _field.begin(); it != _field.end(); ++it) {
+    names.push_back(it->first);
+    info.push_back(it->second);
+  }
+  fields::Write(_file, info, names);
+  _is_field_dirty = false;
+}
+
+void ohstream::write_node_series() {
+  /// Time and Keyframe of the steps are kept by the master file
+  if (_file < 0) return;
+  nodeseries::Write(_file, _node_series);
+  _is_node_series_dirty = false;
 }
 
 template < typename T, typename humT >
@@ -267,12 +899,7 @@ void ohstream::write(T *data, h5pp::listString &link,
   hsize_t mem_size, hsize_t _filesize) {
   assert(_is_open);
   hid_t dtype = H5Tcopy(h5pp::GetHDF5Type<T>());
-  h5pp::WriteVectorDataSerial
-    (
-    _file, data, dtype, dtype,
-    link, offset,
-    stride, mem_size, _filesize
-    );
+  write(data, dtype, dtype, link, offset, stride, mem_size, _filesize);
   H5Tclose(dtype);
 }
 
@@ -281,13 +908,106 @@ void ohstream::write(T *data, hid_t &mem_dtype, hid_t &_filedtype,
   h5pp::listString &link, hsize_t offset,
   hsize_t stride, hsize_t mem_size, hsize_t _filesize) {
   assert(_is_open);
-  h5pp::WriteVectorDataSerial
+  unsigned int_bytes, n_int;
+  /// The stored content hash no longer holds
+  if (_is_subfile == false) hashcache::Invalidate(_file, link);
+  if (_is_subfile == true) {
+    assert(stride == 1);
+    write_subfile(data, mem_dtype, _filedtype, link, offset,
+      mem_size, _filesize);
+  } else if (_pack_chunk_size > 0 && stride == 1 &&
+    deltapack::IsPackable(_filedtype, int_bytes, n_int))
+    chunkio::WriteChunked
+    (
+    _file, data, mem_dtype, _filedtype, link, offset,
+    mem_size, _filesize, _pack_chunk_size,
+    chunkio::Packed(int_bytes, n_int)
+    );
+  else if (_chunk_size > 0 && stride == 1)
+    chunkio::WriteChunked
+    (
+    _file, data, mem_dtype, _filedtype, link, offset,
+    mem_size, _filesize, _chunk_size, chunkio::Deflate(_deflate_level)
+    );
+  else
+    h5pp::WriteVectorDataSerial
     (
     _file, data, mem_dtype, _filedtype,
     link, offset, stride, mem_size, _filesize
     );
 }
 
+void ohstream::write_subfile(const void *data, hid_t mem_dtype,
+  hid_t file_dtype, h5pp::listString &link, hsize_t offset,
+  hsize_t mem_size, hsize_t file_size, hid_t dcpl) {
+  int agg_rank, agg_size;
+  MPI_Comm_rank(_agg_comm, &agg_rank);
+  MPI_Comm_size(_agg_comm, &agg_size);
+  size_t elem_bytes = H5Tget_size(mem_dtype);
+  /// All ranks of the group know all windows to agree on the rounds
+  unsigned long long window[2] = {offset, mem_size};
+  std::vector<unsigned long long> windows(2 * agg_size);
+  MPI_Allgather(window, 2, MPI_UNSIGNED_LONG_LONG, &windows[0], 2,
+    MPI_UNSIGNED_LONG_LONG, _agg_comm);
+  hsize_t max_size = 0;
+  for (int i = 0; i < agg_size; ++i)
+    max_size = std::max(max_size, hsize_t(windows[2 * i + 1]));
+  /// The raw data is gathered in rounds of bounded size, the
+  /// aggregator never holds the whole group window
+  hsize_t round = subfile::GatherRound(elem_bytes, agg_size, _agg_comm);
+  std::vector<int> counts(agg_size), displs(agg_size);
+  std::vector<char> buf(1);
+  std::string cat = h5pp::ListStringToString(link);
+  const char *my_data = static_cast<const char *> (data);
+  for (hsize_t first = 0; first < max_size; first += round) {
+    int total = 0;
+    for (int i = 0; i < agg_size; ++i) {
+      hsize_t size = windows[2 * i + 1];
+      size = (first < size) ? std::min(round, size - first) : 0;
+      counts[i] = int(size * elem_bytes);
+      displs[i] = total;
+      total += counts[i];
+    }
+    hsize_t my_size = (first < mem_size) ? std::min(round, mem_size - first) : 0;
+    if (agg_rank == 0) buf.resize(total + 1);
+    MPI_Gatherv(const_cast<char *> (my_data) + ((my_size > 0) ? first * elem_bytes : 0),
+      int(my_size * elem_bytes), MPI_BYTE, &buf[0], &counts[0], &displs[0],
+      MPI_BYTE, 0, _agg_comm);
+    if (agg_rank != 0) continue;
+    for (int i = 0; i < agg_size; ++i)
+      subfile::AppendBlock
+      (
+      _sub_file, link, &buf[displs[i]], mem_dtype, file_dtype,
+      windows[2 * i] + first, counts[i] / elem_bytes, _extents[cat], dcpl
+      );
+  }
+  if (agg_rank == 0) _global_size[cat] = file_size;
+}
+
+void ohstream::close_subfile() {
+  int rank;
+  MPI_Comm_rank(_mpi_comm, &rank);
+  if (_sub_file >= 0) {
+    std::map< std::string, subfile::extentList >::iterator it;
+    for (it = _extents.begin(); it != _extents.end(); ++it) {
+      if (it->second.empty() == true) continue;
+      h5pp::listString link = subfile::PathToLink(it->first);
+      subfile::WriteIndex(_sub_file, link, it->second, _global_size[it->first]);
+    }
+    H5Fclose(_sub_file);
+  }
+  /// All sub-files are complete before the view is made
+  MPI_Barrier(_mpi_comm);
+  if (rank == 0) {
+    subfile::MakeVirtualView(_file, _fname, _n_subfile);
+    H5Fclose(_file);
+  }
+  MPI_Comm_free(&_agg_comm);
+  _extents.clear();
+  _global_size.clear();
+  _is_subfile = false;
+}
+
 void ohstream::read() {
   if (_is_open == false) return;
   h5pp::listString link;
@@ -295,9 +1015,16 @@ void ohstream::read() {
   link.push_back(hum::nodeLink[hum::PRIMARY]);
   _n_node = h5pp::GetVectorLength<hsize_t>(_file, link);
   link.pop_back();
-  /// Get _n_face
-  link.push_back(hum::faceLink[hum::PRIMARY]);
-  _n_face = h5pp::GetVectorLength<hsize_t>(_file, link);
+  /// Get _n_face (CSR faces have one more offset than faces)
+  _is_face_csr = h5pp::IsValidLink(_file, hum::faceCSRLink[hum::PRIMARY]);
+  if (_is_face_csr == true) {
+    link.push_back(hum::faceCSRLink[hum::PRIMARY]);
+    _n_face = h5pp::GetVectorLength<hsize_t>(_file, link) - 1;
+    _csr_cursor[0] = 0;
+  } else {
+    link.push_back(hum::faceLink[hum::PRIMARY]);
+    _n_face = h5pp::GetVectorLength<hsize_t>(_file, link);
+  }
   link.pop_back();
   /// Get _n_internal_face
   link.push_back(hum::miscLink[hum::FIELD]);
@@ -315,6 +1042,23 @@ void ohstream::read() {
   link.push_back(hum::miscLink[hum::ENTITY]);
   _int_size = h5pp::GetAttributeType(_file, link);
   link.pop_back();
+  /// Existing patches (either layout) are kept in the new table
+  patchtable::infoList info;
+  patchtable::nameList names;
+  patchtable::Read(_file, info, names);
+  for (size_t i = 0; i < names.size(); ++i) {
+    _patch[names[i]] = info[i];
+    _n_patch_face[names[i]] = info[i].faceCount;
+  }
+  _patch_int_size = _int_size;
+  /// Existing fields get further steps
+  fields::infoList field_info;
+  fields::nameList field_names;
+  fields::Read(_file, field_info, field_names);
+  for (size_t i = 0; i < field_names.size(); ++i)
+    _field[field_names[i]] = field_info[i];
+  /// Existing node steps too
+  nodeseries::Read(_file, _node_series);
   /// Debug print
   std::cerr << "_n_cell = " << _n_cell << "\n"
     << "_n_face = " << _n_face << "\n"
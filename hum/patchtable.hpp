@@ -0,0 +1,214 @@
+/*! \file patchtable.hpp
+ ** Boundary patch metadata as one compound table (PatchTable) and one
+ ** packed table of NUL terminated names (PatchNames), each read with a
+ ** single call. Files written before the tables existed keep a group per
+ ** patch under Patches and are read through the compatibility path.
+ **/
+
+#ifndef PATCHTABLE_HPP
+
+#define PATCHTABLE_HPP
+
+#include "types.hpp"
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <stdint.h>
+
+namespace patchtable {
+
+  typedef std::vector< patchBC<hsize_t> > infoList;
+  typedef std::vector< std::string > nameList;
+
+  /// Patches per chunk of the (extendible) PatchTable
+  const hsize_t tableChunk = 64;
+
+  /// Characters per chunk of the (extendible) PatchNames
+  const hsize_t nameChunk = 1024;
+
+  /*! \brief FNV-1a hash of a patch name */
+  uint64_t Hash(const std::string &name);
+
+  /*! \brief Open addressing hash index from the patch
+   **        name to the patch number
+   **/
+  class index {
+  public:
+    /// Constructor
+    index();
+
+    /// Index the names (patch number = position in names)
+    void build(const nameList &names);
+
+    /// Patch number of name, names.size() if not found
+    hsize_t find(const nameList &names, const std::string &name) const;
+
+    /// Drop the index
+    void clear();
+
+  private:
+    std::vector<hsize_t> _slot; /*!< Patch number + 1, 0 if empty */
+  };
+
+  /*! \brief True if the file holds the single patch table */
+  bool IsTable(hid_t file);
+
+  /*! \brief Read the patch table and the packed names */
+  void ReadTable(hid_t file, infoList &info, nameList &names);
+
+  /*! \brief Read the patches of older files, one PatchInfo
+   **        dataset per group (in name order)
+   **/
+  void ReadGroups(hid_t file, infoList &info, nameList &names);
+
+  /*! \brief Read the patches whichever way they are stored */
+  void Read(hid_t file, infoList &info, nameList &names);
+
+  /*! \brief (Re)write the patch table and the packed names.
+   **        int_size is the byte size of the stored integers.
+   **/
+  void WriteTable(hid_t file, const infoList &info, const nameList &names,
+    size_t int_size);
+
+  /***********   Implementation  ****************/
+
+  uint64_t Hash(const std::string &name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < name.size(); ++i) {
+      hash ^= (unsigned char) name[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  index
+  ::index() {
+    /* empty */
+  }
+
+  void index
+  ::build(const nameList &names) {
+    /// Power of two at least twice the patch count
+    size_t n_slot = 16;
+    while (n_slot < 2 * names.size()) n_slot <<= 1;
+    _slot.assign(n_slot, 0);
+    for (size_t i = 0; i < names.size(); ++i) {
+      size_t s = Hash(names[i]) & (n_slot - 1);
+      while (_slot[s] != 0) s = (s + 1) & (n_slot - 1);
+      _slot[s] = i + 1;
+    }
+  }
+
+  hsize_t index
+  ::find(const nameList &names, const std::string &name) const {
+    if (_slot.empty()) return names.size();
+    size_t mask = _slot.size() - 1;
+    for (size_t s = Hash(name) & mask; _slot[s] != 0; s = (s + 1) & mask)
+      if (names[_slot[s] - 1] == name) return _slot[s] - 1;
+    return names.size();
+  }
+
+  void index
+  ::clear() {
+    _slot.clear();
+  }
+
+  bool IsTable(hid_t file) {
+    return h5pp::IsValidLink(file, hum::patchTableLink[hum::PRIMARY]);
+  }
+
+  void ReadTable(hid_t file, infoList &info, nameList &names) {
+    H5TPatch<hsize_t> H5T;
+    h5pp::listString link;
+    /// The compound table
+    link.push_back(hum::patchTableLink[hum::PRIMARY]);
+    hsize_t npatch = h5pp::GetVectorLength<hsize_t>(file, link);
+    info.resize(npatch);
+    if (npatch > 0)
+      h5pp::ReadVectorDataSerial(file, &info[0], H5T.mem_t(),
+      link, 0, 1, npatch);
+    link.pop_back();
+    /// The packed names
+    link.push_back(hum::patchTableLink[hum::SECONDARY]);
+    hsize_t n_char = h5pp::GetVectorLength<hsize_t>(file, link);
+    std::vector<char> packed(n_char + 1, '\0');
+    if (n_char > 0)
+      h5pp::ReadVectorDataSerial(file, &packed[0], H5T_NATIVE_CHAR,
+      link, 0, 1, n_char);
+    names.resize(npatch);
+    hsize_t offset = 0;
+    for (hsize_t i = 0; i < npatch; ++i) {
+      /// Every name starts and ends (NUL) within the packed table
+      const char *name = &packed[offset];
+      const void *end = (offset < n_char) ?
+        std::memchr(name, '\0', n_char - offset) : NULL;
+      if (end == NULL) {
+        std::cerr << "Error: " << hum::patchTableLink[hum::SECONDARY]
+          << " holds " << n_char << " characters, too few for name "
+          << i << " of " << npatch << " patches\n";
+        exit(1);
+      }
+      names[i].assign(name, static_cast<const char *> (end) - name);
+      offset += names[i].size() + 1;
+    }
+  }
+
+  void ReadGroups(hid_t file, infoList &info, nameList &names) {
+    H5TPatch<hsize_t> H5T;
+    h5pp::listString link;
+    link.push_back(hum::patchLink[hum::PRIMARY]);
+    info.clear();
+    names.clear();
+    if (h5pp::IsValidLink(file, link) == false) return;
+    hsize_t npatch = h5pp::GetSubGroupSize(file, link);
+    info.resize(npatch);
+    names.resize(npatch);
+    for (hsize_t i = 0; i < npatch; ++i) {
+      names[i] = h5pp::GetSubGroupName(file, i, link);
+      link.push_back(names[i]);
+      link.push_back(H5T.linkStr());
+      h5pp::ReadVectorDataSerial(file, &info[i], H5T.mem_t(),
+        link, 0, 1, 1);
+      link.pop_back();
+      link.pop_back();
+    }
+  }
+
+  void Read(hid_t file, infoList &info, nameList &names) {
+    if (IsTable(file) == true)
+      ReadTable(file, info, names);
+    else
+      ReadGroups(file, info, names);
+  }
+
+  void WriteTable(hid_t file, const infoList &info, const nameList &names,
+    size_t int_size) {
+    assert(info.size() == names.size());
+    hsize_t npatch = info.size();
+    H5TPatch<hsize_t> H5T;
+    H5TPatch<uint32_t> H5T32;
+    H5TPatch<uint64_t> H5T64;
+    hid_t &file_dtype = (int_size > 4) ? H5T64.file_t() : H5T32.file_t();
+    h5pp::listString link;
+    /// Patches come and go, both tables are resized to the new count
+    link.push_back(hum::patchTableLink[hum::PRIMARY]);
+    h5pp::WriteExtendible(file, npatch ? &info[0] : NULL, H5T.mem_t(),
+      file_dtype, link, npatch, tableChunk);
+    link.pop_back();
+    /// PatchNames follows the row order of the compound table
+    std::vector<char> packed;
+    for (hsize_t i = 0; i < npatch; ++i) {
+      packed.insert(packed.end(), names[i].begin(), names[i].end());
+      packed.push_back('\0');
+    }
+    hsize_t n_char = packed.size();
+    hid_t char_dtype = H5T_NATIVE_CHAR;
+    link.push_back(hum::patchTableLink[hum::SECONDARY]);
+    h5pp::WriteExtendible(file, n_char ? &packed[0] : NULL, char_dtype,
+      char_dtype, link, n_char, nameChunk);
+  }
+}
+
+#endif
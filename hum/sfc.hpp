@@ -7,7 +7,9 @@
 
 #define SFC_HPP
 
+#include "types/packedid.hpp"
 #include <bitset>
+#include <vector>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_sort.h>
 
@@ -98,6 +100,32 @@ namespace sfc {
     }
   }
 
+  /*! \brief Permutation of array O(N) in time for a permutation
+   **        held as chunk-local IDs. perm is only read, a bit per
+   **        entry marks the entries already in place
+   **        (Overloaded version)
+   **/
+  template< typename T, typename uintT >
+  void InplacePermutation(T *data, const packedIds<uintT> &perm,
+    size_t size) {
+    std::vector<bool> is_done(size, false);
+    T temp;
+    uintT j, k;
+    for (uintT i = 0; i < size; ++i) {
+      if (is_done[i] == false && i != perm[i]) {
+        temp = data[i];
+        j = i;
+        while (i != (k = perm[j])) {
+          data[j] = data[k];
+          is_done[j] = true;
+          j = k;
+        }
+        data[j] = temp;
+        is_done[j] = true;
+      }
+    }
+  }
+
   enum SFC_NUM_BITS {
     _10BIT, _20BIT, _NBIT
   };
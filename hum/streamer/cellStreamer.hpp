@@ -0,0 +1,163 @@
+/*! \brief cellStreamer.hpp
+ **  Streams the cell-face connectivity of polyhedral
+ **  cells through a CSR buffer
+ */
+#ifndef CELL_STREAMER_HPP
+
+#define CELL_STREAMER_HPP
+
+#include "ihstream.hpp"
+#include <vector>
+
+template<typename uintT>
+class cellStreamer {
+public:
+  cellStreamer(ihstream &in);
+
+  cellStreamer(ihstream &in, size_t num_cells);
+
+  const bool &isEof() const;
+
+  uintT GetNumCellFaces() const;
+
+  const uintT *GetCellFaces() const;
+
+  uintT *CellFacesData();
+
+  /*! \brief The current cell (valid until the next buffer fill) */
+  polyCell<uintT> CellData();
+
+  const uintT &GetElapsed() const;
+
+  void Increment();
+
+  void SetWriteBufOn();
+
+  void SetWriteBufOff();
+
+protected:
+
+private:
+  ihstream &_hum_in;
+  uintT _count;
+  bool _eof, _write_buf;
+  cellCSR<uintT> _cell_buf;
+  uintT _buf_size, _elapsed;
+
+  void FillUpBuffer();
+  void DumpBuffer();
+
+};
+
+template<typename uintT>
+cellStreamer<uintT>
+::cellStreamer(ihstream &in)
+: _hum_in(in),
+_count(0),
+_eof(in.nCell() == 0),
+_write_buf(false),
+_buf_size(in.nCell()),
+_elapsed(0) {
+  FillUpBuffer();
+}
+
+template<typename uintT>
+cellStreamer<uintT>
+::cellStreamer(ihstream &in, size_t num_cells)
+: _hum_in(in),
+_count(0),
+_eof(in.nCell() == 0),
+_write_buf(false),
+_buf_size(num_cells),
+_elapsed(0) {
+  /// If the user specified a buffer
+  /// size more than we need shrink it
+  if (num_cells > _hum_in.nCell())
+    _buf_size = _hum_in.nCell();
+  /// Read info into buffer
+  FillUpBuffer();
+}
+
+template<typename uintT>
+const bool &cellStreamer<uintT>
+::isEof() const {
+  return _eof;
+}
+
+template<typename uintT>
+void cellStreamer<uintT>
+::SetWriteBufOn() {
+  assert(_hum_in.is_read_write());
+  _write_buf = true;
+}
+
+template<typename uintT>
+void cellStreamer<uintT>
+::SetWriteBufOff() {
+  _write_buf = false;
+}
+
+template<typename uintT>
+uintT cellStreamer<uintT>
+::GetNumCellFaces() const {
+  return _cell_buf.count(_count);
+}
+
+template<typename uintT>
+const uintT *cellStreamer<uintT>
+::GetCellFaces() const {
+  return _cell_buf.facesOf(_count);
+}
+
+template<typename uintT>
+uintT *cellStreamer<uintT>
+::CellFacesData() {
+  return _cell_buf.facesOf(_count);
+}
+
+template<typename uintT>
+polyCell<uintT> cellStreamer<uintT>
+::CellData() {
+  return _cell_buf.at(_count);
+}
+
+template<typename uintT>
+const uintT &cellStreamer<uintT>
+::GetElapsed() const {
+  return _elapsed;
+}
+
+template<typename uintT>
+void cellStreamer<uintT>
+::Increment() {
+  _count++;
+  _elapsed++;
+  if (_elapsed == _hum_in.nCell()) /// Reached end-of-cell
+  {
+    _eof = true;
+    if (_write_buf == true) DumpBuffer();
+    return;
+  }
+  if (_count == _buf_size) /// Reached end-of-buffer
+  {
+    if (_write_buf == true) DumpBuffer();
+    FillUpBuffer();
+    _count = 0;
+  }
+}
+
+template<typename uintT>
+void cellStreamer<uintT>
+::DumpBuffer() {
+  _hum_in.write(_cell_buf, _elapsed - _count);
+}
+
+template<typename uintT>
+void cellStreamer<uintT>
+::FillUpBuffer() {
+  hsize_t size = _hum_in.nCell() - _elapsed;
+  if (size > _buf_size) size = _buf_size;
+  _hum_in.read(_cell_buf, _elapsed, size);
+}
+
+#endif
@@ -6,11 +6,15 @@
 #define FACE_LEFT_RIGHT_STREAMER_HPP
 
 #include "ihstream.hpp"
+#include "streamSpan.hpp"
+#include "ioThread.hpp"
 #include <vector>
 
 template<typename uintT>
 class faceLeftRightStreamer {
 public:
+  typedef streamSpan< leftRight<uintT> > spanType;
+
   faceLeftRightStreamer(ihstream &in);
 
   faceLeftRightStreamer(ihstream &in, size_t num_faces);
@@ -31,6 +35,17 @@ public:
 
   void Increment();
 
+  /*! \brief The current internal face and the rest of the
+   **        buffered internal faces
+   **/
+  spanType GetSpan();
+
+  /*! \brief Move past all faces of GetSpan() */
+  void IncrementSpan();
+
+  /*! \brief Back to the first internal face and the first patch
+   **        (writes the buffers first if the write buffer is on)
+   **/
   void Rewind();
 
   /// Boundary streamer
@@ -61,40 +76,70 @@ public:
 
   void IncrementPatch();
 
+  /*! \brief The current patch face and the rest of the buffered
+   **        faces of the current patch (left is the patch cell)
+   **/
+  spanType GetPatchSpan();
+
+  /*! \brief Move past all faces of GetPatchSpan() */
+  void IncrementPatchSpan();
+
   void SetWriteBufOn();
 
   void SetWriteBufOff();
 
+  /*! \brief Keep a second internal face buffer: the next window
+   **        is read ahead and the modified window written behind on
+   **        a background thread while the current one is worked on
+   **        (serial streams only, patch faces stay synchronous)
+   **/
+  void SetAsyncOn();
+
+  void SetAsyncOff();
+
 protected:
 
 private:
   ihstream &_hum_in;
   uintT _count, _count_patch, _count_patch_face;
-  bool _eof, _eof_patch, _eof_patch_face, _write_buf;
+  bool _eof, _eof_patch, _eof_patch_face, _write_buf, _is_async;
   std::vector< leftRight<uintT> > _lr_buf;
   std::vector< leftRight<uintT> > _patch_lr_buf;
   uintT _buf_size, _elapsed, _elapsed_patch_face;
   uintT _patch_buf_size;
+  uintT _buf_fill, _patch_buf_fill; /*!< Faces read into the buffers */
+  /// The read-ahead / write-behind buffer of internal faces
+  std::vector< leftRight<uintT> > _next_buf;
+  hsize_t _next_offset, _next_size, _dump_offset, _dump_size;
+  ioThread _io; /*!< Last member, joined before the buffers go */
 
+  void ResetPatch();
   void FillUpBuffer();
   void FillUpPatchBuffer();
   void DumpBuffer();
   void DumpPatchBuffer();
+  void NextBuffer();
+  void StartAhead(hsize_t offset);
+  static void *AheadJob(void *arg);
 
 };
 
 template<typename uintT>
 faceLeftRightStreamer<uintT>
 ::faceLeftRightStreamer(ihstream &in)
-: _hum_in(in), _buf_size(in.nInternalFace()),
-_lr_buf(in.nInternalFace()), _count(0),
-_elapsed(0), _eof(false), _write_buf(false),
-_patch_lr_buf(in._max_patch_face),
+: _hum_in(in), _count(0),
 _count_patch(0), _count_patch_face(0),
-_eof_patch(false), _eof_patch_face(false),
-_elapsed_patch_face(0), _patch_buf_size(in._max_patch_face) {
+_eof(in.nInternalFace() == 0), _eof_patch(false),
+_eof_patch_face(false), _write_buf(false), _is_async(false),
+_lr_buf(in.nInternalFace()),
+_patch_lr_buf(in.max_patch_face()),
+_buf_size(in.nInternalFace()), _elapsed(0),
+_elapsed_patch_face(0), _patch_buf_size(in.max_patch_face()),
+_buf_fill(0), _patch_buf_fill(0),
+_next_offset(0), _next_size(0),
+_dump_offset(0), _dump_size(0) {
   FillUpBuffer();
-  FillUpPatchBuffer();
+  ResetPatch();
 }
 
 template<typename uintT>
@@ -102,21 +147,24 @@ faceLeftRightStreamer<uintT>
 ::faceLeftRightStreamer(ihstream &in, size_t num_faces)
 : _hum_in(in), _count(0),
 _count_patch(0), _count_patch_face(0),
-_eof(false), _eof_patch(false),
-_eof_patch_face(false), _write_buf(false),
+_eof(in.nInternalFace() == 0), _eof_patch(false),
+_eof_patch_face(false), _write_buf(false), _is_async(false),
 _buf_size(num_faces), _elapsed(0),
-_elapsed_patch_face(0), _patch_buf_size(num_faces) {
+_elapsed_patch_face(0), _patch_buf_size(num_faces),
+_buf_fill(0), _patch_buf_fill(0),
+_next_offset(0), _next_size(0),
+_dump_offset(0), _dump_size(0) {
   /// Check internal face sizes
   if (num_faces > _hum_in.nInternalFace())
     _buf_size = _hum_in.nInternalFace();
   _lr_buf.resize(_buf_size);
   /// Check patch face sizes
-  if (num_faces > _hum_in._max_patch_face)
-    _patch_buf_size = _hum_in._max_patch_face;
+  if (num_faces > _hum_in.max_patch_face())
+    _patch_buf_size = _hum_in.max_patch_face();
   _patch_lr_buf.resize(_patch_buf_size);
   /// Read data into buffer
   FillUpBuffer();
-  FillUpPatchBuffer();
+  ResetPatch();
 }
 
 template<typename uintT>
@@ -165,10 +213,7 @@ const uintT &faceLeftRightStreamer<uintT>
 template<typename uintT>
 void faceLeftRightStreamer<uintT>
 ::SetWriteBufOn() {
-  unsigned intent;
-  herr_t err = H5Fget_intent(_hum_in._file, &intent);
-  assert(err >= 0);
-  assert(intent == H5F_ACC_RDWR);
+  assert(_hum_in.is_read_write());
   _write_buf = true;
 }
 
@@ -178,6 +223,24 @@ void faceLeftRightStreamer<uintT>
   _write_buf = false;
 }
 
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::SetAsyncOn() {
+  if (_is_async == true || _hum_in._is_parallel == true) return;
+  _is_async = true;
+  _next_buf.resize(_buf_size);
+  _dump_size = 0;
+  if (_eof == false) StartAhead(_elapsed - _count + _buf_fill);
+}
+
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::SetAsyncOff() {
+  /// The read-ahead window is dropped, the next one is read in place
+  _io.wait();
+  _is_async = false;
+}
+
 template<typename uintT>
 void faceLeftRightStreamer<uintT>
 ::Increment() {
@@ -186,23 +249,66 @@ void faceLeftRightStreamer<uintT>
   _elapsed++;
   if (_elapsed == _hum_in.nInternalFace()) /// Reached end-of-face
   {
+    _io.wait();
     if (_write_buf == true) DumpBuffer();
     _eof = true;
     return;
   }
   if (_count == _buf_size) /// Reached end-of-buffer
   {
-    if (_write_buf == true) DumpBuffer();
-    FillUpBuffer();
+    if (_is_async == true)
+      NextBuffer();
+    else {
+      if (_write_buf == true) DumpBuffer();
+      FillUpBuffer();
+    }
     _count = 0;
   }
 }
 
+template<typename uintT>
+typename faceLeftRightStreamer<uintT>::spanType faceLeftRightStreamer<uintT>
+::GetSpan() {
+  return MakeSpan(&_lr_buf[_count], size_t(_buf_fill - _count));
+}
+
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::IncrementSpan() {
+  /// Skip to the last buffered face then step over it
+  uintT skip = _buf_fill - _count - 1;
+  _count += skip;
+  _elapsed += skip;
+  Increment();
+}
+
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::Rewind() {
+  _io.wait();
+  /// At end-of-face the last buffers are already written
+  if (_write_buf == true) {
+    if (_eof == false && _count > 0) DumpBuffer();
+    if (_eof_patch == false && _eof_patch_face == false
+      && _count_patch_face > 0) DumpPatchBuffer();
+  }
+  _count = 0;
+  _elapsed = 0;
+  _eof = (_hum_in.nInternalFace() == 0);
+  FillUpBuffer();
+  _dump_size = 0;
+  if (_is_async == true) StartAhead(_buf_fill);
+  _count_patch = 0;
+  ResetPatch();
+}
+
 template<typename uintT>
 void faceLeftRightStreamer<uintT>
 ::FillUpBuffer() {
   hsize_t size = _hum_in.nInternalFace() - _elapsed;
   if (size > _buf_size) size = _buf_size;
+  _buf_fill = size;
+  if (size == 0) return;
   _hum_in.read< leftRight<uintT>, H5TLeftRight<uintT> >
     (
     &_lr_buf[0], _elapsed, 1, size
@@ -218,6 +324,44 @@ void faceLeftRightStreamer<uintT>
     );
 }
 
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::NextBuffer() {
+  _io.wait();
+  assert(_next_offset == _elapsed);
+  _lr_buf.swap(_next_buf);
+  _buf_fill = _next_size;
+  /// The retired window goes out with the next read-ahead
+  _dump_offset = _elapsed - _count;
+  _dump_size = (_write_buf == true) ? _count : 0;
+  StartAhead(_elapsed + _buf_fill);
+}
+
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::StartAhead(hsize_t offset) {
+  _next_offset = offset;
+  _next_size = _hum_in.nInternalFace() - offset;
+  if (_next_size > _buf_size) _next_size = _buf_size;
+  if (_next_size > 0 || _dump_size > 0)
+    _io.start(AheadJob, this);
+}
+
+template<typename uintT>
+void *faceLeftRightStreamer<uintT>
+::AheadJob(void *arg) {
+  /// The stream serialises the HDF5 calls of all threads
+  faceLeftRightStreamer &fs = *static_cast<faceLeftRightStreamer *> (arg);
+  if (fs._dump_size > 0)
+    fs._hum_in.write(&fs._next_buf[0], fs._dump_offset, 1, fs._dump_size);
+  if (fs._next_size > 0)
+    fs._hum_in.read< leftRight<uintT>, H5TLeftRight<uintT> >
+      (
+      &fs._next_buf[0], fs._next_offset, 1, fs._next_size
+      );
+  return NULL;
+}
+
 /// Boundary streamer
 
 template<typename uintT>
@@ -255,19 +399,19 @@ leftRight<uintT> &faceLeftRightStreamer<uintT>
 template<typename uintT>
 const std::string &faceLeftRightStreamer<uintT>
 ::GetPatchName() const {
-  return _hum_in._patch_name_by_num[ _count_patch ];
+  return _hum_in.get_patch_name(_count_patch);
 }
 
 template<typename uintT>
 const uintT &faceLeftRightStreamer<uintT>
 ::GetPatchType() const {
-  return _hum_in._patch_info_by_num[ _count_patch ].bcType;
+  return _hum_in.get_patch_info(_count_patch).bcType;
 }
 
 template<typename uintT>
 uintT faceLeftRightStreamer<uintT>
 ::GetPatchOffset() const {
-  return _hum_in._patch_info_by_num[ _count_patch ].startFace;
+  return _hum_in.get_patch_info(_count_patch).startFace;
 }
 
 template<typename uintT>
@@ -287,7 +431,7 @@ void faceLeftRightStreamer<uintT>
 ::IncrementPatchFace() {
   _count_patch_face++;
   _elapsed_patch_face++;
-  if (_elapsed_patch_face == _hum_in._patch_info_by_num[_count_patch].faceCount) {
+  if (_elapsed_patch_face == _hum_in.get_patch_info(_count_patch).faceCount) {
     if (_write_buf == true) DumpPatchBuffer();
     _eof_patch_face = true;
     return;
@@ -304,13 +448,39 @@ template<typename uintT>
 void faceLeftRightStreamer<uintT>
 ::IncrementPatch() {
   _count_patch++;
+  ResetPatch();
+}
+
+template<typename uintT>
+typename faceLeftRightStreamer<uintT>::spanType faceLeftRightStreamer<uintT>
+::GetPatchSpan() {
+  return MakeSpan(&_patch_lr_buf[_count_patch_face],
+    size_t(_patch_buf_fill - _count_patch_face));
+}
+
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::IncrementPatchSpan() {
+  /// Skip to the last buffered face then step over it
+  uintT skip = _patch_buf_fill - _count_patch_face - 1;
+  _count_patch_face += skip;
+  _elapsed_patch_face += skip;
+  IncrementPatchFace();
+}
+
+template<typename uintT>
+void faceLeftRightStreamer<uintT>
+::ResetPatch() {
+  /// Start of patch _count_patch
   _count_patch_face = 0;
-  _eof_patch_face = false;
   _elapsed_patch_face = 0;
-  if (_count_patch == _hum_in.nPatch()) {
-    _eof_patch = true;
+  _patch_buf_fill = 0;
+  _eof_patch = (_count_patch == _hum_in.nPatch());
+  if (_eof_patch == true) {
+    _eof_patch_face = true;
     return;
   }
+  _eof_patch_face = (_hum_in.get_patch_info(_count_patch).faceCount == 0);
   FillUpPatchBuffer();
 }
 
@@ -318,9 +488,11 @@ template<typename uintT>
 void faceLeftRightStreamer<uintT>
 ::FillUpPatchBuffer() {
   /// Calculate data chunk size
-  hsize_t size = _hum_in._patch_info_by_num[ _count_patch ].faceCount - _elapsed_patch_face;
-  hsize_t offset = _hum_in._patch_info_by_num[ _count_patch ].startFace;
+  hsize_t size = _hum_in.get_patch_info(_count_patch).faceCount - _elapsed_patch_face;
+  hsize_t offset = _hum_in.get_patch_info(_count_patch).startFace;
   if (size > _patch_buf_size) size = _patch_buf_size;
+  _patch_buf_fill = size;
+  if (size == 0) return;
   /// Read the chunk from hum file
   _hum_in.read< leftRight<uintT>, H5TLeftRight<uintT> >
     (
@@ -332,7 +504,7 @@ void faceLeftRightStreamer<uintT>
 template<typename uintT>
 void faceLeftRightStreamer<uintT>
 ::DumpPatchBuffer() {
-  hsize_t offset = _hum_in._patch_info_by_num[ _count_patch ].startFace;
+  hsize_t offset = _hum_in.get_patch_info(_count_patch).startFace;
   /// Read the chunk from hum file
   _hum_in.write
     (
@@ -1,51 +1,98 @@
 /*! \brief faceStreamer.hpp
- **
+ **  Streams the face-node connectivity in the layout of the file:
+ **  fixed size face records (Faces, hum-raw) or a CSR buffer
+ **  (offsets + flat node IDs) for CSR files
  */
 #ifndef FACE_STREAMER_HPP
 
 #define FACE_STREAMER_HPP
 
 #include "ihstream.hpp"
+#include "streamSpan.hpp"
+#include "ioThread.hpp"
 #include <vector>
+#include <iostream>
+#include <cstdlib>
 
 template<typename uintT>
 class faceStreamer {
 public:
+  typedef faceSpan<uintT> spanType;
+
   faceStreamer(ihstream &in);
 
   faceStreamer(ihstream &in, size_t num_faces);
 
   const bool &isEof() const;
 
-  const uintT &GetNumFaceNodes() const;
+  uintT GetNumFaceNodes() const;
 
   const uintT *GetFaceNodes() const;
 
   uintT *FaceNodesData();
 
+  /*! \brief The record of the current face. For CSR files it is
+   **        a copy put back when the streamer moves on. Polygons
+   **        of more than 4 nodes have no record (see GetFaceNodes).
+   **/
   face<uintT> &FaceData();
 
   const uintT &GetElapsed() const;
 
   void Increment();
 
+  /*! \brief The current face and the rest of the buffered faces
+   **        (packed from the records for files without CSR faces)
+   **/
+  faceSpan<uintT> GetSpan();
+
+  /*! \brief Move past all faces of GetSpan() */
+  void IncrementSpan();
+
+  /*! \brief Back to the first face (writes the buffer
+   **        first if the write buffer is on)
+   **/
   void Rewind();
 
   void SetWriteBufOn();
 
   void SetWriteBufOff();
 
+  /*! \brief Keep a second buffer: the next window is read ahead
+   **        and the modified window written behind on a background
+   **        thread while the current one is worked on (serial
+   **        streams only)
+   **/
+  void SetAsyncOn();
+
+  void SetAsyncOff();
+
 protected:
 
 private:
   ihstream &_hum_in;
   uintT _count;
-  bool _eof, _write_buf;
-  std::vector< face<uintT> > _face_buf;
+  bool _eof, _write_buf, _is_async, _is_csr;
+  faceCSR<uintT> _face_buf; /*!< CSR faces (and spans of records) */
+  std::vector< face<uintT> > _rec_buf; /*!< Fixed size face records */
   uintT _buf_size, _elapsed;
-
+  /// Views handed out: the record of a CSR face, the span of records
+  face<uintT> _face;
+  bool _is_face, _is_span;
+  size_t _span_at;
+  /// The read-ahead / write-behind buffers
+  faceCSR<uintT> _next_buf;
+  std::vector< face<uintT> > _next_rec;
+  hsize_t _next_offset, _next_size, _dump_offset, _dump_size;
+  ioThread _io; /*!< Last member, joined before the buffers go */
+
+  size_t BufFill() const;
+  void Sync();
   void FillUpBuffer();
   void DumpBuffer();
+  void NextBuffer();
+  void StartAhead(hsize_t offset);
+  static void *AheadJob(void *arg);
 
 };
 
@@ -54,11 +101,15 @@ faceStreamer<uintT>
 ::faceStreamer(ihstream &in)
 : _hum_in(in),
 _count(0),
-_eof(false),
+_eof(in.nFace() == 0),
 _write_buf(false),
-_face_buf(in.nFace()),
+_is_async(false),
+_is_csr(in.is_face_csr()),
 _buf_size(in.nFace()),
-_elapsed(0) {
+_elapsed(0),
+_is_face(false), _is_span(false), _span_at(0),
+_next_offset(0), _next_size(0),
+_dump_offset(0), _dump_size(0) {
   FillUpBuffer();
 }
 
@@ -67,17 +118,21 @@ faceStreamer<uintT>
 ::faceStreamer(ihstream &in, size_t num_faces)
 : _hum_in(in),
 _count(0),
-_eof(false),
+_eof(in.nFace() == 0),
 _write_buf(false),
+_is_async(false),
+_is_csr(in.is_face_csr()),
 _buf_size(num_faces),
-_elapsed(0) {
+_elapsed(0),
+_is_face(false), _is_span(false), _span_at(0),
+_next_offset(0), _next_size(0),
+_dump_offset(0), _dump_size(0) {
   /// If the user specified a buffer
   /// size more than we need shrink it
   if (num_faces > _hum_in.nFace())
     _buf_size = _hum_in.nFace();
-  _face_buf.resize(_buf_size),
-    /// Read info into buffer
-    FillUpBuffer();
+  /// Read info into buffer
+  FillUpBuffer();
 }
 
 template<typename uintT>
@@ -89,10 +144,7 @@ const bool &faceStreamer<uintT>
 template<typename uintT>
 void faceStreamer<uintT>
 ::SetWriteBufOn() {
-  unsigned intent;
-  herr_t err = H5Fget_intent(_hum_in._file, &intent);
-  assert(err >= 0);
-  assert(intent == H5F_ACC_RDWR);
+  assert(_hum_in.is_read_write());
   _write_buf = true;
 }
 
@@ -103,27 +155,59 @@ void faceStreamer<uintT>
 }
 
 template<typename uintT>
-const uintT &faceStreamer<uintT>
+void faceStreamer<uintT>
+::SetAsyncOn() {
+  if (_is_async == true || _hum_in._is_parallel == true) return;
+  _is_async = true;
+  _dump_size = 0;
+  if (_eof == false) StartAhead(_elapsed - _count + BufFill());
+}
+
+template<typename uintT>
+void faceStreamer<uintT>
+::SetAsyncOff() {
+  /// The read-ahead window is dropped, the next one is read in place
+  _io.wait();
+  _is_async = false;
+}
+
+template<typename uintT>
+uintT faceStreamer<uintT>
 ::GetNumFaceNodes() const {
-  return _face_buf[_count].bField;
+  if (_is_csr == false) return _rec_buf[_count].bField;
+  return _face_buf.count(_count);
 }
 
 template<typename uintT>
 const uintT *faceStreamer<uintT>
 ::GetFaceNodes() const {
-  return _face_buf[_count].entityID;
+  if (_is_csr == false) return _rec_buf[_count].entityID;
+  return _face_buf.nodesOf(_count);
 }
 
 template<typename uintT>
 uintT *faceStreamer<uintT>
 ::FaceNodesData() {
-  return _face_buf[_count].entityID;
+  if (_is_csr == false) return _rec_buf[_count].entityID;
+  return _face_buf.nodesOf(_count);
 }
 
 template<typename uintT>
 face<uintT> &faceStreamer<uintT>
 ::FaceData() {
-  return _face_buf[_count];
+  if (_is_csr == false) return _rec_buf[_count];
+  if (_is_face == true) return _face;
+  _face = face<uintT>();
+  _face.bField = _face_buf.count(_count);
+  if (_face.bField > 4) {
+    std::cerr << "Error: face " << _elapsed << " has " << _face.bField
+      << " nodes, more than a face record holds (use GetFaceNodes)\n";
+    exit(1);
+  }
+  std::copy(_face_buf.nodesOf(_count),
+    _face_buf.nodesOf(_count) + _face.bField, _face.entityID);
+  _is_face = true;
+  return _face;
 }
 
 template<typename uintT>
@@ -135,28 +219,106 @@ const uintT &faceStreamer<uintT>
 template<typename uintT>
 void faceStreamer<uintT>
 ::Increment() {
+  Sync();
   _count++;
   _elapsed++;
   if (_elapsed == _hum_in.nFace()) /// Reached end-of-face
   {
     _eof = true;
+    _io.wait();
     if (_write_buf == true) DumpBuffer();
     return;
   }
   if (_count == _buf_size) /// Reached end-of-buffer
   {
-    if (_write_buf == true) DumpBuffer();
-    FillUpBuffer();
+    if (_is_async == true)
+      NextBuffer();
+    else {
+      if (_write_buf == true) DumpBuffer();
+      FillUpBuffer();
+    }
     _count = 0;
   }
 }
 
+template<typename uintT>
+faceSpan<uintT> faceStreamer<uintT>
+::GetSpan() {
+  Sync();
+  faceSpan<uintT> span;
+  span.size = BufFill() - _count;
+  if (_is_csr == true) {
+    span.offsets = &_face_buf.offsets[_count];
+    span.nodes = _face_buf.nodesOf(_count);
+    return span;
+  }
+  /// Records are packed, the span goes back when moving on
+  _face_buf.pack(&_rec_buf[_count], span.size, 0);
+  _is_span = true;
+  _span_at = _count;
+  span.offsets = &_face_buf.offsets[0];
+  span.nodes = _face_buf.nodesOf(0);
+  return span;
+}
+
+template<typename uintT>
+void faceStreamer<uintT>
+::IncrementSpan() {
+  /// Skip to the last buffered face then step over it
+  Sync();
+  uintT skip = BufFill() - _count - 1;
+  _count += skip;
+  _elapsed += skip;
+  Increment();
+}
+
+template<typename uintT>
+void faceStreamer<uintT>
+::Rewind() {
+  Sync();
+  _io.wait();
+  /// At end-of-face the last buffer is already written
+  if (_write_buf == true && _eof == false && _count > 0) DumpBuffer();
+  _count = 0;
+  _elapsed = 0;
+  _eof = (_hum_in.nFace() == 0);
+  FillUpBuffer();
+  _dump_size = 0;
+  if (_is_async == true) StartAhead(BufFill());
+}
+
+template<typename uintT>
+size_t faceStreamer<uintT>
+::BufFill() const {
+  return (_is_csr == true) ? _face_buf.size() : _rec_buf.size();
+}
+
+template<typename uintT>
+void faceStreamer<uintT>
+::Sync() {
+  if (_is_face == true) {
+    std::copy(_face.entityID, _face.entityID + _face_buf.count(_count),
+      _face_buf.nodesOf(_count));
+    _is_face = false;
+  }
+  if (_is_span == true) {
+    if (_write_buf == true)
+      _face_buf.unpack(&_rec_buf[_span_at], _face_buf.size());
+    _is_span = false;
+  }
+}
+
 template<typename uintT>
 void faceStreamer<uintT>
 ::DumpBuffer() {
+  if (_is_csr == false) {
+    if (_count > 0)
+      _hum_in.write(&_rec_buf[0], _elapsed - _count, 1, _count);
+    return;
+  }
   _hum_in.write
     (
-    &_face_buf[0], _elapsed - _count, 1, _count
+    _face_buf, _elapsed - _count, _count
     );
 }
 
@@ -165,11 +327,56 @@ void faceStreamer<uintT>
 ::FillUpBuffer() {
   hsize_t size = _hum_in.nFace() - _elapsed;
   if (size > _buf_size) size = _buf_size;
-  _hum_in.read< face<uintT>, H5TFace<uintT> >
-    (
-    &_face_buf[0], _elapsed, 1, size
-    );
+  if (_is_csr == true) {
+    _hum_in.read(_face_buf, _elapsed, size);
+    return;
+  }
+  /// Records are read as stored
+  _rec_buf.resize(size);
+  if (size > 0) _hum_in.read(&_rec_buf[0], _elapsed, size);
 }
 
-#endif
+template<typename uintT>
+void faceStreamer<uintT>
+::NextBuffer() {
+  _io.wait();
+  assert(_next_offset == _elapsed);
+  _face_buf.swap(_next_buf);
+  _rec_buf.swap(_next_rec);
+  /// The retired window goes out with the next read-ahead
+  _dump_offset = _elapsed - _count;
+  _dump_size = (_write_buf == true) ? _count : 0;
+  StartAhead(_elapsed + BufFill());
+}
+
+template<typename uintT>
+void faceStreamer<uintT>
+::StartAhead(hsize_t offset) {
+  _next_offset = offset;
+  _next_size = _hum_in.nFace() - offset;
+  if (_next_size > _buf_size) _next_size = _buf_size;
+  if (_next_size > 0 || _dump_size > 0)
+    _io.start(AheadJob, this);
+}
 
+template<typename uintT>
+void *faceStreamer<uintT>
+::AheadJob(void *arg) {
+  /// The stream serialises the HDF5 calls of all threads
+  faceStreamer &fs = *static_cast<faceStreamer *> (arg);
+  if (fs._is_csr == true) {
+    if (fs._dump_size > 0)
+      fs._hum_in.write(fs._next_buf, fs._dump_offset, fs._dump_size);
+    if (fs._next_size > 0)
+      fs._hum_in.read(fs._next_buf, fs._next_offset, fs._next_size);
+    return NULL;
+  }
+  if (fs._dump_size > 0)
+    fs._hum_in.write(&fs._next_rec[0], fs._dump_offset, 1, fs._dump_size);
+  fs._next_rec.resize(fs._next_size);
+  if (fs._next_size > 0)
+    fs._hum_in.read(&fs._next_rec[0], fs._next_offset, fs._next_size);
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*! \brief faceZipStreamer.hpp
+ **  Streams the face-node connectivity and the left/right cells of
+ **  the faces in lock step: one refill reads both datasets for the
+ **  same window, first through the internal faces then patch by
+ **  patch. Windows never cross from one section (internal faces or
+ **  a patch) into the next, so a span lies in a single section.
+ */
+#ifndef FACE_ZIP_STREAMER_HPP
+
+#define FACE_ZIP_STREAMER_HPP
+
+#include "ihstream.hpp"
+#include "streamSpan.hpp"
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+
+/*! \brief Faces of a window seen from one face on, with their
+ **        left/right cells (lr[i] belongs to face i)
+ **/
+template<typename uintT>
+struct faceZipSpan {
+  size_t size; /*!< Number of faces */
+  const uint64_t *offsets; /*!< size + 1 global node positions */
+  uintT *nodes; /*!< Node IDs of the first face on */
+  leftRight<uintT> *lr; /*!< Left/right cells of the first face on */
+  hsize_t first; /*!< Face ID of the first face */
+
+  /// The face-node part
+  faceSpan<uintT> faces() const {
+    faceSpan<uintT> span;
+    span.size = size;
+    span.offsets = offsets;
+    span.nodes = nodes;
+    return span;
+  }
+
+  /// The left/right part
+  streamSpan< leftRight<uintT> > leftRights() const {
+    return MakeSpan(lr, size);
+  }
+};
+
+/*! \brief Face nodes and left/right cells of one window */
+template<typename uintT>
+struct faceZipWindow {
+  faceCSR<uintT> faces;
+  std::vector< leftRight<uintT> > lr;
+
+  /// Read both datasets for the faces [offset, offset + size)
+  void read(ihstream &in, hsize_t offset, hsize_t size) {
+    in.read(faces, offset, size);
+    lr.resize(size);
+    if (size > 0) in.read(&lr[0], offset, size);
+  }
+
+  /// The faces first on
+  faceZipSpan<uintT> span(size_t first, size_t size, hsize_t offset) {
+    faceZipSpan<uintT> s;
+    s.size = size;
+    s.offsets = &faces.offsets[first];
+    s.nodes = faces.nodesOf(first);
+    s.lr = &lr[first];
+    s.first = offset + first;
+    return s;
+  }
+};
+
+template<typename uintT>
+class faceZipStreamer {
+public:
+  typedef faceZipSpan<uintT> spanType;
+
+  faceZipStreamer(ihstream &in);
+
+  faceZipStreamer(ihstream &in, size_t num_faces);
+
+  const bool &isEof() const;
+
+  /*! \brief Section of the current face: 0 for internal faces,
+   **        p + 1 for the faces of patch p
+   **/
+  const hsize_t &GetSection() const;
+
+  bool isInternal() const;
+
+  /*! \brief Patch of the current face (not for internal faces) */
+  hsize_t GetPatchNum() const;
+
+  const std::string &GetPatchName() const;
+
+  uintT GetNumFaceNodes() const;
+
+  const uintT *GetFaceNodes() const;
+
+  uintT *FaceNodesData();
+
+  const uintT &GetLeftCell() const;
+
+  /*! \brief Right cell of the current (internal) face */
+  const uintT &GetRightCell() const;
+
+  leftRight<uintT> &FaceLRData();
+
+  const hsize_t &GetElapsed() const;
+
+  void Increment();
+
+  /*! \brief The current face and the rest of the buffered faces of
+   **        its section
+   **/
+  spanType GetSpan();
+
+  /*! \brief Move past all faces of GetSpan() */
+  void IncrementSpan();
+
+  /*! \brief Back to the first face (writes the buffer first if the
+   **        write buffer is on)
+   **/
+  void Rewind();
+
+  /*! \brief Write the face nodes and the left/right cells back
+   **        when moving past a window
+   **/
+  void SetWriteBufOn();
+
+  void SetWriteBufOff();
+
+protected:
+
+private:
+  ihstream &_hum_in;
+  hsize_t _count, _section;
+  bool _eof, _write_buf;
+  faceZipWindow<uintT> _buf;
+  hsize_t _buf_size, _buf_fill, _elapsed;
+  std::vector<hsize_t> _section_end; /*!< Past the last face of each */
+
+  void SetSections();
+  void NextSection();
+  void FillUpBuffer();
+  void DumpBuffer();
+
+};
+
+template<typename uintT>
+faceZipStreamer<uintT>
+::faceZipStreamer(ihstream &in)
+: _hum_in(in), _count(0), _section(0),
+_eof(in.nFace() == 0), _write_buf(false),
+_buf_size(in.nFace()), _buf_fill(0), _elapsed(0) {
+  SetSections();
+  Rewind();
+}
+
+template<typename uintT>
+faceZipStreamer<uintT>
+::faceZipStreamer(ihstream &in, size_t num_faces)
+: _hum_in(in), _count(0), _section(0),
+_eof(in.nFace() == 0), _write_buf(false),
+_buf_size(num_faces), _buf_fill(0), _elapsed(0) {
+  /// If the user specified a buffer
+  /// size more than we need shrink it
+  if (num_faces > _hum_in.nFace())
+    _buf_size = _hum_in.nFace();
+  SetSections();
+  Rewind();
+}
+
+template<typename uintT>
+const bool &faceZipStreamer<uintT>
+::isEof() const {
+  return _eof;
+}
+
+template<typename uintT>
+const hsize_t &faceZipStreamer<uintT>
+::GetSection() const {
+  return _section;
+}
+
+template<typename uintT>
+bool faceZipStreamer<uintT>
+::isInternal() const {
+  return _section == 0;
+}
+
+template<typename uintT>
+hsize_t faceZipStreamer<uintT>
+::GetPatchNum() const {
+  assert(_section > 0);
+  return _section - 1;
+}
+
+template<typename uintT>
+const std::string &faceZipStreamer<uintT>
+::GetPatchName() const {
+  return _hum_in.get_patch_name(GetPatchNum());
+}
+
+template<typename uintT>
+uintT faceZipStreamer<uintT>
+::GetNumFaceNodes() const {
+  return _buf.faces.count(_count);
+}
+
+template<typename uintT>
+const uintT *faceZipStreamer<uintT>
+::GetFaceNodes() const {
+  return _buf.faces.nodesOf(_count);
+}
+
+template<typename uintT>
+uintT *faceZipStreamer<uintT>
+::FaceNodesData() {
+  return _buf.faces.nodesOf(_count);
+}
+
+template<typename uintT>
+const uintT &faceZipStreamer<uintT>
+::GetLeftCell() const {
+  return _buf.lr[_count].left;
+}
+
+template<typename uintT>
+const uintT &faceZipStreamer<uintT>
+::GetRightCell() const {
+  assert(_section == 0);
+  return _buf.lr[_count].right;
+}
+
+template<typename uintT>
+leftRight<uintT> &faceZipStreamer<uintT>
+::FaceLRData() {
+  return _buf.lr[_count];
+}
+
+template<typename uintT>
+const hsize_t &faceZipStreamer<uintT>
+::GetElapsed() const {
+  return _elapsed;
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::SetWriteBufOn() {
+  assert(_hum_in.is_read_write());
+  _write_buf = true;
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::SetWriteBufOff() {
+  _write_buf = false;
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::Increment() {
+  _count++;
+  _elapsed++;
+  if (_count < _buf_fill) return;
+  /// Reached end-of-buffer (or end-of-section)
+  if (_write_buf == true) DumpBuffer();
+  if (_elapsed == _section_end[_section]) NextSection();
+  if (_eof == true) return;
+  FillUpBuffer();
+}
+
+template<typename uintT>
+typename faceZipStreamer<uintT>::spanType faceZipStreamer<uintT>
+::GetSpan() {
+  return _buf.span(_count, _buf_fill - _count, _elapsed - _count);
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::IncrementSpan() {
+  /// Skip to the last buffered face then step over it
+  hsize_t skip = _buf_fill - _count - 1;
+  _count += skip;
+  _elapsed += skip;
+  Increment();
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::Rewind() {
+  /// At end-of-face the last buffer is already written
+  if (_write_buf == true && _eof == false && _count > 0) DumpBuffer();
+  _count = 0;
+  _elapsed = 0;
+  _section = 0;
+  _buf_fill = 0;
+  _eof = (_hum_in.nFace() == 0);
+  /// An empty internal section (or patch) is skipped
+  if (_eof == false && _section_end[0] == 0) NextSection();
+  if (_eof == false) FillUpBuffer();
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::SetSections() {
+  /// Patches follow the internal faces back to back
+  _section_end.resize(_hum_in.nPatch() + 1);
+  _section_end[0] = _hum_in.nInternalFace();
+  for (hsize_t p = 0; p < _hum_in.nPatch(); ++p) {
+    const patchBC<hsize_t> &patch = _hum_in.get_patch_info(p);
+    if (patch.startFace != _section_end[p]) {
+      std::cerr << "Error: patch " << _hum_in.get_patch_name(p)
+        << " starts at face " << patch.startFace << ", expected "
+        << _section_end[p] << " (patches must follow the internal"
+        << " faces back to back)\n";
+      exit(1);
+    }
+    _section_end[p + 1] = patch.startFace + patch.faceCount;
+  }
+  if (_section_end.back() != _hum_in.nFace()) {
+    std::cerr << "Error: the patches end at face " << _section_end.back()
+      << ", the mesh has " << _hum_in.nFace() << " faces\n";
+    exit(1);
+  }
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::NextSection() {
+  /// Patches without faces are passed over
+  while (_section + 1 < _section_end.size() &&
+    _section_end[_section] == _elapsed)
+    _section++;
+  _eof = (_elapsed == _hum_in.nFace());
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::FillUpBuffer() {
+  hsize_t size = _section_end[_section] - _elapsed;
+  if (size > _buf_size) size = _buf_size;
+  _buf.read(_hum_in, _elapsed, size);
+  _buf_fill = size;
+  _count = 0;
+}
+
+template<typename uintT>
+void faceZipStreamer<uintT>
+::DumpBuffer() {
+  if (_count == 0) return;
+  _hum_in.write
+    (
+    _buf.faces, _elapsed - _count, _count
+    );
+  _hum_in.write
+    (
+    &_buf.lr[0], _elapsed - _count, 1, _count
+    );
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*! \brief fieldStreamer.hpp
+ **  Streams one step of a solution field through a window of
+ **  entities. Values of any entity can be fetched too, so a cell
+ **  field follows the left/right cells of faceLeftRightStreamer
+ **  (SFC ordered cells of nearby faces share the window).
+ */
+#ifndef FIELD_STREAMER_HPP
+
+#define FIELD_STREAMER_HPP
+
+#include "ihstream.hpp"
+#include <vector>
+
+template<typename floatT>
+class fieldStreamer {
+public:
+  fieldStreamer(ihstream &in, const std::string &name, hsize_t step);
+
+  fieldStreamer(ihstream &in, const std::string &name, hsize_t step,
+    size_t num_entities);
+
+  const bool &isEof() const;
+
+  unsigned GetNumComponents() const;
+
+  /*! \brief Values of the current entity (nComponents) */
+  const floatT *GetValues();
+
+  /*! \brief Values of entity (the window moves to it if needed) */
+  const floatT *EntityValues(hsize_t entity);
+
+  const hsize_t &GetElapsed() const;
+
+  void Increment();
+
+  void Rewind();
+
+protected:
+
+private:
+  ihstream &_hum_in;
+  hsize_t _num, _step;
+  unsigned _n_comp;
+  bool _eof;
+  std::vector<floatT> _buf;
+  hsize_t _buf_size, _n_entity;
+  hsize_t _win_start, _win_size, _elapsed;
+
+  void Init(const std::string &name, hsize_t step, size_t num_entities);
+  void FillUpBuffer(hsize_t start);
+
+};
+
+template<typename floatT>
+fieldStreamer<floatT>
+::fieldStreamer(ihstream &in, const std::string &name, hsize_t step)
+: _hum_in(in) {
+  Init(name, step, 0);
+}
+
+template<typename floatT>
+fieldStreamer<floatT>
+::fieldStreamer(ihstream &in, const std::string &name, hsize_t step,
+  size_t num_entities)
+: _hum_in(in) {
+  Init(name, step, num_entities);
+}
+
+template<typename floatT>
+const bool &fieldStreamer<floatT>
+::isEof() const {
+  return _eof;
+}
+
+template<typename floatT>
+unsigned fieldStreamer<floatT>
+::GetNumComponents() const {
+  return _n_comp;
+}
+
+template<typename floatT>
+const floatT *fieldStreamer<floatT>
+::GetValues() {
+  return EntityValues(_elapsed);
+}
+
+template<typename floatT>
+const floatT *fieldStreamer<floatT>
+::EntityValues(hsize_t entity) {
+  assert(entity < _n_entity);
+  if (entity < _win_start || entity >= _win_start + _win_size) {
+    /// Going back keeps half a window ahead of entity
+    hsize_t lead = 0;
+    if (entity < _win_start) lead = std::min(entity, _buf_size / 2);
+    FillUpBuffer(entity - lead);
+  }
+  return &_buf[(entity - _win_start) * _n_comp];
+}
+
+template<typename floatT>
+const hsize_t &fieldStreamer<floatT>
+::GetElapsed() const {
+  return _elapsed;
+}
+
+template<typename floatT>
+void fieldStreamer<floatT>
+::Increment() {
+  _elapsed++;
+  if (_elapsed == _n_entity) /// Reached end-of-field
+    _eof = true;
+}
+
+template<typename floatT>
+void fieldStreamer<floatT>
+::Rewind() {
+  _elapsed = 0;
+  _eof = (_n_entity == 0);
+}
+
+template<typename floatT>
+void fieldStreamer<floatT>
+::Init(const std::string &name, hsize_t step, size_t num_entities) {
+  _num = _hum_in.get_field_num(name);
+  assert(_num < _hum_in.nField());
+  _step = step;
+  _n_comp = _hum_in.get_field_info(_num).nComponents;
+  _n_entity = _hum_in.get_field_size(_num);
+  /// The whole field if no (or too large a) window is given
+  _buf_size = _n_entity;
+  if (num_entities > 0 && num_entities < _n_entity)
+    _buf_size = num_entities;
+  _buf.resize(_buf_size * _n_comp);
+  _win_start = 0;
+  _win_size = 0;
+  Rewind();
+}
+
+template<typename floatT>
+void fieldStreamer<floatT>
+::FillUpBuffer(hsize_t start) {
+  hsize_t size = _n_entity - start;
+  if (size > _buf_size) size = _buf_size;
+  _hum_in.read_field(_num, _step, &_buf[0], start, size);
+  _win_start = start;
+  _win_size = size;
+}
+
+#endif
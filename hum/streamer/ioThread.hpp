@@ -0,0 +1,71 @@
+/*! \brief ioThread.hpp
+ **  One background I/O job at a time for the streamers: while the
+ **  caller works on the current window the job writes back the window
+ **  before it and reads the window after it.
+ */
+#ifndef IO_THREAD_HPP
+
+#define IO_THREAD_HPP
+
+#include <pthread.h>
+
+class ioThread {
+public:
+  typedef void *(*jobType)(void *);
+
+  ioThread();
+
+  /*! \brief Waits for the running job */
+  ~ioThread();
+
+  /*! \brief Run job(arg) in the background, after the previous job
+   **        finished. If no thread can be started the job runs
+   **        before start returns.
+   **/
+  void start(jobType job, void *arg);
+
+  /*! \brief Wait for the running job (if any) */
+  void wait();
+
+  const bool &isBusy() const;
+
+private:
+  pthread_t _thread;
+  bool _is_busy;
+
+  /// Non copyable
+  ioThread(const ioThread &);
+  ioThread &operator=(const ioThread &);
+};
+
+ioThread
+::ioThread()
+: _is_busy(false) {
+  /* empty */
+}
+
+ioThread
+::~ioThread() {
+  wait();
+}
+
+void ioThread
+::start(jobType job, void *arg) {
+  wait();
+  _is_busy = (pthread_create(&_thread, NULL, job, arg) == 0);
+  if (_is_busy == false) job(arg);
+}
+
+void ioThread
+::wait() {
+  if (_is_busy == false) return;
+  pthread_join(_thread, NULL);
+  _is_busy = false;
+}
+
+const bool &ioThread
+::isBusy() const {
+  return _is_busy;
+}
+
+#endif
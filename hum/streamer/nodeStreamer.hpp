@@ -1,16 +1,20 @@
 /*! \brief nodeStreamer.hpp
- **
+ **  Streams the node coordinates through a buffer
  */
 #ifndef NODE_STREAMER_HPP
 
 #define NODE_STREAMER_HPP
 
-#include "ihstream.h"
-#include<vector>
+#include "ihstream.hpp"
+#include "streamSpan.hpp"
+#include "ioThread.hpp"
+#include <vector>
 
 template<typename floatT>
 class nodeStreamer {
 public:
+  typedef streamSpan< node<floatT> > spanType;
+
   nodeStreamer(ihstream &in);
 
   nodeStreamer(ihstream &in, size_t num_nodes);
@@ -27,52 +31,84 @@ public:
 
   floatT *XYZData();
 
-  const floatT &GetElapsed() const;
+  const hsize_t &GetElapsed() const;
 
   void Increment();
 
+  /*! \brief The current node and the rest of the buffered nodes */
+  spanType GetSpan();
+
+  /*! \brief Move past all nodes of GetSpan() */
+  void IncrementSpan();
+
+  /*! \brief Back to the first node (writes the buffer first if
+   **        the write buffer is on)
+   **/
   void Rewind();
 
   void SetWriteBufOn();
 
   void SetWriteBufOff();
 
+  /*! \brief Keep a second buffer: the next window is read ahead
+   **        and the modified window written behind on a background
+   **        thread while the current one is worked on (serial
+   **        streams only)
+   **/
+  void SetAsyncOn();
+
+  void SetAsyncOff();
+
 protected:
 
 private:
   ihstream &_hum_in;
-  floatT _count;
-  bool _eof, _write_buf;
+  hsize_t _count;
+  bool _eof, _write_buf, _is_async;
   std::vector< node<floatT> > _node_buf;
-  floatT _buf_size, _elapsed;
+  hsize_t _buf_size, _elapsed;
+  hsize_t _buf_fill; /*!< Nodes read into the buffer */
+  /// The read-ahead / write-behind buffer
+  std::vector< node<floatT> > _next_buf;
+  hsize_t _next_offset, _next_size, _dump_offset, _dump_size;
+  ioThread _io; /*!< Last member, joined before the buffers go */
 
   void FillUpBuffer();
   void DumpBuffer();
+  void NextBuffer();
+  void StartAhead(hsize_t offset);
+  static void *AheadJob(void *arg);
 
 };
 
 template<typename floatT>
 nodeStreamer<floatT>
 ::nodeStreamer(ihstream &in)
-: _hum_in(in), _buf_size(in.nNode()),
-_node_buf(in.nNode()), _count(0),
-_elapsed(0), _eof(false), _write_buf(false) {
+: _hum_in(in), _count(0),
+_eof(in.nNode() == 0), _write_buf(false), _is_async(false),
+_node_buf(in.nNode()), _buf_size(in.nNode()),
+_elapsed(0), _buf_fill(0),
+_next_offset(0), _next_size(0),
+_dump_offset(0), _dump_size(0) {
   FillUpBuffer();
 }
 
 template<typename floatT>
 nodeStreamer<floatT>
 ::nodeStreamer(ihstream &in, size_t num_nodes)
-: _hum_in(in), _buf_size(num_nodes),
-_count(0), _elapsed(0), _eof(false),
-_write_buf(false) {
+: _hum_in(in), _count(0),
+_eof(in.nNode() == 0), _write_buf(false), _is_async(false),
+_buf_size(num_nodes), _elapsed(0),
+_buf_fill(0),
+_next_offset(0), _next_size(0),
+_dump_offset(0), _dump_size(0) {
   /// If the user specified a buffer
   /// size more than we need shrink it
   if (num_nodes > _hum_in.nNode())
     _buf_size = _hum_in.nNode();
-  _node_buf.resize(_buf_size),
-    /// Read info into buffer
-    FillUpBuffer();
+  _node_buf.resize(_buf_size);
+  /// Read info into buffer
+  FillUpBuffer();
 }
 
 template<typename floatT>
@@ -112,7 +148,7 @@ floatT *nodeStreamer<floatT>
 }
 
 template<typename floatT>
-const floatT &nodeStreamer<floatT>
+const hsize_t &nodeStreamer<floatT>
 ::GetElapsed() const {
   return _elapsed;
 }
@@ -120,9 +156,7 @@ const floatT &nodeStreamer<floatT>
 template<typename floatT>
 void nodeStreamer<floatT>
 ::SetWriteBufOn() {
-  unsigned intent;
-  herr_t err = H5Fget_intent(_hum_in._file, &intent);
-  assert(intent == H5F_ACC_RDWR);
+  assert(_hum_in.is_read_write());
   _write_buf = true;
 }
 
@@ -132,44 +166,130 @@ void nodeStreamer<floatT>
   _write_buf = false;
 }
 
+template<typename floatT>
+void nodeStreamer<floatT>
+::SetAsyncOn() {
+  if (_is_async == true || _hum_in._is_parallel == true) return;
+  _is_async = true;
+  _next_buf.resize(_buf_size);
+  _dump_size = 0;
+  if (_eof == false) StartAhead(_elapsed - _count + _buf_fill);
+}
+
+template<typename floatT>
+void nodeStreamer<floatT>
+::SetAsyncOff() {
+  /// The read-ahead window is dropped, the next one is read in place
+  _io.wait();
+  _is_async = false;
+}
+
 template<typename floatT>
 void nodeStreamer<floatT>
 ::Increment() {
   _count++;
   _elapsed++;
-  if (_elapsed == _hum_in.nNode()) /// Reached end-of-face
+  if (_elapsed == _hum_in.nNode()) /// Reached end-of-node
   {
     _eof = true;
+    _io.wait();
     if (_write_buf == true) DumpBuffer();
     return;
   }
   if (_count == _buf_size) /// Reached end-of-buffer
   {
-    if (_write_buf == true) DumpBuffer();
-    FillUpBuffer();
+    if (_is_async == true)
+      NextBuffer();
+    else {
+      if (_write_buf == true) DumpBuffer();
+      FillUpBuffer();
+    }
     _count = 0;
   }
 }
 
+template<typename floatT>
+typename nodeStreamer<floatT>::spanType nodeStreamer<floatT>
+::GetSpan() {
+  return MakeSpan(&_node_buf[_count], size_t(_buf_fill - _count));
+}
+
+template<typename floatT>
+void nodeStreamer<floatT>
+::IncrementSpan() {
+  /// Skip to the last buffered node then step over it
+  hsize_t skip = _buf_fill - _count - 1;
+  _count += skip;
+  _elapsed += skip;
+  Increment();
+}
+
+template<typename floatT>
+void nodeStreamer<floatT>
+::Rewind() {
+  _io.wait();
+  /// At end-of-node the last buffer is already written
+  if (_write_buf == true && _eof == false && _count > 0) DumpBuffer();
+  _count = 0;
+  _elapsed = 0;
+  _eof = (_hum_in.nNode() == 0);
+  FillUpBuffer();
+  _dump_size = 0;
+  if (_is_async == true) StartAhead(_buf_fill);
+}
+
 template<typename floatT>
 void nodeStreamer<floatT>
 ::FillUpBuffer() {
   hsize_t size = _hum_in.nNode() - _elapsed;
   if (size > _buf_size) size = _buf_size;
-  _hum_in.Read< node<floatT>, H5TNode<floatT> >
-    (
-    &_node_buf[0], _elapsed, 1, size
-    );
+  _buf_fill = size;
+  if (size == 0) return;
+  _hum_in.read(&_node_buf[0], _elapsed, size);
 }
 
 template<typename floatT>
 void nodeStreamer<floatT>
 ::DumpBuffer() {
-  _hum_in.Write
+  _hum_in.write
     (
     &_node_buf[0], _elapsed - _count, 1, _count
     );
 }
 
-#endif
+template<typename floatT>
+void nodeStreamer<floatT>
+::NextBuffer() {
+  _io.wait();
+  assert(_next_offset == _elapsed);
+  _node_buf.swap(_next_buf);
+  _buf_fill = _next_size;
+  /// The retired window goes out with the next read-ahead
+  _dump_offset = _elapsed - _count;
+  _dump_size = (_write_buf == true) ? _count : 0;
+  StartAhead(_elapsed + _buf_fill);
+}
+
+template<typename floatT>
+void nodeStreamer<floatT>
+::StartAhead(hsize_t offset) {
+  _next_offset = offset;
+  _next_size = _hum_in.nNode() - offset;
+  if (_next_size > _buf_size) _next_size = _buf_size;
+  if (_next_size > 0 || _dump_size > 0)
+    _io.start(AheadJob, this);
+}
 
+template<typename floatT>
+void *nodeStreamer<floatT>
+::AheadJob(void *arg) {
+  /// The stream serialises the HDF5 calls of all threads
+  nodeStreamer &ns = *static_cast<nodeStreamer *> (arg);
+  if (ns._dump_size > 0)
+    ns._hum_in.write(&ns._next_buf[0], ns._dump_offset, 1, ns._dump_size);
+  if (ns._next_size > 0)
+    ns._hum_in.read(&ns._next_buf[0], ns._next_offset, ns._next_size);
+  return NULL;
+}
+
+#endif
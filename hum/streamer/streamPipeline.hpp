@@ -0,0 +1,309 @@
+/*! \brief streamPipeline.hpp
+ **  Windows of a hum stream through a TBB pipeline: a serial in-order
+ **  read stage, a parallel transform stage and a serial in-order write
+ **  stage with a bounded number of windows in flight. Per-window work
+ **  of a streaming pass runs on all cores while the windows are read
+ **  and written in file order.
+ **
+ **  Transform runs a body (body(span, offset), span as handed out by
+ **  the streamers) over every window of a section (faceNodes,
+ **  faceLeftRight, faceZip or nodes); Run takes any stages type for
+ **  passes that reduce in the write stage.
+ */
+#ifndef STREAM_PIPELINE_HPP
+
+#define STREAM_PIPELINE_HPP
+
+#include "ihstream.hpp"
+#include "streamSpan.hpp"
+#include "faceZipStreamer.hpp"
+#include <vector>
+#include <tbb/blocked_range.h>
+
+/// The pipeline interface moved with oneTBB
+#if TBB_VERSION_MAJOR >= 2021
+#include <tbb/parallel_pipeline.h>
+#define PIPELINE_MODE(m) tbb::filter_mode::m
+#else
+#include <tbb/pipeline.h>
+#define PIPELINE_MODE(m) tbb::filter::m
+#endif
+
+namespace pipeline {
+
+  /// Default number of windows in flight
+  const unsigned defaultChunks = 8;
+
+  /*! \brief One window of a stream in flight */
+  template<typename bufferT>
+  struct chunk {
+    hsize_t offset; /*!< First entity */
+    hsize_t size; /*!< Number of entities */
+    bufferT buf;
+  };
+
+  /*! \brief Face-node connectivity of all faces (CSR windows) */
+  template<typename uintT>
+  struct faceNodes {
+    typedef faceCSR<uintT> bufferType;
+    typedef faceSpan<uintT> spanType;
+
+    static hsize_t Size(ihstream &in) {
+      return in.nFace();
+    }
+
+    static void Read(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      in.read(buf, offset, size);
+    }
+
+    static void Write(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      in.write(buf, offset, size);
+    }
+
+    static spanType Span(bufferType &buf, hsize_t, hsize_t size) {
+      spanType span;
+      span.size = size;
+      span.offsets = &buf.offsets[0];
+      span.nodes = buf.nodesOf(0);
+      return span;
+    }
+  };
+
+  /*! \brief Left/right cells of all faces (boundary faces, from
+   **        nInternalFace on, have only a left cell)
+   **/
+  template<typename uintT>
+  struct faceLeftRight {
+    typedef std::vector< leftRight<uintT> > bufferType;
+    typedef streamSpan< leftRight<uintT> > spanType;
+
+    static hsize_t Size(ihstream &in) {
+      return in.nFace();
+    }
+
+    static void Read(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      buf.resize(size);
+      in.read(&buf[0], offset, size);
+    }
+
+    static void Write(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      in.write(&buf[0], offset, 1, size);
+    }
+
+    static spanType Span(bufferType &buf, hsize_t, hsize_t size) {
+      return MakeSpan(&buf[0], size_t(size));
+    }
+  };
+
+  /*! \brief Face nodes and left/right cells of all faces, both
+   **        read for the same window
+   **/
+  template<typename uintT>
+  struct faceZip {
+    typedef faceZipWindow<uintT> bufferType;
+    typedef faceZipSpan<uintT> spanType;
+
+    static hsize_t Size(ihstream &in) {
+      return in.nFace();
+    }
+
+    static void Read(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      buf.read(in, offset, size);
+    }
+
+    static void Write(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      in.write(buf.faces, offset, size);
+      in.write(&buf.lr[0], offset, 1, size);
+    }
+
+    static spanType Span(bufferType &buf, hsize_t offset, hsize_t size) {
+      return buf.span(0, size_t(size), offset);
+    }
+  };
+
+  /*! \brief Node coordinates */
+  template<typename floatT>
+  struct nodes {
+    typedef std::vector< node<floatT> > bufferType;
+    typedef streamSpan< node<floatT> > spanType;
+
+    static hsize_t Size(ihstream &in) {
+      return in.nNode();
+    }
+
+    static void Read(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      buf.resize(size);
+      in.read(&buf[0], offset, size);
+    }
+
+    static void Write(ihstream &in, bufferType &buf, hsize_t offset,
+      hsize_t size) {
+      in.write(&buf[0], offset, 1, size);
+    }
+
+    static spanType Span(bufferType &buf, hsize_t, hsize_t size) {
+      return MakeSpan(&buf[0], size_t(size));
+    }
+  };
+
+  /*! \brief Stages running body(span, offset) over the windows of
+   **        section, written back if is_write
+   **/
+  template<typename sectionT, typename bodyT>
+  class transformStages {
+  public:
+    typedef chunk<typename sectionT::bufferType> chunkType;
+
+    transformStages(ihstream &in, const bodyT &body, hsize_t window,
+      bool is_write);
+
+    bool read(chunkType &c);
+
+    void transform(chunkType &c);
+
+    void write(chunkType &c);
+
+  private:
+    ihstream &_hum_in;
+    const bodyT &_body;
+    hsize_t _window, _offset, _n_entity;
+    bool _is_write;
+  };
+
+  /*! \brief Run the stages with at most max_chunks windows in flight:
+   **        stages.read(c) fills the next window (serial, in order,
+   **        false past the last one), stages.transform(c) runs in
+   **        parallel and stages.write(c) serial in order. The stages
+   **        type names its window type chunkType.
+   **/
+  template<typename stagesT>
+  void Run(stagesT &stages, unsigned max_chunks = defaultChunks);
+
+  /*! \brief Run body(span, offset) over all windows of section of the
+   **        stream, the windows are written back if is_write
+   **/
+  template<typename sectionT, typename bodyT>
+  void Transform(ihstream &in, const bodyT &body, hsize_t window,
+    bool is_write, unsigned max_chunks = defaultChunks);
+
+  /***********   Implementation  ****************/
+
+  template<typename sectionT, typename bodyT>
+  transformStages<sectionT, bodyT>
+  ::transformStages(ihstream &in, const bodyT &body, hsize_t window,
+    bool is_write)
+  : _hum_in(in), _body(body), _window(window), _offset(0),
+  _n_entity(sectionT::Size(in)), _is_write(is_write) {
+    assert(window > 0);
+  }
+
+  template<typename sectionT, typename bodyT>
+  bool transformStages<sectionT, bodyT>
+  ::read(chunkType &c) {
+    if (_offset >= _n_entity) return false;
+    c.offset = _offset;
+    c.size = std::min(_window, _n_entity - _offset);
+    sectionT::Read(_hum_in, c.buf, c.offset, c.size);
+    _offset += c.size;
+    return true;
+  }
+
+  template<typename sectionT, typename bodyT>
+  void transformStages<sectionT, bodyT>
+  ::transform(chunkType &c) {
+    _body(sectionT::Span(c.buf, c.offset, c.size), c.offset);
+  }
+
+  template<typename sectionT, typename bodyT>
+  void transformStages<sectionT, bodyT>
+  ::write(chunkType &c) {
+    if (_is_write == true)
+      sectionT::Write(_hum_in, c.buf, c.offset, c.size);
+  }
+
+  /// The three filters of Run. Windows are taken round robin from
+  /// the pool: with at most pool size tokens alive, the window read
+  /// into a slot left the write stage before.
+
+  template<typename stagesT>
+  struct readFilter {
+    typedef typename stagesT::chunkType chunkType;
+    stagesT *stages;
+    std::vector<chunkType> *pool;
+    size_t *count;
+
+    chunkType *operator()(tbb::flow_control &fc) const {
+      chunkType &c = (*pool)[*count % pool->size()];
+      if (stages->read(c) == false) {
+        fc.stop();
+        return NULL;
+      }
+      (*count)++;
+      return &c;
+    }
+  };
+
+  template<typename stagesT>
+  struct transformFilter {
+    typedef typename stagesT::chunkType chunkType;
+    stagesT *stages;
+
+    chunkType *operator()(chunkType *c) const {
+      stages->transform(*c);
+      return c;
+    }
+  };
+
+  template<typename stagesT>
+  struct writeFilter {
+    typedef typename stagesT::chunkType chunkType;
+    stagesT *stages;
+
+    void operator()(chunkType *c) const {
+      stages->write(*c);
+    }
+  };
+
+  template<typename stagesT>
+  void Run(stagesT &stages, unsigned max_chunks) {
+    typedef typename stagesT::chunkType chunkType;
+    assert(max_chunks > 0);
+    std::vector<chunkType> pool(max_chunks);
+    size_t count = 0;
+    readFilter<stagesT> read_f;
+    read_f.stages = &stages;
+    read_f.pool = &pool;
+    read_f.count = &count;
+    transformFilter<stagesT> transform_f;
+    transform_f.stages = &stages;
+    writeFilter<stagesT> write_f;
+    write_f.stages = &stages;
+    /// The stream serialises the HDF5 calls of the read and write stage
+    tbb::parallel_pipeline
+      (
+      max_chunks,
+      tbb::make_filter<void, chunkType *>
+      (PIPELINE_MODE(serial_in_order), read_f) &
+      tbb::make_filter<chunkType *, chunkType *>
+      (PIPELINE_MODE(parallel), transform_f) &
+      tbb::make_filter<chunkType *, void>
+      (PIPELINE_MODE(serial_in_order), write_f)
+      );
+  }
+
+  template<typename sectionT, typename bodyT>
+  void Transform(ihstream &in, const bodyT &body, hsize_t window,
+    bool is_write, unsigned max_chunks) {
+    transformStages<sectionT, bodyT> stages(in, body, window, is_write);
+    Run(stages, max_chunks);
+  }
+}
+
+#endif
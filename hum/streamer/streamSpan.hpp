@@ -0,0 +1,126 @@
+/*! \brief streamSpan.hpp
+ **  Contiguous views of a streamer buffer and a range over the
+ **  buffer refills of a streamer, so user loops run over plain
+ **  arrays instead of one Increment() per entity:
+ **
+ **    chunkRange< faceLeftRightStreamer<uintT> > chunks(fs_lr);
+ **    for (chunkRange<...>::iterator c = chunks.begin();
+ **      c != chunks.end(); ++c) {
+ **      streamSpan< leftRight<uintT> > lr = *c;
+ **      for (size_t i = 0; i < lr.size(); ++i) ...
+ **    }
+ **
+ **  (or `for (auto lr : chunks(fs_lr)) for (auto &f : lr)` in C++11).
+ */
+#ifndef STREAM_SPAN_HPP
+
+#define STREAM_SPAN_HPP
+
+#include <cstddef>
+#include <iterator>
+
+/*! \brief A contiguous run of buffered entities. Valid until
+ **        the streamer moves past it.
+ **/
+template<typename T>
+struct streamSpan {
+  T *first; /*!< First entity */
+  size_t count; /*!< Number of entities */
+
+  size_t size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  T *begin() const {
+    return first;
+  }
+
+  T *end() const {
+    return first + count;
+  }
+
+  T &operator[](size_t i) const {
+    return first[i];
+  }
+};
+
+/*! \brief Make a span of count entities at first */
+template<typename T>
+streamSpan<T> MakeSpan(T *first, size_t count) {
+  streamSpan<T> span;
+  span.first = first;
+  span.count = count;
+  return span;
+}
+
+/*! \brief Input range over the spans of a streamer: dereferencing
+ **        gives GetSpan(), incrementing IncrementSpan(), the range
+ **        ends at isEof(). The streamer type names its span type
+ **        spanType.
+ **/
+template<typename streamerT>
+class chunkRange {
+public:
+  typedef typename streamerT::spanType spanType;
+
+  class iterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef spanType value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const spanType *pointer;
+    typedef spanType reference;
+
+    explicit iterator(streamerT *s) : _s(s) { }
+
+    spanType operator*() const {
+      return _s->GetSpan();
+    }
+
+    iterator &operator++() {
+      _s->IncrementSpan();
+      return *this;
+    }
+
+    /// Only the end test is meaningful for an input range
+    bool operator==(const iterator &other) const {
+      return at_end() == other.at_end();
+    }
+
+    bool operator!=(const iterator &other) const {
+      return at_end() != other.at_end();
+    }
+
+  private:
+    streamerT *_s;
+
+    bool at_end() const {
+      return _s == 0 || _s->isEof() == true;
+    }
+  };
+
+  explicit chunkRange(streamerT &s) : _s(&s) { }
+
+  iterator begin() const {
+    return iterator(_s);
+  }
+
+  iterator end() const {
+    return iterator(0);
+  }
+
+private:
+  streamerT *_s;
+};
+
+/*! \brief Range over the spans of s */
+template<typename streamerT>
+chunkRange<streamerT> chunks(streamerT &s) {
+  return chunkRange<streamerT>(s);
+}
+
+#endif
@@ -0,0 +1,280 @@
+/*! \file subfile.hpp
+ ** Sub-filing of hum datasets. Every I/O aggregator appends the blocks
+ ** of its ranks to its own sub-file and records where each block sits in
+ ** the global dataset. When the master file is closed it receives one
+ ** HDF5 virtual dataset per global dataset mapping the sub-file blocks
+ ** back to their global offsets, so ihstream, the streamers and the tools
+ ** keep seeing ordinary global datasets. Needs HDF5 >= 1.10.
+ **/
+
+#ifndef SUBFILE_HPP
+
+#define SUBFILE_HPP
+
+#include "types.hpp"
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <climits>
+
+#if H5_VERSION_GE(1,10,0)
+#define H5PP_VIRTUAL
+#endif
+
+namespace subfile {
+
+  /*! \brief One block of a global dataset stored contiguously
+   **        in a sub-file
+   **/
+  template <typename uintT>
+  struct extent {
+    uintT globalStart;
+    uintT count;
+    uintT localStart;
+  };
+
+  typedef std::vector< extent<hsize_t> > extentList;
+
+  /// Bytes an aggregator gathers from its ranks in one round
+  const size_t gatherBytes = size_t(1) << 28;
+
+  /*! \brief The extent HDF5 type data-structure
+   **
+   **/
+  template < typename uintT >
+  struct H5TExtent : public humType {
+  public:
+
+    /*! \brief Constructor commits the HDF5
+     **        type extent to the extent struct
+     **/
+    H5TExtent() {
+      _mtype = H5Tcreate(H5T_COMPOUND, sizeof ( extent<uintT>));
+      H5Tinsert(_mtype, "GlobalStart", HOFFSET(extent<uintT>, globalStart),
+        h5pp::GetHDF5Type<uintT>());
+      H5Tinsert(_mtype, "Count", HOFFSET(extent<uintT>, count),
+        h5pp::GetHDF5Type<uintT>());
+      H5Tinsert(_mtype, "LocalStart", HOFFSET(extent<uintT>, localStart),
+        h5pp::GetHDF5Type<uintT>());
+      _ftype = H5Tcopy(_mtype);
+      _link = hum::subFileLink[hum::PRIMARY];
+    }
+  };
+
+  /*! \brief Name of the sub-file with the given id */
+  std::string SubFileName(const std::string &fname, unsigned id) {
+    std::stringstream cat;
+    cat << fname << "." << id;
+    return cat.str();
+  }
+
+  /*! \brief Strip the directory part of a path (virtual dataset
+   **        sources are resolved relative to the master file)
+   **/
+  std::string BaseName(const std::string &path) {
+    size_t pos = path.find_last_of('/');
+    return (pos == std::string::npos) ? path : path.substr(pos + 1);
+  }
+
+  /*! \brief Split a "/" separated object path into a link */
+  h5pp::listString PathToLink(const std::string &path) {
+    h5pp::listString link;
+    std::stringstream cat(path);
+    std::string item;
+    while (std::getline(cat, item, '/'))
+      if (item.empty() == false) link.push_back(item);
+    return link;
+  }
+
+  /*! \brief Elements gathered from every rank of a group of n_rank
+   **        per round, so that a round stays within gatherBytes (one
+   **        at least). Stops the run when a single element per rank
+   **        already overflows the int counts of MPI_Gatherv.
+   **/
+  hsize_t GatherRound(size_t elem_bytes, int n_rank, MPI_Comm comm) {
+    if (elem_bytes * size_t(n_rank) > size_t(INT_MAX)) {
+      std::cerr << "Error: gathering " << elem_bytes << " byte elements from "
+        << n_rank << " ranks overflows the MPI counts\n";
+      MPI_Abort(comm, 1);
+    }
+    return std::max(hsize_t(1), hsize_t(gatherBytes / (elem_bytes * n_rank)));
+  }
+
+  /*! \brief Appends count elements to the (extendible) dataset given
+   **        by link in the sub-file and records the global extent.
+   **        A new dataset is created with dcpl (chunked, filters
+   **        included) unless it is H5P_DEFAULT.
+   **/
+  void AppendBlock(hid_t sub_file, h5pp::listString &link,
+    const void *data, hid_t mem_dtype, hid_t file_dtype,
+    hsize_t global_offset, hsize_t count, extentList &extents,
+    hid_t dcpl = H5P_DEFAULT) {
+    if (count == 0) return;
+    hid_t dset;
+    hsize_t local = 0, stride = 1;
+    std::string cat = h5pp::ListStringToString(link);
+    h5pp::CreateGroupForDset(sub_file, link);
+    if (h5pp::IsValidLink(sub_file, link) == false) {
+      hsize_t zero = 0, unlimited = H5S_UNLIMITED;
+      hsize_t chunk = std::min(count, hsize_t(65536));
+      hid_t dspace = H5Screate_simple(1, &zero, &unlimited);
+      hid_t plist = dcpl;
+      if (dcpl == H5P_DEFAULT) {
+        plist = H5Pcreate(H5P_DATASET_CREATE);
+        H5Pset_chunk(plist, 1, &chunk);
+      }
+      dset = H5Dcreate(sub_file, cat.c_str(), file_dtype, dspace,
+        H5P_DEFAULT, plist, H5P_DEFAULT);
+      if (dcpl == H5P_DEFAULT) H5Pclose(plist);
+      H5Sclose(dspace);
+    } else {
+      dset = H5Dopen2(sub_file, cat.c_str(), H5P_DEFAULT);
+      hid_t dspace = H5Dget_space(dset);
+      H5Sget_simple_extent_dims(dspace, &local, NULL);
+      H5Sclose(dspace);
+    }
+    hsize_t new_size = local + count;
+    herr_t status = H5Dset_extent(dset, &new_size);
+    assert(status >= 0);
+    hid_t dspace_mem = H5Screate_simple(1, &count, NULL);
+    hid_t dspace_file = H5Dget_space(dset);
+    status = H5Sselect_hyperslab(dspace_file, H5S_SELECT_SET, &local,
+      &stride, &count, NULL);
+    status = H5Dwrite(dset, mem_dtype, dspace_mem, dspace_file,
+      H5P_DEFAULT, data);
+    assert(status >= 0);
+    H5Sclose(dspace_mem);
+    H5Sclose(dspace_file);
+    H5Dclose(dset);
+    /// Merge with the previous block if contiguous in both files
+    if (extents.empty() == false &&
+      extents.back().globalStart + extents.back().count == global_offset &&
+      extents.back().localStart + extents.back().count == local) {
+      extents.back().count += count;
+      return;
+    }
+    extent<hsize_t> ext;
+    ext.globalStart = global_offset;
+    ext.count = count;
+    ext.localStart = local;
+    extents.push_back(ext);
+  }
+
+  /*! \brief Stores the extents of the dataset given by link in the
+   **        sub-file index together with the global dataset size
+   **/
+  void WriteIndex(hid_t sub_file, h5pp::listString &link,
+    extentList &extents, hsize_t global_size) {
+    H5TExtent<hsize_t> H5T;
+    h5pp::listString index_link = link;
+    index_link.push_front(hum::subFileLink[hum::PRIMARY]);
+    h5pp::WriteVectorDataSerial
+      (
+      sub_file, &extents[0], H5T.mem_t(), H5T.file_t(), index_link,
+      0, 1, extents.size(), extents.size()
+      );
+    index_link.push_back(hum::subFileLink[hum::FIELD]);
+    h5pp::WriteAttribute(sub_file, index_link, global_size);
+  }
+
+  /*! \brief H5Lvisit callback collecting the index datasets (soft
+   **        and external links are not followed)
+   **/
+  herr_t CollectIndex(hid_t group, const char *name,
+    const H5L_info_t *info, void *op_data) {
+    std::vector<std::string> *names =
+      static_cast<std::vector<std::string> *> (op_data);
+    if (info->type == H5L_TYPE_HARD && h5pp::IsDataset(group, name) == true)
+      names->push_back(name);
+    return 0;
+  }
+
+  /*! \brief Creates the virtual datasets of the master file from
+   **        the indices of all n_subfile sub-files (call once)
+   **/
+  void MakeVirtualView(hid_t master, const std::string &fname,
+    unsigned n_subfile) {
+#ifdef H5PP_VIRTUAL
+    H5TExtent<hsize_t> H5T;
+    hsize_t stride = 1;
+    std::map<std::string, hid_t> dcpl, dtype;
+    std::map<std::string, hsize_t> global_size;
+    for (unsigned id = 0; id < n_subfile; ++id) {
+      std::string sub_name = SubFileName(fname, id);
+      hid_t sub_file = H5Fopen(sub_name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      assert(sub_file >= 0);
+      /// Sub-file of an aggregator without data
+      if (h5pp::IsValidLink(sub_file, hum::subFileLink[hum::PRIMARY]) == false) {
+        H5Fclose(sub_file);
+        continue;
+      }
+      std::vector<std::string> names;
+      hid_t index = H5Gopen(sub_file, hum::subFileLink[hum::PRIMARY], H5P_DEFAULT);
+      H5Lvisit(index, H5_INDEX_NAME, H5_ITER_INC, CollectIndex, &names);
+      H5Gclose(index);
+      for (size_t i = 0; i < names.size(); ++i) {
+        std::string path = "/" + names[i];
+        h5pp::listString index_link = PathToLink(names[i]);
+        index_link.push_front(hum::subFileLink[hum::PRIMARY]);
+        /// Read the extents of this dataset
+        extentList extents(h5pp::GetVectorLength<hsize_t>(sub_file, index_link));
+        h5pp::ReadVectorDataSerial
+          (
+          sub_file, &extents[0], H5T.mem_t(), index_link,
+          0, 1, extents.size()
+          );
+        if (dcpl.find(path) == dcpl.end()) {
+          index_link.push_back(hum::subFileLink[hum::FIELD]);
+          global_size[path] = h5pp::ReadAttribute<hsize_t>(sub_file, index_link);
+          hid_t dset = H5Dopen2(sub_file, path.c_str(), H5P_DEFAULT);
+          dtype[path] = H5Dget_type(dset);
+          H5Dclose(dset);
+          dcpl[path] = H5Pcreate(H5P_DATASET_CREATE);
+        }
+        /// Map every block to its global position
+        hsize_t local_size = 0;
+        for (size_t j = 0; j < extents.size(); ++j)
+          local_size = std::max(local_size, extents[j].localStart + extents[j].count);
+        hid_t vspace = H5Screate_simple(1, &global_size[path], NULL);
+        hid_t sspace = H5Screate_simple(1, &local_size, NULL);
+        for (size_t j = 0; j < extents.size(); ++j) {
+          H5Sselect_hyperslab(vspace, H5S_SELECT_SET, &extents[j].globalStart,
+            &stride, &extents[j].count, NULL);
+          H5Sselect_hyperslab(sspace, H5S_SELECT_SET, &extents[j].localStart,
+            &stride, &extents[j].count, NULL);
+          herr_t status = H5Pset_virtual(dcpl[path], vspace,
+            BaseName(sub_name).c_str(), path.c_str(), sspace);
+          assert(status >= 0);
+        }
+        H5Sclose(vspace);
+        H5Sclose(sspace);
+      }
+      H5Fclose(sub_file);
+    }
+    /// Create the global virtual datasets
+    for (std::map<std::string, hid_t>::iterator it = dcpl.begin();
+      it != dcpl.end(); ++it) {
+      h5pp::listString link = PathToLink(it->first);
+      h5pp::CreateGroupForDset(master, link);
+      hid_t vspace = H5Screate_simple(1, &global_size[it->first], NULL);
+      hid_t dset = H5Dcreate(master, it->first.c_str(), dtype[it->first],
+        vspace, H5P_DEFAULT, it->second, H5P_DEFAULT);
+      assert(dset >= 0);
+      H5Dclose(dset);
+      H5Sclose(vspace);
+      H5Pclose(it->second);
+      H5Tclose(dtype[it->first]);
+    }
+    h5pp::listString link;
+    link.push_back(hum::subFileLink[hum::SECONDARY]);
+    h5pp::WriteAttribute(master, link, n_subfile);
+#else
+    assert(false && "sub-filing needs virtual datasets (HDF5 >= 1.10)");
+#endif
+  }
+
+} // end of subfile namespace
+
+#endif
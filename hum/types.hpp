@@ -13,6 +13,7 @@
 #include "types/face.hpp"
 #include "types/cell.hpp"
 #include "types/patch.hpp"
+#include "types/packedid.hpp"
 #include "constants.hpp"
 
 struct humType {
@@ -6,6 +6,10 @@
 
 #define CELL_ENTITY_HPP
 
+#include "face.hpp"
+#include <vector>
+#include <cstddef>
+
 /*! \brief Cell entity of the mesh
  **        Contains the face IDs
  **        forming the cell
@@ -75,12 +79,77 @@ private:
 
 /*! \brief polyCell entity of the mesh
  **        Contains the face IDs forming
- **        the polyhedral cell
+ **        the polyhedral cell. The IDs are
+ **        not owned (they point into a cellCSR)
+ **        and the face orientation follows from
+ **        the face left/right cells.
  **/
 template <typename uintT>
 struct polyCell {
-  uintT bField;
-  uintT *entityIDs;
+  uintT bField; /*!< Number of faces */
+  uintT *entityIDs; /*!< Face IDs */
+};
+
+/*! \brief A window of polyhedral cells in compressed row
+ **        storage (CSR). offsets hold size + 1 positions in
+ **        the flat cell-face array (nFace + nInternalFace long)
+ **        and faces holds the face IDs of the window back to back.
+ **        The positions are 64-bit like those of faceCSR.
+ **/
+template <typename uintT>
+struct cellCSR {
+  std::vector<uint64_t> offsets;
+  std::vector<uintT> faces;
+
+  /// Number of cells in the window
+  size_t size() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+
+  /// Number of faces of cell i
+  uintT count(size_t i) const {
+    return offsets[i + 1] - offsets[i];
+  }
+
+  /// Face IDs of cell i
+  uintT *facesOf(size_t i) {
+    return &faces[0] + (offsets[i] - offsets[0]);
+  }
+
+  /// Face IDs of cell i
+  const uintT *facesOf(size_t i) const {
+    return &faces[0] + (offsets[i] - offsets[0]);
+  }
+
+  /// Cell i as a polyCell
+  polyCell<uintT> at(size_t i) {
+    polyCell<uintT> c;
+    c.bField = count(i);
+    c.entityIDs = facesOf(i);
+    return c;
+  }
+
+  /// Build all n_cell cells from the face left/right cells (any
+  /// indexable ID arrays, e.g. packedIds). Faces from n_internal_face
+  /// on are boundary faces (left cell only). The faces of a cell are
+  /// in increasing face ID order.
+  template< typename idArrayT >
+  void build(const idArrayT &left, const idArrayT &right, size_t n_face,
+    size_t n_internal_face, size_t n_cell) {
+    offsets.assign(n_cell + 1, 0);
+    for (size_t i = 0; i < n_face; ++i) {
+      offsets[uintT(left[i]) + 1]++;
+      if (i < n_internal_face) offsets[uintT(right[i]) + 1]++;
+    }
+    for (size_t i = 0; i < n_cell; ++i)
+      offsets[i + 1] += offsets[i];
+    faces.resize(offsets[n_cell]);
+    std::vector<uint64_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < n_face; ++i) {
+      faces[fill[uintT(left[i])]++] = i;
+      if (i < n_internal_face) faces[fill[uintT(right[i])]++] = i;
+    }
+  }
 };
 
 #endif
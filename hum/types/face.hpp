@@ -7,6 +7,9 @@
 #define FACE_ENTITY_HPP
 
 #include<algorithm>
+#include<vector>
+#include<cassert>
+#include<stdint.h>
 
 namespace common {
   const unsigned face_bucket_size = 100000;
@@ -22,6 +25,93 @@ struct face {
   uintT entityID[4];
 };
 
+/*! \brief A window of faces in compressed row storage (CSR).
+ **        offsets hold size + 1 positions in the flat face-node
+ **        array (FaceAdjncySize long, window relative when read
+ **        from fixed size Faces records) and nodes holds the
+ **        node IDs of the window back to back. The positions are
+ **        64-bit whatever uintT is: a mesh with 32-bit IDs may
+ **        have more than 4G face-node entries (only then are they
+ **        stored at 64 bits).
+ **/
+template< typename uintT >
+struct faceCSR {
+  std::vector<uint64_t> offsets;
+  std::vector<uintT> nodes;
+
+  /// Number of faces in the window
+  size_t size() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+
+  /// Number of nodes of face i
+  uintT count(size_t i) const {
+    return offsets[i + 1] - offsets[i];
+  }
+
+  /// Node IDs of face i
+  uintT *nodesOf(size_t i) {
+    return &nodes[0] + (offsets[i] - offsets[0]);
+  }
+
+  /// Node IDs of face i
+  const uintT *nodesOf(size_t i) const {
+    return &nodes[0] + (offsets[i] - offsets[0]);
+  }
+
+  /// Pack n faces whose first node sits at first_node
+  void pack(const face<uintT> *f, size_t n, uint64_t first_node) {
+    offsets.resize(n + 1);
+    offsets[0] = first_node;
+    for (size_t i = 0; i < n; ++i) {
+      assert(f[i].bField <= 4);
+      offsets[i + 1] = offsets[i] + f[i].bField;
+    }
+    nodes.resize(offsets[n] - first_node);
+    for (size_t i = 0; i < n; ++i)
+      std::copy(f[i].entityID, f[i].entityID + f[i].bField, nodesOf(i));
+  }
+
+  /// Append a face of n nodes (polygons of any size)
+  void append(const uintT *ids, uintT n) {
+    if (offsets.empty()) offsets.push_back(0);
+    nodes.insert(nodes.end(), ids, ids + n);
+    offsets.push_back(offsets.back() + n);
+  }
+
+  /// Drop all faces of the window
+  void clear() {
+    offsets.clear();
+    nodes.clear();
+  }
+
+  /// Exchange the windows without copying
+  void swap(faceCSR &other) {
+    offsets.swap(other.offsets);
+    nodes.swap(other.nodes);
+  }
+
+  /// Unpack the first n faces of the window
+  void unpack(face<uintT> *f, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+      f[i].bField = count(i);
+      assert(f[i].bField <= 4);
+      std::fill(f[i].entityID, f[i].entityID + 4, uintT(0));
+      std::copy(nodesOf(i), nodesOf(i) + count(i), f[i].entityID);
+    }
+  }
+};
+
+/*! \brief Faces of a CSR window seen from one face on: the nodes
+ **        of face i start at nodes[offsets[i] - offsets[0]]
+ **/
+template< typename uintT >
+struct faceSpan {
+  size_t size; /*!< Number of faces */
+  const uint64_t *offsets; /*!< size + 1 global node positions */
+  uintT *nodes; /*!< Node IDs of the first face on */
+};
+
 /*! \brief The internal cell left/right cell
  **        
  **        
@@ -0,0 +1,238 @@
+/*! \file packedid.hpp
+ **       Chunk-local IDs: an in-memory array of entity IDs
+ **       that keeps one base per chunk and 32-bit offsets
+ **/
+#ifndef PACKED_ID_HPP
+
+#define PACKED_ID_HPP
+
+#include<vector>
+#include<algorithm>
+#include<cassert>
+#include<cstddef>
+#include<stdint.h>
+
+/*! \brief Array of uintT IDs stored as a uintT base for every
+ **        chunk of chunkSize entries plus a 32-bit offset per entry.
+ **        Once a mesh is SFC ordered the IDs inside a chunk span a
+ **        small range, so 64-bit IDs cost little more than 32-bit
+ **        ones. A chunk whose IDs span more than 32 bits is kept
+ **        wide (full uintT entries) so any value can be stored.
+ **        Elements are read by value and written through a proxy
+ **        (ids[i] = v works as for a std::vector).
+ **/
+template< typename uintT >
+class packedIds {
+public:
+  /// Entries per chunk (one base each)
+  static const size_t chunkSize = 1024;
+
+  /*! \brief Assignable reference to one entry */
+  class reference {
+  public:
+
+    reference(packedIds<uintT> &ids, size_t i)
+    : _ids(ids), _i(i) {
+      /* empty */
+    }
+
+    operator uintT() const {
+      return _ids.get(_i);
+    }
+
+    reference &operator=(uintT v) {
+      _ids.set(_i, v);
+      return *this;
+    }
+
+    reference &operator=(const reference &r) {
+      _ids.set(_i, uintT(r));
+      return *this;
+    }
+
+  private:
+    packedIds<uintT> &_ids;
+    size_t _i;
+  };
+
+  packedIds() {
+    /* empty */
+  }
+
+  explicit packedIds(size_t n) {
+    resize(n);
+  }
+
+  /// Number of entries
+  size_t size() const {
+    return _offset.size();
+  }
+
+  /// Resize (new entries are undefined until set, so that the
+  /// first entry set in a new chunk becomes its base)
+  void resize(size_t n) {
+    size_t n_chunk = (n + chunkSize - 1) / chunkSize;
+    _offset.resize(n, 0);
+    _base.resize(n_chunk, 0);
+    _wide_index.resize(n_chunk, 0);
+    _is_empty.resize(n_chunk, true);
+  }
+
+  /// Drop all entries
+  void clear() {
+    std::vector<uintT>().swap(_base);
+    std::vector<uint32_t>().swap(_offset);
+    std::vector<uint32_t>().swap(_wide_index);
+    std::vector< std::vector<uintT> >().swap(_wide);
+    std::vector<bool>().swap(_is_empty);
+  }
+
+  /// Entry i
+  uintT get(size_t i) const {
+    size_t c = i / chunkSize;
+    if (_wide_index[c] != 0)
+      return _wide[_wide_index[c] - 1][i % chunkSize];
+    return _base[c] + uintT(_offset[i]);
+  }
+
+  /// Set entry i (rebases or widens its chunk when needed)
+  void set(size_t i, uintT v) {
+    size_t c = i / chunkSize;
+    if (_wide_index[c] != 0) {
+      _wide[_wide_index[c] - 1][i % chunkSize] = v;
+      return;
+    }
+    if (_is_empty[c] == true) {
+      _is_empty[c] = false;
+      _base[c] = v;
+    }
+    if (v >= _base[c] && uint64_t(v - _base[c]) <= uint64_t(0xffffffffu)) {
+      _offset[i] = uint32_t(v - _base[c]);
+      return;
+    }
+    if (v < _base[c] && Rebase(c, v) == true) {
+      _offset[i] = 0;
+      return;
+    }
+    Widen(c);
+    _wide[_wide_index[c] - 1][i % chunkSize] = v;
+  }
+
+  uintT operator[](size_t i) const {
+    return get(i);
+  }
+
+  reference operator[](size_t i) {
+    return reference(*this, i);
+  }
+
+  /// Store the n IDs starting at entry offset
+  void pack(const uintT *ids, size_t offset, size_t n) {
+    assert(offset + n <= size());
+    size_t i = offset, end = offset + n;
+    while (i < end) {
+      size_t c = i / chunkSize, first = c * chunkSize;
+      size_t last = std::min(first + chunkSize, size());
+      /// Whole chunks get the tightest base
+      if (i == first && last <= end)
+        PackChunk(c, ids + (i - offset));
+      else
+        for (size_t j = i; j < std::min(last, end); ++j)
+          set(j, ids[j - offset]);
+      i = std::min(last, end);
+    }
+  }
+
+  /// Pack n IDs (replaces all entries)
+  void assign(const uintT *ids, size_t n) {
+    clear();
+    resize(n);
+    pack(ids, 0, n);
+  }
+
+  /// Copy the n IDs starting at entry offset to ids
+  void unpack(uintT *ids, size_t offset, size_t n) const {
+    assert(offset + n <= size());
+    for (size_t i = 0; i < n; ++i)
+      ids[i] = get(offset + i);
+  }
+
+  /// Memory held by the entries
+  size_t bytes() const {
+    size_t ret = _base.size() * sizeof (uintT) +
+      _offset.size() * sizeof (uint32_t) +
+      _wide_index.size() * sizeof (uint32_t) + _is_empty.size() / 8;
+    for (size_t c = 0; c < _wide.size(); ++c)
+      ret += _wide[c].size() * sizeof (uintT);
+    return ret;
+  }
+
+private:
+  std::vector<uintT> _base; /*!< Base of every chunk */
+  std::vector<uint32_t> _offset; /*!< Offset of every entry from its base */
+  std::vector<uint32_t> _wide_index; /*!< 1 + wide chunk slot (0 = packed) */
+  std::vector< std::vector<uintT> > _wide; /*!< Entries of wide chunks */
+  std::vector<bool> _is_empty; /*!< No entry of the chunk is set yet */
+
+  size_t NumChunk() const {
+    return _base.size();
+  }
+
+  /// Entries of chunk c are [first, last)
+  void Range(size_t c, size_t &first, size_t &last) const {
+    first = c * chunkSize;
+    last = std::min(first + chunkSize, size());
+  }
+
+  /// Lower the base of chunk c to v if the offsets still fit
+  bool Rebase(size_t c, uintT v) {
+    size_t first, last;
+    Range(c, first, last);
+    uint32_t hi = 0;
+    for (size_t j = first; j < last; ++j)
+      hi = std::max(hi, _offset[j]);
+    uint64_t shift = uint64_t(_base[c] - v);
+    if (shift + hi > uint64_t(0xffffffffu)) return false;
+    for (size_t j = first; j < last; ++j)
+      _offset[j] += uint32_t(shift);
+    _base[c] = v;
+    return true;
+  }
+
+  /// Move chunk c to full uintT entries
+  void Widen(size_t c) {
+    size_t first, last;
+    Range(c, first, last);
+    std::vector<uintT> entries(chunkSize, 0);
+    for (size_t j = first; j < last; ++j)
+      entries[j - first] = _base[c] + uintT(_offset[j]);
+    _wide.push_back(std::vector<uintT>());
+    _wide.back().swap(entries);
+    _wide_index[c] = uint32_t(_wide.size());
+  }
+
+  /// Store all entries of chunk c (packed if they fit)
+  void PackChunk(size_t c, const uintT *ids) {
+    size_t first, last;
+    Range(c, first, last);
+    uintT lo = ids[0], hi = ids[0];
+    for (size_t j = 0; j < last - first; ++j) {
+      lo = std::min(lo, ids[j]);
+      hi = std::max(hi, ids[j]);
+    }
+    _is_empty[c] = false;
+    if (_wide_index[c] == 0 && uint64_t(hi - lo) <= uint64_t(0xffffffffu)) {
+      _base[c] = lo;
+      for (size_t j = first; j < last; ++j)
+        _offset[j] = uint32_t(ids[j - first] - lo);
+      return;
+    }
+    if (_wide_index[c] == 0) Widen(c);
+    std::copy(ids, ids + (last - first), _wide[_wide_index[c] - 1].begin());
+  }
+};
+
+template< typename uintT >
+const size_t packedIds<uintT>::chunkSize;
+
+#endif
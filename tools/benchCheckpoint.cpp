@@ -0,0 +1,239 @@
+
+#include "ihstream.hpp"
+#include "checkpoint.hpp"
+#include "nodeStreamer.hpp"
+#include "cellStreamer.hpp"
+#include "faceLeftRightStreamer.hpp"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <tclap/CmdLine.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/// Some typedefs
+typedef TCLAP::CmdLine CmdLineClass;
+typedef TCLAP::ValueArg<std::string> StringArg;
+typedef TCLAP::ValueArg<unsigned> IntArg;
+
+/// Checkpoint settings
+struct settings {
+  std::string prefix; /*!< Checkpoint files prefix_<num>.hum */
+  unsigned count; /*!< Checkpoints written */
+  hsize_t window; /*!< Streamer buffer size */
+  hsize_t chunk; /*!< Chunk size of deflated checkpoints */
+  int deflate; /*!< Deflate level (0 = contiguous) */
+};
+
+/// Milliseconds since begin
+double Elapsed(const struct timeval &begin);
+
+/// Solver state of the mesh (nodes and cells streamed in), written as
+/// count checkpoints and read back from the last one
+template<typename floatT, typename uintT>
+void BenchCheckpoint(const char *hum_file, const settings &set);
+
+/// Faces of every cell (cellStreamer for polyhedral cells, else
+/// counted from the left/right cells)
+template<typename uintT>
+void CellFaceCount(ihstream &hum_in, hsize_t window,
+  std::vector<uintT> &count);
+
+/// Main program
+
+int main(int nargs, char *args[]) {
+  try {
+    /// The command line object
+    CmdLineClass cmd
+      (
+      "Asynchronous checkpoint/restart benchmark of a mesh sized solver state",
+      ' ', "0.1"
+      );
+    /// The Input hum file name
+    StringArg hum_file_arg
+      (
+      "i", "input",
+      "The hum mesh file", true,
+      "", "string"
+      );
+    cmd.add(hum_file_arg);
+    /// The checkpoint prefix
+    StringArg prefix_arg
+      (
+      "o", "output",
+      "Prefix of the checkpoint files (prefix_<num>.hum)", false,
+      "checkpoint", "string"
+      );
+    cmd.add(prefix_arg);
+    /// Number of checkpoints
+    IntArg count_arg
+      (
+      "n", "count",
+      "Number of checkpoints written", false,
+      4, "integer"
+      );
+    cmd.add(count_arg);
+    /// The stream buffer size
+    IntArg buf_size_arg
+      (
+      "s", "size",
+      "The stream buffer size - in entity counts", false,
+      262144, "integer"
+      );
+    cmd.add(buf_size_arg);
+    /// Deflate compression of the checkpoints
+    IntArg deflate_arg
+      (
+      "z", "deflate",
+      "Deflate level of the checkpoints (0 = uncompressed)", false,
+      0, "integer"
+      );
+    cmd.add(deflate_arg);
+    /// Chunk size of the compressed datasets
+    IntArg chunk_arg
+      (
+      "k", "chunk",
+      "Chunk size of the compressed checkpoints - in entity counts", false,
+      65536, "integer"
+      );
+    cmd.add(chunk_arg);
+    cmd.parse(nargs, args);
+    std::string hum_file = hum_file_arg.getValue();
+    settings set;
+    set.prefix = prefix_arg.getValue();
+    set.count = std::max(1u, count_arg.getValue());
+    set.window = std::max(1u, buf_size_arg.getValue());
+    set.deflate = int(deflate_arg.getValue());
+    set.chunk = (set.deflate > 0) ? chunk_arg.getValue() : 0;
+    bool is64, is_float;
+    {
+      ihstream hum_in(hum_file.c_str());
+      is64 = (hum_in.get_int_size() > 4) ? true : false;
+      is_float = (hum_in.get_float_size() == 4) ? true : false;
+      hum_in.close();
+    }
+    if (is64 && is_float)
+      BenchCheckpoint<float, uint64_t>(hum_file.c_str(), set);
+    else if (is64)
+      BenchCheckpoint<double, uint64_t>(hum_file.c_str(), set);
+    else if (is_float)
+      BenchCheckpoint<float, uint32_t>(hum_file.c_str(), set);
+    else
+      BenchCheckpoint<double, uint32_t>(hum_file.c_str(), set);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg "
+      << e.argId() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+double Elapsed(const struct timeval &begin) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return double( end.tv_sec - begin.tv_sec) * 1.0e3
+    + double( end.tv_usec - begin.tv_usec) / 1.0e3;
+}
+
+template<typename floatT, typename uintT>
+void BenchCheckpoint(const char *hum_file, const settings &set) {
+  std::vector<floatT> xyz;
+  std::vector<uintT> face_count;
+  std::vector<double> value;
+  struct timeval begin;
+  ihstream hum_in(hum_file);
+  hsize_t n_node = hum_in.nNode(), n_cell = hum_in.nCell();
+
+  /// The state: node coordinates, faces and a value per cell
+  gettimeofday(&begin, NULL);
+  std::cout << "Solver state (streaming) ... ";
+  xyz.resize(3 * n_node);
+  {
+    nodeStreamer<floatT> nodes(hum_in, set.window);
+    for (hsize_t i = 0; nodes.isEof() == false; nodes.IncrementSpan()) {
+      typename nodeStreamer<floatT>::spanType span = nodes.GetSpan();
+      for (size_t j = 0; j < span.size(); ++j, ++i)
+        std::copy(span[j].xyz, span[j].xyz + 3, &xyz[3 * i]);
+    }
+  }
+  CellFaceCount(hum_in, set.window, face_count);
+  value.assign(n_cell, 0.0);
+  hum_in.close();
+  std::cout << "(done) " << Elapsed(begin) << " ms\n";
+
+  /// Checkpoints are staged and written behind the time steps
+  checkpoint::engine writer;
+  writer.set_size(n_cell, n_node, 0);
+  writer.set_deflate(set.chunk, set.deflate);
+  writer.open(set.prefix.c_str());
+  if (n_node > 0)
+    writer.add("Coordinates", fields::NODE, 3, &xyz[0], 0, n_node);
+  if (n_cell > 0) {
+    writer.add("FaceCount", fields::CELL, 1, &face_count[0], 0, n_cell);
+    writer.add("Value", fields::CELL, 1, &value[0], 0, n_cell);
+  }
+  std::cout << "Checkpoints are written "
+    << ((writer.isAsync() == true) ? "asynchronously" : "by the caller")
+    << "\n";
+  struct timeval total;
+  gettimeofday(&total, NULL);
+  double staged = 0.0, bytes = 0.0;
+  hsize_t num = 0;
+  for (unsigned k = 0; k < set.count; ++k) {
+    /// A time step of the solver
+    for (hsize_t c = 0; c < n_cell; ++c)
+      value[c] += double(face_count[c]) * double(k + 1);
+    gettimeofday(&begin, NULL);
+    num = writer.write(double(k + 1));
+    staged += Elapsed(begin);
+    bytes += double(xyz.size() * sizeof (floatT)) +
+      double(n_cell) * (sizeof (uintT) + sizeof (double));
+  }
+  writer.wait();
+  double elapsed = Elapsed(total);
+  std::cout << "Checkpoint " << set.count << " x ... staged "
+    << staged << " ms, written " << elapsed << " ms ("
+    << bytes / 1048576.0 / (elapsed / 1.0e3) << " MB/s)\n";
+  std::string last = writer.name(num);
+  writer.close();
+
+  /// Restart from the last checkpoint and compare
+  gettimeofday(&begin, NULL);
+  std::cout << "Restart from " << last << " ... ";
+  std::vector<floatT> xyz_in(xyz.size());
+  std::vector<uintT> count_in(n_cell);
+  std::vector<double> value_in(n_cell);
+  checkpoint::restart reader(last.c_str());
+  if (n_node > 0)
+    reader.read("Coordinates", &xyz_in[0], 0, n_node);
+  if (n_cell > 0) {
+    reader.read("FaceCount", &count_in[0], 0, n_cell);
+    reader.read("Value", &value_in[0], 0, n_cell);
+  }
+  reader.close();
+  std::cout << "(done) " << Elapsed(begin) << " ms\n";
+  if (xyz_in != xyz || count_in != face_count || value_in != value) {
+    std::cerr << "Error: " << last << " does not hold the state written\n";
+    exit(1);
+  }
+}
+
+template<typename uintT>
+void CellFaceCount(ihstream &hum_in, hsize_t window,
+  std::vector<uintT> &count) {
+  count.assign(hum_in.nCell(), 0);
+  if (hum_in.is_poly_cell() == true) {
+    cellStreamer<uintT> cells(hum_in, window);
+    for (hsize_t c = 0; cells.isEof() == false; cells.Increment(), ++c)
+      count[c] = cells.GetNumCellFaces();
+    return;
+  }
+  faceLeftRightStreamer<uintT> lr(hum_in, window);
+  for (hsize_t f = 0; lr.isEof() == false; lr.IncrementSpan()) {
+    typename faceLeftRightStreamer<uintT>::spanType span = lr.GetSpan();
+    for (size_t i = 0; i < span.size(); ++i, ++f) {
+      count[span[i].left]++;
+      if (f < hum_in.nInternalFace()) count[span[i].right]++;
+    }
+  }
+}
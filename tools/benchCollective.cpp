@@ -0,0 +1,201 @@
+
+#include "ihstream.hpp"
+#include <string>
+#include <tclap/CmdLine.h>
+#include <stdint.h>
+#include <iostream>
+#include <iomanip>
+
+/// Some typedefs
+typedef TCLAP::CmdLine CmdLineClass;
+typedef TCLAP::ValueArg<std::string> StringArg;
+typedef TCLAP::ValueArg<unsigned> IntArg;
+
+/// Each rank reads its slice of Nodes, Faces and FaceLRCell
+template<typename uintT>
+hsize_t ReadSlices(ihstream &hum_in, hsize_t window);
+
+/// Time the slice reads for one transfer mode
+template<typename uintT>
+void BenchMode(const char *hum_file, h5pp::mpioHints &hints,
+  hsize_t window, unsigned repeat);
+
+/// Main program
+
+int main(int nargs, char *args[]) {
+  MPI_Init(&nargs, &args);
+  try {
+    /// The command line object
+    CmdLineClass cmd
+      (
+      "Collective vs independent MPI-IO read benchmark for hum",
+      ' ', "0.1"
+      );
+    /// The Input hum file name
+    StringArg hum_file_arg
+      (
+      "i", "input",
+      "The hum mesh file", true,
+      "", "string"
+      );
+    cmd.add(hum_file_arg);
+    /// Read window per call
+    IntArg window_arg
+      (
+      "s", "size",
+      "Read window per call - in entity counts (0 = whole slice)", false,
+      0, "integer"
+      );
+    cmd.add(window_arg);
+    /// Repetitions
+    IntArg repeat_arg
+      (
+      "r", "repeat",
+      "Number of timed repetitions per mode", false,
+      3, "integer"
+      );
+    cmd.add(repeat_arg);
+    /// MPI-IO hints
+    IntArg cb_nodes_arg
+      (
+      "b", "cb-nodes",
+      "Collective buffering aggregators (0 = MPI-IO default)", false,
+      0, "integer"
+      );
+    cmd.add(cb_nodes_arg);
+    IntArg cb_buffer_arg
+      (
+      "c", "cb-buffer",
+      "Collective buffer size in bytes (0 = MPI-IO default)", false,
+      0, "integer"
+      );
+    cmd.add(cb_buffer_arg);
+    IntArg stripe_count_arg
+      (
+      "f", "stripe-count",
+      "Lustre striping factor (0 = file system default)", false,
+      0, "integer"
+      );
+    cmd.add(stripe_count_arg);
+    IntArg stripe_size_arg
+      (
+      "u", "stripe-size",
+      "Lustre stripe size in bytes (0 = file system default)", false,
+      0, "integer"
+      );
+    cmd.add(stripe_size_arg);
+    IntArg alignment_arg
+      (
+      "a", "alignment",
+      "Align HDF5 objects to this many bytes (0 = no alignment)", false,
+      0, "integer"
+      );
+    cmd.add(alignment_arg);
+    cmd.parse(nargs, args);
+    std::string hum_file = hum_file_arg.getValue();
+    h5pp::mpioHints hints;
+    hints.cb_nodes = cb_nodes_arg.getValue();
+    hints.cb_buffer_size = cb_buffer_arg.getValue();
+    hints.striping_factor = stripe_count_arg.getValue();
+    hints.striping_unit = stripe_size_arg.getValue();
+    hints.alignment = alignment_arg.getValue();
+    hsize_t window = window_arg.getValue();
+    unsigned repeat = repeat_arg.getValue();
+    if (repeat < 1) {
+      std::cerr << "error: the number of repetitions must be at least 1\n";
+      MPI_Finalize();
+      return 1;
+    }
+    bool is64;
+    {
+      MPI_Comm comm = MPI_COMM_WORLD;
+      ihstream hum_in(hum_file.c_str(), comm);
+      is64 = (hum_in.get_int_size() > 4) ? true : false;
+      hum_in.close();
+    }
+    /// Independent then collective transfers
+    for (unsigned mode = 0; mode < 2; ++mode) {
+      hints.collective = (mode == 1);
+      if (is64)
+        BenchMode<uint64_t>(hum_file.c_str(), hints, window, repeat);
+      else
+        BenchMode<uint32_t>(hum_file.c_str(), hints, window, repeat);
+    }
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg "
+      << e.argId() << std::endl;
+    MPI_Finalize();
+    return 1;
+  }
+  MPI_Finalize();
+  return 0;
+}
+
+template<typename uintT>
+void BenchMode(const char *hum_file, h5pp::mpioHints &hints,
+  hsize_t window, unsigned repeat) {
+  int rank, nproc;
+  MPI_Comm comm = MPI_COMM_WORLD;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  double best = 0.0, open_time;
+  unsigned long long bytes = 0, my_bytes = 0;
+  /// Open (metadata) cost
+  MPI_Barrier(comm);
+  double begin = MPI_Wtime();
+  ihstream hum_in(hum_file, comm, hints);
+  double elapsed = MPI_Wtime() - begin;
+  MPI_Allreduce(&elapsed, &open_time, 1, MPI_DOUBLE, MPI_MAX, comm);
+  for (unsigned r = 0; r < repeat; ++r) {
+    MPI_Barrier(comm);
+    begin = MPI_Wtime();
+    my_bytes = ReadSlices<uintT>(hum_in, window);
+    elapsed = MPI_Wtime() - begin;
+    double slowest;
+    MPI_Allreduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+    if (r == 0 || slowest < best) best = slowest;
+  }
+  MPI_Allreduce(&my_bytes, &bytes, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+  if (rank == 0)
+    std::cout << std::setw(12)
+    << ((hints.collective == true) ? "collective" : "independent")
+    << " ranks = " << nproc
+    << " open = " << open_time * 1.0e3 << " ms"
+    << " read = " << best * 1.0e3 << " ms"
+    << " (" << double(bytes) / best / 1.0e9 << " GB/s)\n";
+}
+
+template<typename uintT>
+hsize_t ReadSlices(ihstream &hum_in, hsize_t window) {
+  int rank, nproc;
+  MPI_Comm_rank(hum_in.get_comm(), &rank);
+  MPI_Comm_size(hum_in.get_comm(), &nproc);
+  hsize_t node_beg = hum_in.nNode() * rank / nproc;
+  hsize_t node_end = hum_in.nNode() * (rank + 1) / nproc;
+  hsize_t face_beg = hum_in.nFace() * rank / nproc;
+  hsize_t face_end = hum_in.nFace() * (rank + 1) / nproc;
+  hsize_t my_len = std::max(node_end - node_beg, face_end - face_beg);
+  if (window == 0 || window > my_len) window = my_len;
+  if (window == 0) window = 1;
+  /// Collective calls need the same number of reads on every rank
+  unsigned long long my_calls = (my_len + window - 1) / window;
+  unsigned long long n_calls;
+  MPI_Allreduce(&my_calls, &n_calls, 1, MPI_UNSIGNED_LONG_LONG,
+    MPI_MAX, hum_in.get_comm());
+  std::vector< node<double> > nodes(window);
+  std::vector< face<uintT> > faces(window);
+  std::vector< leftRight<uintT> > lr(window);
+  hsize_t bytes = 0;
+  for (unsigned long long i = 0; i < n_calls; ++i) {
+    hsize_t node_off = std::min(node_beg + i * window, node_end);
+    hsize_t face_off = std::min(face_beg + i * window, face_end);
+    hsize_t node_len = std::min(window, node_end - node_off);
+    hsize_t face_len = std::min(window, face_end - face_off);
+    hum_in.read(&nodes[0], node_off, node_len);
+    hum_in.read(&faces[0], face_off, face_len);
+    hum_in.read(&lr[0], face_off, face_len);
+    bytes += node_len * sizeof (node<double>)
+      + face_len * (sizeof (face<uintT>) + sizeof (leftRight<uintT>));
+  }
+  return bytes;
+}
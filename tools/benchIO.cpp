@@ -0,0 +1,725 @@
+
+#include "ihstream.hpp"
+#include "faceStreamer.hpp"
+#include "faceLeftRightStreamer.hpp"
+#include "faceZipStreamer.hpp"
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <tclap/CmdLine.h>
+#include <stdint.h>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+
+/// Some typedefs
+typedef TCLAP::CmdLine CmdLineClass;
+typedef TCLAP::ValueArg<std::string> StringArg;
+typedef TCLAP::ValueArg<unsigned> IntArg;
+
+/// One timed sweep point
+struct result {
+  std::string source; /*!< "synthetic" or the hum file */
+  std::string dataset;
+  std::string op; /*!< read or write */
+  std::string path; /*!< serial, inflate, independent, collective,
+                     streamer or streamer-async */
+  std::string layout; /*!< contiguous, chunked or derived (CSR faces) */
+  std::string filter; /*!< none, deflate, packed or quantised */
+  hsize_t chunk; /*!< Chunk size in entities (0 = contiguous) */
+  hsize_t window; /*!< Entities per read/write call or refill */
+  unsigned long long bytes, entities; /*!< Moved by all ranks */
+  double seconds; /*!< Slowest rank */
+  std::vector<double> latency; /*!< Seconds of every call (all ranks) */
+};
+
+/// Benchmark settings
+struct settings {
+  std::vector<hsize_t> windows, chunks;
+  std::vector<std::string> filters;
+  unsigned repeat;
+  int deflate;
+  std::string tmp_dir;
+  bool mpi_paths;
+};
+
+/// Comma separated list of integers
+std::vector<hsize_t> ParseList(const std::string &list);
+
+/// Comma separated list of words
+std::vector<std::string> ParseWords(const std::string &list);
+
+/// Entities [beg, end) of rank out of nproc
+void Slice(hsize_t n, int rank, int nproc, hsize_t &beg, hsize_t &end);
+
+/// Time, bytes and latencies of every rank summed up on all ranks
+void Reduce(result &r, MPI_Comm comm);
+
+/// Write the results as JSON
+void WriteJSON(std::ostream &out, std::vector<result> &results, int nproc);
+
+/// Write/read sweep of h5pp over a synthetic face dataset
+template<typename uintT>
+void BenchSynthetic(hsize_t n_face, const settings &set,
+  std::vector<result> &results);
+
+/// Read sweep of a hum file (ihstream paths and streamers)
+template<typename floatT, typename uintT>
+void BenchHum(const char *hum_file, const settings &set,
+  std::vector<result> &results);
+
+/// Main program
+
+int main(int nargs, char *args[]) {
+  MPI_Init(&nargs, &args);
+  try {
+    /// The command line object
+    CmdLineClass cmd
+      (
+      "h5++ and hum I/O throughput benchmark (JSON report)",
+      ' ', "0.1"
+      );
+    /// The Input hum file name
+    StringArg hum_file_arg
+      (
+      "i", "input",
+      "The hum mesh file (none = synthetic data only)", false,
+      "", "string"
+      );
+    cmd.add(hum_file_arg);
+    /// The JSON report
+    StringArg json_arg
+      (
+      "o", "output",
+      "The JSON report file (default stdout)", false,
+      "", "string"
+      );
+    cmd.add(json_arg);
+    /// Synthetic dataset size
+    IntArg synthetic_arg
+      (
+      "n", "synthetic",
+      "Synthetic face count (0 = skip the synthetic sweep)", false,
+      1048576, "integer"
+      );
+    cmd.add(synthetic_arg);
+    /// Directory of the synthetic file
+    StringArg tmp_arg
+      (
+      "t", "tmpdir",
+      "Directory of the synthetic file (the storage to test)", false,
+      ".", "string"
+      );
+    cmd.add(tmp_arg);
+    /// Windows
+    StringArg window_arg
+      (
+      "w", "windows",
+      "Entities per read call or streamer refill - comma separated", false,
+      "16384,262144", "list"
+      );
+    cmd.add(window_arg);
+    /// Chunk layouts
+    StringArg chunk_arg
+      (
+      "k", "chunks",
+      "Synthetic chunk sizes in entities, 0 = contiguous - comma separated",
+      false, "0,65536", "list"
+      );
+    cmd.add(chunk_arg);
+    /// Filters
+    StringArg filter_arg
+      (
+      "f", "filters",
+      "Synthetic chunk filters (none, deflate, packed) - comma separated",
+      false, "none,deflate,packed", "list"
+      );
+    cmd.add(filter_arg);
+    IntArg deflate_arg
+      (
+      "z", "deflate",
+      "Deflate level of the deflate filter", false,
+      4, "integer"
+      );
+    cmd.add(deflate_arg);
+    /// Repetitions
+    IntArg repeat_arg
+      (
+      "r", "repeat",
+      "Number of timed repetitions (the fastest is kept)", false,
+      3, "integer"
+      );
+    cmd.add(repeat_arg);
+    /// Toggle 64 bit mode for the synthetic data
+    TCLAP::SwitchArg is64_arg
+      (
+      "L", "large",
+      "Use 64-bit integers for the synthetic data",
+      cmd, false
+      );
+    /// Skip the MPI-IO paths
+    TCLAP::SwitchArg serial_arg
+      (
+      "s", "serial",
+      "Only time the serial paths (no MPI-IO)",
+      cmd, false
+      );
+    cmd.parse(nargs, args);
+    settings set;
+    set.windows = ParseList(window_arg.getValue());
+    /// A window of zero entities would never finish
+    set.windows.erase(std::remove(set.windows.begin(), set.windows.end(),
+      hsize_t(0)), set.windows.end());
+    set.chunks = ParseList(chunk_arg.getValue());
+    set.filters = ParseWords(filter_arg.getValue());
+    set.repeat = std::max(1u, repeat_arg.getValue());
+    set.deflate = int(deflate_arg.getValue());
+    set.tmp_dir = tmp_arg.getValue();
+    set.mpi_paths = (serial_arg.getValue() == false);
+    std::vector<result> results;
+    hsize_t n_face = synthetic_arg.getValue();
+    if (n_face > 0) {
+      if (is64_arg.getValue())
+        BenchSynthetic<uint64_t>(n_face, set, results);
+      else
+        BenchSynthetic<uint32_t>(n_face, set, results);
+    }
+    std::string hum_file = hum_file_arg.getValue();
+    if (hum_file.empty() == false) {
+      int int_size, float_size;
+      {
+        ihstream hum_in(hum_file.c_str(), false);
+        int_size = hum_in.get_int_size();
+        float_size = hum_in.get_float_size();
+        hum_in.close();
+      }
+      if (int_size > 4 && float_size == 4)
+        BenchHum<float, uint64_t>(hum_file.c_str(), set, results);
+      else if (int_size > 4)
+        BenchHum<double, uint64_t>(hum_file.c_str(), set, results);
+      else if (float_size == 4)
+        BenchHum<float, uint32_t>(hum_file.c_str(), set, results);
+      else
+        BenchHum<double, uint32_t>(hum_file.c_str(), set, results);
+    }
+    int rank, nproc;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+    if (rank == 0) {
+      std::string json = json_arg.getValue();
+      if (json.empty() == true)
+        WriteJSON(std::cout, results, nproc);
+      else {
+        std::ofstream out(json.c_str());
+        WriteJSON(out, results, nproc);
+      }
+    }
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg "
+      << e.argId() << std::endl;
+    MPI_Finalize();
+    return 1;
+  }
+  MPI_Finalize();
+  return 0;
+}
+
+std::vector<hsize_t> ParseList(const std::string &list) {
+  std::vector<hsize_t> ret;
+  std::vector<std::string> words = ParseWords(list);
+  for (size_t i = 0; i < words.size(); ++i) {
+    std::stringstream cat(words[i]);
+    hsize_t value = 0;
+    cat >> value;
+    ret.push_back(value);
+  }
+  return ret;
+}
+
+std::vector<std::string> ParseWords(const std::string &list) {
+  std::vector<std::string> ret;
+  std::stringstream cat(list);
+  std::string word;
+  while (std::getline(cat, word, ','))
+    if (word.empty() == false) ret.push_back(word);
+  return ret;
+}
+
+void Slice(hsize_t n, int rank, int nproc, hsize_t &beg, hsize_t &end) {
+  beg = n * rank / nproc;
+  end = n * (rank + 1) / nproc;
+}
+
+void Reduce(result &r, MPI_Comm comm) {
+  int rank, nproc;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  double slowest;
+  MPI_Allreduce(&r.seconds, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+  r.seconds = slowest;
+  unsigned long long sum[2], my_sum[2] = {r.bytes, r.entities};
+  MPI_Allreduce(my_sum, sum, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+  r.bytes = sum[0];
+  r.entities = sum[1];
+  /// Latencies of all ranks end up on rank 0
+  int my_count = int(r.latency.size());
+  std::vector<int> count(nproc), displ(nproc, 0);
+  MPI_Gather(&my_count, 1, MPI_INT, &count[0], 1, MPI_INT, 0, comm);
+  for (int p = 1; p < nproc; ++p)
+    displ[p] = displ[p - 1] + count[p - 1];
+  std::vector<double> all((rank == 0) ? displ[nproc - 1] + count[nproc - 1] : 0);
+  MPI_Gatherv(r.latency.empty() ? NULL : &r.latency[0], my_count, MPI_DOUBLE,
+    all.empty() ? NULL : &all[0], &count[0], &displ[0], MPI_DOUBLE, 0, comm);
+  r.latency.swap(all);
+}
+
+/// The p-th percentile of sorted values
+double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  size_t i = size_t(p / 100.0 * double(sorted.size() - 1) + 0.5);
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/// JSON string (names and paths only need quotes escaped)
+std::string Quote(const std::string &s) {
+  std::string ret = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') ret += '\\';
+    ret += s[i];
+  }
+  return ret + "\"";
+}
+
+void WriteJSON(std::ostream &out, std::vector<result> &results, int nproc) {
+  out << "{\n  \"benchmark\": \"benchIO\",\n  \"ranks\": " << nproc
+    << ",\n  \"results\": [";
+  out << std::setprecision(6);
+  for (size_t i = 0; i < results.size(); ++i) {
+    result &r = results[i];
+    std::sort(r.latency.begin(), r.latency.end());
+    double seconds = (r.seconds > 0.0) ? r.seconds : 1.0e-9;
+    out << ((i == 0) ? "\n" : ",\n")
+      << "    {\"source\": " << Quote(r.source)
+      << ", \"dataset\": " << Quote(r.dataset)
+      << ", \"op\": " << Quote(r.op)
+      << ", \"path\": " << Quote(r.path)
+      << ", \"layout\": " << Quote(r.layout)
+      << ", \"filter\": " << Quote(r.filter)
+      << ", \"chunk\": " << r.chunk
+      << ", \"window\": " << r.window
+      << ",\n     \"bytes\": " << r.bytes
+      << ", \"entities\": " << r.entities
+      << ", \"seconds\": " << r.seconds
+      << ", \"gb_per_s\": " << double(r.bytes) / seconds / 1.0e9
+      << ", \"entities_per_s\": " << double(r.entities) / seconds
+      << ",\n     \"calls\": " << r.latency.size()
+      << ", \"latency_us\": {\"p50\": " << Percentile(r.latency, 50) * 1.0e6
+      << ", \"p90\": " << Percentile(r.latency, 90) * 1.0e6
+      << ", \"p99\": " << Percentile(r.latency, 99) * 1.0e6
+      << ", \"max\": " << Percentile(r.latency, 100) * 1.0e6 << "}}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+/// Synthetic quad faces of a structured block (SFC like locality)
+template<typename uintT>
+void MakeFaces(std::vector< face<uintT> > &faces, hsize_t n_face) {
+  const uintT row = 128;
+  faces.resize(n_face);
+  for (hsize_t i = 0; i < n_face; ++i) {
+    uintT base = uintT(i / 3);
+    faces[i].bField = 4;
+    faces[i].entityID[0] = base;
+    faces[i].entityID[1] = base + 1;
+    faces[i].entityID[2] = base + row + 1;
+    faces[i].entityID[3] = base + row;
+  }
+}
+
+/// Timed serial write of the synthetic faces in windows
+template<typename uintT>
+double WriteSynthetic(const std::string &fname, std::vector< face<uintT> > &faces,
+  hsize_t chunk, const chunkio::filter &f, bool is_filtered,
+  hsize_t window, std::vector<double> &latency) {
+  H5TFace<uintT> H5T;
+  h5pp::listString link;
+  link.push_back(H5T.linkStr());
+  hsize_t n_face = faces.size();
+  double begin = MPI_Wtime();
+  hid_t file = H5Fcreate(fname.c_str(), H5F_ACC_TRUNC,
+    H5P_DEFAULT, H5P_DEFAULT);
+  for (hsize_t off = 0; off < n_face; off += window) {
+    hsize_t len = std::min(window, n_face - off);
+    double t = MPI_Wtime();
+    if (chunk == 0)
+      h5pp::WriteVectorDataSerial(file, &faces[off], H5T.mem_t(),
+      H5T.file_t(), link, off, 1, len, n_face);
+    else if (is_filtered == true)
+      chunkio::WriteChunked(file, &faces[off], H5T.mem_t(), H5T.file_t(),
+      link, off, len, n_face, chunk, f);
+    else {
+      hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+      hsize_t chunk_size = std::min(chunk, n_face);
+      H5Pset_chunk(dcpl, 1, &chunk_size);
+      hid_t dset = h5pp::OpenOrCreateDset(file, H5T.file_t(), link,
+        n_face, dcpl);
+      H5Pclose(dcpl);
+      chunkio::WriteSlab(dset, &faces[off], H5T.mem_t(), off, len);
+      H5Dclose(dset);
+    }
+    latency.push_back(MPI_Wtime() - t);
+  }
+  H5Fclose(file);
+  return MPI_Wtime() - begin;
+}
+
+/// Timed window reads of a rank slice of the synthetic faces
+template<typename uintT>
+double ReadSynthetic(const std::string &fname, const std::string &path,
+  hsize_t n_face, hsize_t window, std::vector<double> &latency) {
+  int rank, nproc;
+  MPI_Comm comm = MPI_COMM_WORLD;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  H5TFace<uintT> H5T;
+  h5pp::listString link;
+  link.push_back(H5T.linkStr());
+  hsize_t beg, end;
+  Slice(n_face, rank, nproc, beg, end);
+  bool is_mpi = (path == "independent" || path == "collective");
+  /// Collective calls need the same number of reads on every rank
+  unsigned long long n_calls, my_calls = (end - beg + window - 1) / window;
+  MPI_Allreduce(&my_calls, &n_calls, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+  std::vector< face<uintT> > buf(window);
+  MPI_Barrier(comm);
+  double begin = MPI_Wtime();
+  hid_t file;
+  h5pp::mpioHints hints;
+  hints.collective = (path == "collective");
+  if (is_mpi == true) {
+    hid_t plist_id = h5pp::MakeMPIOPlist(comm, hints);
+    file = H5Fopen(fname.c_str(), H5F_ACC_RDONLY, plist_id);
+    H5Pclose(plist_id);
+  } else
+    file = H5Fopen(fname.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  for (unsigned long long i = 0; i < n_calls; ++i) {
+    hsize_t off = std::min(beg + i * window, end);
+    hsize_t len = std::min(window, end - off);
+    double t = MPI_Wtime();
+    if (is_mpi == true)
+      h5pp::ReadVectorData(file, &buf[0], H5T.mem_t(), link, off, 1, len,
+      hints.xfer_mode());
+    else if (len > 0 && (path != "inflate" ||
+      chunkio::TryReadChunked(file, &buf[0], H5T.mem_t(), link, off, len) == false))
+      h5pp::ReadVectorDataSerial(file, &buf[0], H5T.mem_t(), link, off, 1, len);
+    latency.push_back(MPI_Wtime() - t);
+  }
+  H5Fclose(file);
+  return MPI_Wtime() - begin;
+}
+
+template<typename uintT>
+void BenchSynthetic(hsize_t n_face, const settings &set,
+  std::vector<result> &results) {
+  int rank;
+  MPI_Comm comm = MPI_COMM_WORLD;
+  MPI_Comm_rank(comm, &rank);
+  std::vector< face<uintT> > faces;
+  if (rank == 0) MakeFaces(faces, n_face);
+  /// Every rank reads the packed chunks back
+  deltapack::Register();
+  std::string fname = set.tmp_dir + "/benchIO_synthetic.h5";
+  std::vector<std::string> paths;
+  paths.push_back("serial");
+  paths.push_back("inflate");
+  if (set.mpi_paths == true) {
+    paths.push_back("independent");
+    paths.push_back("collective");
+  }
+  for (size_t c = 0; c < set.chunks.size(); ++c) {
+    hsize_t chunk = set.chunks[c];
+    for (size_t k = 0; k < set.filters.size(); ++k) {
+      /// Contiguous datasets can not be filtered
+      const std::string &name = set.filters[k];
+      if (chunk == 0 && name != "none") continue;
+      bool is_filtered = (name != "none");
+      chunkio::filter f = (name == "packed") ?
+        chunkio::Packed(sizeof (uintT), 5) : chunkio::Deflate(set.deflate);
+      result r;
+      r.source = "synthetic";
+      r.dataset = hum::faceLink[hum::PRIMARY];
+      r.layout = (chunk == 0) ? "contiguous" : "chunked";
+      r.filter = name;
+      r.chunk = chunk;
+      /// Writes (rank 0), the file of the last window is read back
+      for (size_t w = 0; w < set.windows.size(); ++w) {
+        r.op = "write";
+        r.path = "serial";
+        r.window = set.windows[w];
+        r.seconds = 0.0;
+        r.bytes = r.entities = 0;
+        r.latency.clear();
+        if (rank == 0) {
+          for (unsigned rep = 0; rep < set.repeat; ++rep) {
+            std::vector<double> latency;
+            double seconds = WriteSynthetic(fname, faces, chunk, f,
+              is_filtered, r.window, latency);
+            if (rep == 0 || seconds < r.seconds) {
+              r.seconds = seconds;
+              r.latency.swap(latency);
+            }
+          }
+          r.bytes = n_face * sizeof (face<uintT>);
+          r.entities = n_face;
+        }
+        MPI_Barrier(comm);
+        if (rank == 0) results.push_back(r);
+      }
+      for (size_t w = 0; w < set.windows.size(); ++w) {
+        for (size_t p = 0; p < paths.size(); ++p) {
+          if (paths[p] == "inflate" && is_filtered == false) continue;
+          r.op = "read";
+          r.path = paths[p];
+          r.window = set.windows[w];
+          r.latency.clear();
+          for (unsigned rep = 0; rep < set.repeat; ++rep) {
+            std::vector<double> latency;
+            double seconds = ReadSynthetic<uintT>(fname, r.path, n_face,
+              r.window, latency);
+            if (rep == 0 || seconds < r.seconds) {
+              r.seconds = seconds;
+              r.latency.swap(latency);
+            }
+          }
+          hsize_t beg, end;
+          int nproc;
+          MPI_Comm_size(comm, &nproc);
+          Slice(n_face, rank, nproc, beg, end);
+          r.entities = end - beg;
+          r.bytes = r.entities * sizeof (face<uintT>);
+          Reduce(r, comm);
+          if (rank == 0) results.push_back(r);
+        }
+      }
+    }
+  }
+  if (rank == 0) std::remove(fname.c_str());
+}
+
+/// Layout, filter and chunk size of a hum dataset (rank 0)
+void DescribeLayout(const char *hum_file, const char *dataset, result &r) {
+  r.layout = "derived"; /// CSR faces have no face dataset
+  r.filter = "none";
+  r.chunk = 0;
+  hid_t file = H5Fopen(hum_file, H5F_ACC_RDONLY, H5P_DEFAULT);
+  std::string cat = std::string("/") + dataset;
+  if (h5pp::IsDataset(file, cat.c_str()) == true) {
+    hid_t dset = H5Dopen2(file, cat.c_str(), H5P_DEFAULT);
+    hid_t dcpl = H5Dget_create_plist(dset);
+    chunkio::filter f;
+    r.layout = (H5Pget_layout(dcpl) == H5D_CHUNKED) ? "chunked" : "contiguous";
+    if (H5Pget_layout(dcpl) == H5D_CHUNKED)
+      H5Pget_chunk(dcpl, 1, &r.chunk);
+    if (chunkio::IsFilterChunked(dset, r.chunk, f) == true)
+      r.filter = (f.id == H5Z_FILTER_DEFLATE) ? "deflate" :
+      (f.id == deltapack::filterId) ? "packed" : "quantised";
+    else if (H5Pget_nfilters(dcpl) > 0)
+      r.filter = "other";
+    H5Pclose(dcpl);
+    H5Dclose(dset);
+  }
+  H5Fclose(file);
+}
+
+/// Timed window reads of a rank slice of one hum dataset
+template<typename T>
+double ReadHum(ihstream &hum_in, bool is_mpi, hsize_t n, hsize_t window,
+  std::vector<double> &latency) {
+  int rank = 0, nproc = 1;
+  if (is_mpi == true) {
+    MPI_Comm_rank(hum_in.get_comm(), &rank);
+    MPI_Comm_size(hum_in.get_comm(), &nproc);
+  }
+  hsize_t beg, end;
+  Slice(n, rank, nproc, beg, end);
+  unsigned long long n_calls = (end - beg + window - 1) / window;
+  if (is_mpi == true) {
+    unsigned long long my_calls = n_calls;
+    MPI_Allreduce(&my_calls, &n_calls, 1, MPI_UNSIGNED_LONG_LONG,
+      MPI_MAX, hum_in.get_comm());
+    MPI_Barrier(hum_in.get_comm());
+  }
+  std::vector<T> buf(window);
+  double begin = MPI_Wtime();
+  for (unsigned long long i = 0; i < n_calls; ++i) {
+    hsize_t off = std::min(beg + i * window, end);
+    hsize_t len = std::min(window, end - off);
+    double t = MPI_Wtime();
+    hum_in.read(&buf[0], off, len);
+    latency.push_back(MPI_Wtime() - t);
+  }
+  return MPI_Wtime() - begin;
+}
+
+/// Read sweep of one hum dataset over all windows and paths
+template<typename T>
+void BenchHumDataset(const char *hum_file, const char *dataset,
+  hsize_t n, const settings &set, std::vector<result> &results) {
+  int rank, nproc;
+  MPI_Comm comm = MPI_COMM_WORLD;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+  std::vector<std::string> paths;
+  paths.push_back("serial");
+  paths.push_back("inflate");
+  if (set.mpi_paths == true) {
+    paths.push_back("independent");
+    paths.push_back("collective");
+  }
+  result layout;
+  DescribeLayout(hum_file, dataset, layout);
+  for (size_t w = 0; w < set.windows.size(); ++w) {
+    for (size_t p = 0; p < paths.size(); ++p) {
+      /// Parallel decoding only applies to filtered chunks
+      if (paths[p] == "inflate" && layout.filter == "none") continue;
+      result r = layout;
+      r.source = hum_file;
+      r.dataset = dataset;
+      r.op = "read";
+      r.path = paths[p];
+      r.window = set.windows[w];
+      bool is_mpi = (r.path == "independent" || r.path == "collective");
+      r.seconds = 0.0;
+      for (unsigned rep = 0; rep < set.repeat; ++rep) {
+        std::vector<double> latency;
+        double seconds = 0.0;
+        if (is_mpi == true) {
+          h5pp::mpioHints hints;
+          hints.collective = (r.path == "collective");
+          ihstream hum_in(hum_file, comm, hints);
+          seconds = ReadHum<T>(hum_in, true, n, r.window, latency);
+        } else if (rank == 0) {
+          /// The serial paths read the whole dataset on rank 0
+          ihstream hum_in(hum_file, false);
+          hum_in.set_parallel_inflate(r.path == "inflate");
+          seconds = ReadHum<T>(hum_in, false, n, r.window, latency);
+        }
+        if (rep == 0 || seconds < r.seconds) {
+          r.seconds = seconds;
+          r.latency.swap(latency);
+        }
+      }
+      hsize_t beg, end;
+      Slice(n, rank, nproc, beg, end);
+      r.entities = is_mpi ? end - beg : (rank == 0 ? n : 0);
+      r.bytes = r.entities * sizeof (T);
+      Reduce(r, comm);
+      if (rank == 0) results.push_back(r);
+    }
+  }
+}
+
+/// Timed pass over the spans of a streamer, one latency per refill
+template<typename streamerT>
+void StreamSpans(streamerT &s, std::vector<double> &latency) {
+  chunkRange<streamerT> range(s);
+  typename chunkRange<streamerT>::iterator c = range.begin();
+  while (c != range.end()) {
+    double t = MPI_Wtime();
+    ++c;
+    latency.push_back(MPI_Wtime() - t);
+  }
+  /// Stepping past the last span reads nothing
+  if (latency.empty() == false) latency.pop_back();
+}
+
+/// Timed face, LR and zipped streamer passes of rank 0, synchronous
+/// and with read-ahead, one latency per refill
+template<typename floatT, typename uintT>
+void BenchStreamers(const char *hum_file, const settings &set,
+  std::vector<result> &results) {
+  ihstream hum_in(hum_file, false);
+  for (size_t w = 0; w < set.windows.size(); ++w) {
+    result r;
+    r.source = hum_file;
+    r.op = "read";
+    r.window = set.windows[w];
+    for (unsigned a = 0; a < 2; ++a) {
+      bool is_async = (a == 1);
+      r.path = (is_async == true) ? "streamer-async" : "streamer";
+      /// The zipped streamer has no read-ahead
+      for (unsigned s = 0; s < ((is_async == true) ? 2u : 3u); ++s) {
+        DescribeLayout(hum_file, hum::faceLink[s % 2], r);
+        r.latency.clear();
+        for (unsigned rep = 0; rep < set.repeat; ++rep) {
+          std::vector<double> latency;
+          double begin = MPI_Wtime(), seconds;
+          if (s == 0) {
+            r.dataset = hum::faceLink[hum::PRIMARY];
+            r.entities = hum_in.nFace();
+            r.bytes = r.entities * sizeof (face<uintT>);
+            faceStreamer<uintT> faces(hum_in, r.window);
+            if (is_async == true) faces.SetAsyncOn();
+            latency.push_back(MPI_Wtime() - begin);
+            StreamSpans(faces, latency);
+          } else if (s == 1) {
+            r.dataset = hum::faceLink[hum::SECONDARY];
+            faceLeftRightStreamer<uintT> lr(hum_in, r.window);
+            if (is_async == true) lr.SetAsyncOn();
+            latency.push_back(MPI_Wtime() - begin);
+            /// Internal faces then the boundary faces patch by patch
+            StreamSpans(lr, latency);
+            r.entities = hum_in.nInternalFace();
+            while (lr.isEofPatch() == false) {
+              while (lr.isEofPatchFace() == false) {
+                double t = MPI_Wtime();
+                r.entities += lr.GetPatchSpan().size();
+                lr.IncrementPatchSpan();
+                latency.push_back(MPI_Wtime() - t);
+              }
+              lr.IncrementPatch();
+            }
+            r.bytes = r.entities * sizeof (leftRight<uintT>);
+          } else {
+            /// Both datasets read for the same window, section by section
+            r.dataset = std::string(hum::faceLink[hum::PRIMARY]) + "+"
+              + hum::faceLink[hum::SECONDARY];
+            r.entities = hum_in.nFace();
+            r.bytes = r.entities *
+              (sizeof (face<uintT>) + sizeof (leftRight<uintT>));
+            faceZipStreamer<uintT> zip(hum_in, r.window);
+            latency.push_back(MPI_Wtime() - begin);
+            StreamSpans(zip, latency);
+          }
+          seconds = MPI_Wtime() - begin;
+          if (rep == 0 || seconds < r.seconds) {
+            r.seconds = seconds;
+            r.latency.swap(latency);
+          }
+        }
+        results.push_back(r);
+      }
+    }
+  }
+}
+
+template<typename floatT, typename uintT>
+void BenchHum(const char *hum_file, const settings &set,
+  std::vector<result> &results) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  hsize_t n_node, n_face;
+  {
+    ihstream hum_in(hum_file, false);
+    n_node = hum_in.nNode();
+    n_face = hum_in.nFace();
+  }
+  BenchHumDataset< node<floatT> >(hum_file, hum::nodeLink[hum::PRIMARY],
+    n_node, set, results);
+  BenchHumDataset< face<uintT> >(hum_file, hum::faceLink[hum::PRIMARY],
+    n_face, set, results);
+  BenchHumDataset< leftRight<uintT> >(hum_file, hum::faceLink[hum::SECONDARY],
+    n_face, set, results);
+  if (rank == 0) BenchStreamers<floatT, uintT>(hum_file, set, results);
+}
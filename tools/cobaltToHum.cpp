@@ -6,6 +6,7 @@
 typedef TCLAP::CmdLine CmdLineClass;
 typedef TCLAP::ValueArg<std::string> StringArg;
 typedef TCLAP::ValueArg<double> FloatArg;
+typedef TCLAP::ValueArg<unsigned> IntArg;
 
 int main(int nargs, char *args[]) {
   try {
@@ -39,6 +40,22 @@ int main(int nargs, char *args[]) {
       0.0005, "float"
       );
     cmd.add(buf_size_arg);
+    /// Deflate compression of the output datasets
+    IntArg deflate_arg
+      (
+      "z", "deflate",
+      "Deflate level of compressed output (0 = uncompressed)", false,
+      0, "integer"
+      );
+    cmd.add(deflate_arg);
+    /// Chunk size of the compressed datasets
+    IntArg chunk_arg
+      (
+      "k", "chunk",
+      "Chunk size of compressed output - in entity counts", false,
+      65536, "integer"
+      );
+    cmd.add(chunk_arg);
     /// Toggle 64 bit mode for large files
     TCLAP::SwitchArg is64_arg
       (
@@ -46,17 +63,67 @@ int main(int nargs, char *args[]) {
       "Enable 64-bit integers for large meshes",
       cmd, false
       );
+    /// Store the face-node connectivity in CSR form
+    TCLAP::SwitchArg csr_arg
+      (
+      "c", "csr",
+      "Store face-nodes in CSR form (offsets + flat node IDs)",
+      cmd, false
+      );
+    /// Store the cell-face connectivity (polyhedral cells)
+    TCLAP::SwitchArg poly_arg
+      (
+      "p", "polycell",
+      "Store the cell-face connectivity in CSR form (polyhedral cells)",
+      cmd, false
+      );
+    /// Delta + bit pack the connectivity
+    TCLAP::SwitchArg pack_arg
+      (
+      "d", "delta",
+      "Store the connectivity delta + bit packed (chunks of -k entities)",
+      cmd, false
+      );
+    /// Single precision node coordinates
+    TCLAP::SwitchArg float_arg
+      (
+      "f", "float",
+      "Store the node coordinates in single precision",
+      cmd, false
+      );
+    /// Quantised node coordinates
+    FloatArg quantise_arg
+      (
+      "q", "quantise",
+      "Store the node coordinates quantised within this error bound (chunks of -k nodes, 0 = off)", false,
+      0.0, "float"
+      );
+    cmd.add(quantise_arg);
     cmd.parse(nargs, args);
     std::string hum_file = hum_file_arg.getValue();
     std::string cobalt_file = cobalt_file_arg.getValue();
     bool is64 = is64_arg.getValue();
+    bool csr = csr_arg.getValue();
+    bool poly = poly_arg.getValue();
     double buf_size = buf_size_arg.getValue();
+    unsigned deflate = deflate_arg.getValue();
+    hsize_t chunk = (deflate > 0) ? chunk_arg.getValue() : 0;
+    hsize_t pack_chunk = pack_arg.getValue() ? chunk_arg.getValue() : 0;
+    bool is_float = float_arg.getValue();
+    double tolerance = quantise_arg.getValue();
+    hsize_t node_chunk = (tolerance > 0.0) ? chunk_arg.getValue() : 0;
     if (is64) {
       COBALT<double, uint64_t> cobFile
         (
         cobalt_file.c_str(),
         hum_file.c_str(), buf_size
         );
+      cobFile.set_deflate(chunk, deflate);
+      cobFile.set_packing(pack_chunk);
+      cobFile.set_node_float(is_float);
+      cobFile.set_node_quantise(node_chunk, tolerance);
+      cobFile.set_face_csr(csr);
+      cobFile.set_poly_cell(poly);
       cobFile.Start();
     } else {
       COBALT<double, uint32_t> cobFile
@@ -64,6 +131,12 @@ int main(int nargs, char *args[]) {
         cobalt_file.c_str(),
         hum_file.c_str(), buf_size
         );
+      cobFile.set_deflate(chunk, deflate);
+      cobFile.set_packing(pack_chunk);
+      cobFile.set_node_float(is_float);
+      cobFile.set_node_quantise(node_chunk, tolerance);
+      cobFile.set_face_csr(csr);
+      cobFile.set_poly_cell(poly);
       cobFile.Start();
     }
   }  catch (TCLAP::ArgException &e) {
@@ -0,0 +1,166 @@
+
+#include "hashcache.hpp"
+#include <string>
+#include <iomanip>
+#include <tclap/CmdLine.h>
+#include <stdint.h>
+
+/// Some typedefs
+typedef TCLAP::CmdLine CmdLineClass;
+typedef TCLAP::ValueArg<std::string> StringArg;
+
+/// Hash the primary datasets (all ranks) and store or check the hashes
+int HashPrimary(const char *hum_file, bool is_check, MPI_Comm comm);
+
+/// List (and prune) the derived-data cache entries
+void ListCache(const char *hum_file, const std::string &sidecar,
+  bool is_prune);
+
+/// Hash as fixed width hex
+std::string HexHash(uint64_t hash);
+
+/// Main program
+
+int main(int nargs, char *args[]) {
+  MPI_Init(&nargs, &args);
+  int ret = 0;
+  try {
+    /// The command line object
+    CmdLineClass cmd
+      (
+      "Content hashes of the primary hum datasets and the derived-data"
+      " cache keyed on them",
+      ' ', "0.1"
+      );
+    /// The Input hum file name
+    StringArg hum_file_arg
+      (
+      "i", "input",
+      "The hum mesh file", true,
+      "", "string"
+      );
+    cmd.add(hum_file_arg);
+    /// The sidecar cache file
+    StringArg sidecar_arg
+      (
+      "s", "sidecar",
+      "The cache file (default: the cache in the hum file)", false,
+      "", "string"
+      );
+    cmd.add(sidecar_arg);
+    TCLAP::SwitchArg is_check_arg
+      (
+      "c", "check",
+      "Verify the stored hashes instead of storing them",
+      cmd, false
+      );
+    TCLAP::SwitchArg is_list_arg
+      (
+      "l", "list",
+      "List the cache entries and whether they are valid or stale",
+      cmd, false
+      );
+    TCLAP::SwitchArg is_prune_arg
+      (
+      "p", "prune",
+      "Remove the stale cache entries",
+      cmd, false
+      );
+    cmd.parse(nargs, args);
+    std::string hum_file = hum_file_arg.getValue();
+    bool is_list = is_list_arg.getValue();
+    bool is_prune = is_prune_arg.getValue();
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (is_list == false && is_prune == false)
+      ret = HashPrimary(hum_file.c_str(), is_check_arg.getValue(),
+      MPI_COMM_WORLD);
+    else if (rank == 0)
+      ListCache(hum_file.c_str(), sidecar_arg.getValue(), is_prune);
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg "
+      << e.argId() << std::endl;
+    MPI_Finalize();
+    return 1;
+  }
+  MPI_Finalize();
+  return ret;
+}
+
+int HashPrimary(const char *hum_file, bool is_check, MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  /// Every rank hashes its blocks of a read-only handle
+  hid_t file = H5Fopen(hum_file, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(file >= 0);
+  deltapack::Register();
+  nodequant::Register();
+  hashcache::nameList paths = hashcache::PrimaryPaths(file);
+  hashcache::hashList hash(paths.size()), stored(paths.size());
+  std::vector<bool> is_stored(paths.size());
+  double begin = MPI_Wtime();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    hash[i] = hashcache::Hash(file, paths[i], comm);
+    is_stored[i] = hashcache::ReadHash(file, paths[i], stored[i]);
+  }
+  double elapsed = MPI_Wtime() - begin;
+  H5Fclose(file);
+  /// The read-only handles are gone before rank 0 writes
+  MPI_Barrier(comm);
+  if (rank != 0) return 0;
+  int n_bad = 0;
+  if (is_check == false)
+    file = H5Fopen(hum_file, H5F_ACC_RDWR, H5P_DEFAULT);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    std::string status = "new";
+    if (is_stored[i] == true)
+      status = (stored[i] == hash[i]) ? "ok" : "changed";
+    if (status == "changed") n_bad++;
+    if (is_check == false && status != "ok")
+      hashcache::WriteHash(file, paths[i], hash[i]);
+    std::cout << std::setw(16) << std::left << paths[i] << " "
+      << HexHash(hash[i]) << " " << status << "\n";
+  }
+  if (is_check == false)
+    H5Fclose(file);
+  std::cout << "(done) " << elapsed * 1.0e3 << " ms\n";
+  /// Checking fails if a stored hash no longer matches the data
+  return (is_check == true && n_bad > 0) ? 1 : 0;
+}
+
+void ListCache(const char *hum_file, const std::string &sidecar,
+  bool is_prune) {
+  /// Pruning the cache of the hum file itself needs write access
+  unsigned h5_mode = (is_prune == true && sidecar.empty() == true) ?
+    H5F_ACC_RDWR : H5F_ACC_RDONLY;
+  hid_t file = H5Fopen(hum_file, h5_mode, H5P_DEFAULT);
+  assert(file >= 0);
+  deltapack::Register();
+  nodequant::Register();
+  hashcache::cache *dcache = (sidecar.empty() == true) ?
+    new hashcache::cache(file) :
+    new hashcache::cache(file, sidecar.c_str());
+  hashcache::nameList names = dcache->entries();
+  for (size_t i = 0; i < names.size(); ++i) {
+    bool is_valid = dcache->is_valid(names[i]);
+    hashcache::nameList src = dcache->sources(names[i]);
+    std::cout << std::setw(16) << std::left << names[i] << " "
+      << ((is_valid == true) ? "valid" : "stale") << " (";
+    for (size_t j = 0; j < src.size(); ++j)
+      std::cout << ((j > 0) ? ", " : "") << src[j];
+    std::cout << ")";
+    if (is_valid == false && is_prune == true) {
+      dcache->remove(names[i]);
+      std::cout << " removed";
+    }
+    std::cout << "\n";
+  }
+  delete dcache;
+  H5Fclose(file);
+}
+
+std::string HexHash(uint64_t hash) {
+  std::stringstream cat;
+  cat << std::hex << std::setw(16) << std::setfill('0') << std::right << hash;
+  return cat.str();
+}
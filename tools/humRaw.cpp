@@ -0,0 +1,213 @@
+
+#include "ihstream.hpp"
+#include "ohstream.hpp"
+#include "humraw.hpp"
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <tclap/CmdLine.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/// Some typedefs
+typedef TCLAP::CmdLine CmdLineClass;
+typedef TCLAP::ValueArg<std::string> StringArg;
+
+/// Convert an HDF5 hum file to a hum-raw file
+template<typename floatT, typename uintT>
+void HumToRaw(const char *hum_file, const char *raw_file);
+
+/// Convert a hum-raw file to an HDF5 hum file
+template<typename floatT, typename uintT>
+void RawToHum(const char *raw_file, const char *hum_file);
+
+/// Dispatch on the stored integer/float sizes
+template<typename floatT>
+void Convert(const char *in_file, const char *out_file,
+  bool to_raw, bool is64);
+
+/// Main program
+
+int main(int nargs, char *args[]) {
+  try {
+    /// The command line object
+    CmdLineClass cmd
+      (
+      "Lossless hum (HDF5) <-> hum-raw (mmap) converter."
+      " The direction follows the input file format",
+      ' ', "0.1"
+      );
+    /// The Input file name
+    StringArg in_file_arg
+      (
+      "i", "input",
+      "The input mesh file (hum or hum-raw)", true,
+      "", "string"
+      );
+    cmd.add(in_file_arg);
+    /// The Output file name
+    StringArg out_file_arg
+      (
+      "o", "output",
+      "The output mesh file (hum-raw or hum)", true,
+      "", "string"
+      );
+    cmd.add(out_file_arg);
+    cmd.parse(nargs, args);
+    std::string in_file = in_file_arg.getValue();
+    std::string out_file = out_file_arg.getValue();
+    bool to_raw = (humraw::IsRaw(in_file.c_str()) == false);
+    bool is64, is_double;
+    {
+      ihstream hum_in(in_file.c_str());
+      is64 = (hum_in.get_int_size() > 4) ? true : false;
+      is_double = (hum_in.get_float_size() > 4) ? true : false;
+      hum_in.close();
+    }
+    struct timeval begin, end;
+    gettimeofday(&begin, NULL);
+    std::cout << ((to_raw == true) ? "hum -> hum-raw ... " : "hum-raw -> hum ... ");
+    if (is_double)
+      Convert<double>(in_file.c_str(), out_file.c_str(), to_raw, is64);
+    else
+      Convert<float>(in_file.c_str(), out_file.c_str(), to_raw, is64);
+    gettimeofday(&end, NULL);
+    double elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
+      + double( end.tv_usec - begin.tv_usec) / 1.0e3;
+    std::cout << "(done) " << elapsed << " ms\n";
+  } catch (TCLAP::ArgException &e) {
+    std::cerr << "error: " << e.error() << " for arg "
+      << e.argId() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+template<typename floatT>
+void Convert(const char *in_file, const char *out_file,
+  bool to_raw, bool is64) {
+  if (to_raw == true && is64 == true)
+    HumToRaw<floatT, uint64_t>(in_file, out_file);
+  else if (to_raw == true)
+    HumToRaw<floatT, uint32_t>(in_file, out_file);
+  else if (is64 == true)
+    RawToHum<floatT, uint64_t>(in_file, out_file);
+  else
+    RawToHum<floatT, uint32_t>(in_file, out_file);
+}
+
+template<typename floatT, typename uintT>
+void HumToRaw(const char *hum_file, const char *raw_file) {
+  ihstream hum_in(hum_file);
+  /// hum-raw keeps fixed size face records and no cell table
+  if (hum_in.is_poly_cell() == true)
+    std::cerr << "Warning: cell-face connectivity is not kept"
+    " (rebuild it from the face left/right cells)\n";
+  /// Patch names are stored NUL terminated in fixed size records
+  for (hsize_t i = 0; i < hum_in.nPatch(); ++i)
+    if (hum_in.get_patch_name(i).size() >= humraw::patchNameSize) {
+      std::cerr << "Error: patch name " << hum_in.get_patch_name(i)
+        << " is longer than " << humraw::patchNameSize - 1
+        << " characters\n";
+      exit(1);
+    }
+  /// Header and offset table
+  humraw::header head;
+  humraw::InitHeader(head, sizeof (uintT), sizeof (floatT));
+  head.nCell = hum_in.nCell();
+  head.nInternalFace = hum_in.nInternalFace();
+  head.nFaceAdjncy = hum_in.nFaceAdjncy();
+  node<double> min, max;
+  hum_in.read(min, max);
+  for (unsigned i = 0; i < 3; ++i) {
+    head.min[i] = min.xyz[i];
+    head.max[i] = max.xyz[i];
+  }
+  head.table[humraw::NODES].count = hum_in.nNode();
+  head.table[humraw::FACES].count = hum_in.nFace();
+  head.table[humraw::LEFT_RIGHT].count = hum_in.nFace();
+  head.table[humraw::PATCHES].count = hum_in.nPatch();
+  humraw::image raw;
+  if (raw.create(raw_file, head) == false) {
+    std::cerr << "Error: can not create " << raw_file << "\n";
+    exit(1);
+  }
+  /// Datasets are read straight into the mapped sections
+  if (hum_in.nNode() > 0)
+    hum_in.read(static_cast< node<floatT> *> (raw.section(humraw::NODES)));
+  if (hum_in.nFace() > 0) {
+    hum_in.read(static_cast< face<uintT> *> (raw.section(humraw::FACES)));
+    hum_in.read(static_cast< leftRight<uintT> *> (raw.section(humraw::LEFT_RIGHT)));
+  }
+  /// Patch table
+  humraw::patchRecord *record = raw.patches();
+  for (hsize_t i = 0; i < hum_in.nPatch(); ++i) {
+    const std::string &name = hum_in.get_patch_name(i);
+    const patchBC<hsize_t> &patch = hum_in.get_patch_info(i);
+    std::memset(record[i].name, 0, humraw::patchNameSize);
+    std::memcpy(record[i].name, name.c_str(), name.size());
+    record[i].info.bcType = patch.bcType;
+    record[i].info.startFace = patch.startFace;
+    record[i].info.faceCount = patch.faceCount;
+    record[i].info.attachedToProcID = patch.attachedToProcID;
+  }
+  raw.close();
+}
+
+template<typename floatT, typename uintT>
+void RawToHum(const char *raw_file, const char *hum_file) {
+  ihstream raw_in(raw_file);
+  /// Copy-on-write views give writable pointers without a copy
+  mappedSpan< node<floatT> > nodes;
+  mappedSpan< face<uintT> > faces;
+  mappedSpan< leftRight<uintT> > lr;
+  raw_in.map(nodes, true);
+  raw_in.map(faces, true);
+  raw_in.map(lr, true);
+  /// ohstream updates existing files, start from scratch
+  std::remove(hum_file);
+  ohstream hum_out(hum_file);
+  hum_out.set_size(raw_in.nNode(), raw_in.nFace());
+  if (raw_in.nNode() > 0)
+    hum_out.write(nodes.writable(), 0, 1, raw_in.nNode());
+  if (raw_in.nFace() > 0) {
+    hum_out.write(faces.writable(), 0, 1, raw_in.nFace());
+    hum_out.write(lr.writable(), 0, 1, raw_in.nFace());
+  }
+  /// Patch information
+  for (hsize_t i = 0; i < raw_in.nPatch(); ++i) {
+    std::string name = raw_in.get_patch_name(i);
+    const patchBC<hsize_t> &info = raw_in.get_patch_info(i);
+    patchBC<uintT> patch;
+    patch.bcType = info.bcType;
+    patch.startFace = info.startFace;
+    patch.faceCount = info.faceCount;
+    patch.attachedToProcID = info.attachedToProcID;
+    hum_out.write(name, patch);
+  }
+  /// Size attributes
+  h5pp::listString link;
+  link.push_back(hum::miscLink[hum::PRIMARY]);
+  h5pp::WriteAttribute(hum_out.file(), link, raw_in.nCell());
+  link.pop_back();
+  link.push_back(hum::miscLink[hum::SECONDARY]);
+  h5pp::WriteAttribute(hum_out.file(), link, raw_in.nFaceAdjncy());
+  link.pop_back();
+  link.push_back(hum::miscLink[hum::FIELD]);
+  h5pp::WriteAttribute(hum_out.file(), link, raw_in.nInternalFace());
+  link.pop_back();
+  link.push_back(hum::miscLink[hum::ENTITY]);
+  uintT IntegerT = sizeof (uintT);
+  h5pp::WriteAttribute(hum_out.file(), link, IntegerT);
+  link.pop_back();
+  /// The AABB (stored in double precision by hum-raw)
+  node<double> min, max;
+  H5TNode<double> my_h5_node;
+  raw_in.read(min, max);
+  link.push_back(hum::AABBLink[hum::PRIMARY]);
+  h5pp::WriteAttribute(hum_out.file(), link, min, my_h5_node.mem_t());
+  link.pop_back();
+  link.push_back(hum::AABBLink[hum::SECONDARY]);
+  h5pp::WriteAttribute(hum_out.file(), link, max, my_h5_node.mem_t());
+  hum_out.close();
+}
@@ -1,11 +1,13 @@
 #include "ihstream.hpp"
-#include "faceStreamer.hpp"
-#include "faceLeftRightStreamer.hpp"
+#include "ohstream.hpp"
+#include "streamPipeline.hpp"
 #include <string>
 #include <tclap/CmdLine.h>
 #include <stdint.h>
 #include "sfc.hpp"
 #include <fstream>
+#include <cstdio>
+#include <pthread.h>
 #include <sys/time.h>
 
 /// Some typedefs
@@ -13,13 +15,131 @@ typedef TCLAP::CmdLine CmdLineClass;
 typedef TCLAP::ValueArg<std::string> StringArg;
 typedef TCLAP::ValueArg<unsigned> IntArg;
 
-/// Reorder nodes
+/// Reorder nodes (floatT of the stored coordinates)
+template<typename floatT, typename uintT>
+void ReorderNode(const char *hum_file, size_t limit, bool in_memory,
+  unsigned queue_depth, bool direct);
+
+/// Reorder cells (floatT of the stored coordinates)
+template<typename floatT, typename uintT>
+void ReorderCell(const char *hum_file, size_t limit, bool in_memory,
+  unsigned queue_depth, bool direct);
+
+/// Layout of the output file of the out-of-place reordering
+struct copySettings {
+  hsize_t window; /*!< Faces per streamed window */
+  hsize_t chunk; /*!< Chunk size of compressed datasets (0 = contiguous) */
+  int deflate; /*!< Deflate level */
+  bool pack; /*!< Delta + bit pack the connectivity */
+  std::string cache; /*!< Sidecar cache of the cell order (empty = none) */
+};
+
+/// Reorder into a new file (the input is only read)
+template<typename floatT, typename uintT>
+void ReorderCopy(const char *hum_file, const char *out_file,
+  bool is_node, bool is_cell, bool in_memory, const copySettings &set);
+
+/// SFC node order of the nodes (read whole) as the inverse permutation
+template<typename floatT, typename uintT>
+void NodePerm(ihstream &hum_in, std::vector< node<floatT> > &nodes,
+  std::vector<uintT> &iperm);
+
+/// Nodes moved to their new IDs (iperm: old -> new)
+template<typename floatT, typename uintT>
+void PermuteNodes(std::vector< node<floatT> > &nodes,
+  const std::vector<uintT> &iperm);
+
+/// 64-bit meshes hold the permutation as chunk-local IDs
+/// (Overloaded version)
+template<typename floatT>
+void PermuteNodes(std::vector< node<floatT> > &nodes,
+  const std::vector<uint64_t> &iperm);
+
+/// SFC cell order of the cell centroids as the inverse permutation
+/// (faces streamed window faces at a time)
+template<typename floatT, typename uintT>
+void CellPerm(ihstream &hum_in, std::vector<uintT> &iperm, size_t window);
+
+/// CellPerm through the derived-data cache in cache_file: reused while
+/// the primary datasets hash the same, built and stored otherwise
+template<typename floatT, typename uintT>
+void CachedCellPerm(ihstream &hum_in, std::vector<uintT> &iperm,
+  size_t window, const std::string &cache_file);
+
+/// Left/right cells of a face window, renumbered by iperm unless NULL
+template<typename uintT>
+void ReadLeftRight(ihstream &hum_in, const uintT *iperm, hsize_t offset,
+  hsize_t size, std::vector< leftRight<uintT> > &lr);
+
+/// Cell-face connectivity rebuilt from the left/right cells (renumbered
+/// by iperm unless NULL) in two sweeps over the faces and written to
+/// out window cells at a time
+template<typename uintT, typename streamT>
+void WriteCellFaces(ihstream &hum_in, streamT &out, const uintT *iperm,
+  hsize_t window);
+
+/// Renumber the face nodes of a window (pipeline body)
+template<typename uintT>
+struct relabelNodes {
+  const uintT *iperm;
+
+  void operator()(faceSpan<uintT> span, hsize_t offset) const;
+};
+
+/// Renumber the left/right cells of a window (pipeline body)
+template<typename uintT>
+struct relabelCells {
+  const uintT *iperm;
+  hsize_t n_internal; /*!< Boundary faces have no right cell */
+
+  void operator()(streamSpan< leftRight<uintT> > lr, hsize_t offset) const;
+};
+
+/// Face centroids of windows summed into the cells (pipeline stages)
+template<typename floatT, typename uintT>
+class centroidStages {
+public:
+  struct window {
+    hsize_t offset, size;
+    faceZipWindow<uintT> zip; /*!< Face nodes and left/right cells */
+    std::vector< node<double> > centroid; /*!< Of every face */
+  };
+  typedef window chunkType;
+
+  centroidStages(ihstream &in, const mappedSpan< node<floatT> > &nodes,
+    hsize_t window_size, std::vector< node<double> > &centroid,
+    std::vector<uintT> &count);
+
+  /// Faces and left/right cells of the next window
+  bool read(chunkType &c);
+
+  /// Face centroids (parallel)
+  void transform(chunkType &c);
+
+  /// Summed into the cells in face order (serial)
+  void write(chunkType &c);
+
+private:
+  ihstream &_hum_in;
+  const mappedSpan< node<floatT> > &_nodes;
+  hsize_t _window, _offset;
+  std::vector< node<double> > &_centroid;
+  std::vector<uintT> &_count;
+};
+
+/// One window of faces and their left/right cells
 template<typename uintT>
-void ReorderNode(const char *hum_file, size_t limit);
+struct faceWindow {
+  ihstream *hum_in;
+  hsize_t offset, size;
+  std::vector< face<uintT> > faces; /*!< Fixed size face records */
+  faceCSR<uintT> csr; /*!< CSR faces */
+  std::vector< leftRight<uintT> > lr;
+};
 
-/// Reorder cells
+/// Read a face window (the read-ahead thread)
 template<typename uintT>
-void ReorderCell(const char *hum_file, size_t limit);
+void *ReadFaceWindow(void *arg);
 
 /// Main program
 
@@ -40,11 +160,19 @@ int main(int nargs, char *args[]) {
       );
     cmd.add(hum_file_arg);
     /// The Output hum file name
+    StringArg out_file_arg
+      (
+      "o", "output",
+      "Write the reordered mesh to a new file (the input is left as is)", false,
+      "", "string"
+      );
+    cmd.add(out_file_arg);
+    /// The stream buffer size
     IntArg buf_size_arg
       (
       "s", "size",
       "The stream buffer size - in entity counts", false,
-      10000, "integer"
+      262144, "integer"
       );
     cmd.add(buf_size_arg);
     /// Toggle node reordering
@@ -61,31 +189,135 @@ int main(int nargs, char *args[]) {
       "Disable cell re-ordering",
       cmd, true
       );
+    /// Toggle in-memory file image
+    TCLAP::SwitchArg is_memory_arg
+      (
+      "m", "memory",
+      "Load the whole hum file into memory (written back at the end)",
+      cmd, false
+      );
+    /// Asynchronous reads of hum-raw files
+    IntArg queue_depth_arg
+      (
+      "a", "async",
+      "Queue depth of asynchronous hum-raw reads (0 = off)", false,
+      0, "integer"
+      );
+    cmd.add(queue_depth_arg);
+    TCLAP::SwitchArg is_direct_arg
+      (
+      "d", "direct",
+      "Bypass the page cache (O_DIRECT) for asynchronous reads",
+      cmd, false
+      );
+    /// Deflate compression of the output datasets
+    IntArg deflate_arg
+      (
+      "z", "deflate",
+      "Deflate level of the output file (-o, 0 = uncompressed)", false,
+      0, "integer"
+      );
+    cmd.add(deflate_arg);
+    /// Chunk size of the compressed datasets
+    IntArg chunk_arg
+      (
+      "k", "chunk",
+      "Chunk size of the compressed output (-o) - in entity counts", false,
+      65536, "integer"
+      );
+    cmd.add(chunk_arg);
+    /// Sidecar cache of the SFC cell order
+    StringArg cache_arg
+      (
+      "x", "cache",
+      "Cache file of the cell order (-o), reused while the mesh is unchanged",
+      false, "", "string"
+      );
+    cmd.add(cache_arg);
+    /// Delta + bit pack the connectivity
+    TCLAP::SwitchArg pack_arg
+      (
+      "p", "pack",
+      "Store the output connectivity (-o) delta + bit packed",
+      cmd, false
+      );
     cmd.parse(nargs, args);
     std::string hum_file = hum_file_arg.getValue();
     double buf_size = buf_size_arg.getValue();
     bool is_cell = is_cell_arg.getValue();
     bool is_node = is_node_arg.getValue();
-    bool is64;
+    bool is_memory = is_memory_arg.getValue();
+    unsigned queue_depth = queue_depth_arg.getValue();
+    bool is_direct = is_direct_arg.getValue();
+    std::string out_file = out_file_arg.getValue();
+    copySettings set;
+    set.deflate = deflate_arg.getValue();
+    set.pack = pack_arg.getValue();
+    set.cache = cache_arg.getValue();
+    set.chunk = (set.deflate > 0 || set.pack == true) ?
+      chunk_arg.getValue() : 0;
+    /// Windows of whole chunks are coded in parallel and written directly
+    set.window = hsize_t(buf_size);
+    if (set.chunk > 0)
+      set.window = (set.window + set.chunk - 1) / set.chunk * set.chunk;
+    bool is64, is_float;
     {
       ihstream hum_in(hum_file.c_str());
       is64 = (hum_in.get_int_size() > 4) ? true : false;
+      /// Single precision nodes are held as such in memory
+      is_float = (hum_in.get_float_size() == 4) ? true : false;
       hum_in.close();
     }
+    //// Out-of-place re-ordering
+    if (out_file.empty() == false) {
+      if (out_file == hum_file) {
+        std::cerr << "error: the output file is the input file\n";
+        return 1;
+      }
+      if (is64 && is_float)
+        ReorderCopy<float, uint64_t>(hum_file.c_str(), out_file.c_str(),
+          is_node, is_cell, is_memory, set);
+      else if (is64)
+        ReorderCopy<double, uint64_t>(hum_file.c_str(), out_file.c_str(),
+          is_node, is_cell, is_memory, set);
+      else if (is_float)
+        ReorderCopy<float, uint32_t>(hum_file.c_str(), out_file.c_str(),
+          is_node, is_cell, is_memory, set);
+      else
+        ReorderCopy<double, uint32_t>(hum_file.c_str(), out_file.c_str(),
+          is_node, is_cell, is_memory, set);
+      return 0;
+    }
     //#if 0
     //// Cell re-ordering
     if (is_cell) {
-      if (is64)
-        ReorderCell<uint64_t>(hum_file.c_str(), buf_size);
+      if (is64 && is_float)
+        ReorderCell<float, uint64_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
+      else if (is64)
+        ReorderCell<double, uint64_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
+      else if (is_float)
+        ReorderCell<float, uint32_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
       else
-        ReorderCell<uint32_t>(hum_file.c_str(), buf_size);
+        ReorderCell<double, uint32_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
     }
     //// Node re-ordering
     if (is_node) {
-      if (is64)
-        ReorderNode<uint64_t>(hum_file.c_str(), buf_size);
+      if (is64 && is_float)
+        ReorderNode<float, uint64_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
+      else if (is64)
+        ReorderNode<double, uint64_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
+      else if (is_float)
+        ReorderNode<float, uint32_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
       else
-        ReorderNode<uint32_t>(hum_file.c_str(), buf_size);
+        ReorderNode<double, uint32_t>(hum_file.c_str(), buf_size, is_memory,
+          queue_depth, is_direct);
     }
     //#endif
   } catch (TCLAP::ArgException &e) {
@@ -96,43 +328,27 @@ int main(int nargs, char *args[]) {
   return 0;
 }
 
-template<typename uintT>
-void ReorderNode(const char *hum_file, size_t limit) {
-  node<double> min, max;
-  std::vector< node<double> > nodes;
-  std::vector< uintT > iperm, perm;
+template<typename floatT, typename uintT>
+void ReorderNode(const char *hum_file, size_t limit, bool in_memory,
+  unsigned queue_depth, bool direct) {
+  std::vector< node<floatT> > nodes;
+  std::vector< uintT > iperm;
   struct timeval begin, end;
   double elapsed;
   std::cout << " ===========================================\n";
   std::cout << " ====  Node re-ordering and re-numbering ===\n";
   std::cout << " ===========================================\n";
-  /// Construct sfc and sort and get fwd/inv permutation
-  gettimeofday(&begin, NULL);
-  std::cout << "SFC construction + sorting ... ";
   /// Read from input file
-  ihstream hum_in(hum_file, true);
-  hum_in.read(min, max);
-  nodes.resize(hum_in.nNode());
-  hum_in.read(&nodes[0]);
-  sfc::sfcFunctor<double, uintT> sfc_func(min.xyz, max.xyz);
-  sfc_func.set(nodes.size(), &(nodes[0].xyz[0]));
-  sfc_func.sort();
-  sfc_func.make_iperm();
-  iperm.swap(sfc_func.iperm());
-  sfc_func.clear();
-  gettimeofday(&end, NULL);
-  elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
-    + double( end.tv_usec - begin.tv_usec) / 1.0e3;
-  std::cout << "(done) " << elapsed << " ms\n";
+  ihstream hum_in(hum_file, true, in_memory);
+  hum_in.set_parallel_inflate(true);
+  hum_in.set_async_io(queue_depth, direct);
+  NodePerm(hum_in, nodes, iperm);
 
   /// Re-order nodes
   gettimeofday(&begin, NULL);
   std::cout << "Node re-ordering ... ";
   /// Create permutation
-  perm.resize(iperm.size());
-  for (uintT i = 0; i < perm.size(); ++i)
-    perm[ iperm[i] ] = i;
-  sfc::InplacePermutation(&nodes[0], &perm[0], perm.size());
+  PermuteNodes(nodes, iperm);
   hum_in.write(&nodes[0]);
   gettimeofday(&end, NULL);
   elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
@@ -142,75 +358,129 @@ void ReorderNode(const char *hum_file, size_t limit) {
   /// Re-number face-node connectivity
   gettimeofday(&begin, NULL);
   std::cout << "Stream re-numbering of face-nodes ... ";
-  faceStreamer<uintT> fs(hum_in, 10000);
-  fs.SetWriteBufOn();
-  while (!fs.isEof()) {
-    for (uintT i = 0; i < fs.GetNumFaceNodes(); ++i) {
-      fs.FaceNodesData()[i] = iperm[fs.FaceNodesData()[i]];
-    }
-    fs.Increment();
-  }
+  /// Windows are renumbered in parallel, read and written in order
+  relabelNodes<uintT> relabel;
+  relabel.iperm = &iperm[0];
+  pipeline::Transform< pipeline::faceNodes<uintT> >
+    (
+    hum_in, relabel, limit, true
+    );
   gettimeofday(&end, NULL);
   elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
     + double( end.tv_usec - begin.tv_usec) / 1.0e3;
   std::cout << "(done) " << elapsed << " ms\n";
 }
 
-template<typename uintT>
-void ReorderCell(const char *hum_file, size_t limit) {
-  std::vector< node<double> > nodes, centroid;
-  node<double> min, max;
+template<typename floatT, typename uintT>
+void ReorderCell(const char *hum_file, size_t limit, bool in_memory,
+  unsigned queue_depth, bool direct) {
   struct timeval begin, end;
   double elapsed;
-  std::vector<uintT> cell_face_count, iperm;
+  std::vector<uintT> iperm;
 
   std::cout << " ======================================\n";
   std::cout << " ====  Cell left/right re-numbering ===\n";
   std::cout << " ======================================\n";
-  /// Centroid construction
+  ihstream hum_in(hum_file, true, in_memory);
+  hum_in.set_parallel_inflate(true);
+  hum_in.set_async_io(queue_depth, direct);
+  CellPerm<floatT>(hum_in, iperm, limit);
+#if 1
+  /// Cell left/right re-numbering
   gettimeofday(&begin, NULL);
-  std::cout << "Cell centroid construction ...";
-  ihstream hum_in(hum_file, true);
+  std::cout << "Face left/right cell ID re-numbering (streaming) ...";
+  /// Internal and patch faces, windows renumbered in parallel
+  relabelCells<uintT> relabel;
+  relabel.iperm = &iperm[0];
+  relabel.n_internal = hum_in.nInternalFace();
+  pipeline::Transform< pipeline::faceLeftRight<uintT> >
+    (
+    hum_in, relabel, limit, true
+    );
+  gettimeofday(&end, NULL);
+  elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
+    + double( end.tv_usec - begin.tv_usec) / 1.0e3;
+  std::cout << "(done) " << elapsed << " ms\n";
+  /// Polyhedral cells move with their new IDs
+  if (hum_in.is_poly_cell() == true) {
+    gettimeofday(&begin, NULL);
+    std::cout << "Cell-face connectivity re-numbering (streaming) ...";
+    /// The left/right cells already carry the new IDs
+    WriteCellFaces<uintT>(hum_in, hum_in, (const uintT *) NULL, limit);
+    gettimeofday(&end, NULL);
+    elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
+      + double( end.tv_usec - begin.tv_usec) / 1.0e3;
+    std::cout << "(done) " << elapsed << " ms\n";
+  }
+#endif
+}
+
+template<typename floatT, typename uintT>
+void NodePerm(ihstream &hum_in, std::vector< node<floatT> > &nodes,
+  std::vector<uintT> &iperm) {
+  node<floatT> min, max;
+  struct timeval begin, end;
+  double elapsed;
+  /// Construct sfc and sort and get fwd/inv permutation
+  gettimeofday(&begin, NULL);
+  std::cout << "SFC construction + sorting ... ";
   hum_in.read(min, max);
   nodes.resize(hum_in.nNode());
   hum_in.read(&nodes[0]);
+  sfc::sfcFunctor<floatT, uintT> sfc_func(min.xyz, max.xyz);
+  sfc_func.set(nodes.size(), &(nodes[0].xyz[0]));
+  sfc_func.sort();
+  sfc_func.make_iperm();
+  iperm.swap(sfc_func.iperm());
+  sfc_func.clear();
+  gettimeofday(&end, NULL);
+  elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
+    + double( end.tv_usec - begin.tv_usec) / 1.0e3;
+  std::cout << "(done) " << elapsed << " ms\n";
+}
+
+template<typename floatT, typename uintT>
+void PermuteNodes(std::vector< node<floatT> > &nodes,
+  const std::vector<uintT> &iperm) {
+  std::vector<uintT> perm(iperm.size());
+  for (uintT i = 0; i < perm.size(); ++i)
+    perm[ iperm[i] ] = i;
+  sfc::InplacePermutation(&nodes[0], &perm[0], perm.size());
+}
+
+template<typename floatT>
+void PermuteNodes(std::vector< node<floatT> > &nodes,
+  const std::vector<uint64_t> &iperm) {
+  /// Half the memory of a uint64_t permutation while the IDs of a
+  /// chunk span less than 4G
+  packedIds<uint64_t> perm(iperm.size());
+  for (uint64_t i = 0; i < perm.size(); ++i)
+    perm[ iperm[i] ] = i;
+  sfc::InplacePermutation(&nodes[0], perm, perm.size());
+}
+
+template<typename floatT, typename uintT>
+void CellPerm(ihstream &hum_in, std::vector<uintT> &iperm, size_t window) {
+  std::vector< node<double> > centroid;
+  mappedSpan< node<floatT> > nodes;
+  node<double> min, max;
+  struct timeval begin, end;
+  double elapsed;
+  std::vector<uintT> cell_face_count;
+
+  /// Centroid construction
+  gettimeofday(&begin, NULL);
+  std::cout << "Cell centroid construction ...";
+  hum_in.read(min, max);
+  /// Nodes are only looked up, map them instead of reading
+  hum_in.map(nodes);
   cell_face_count.resize(hum_in.nCell());
   centroid.resize(hum_in.nCell());
   {
-    faceLeftRightStreamer<uintT> fs_lr(hum_in, 10000);
-    faceStreamer<uintT> fs(hum_in, 10000);
-    /// Internal faces
-    while (!fs_lr.isEof()) {
-      node<double> face_centroid;
-      const uintT &left = fs_lr.GetLeftCell();
-      const uintT &right = fs_lr.GetRightCell();
-      for (unsigned j = 0; j < fs.GetNumFaceNodes(); ++j)
-        face_centroid += nodes[fs.FaceNodesData()[j]];
-      face_centroid.scale(1.0 / double(fs.GetNumFaceNodes()));
-      centroid[left] += face_centroid;
-      centroid[right] += face_centroid;
-      cell_face_count[left]++;
-      cell_face_count[right]++;
-      /// Increment the stream counter
-      fs_lr.Increment();
-      fs.Increment();
-    }
-    /// Boundary faces
-    while (!fs_lr.isEofPatch()) {
-      while (!fs_lr.isEofPatchFace()) {
-        node<double> face_centroid;
-        const uintT &left = fs_lr.GetPatchCell();
-        for (unsigned j = 0; j < fs.GetNumFaceNodes(); ++j)
-          face_centroid += nodes[fs.FaceNodesData()[j]];
-        face_centroid.scale(1.0 / double(fs.GetNumFaceNodes()));
-        centroid[left] += face_centroid;
-        cell_face_count[left]++;
-        /// Increment the stream counter
-        fs_lr.IncrementPatchFace();
-        fs.Increment();
-      }
-      fs_lr.IncrementPatch();
-    }
+    /// Face centroids in parallel, summed in face order
+    centroidStages<floatT, uintT> stages(hum_in, nodes, window, centroid,
+      cell_face_count);
+    pipeline::Run(stages);
   }
   /// Divide by cell_face_count to get cell centroid
   for (uintT i = 0; i < hum_in.nCell(); ++i)
@@ -232,7 +502,6 @@ void ReorderCell(const char *hum_file, size_t limit) {
     << centroid[i].xyz[2] << "\n";
 #endif
 
-#if 1
   /// SFC construction + key sorting
   gettimeofday(&begin, NULL);
   std::cout << "SFC construction + key sorting ...";
@@ -246,29 +515,289 @@ void ReorderCell(const char *hum_file, size_t limit) {
   elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
     + double( end.tv_usec - begin.tv_usec) / 1.0e3;
   std::cout << "(done) " << elapsed << " ms\n";
-  /// Cell left/right re-numbering
-  gettimeofday(&begin, NULL);
-  std::cout << "Face left/right cell ID re-numbering (streaming) ...";
-  faceLeftRightStreamer<uintT> fs_lr(hum_in, 10000);
-  fs_lr.SetWriteBufOn();
-  /// Internal faces
-  while (!fs_lr.isEof()) {
-    fs_lr.FaceLeftData() = iperm[ fs_lr.FaceLeftData() ];
-    fs_lr.FaceRightData() = iperm[ fs_lr.FaceRightData() ];
-    fs_lr.Increment();
+}
+
+template<typename floatT, typename uintT>
+void CachedCellPerm(ihstream &hum_in, std::vector<uintT> &iperm,
+  size_t window, const std::string &cache_file) {
+  if (cache_file.empty() == true) {
+    CellPerm<floatT>(hum_in, iperm, window);
+    return;
+  }
+  const std::string name = "cellSFC";
+  hashcache::cache dcache(hum_in.file(), cache_file.c_str());
+  /// The sources are hashed unless hashHum stored their hashes
+  std::cout << "Cell order from cache " << cache_file << " ...";
+  if (dcache.load(name, iperm) == true && iperm.size() == hum_in.nCell()) {
+    std::cout << "(hit)\n";
+    return;
+  }
+  std::cout << "(miss)\n";
+  CellPerm<floatT>(hum_in, iperm, window);
+  dcache.store(name, iperm, hashcache::PrimaryPaths(hum_in.file()));
+}
+
+template<typename uintT>
+void *ReadFaceWindow(void *arg) {
+  faceWindow<uintT> &win = *static_cast<faceWindow<uintT> *> (arg);
+  if (win.size == 0) return NULL;
+  if (win.hum_in->is_face_csr() == true)
+    win.hum_in->read(win.csr, win.offset, win.size);
+  else {
+    win.faces.resize(win.size);
+    win.hum_in->read(&win.faces[0], win.offset, win.size);
+  }
+  win.lr.resize(win.size);
+  win.hum_in->read(&win.lr[0], win.offset, win.size);
+  return NULL;
+}
+
+template<typename uintT>
+void ReadLeftRight(ihstream &hum_in, const uintT *iperm, hsize_t offset,
+  hsize_t size, std::vector< leftRight<uintT> > &lr) {
+  lr.resize(size);
+  if (size == 0) return;
+  hum_in.read(&lr[0], offset, size);
+  if (iperm == NULL) return;
+  /// Boundary faces have no right cell
+  for (hsize_t i = 0; i < size; ++i) {
+    lr[i].left = iperm[lr[i].left];
+    if (offset + i < hum_in.nInternalFace())
+      lr[i].right = iperm[lr[i].right];
+  }
+}
+
+template<typename uintT, typename streamT>
+void WriteCellFaces(ihstream &hum_in, streamT &out, const uintT *iperm,
+  hsize_t window) {
+  hsize_t n_face = hum_in.nFace(), n_cell = hum_in.nCell();
+  std::vector< leftRight<uintT> > lr;
+  /// Faces per cell, summed into the start of each cell in the
+  /// flat cell-face array (one sweep over the faces)
+  std::vector<uint64_t> start(n_cell + 1, 0);
+  for (hsize_t f = 0; f < n_face; f += window) {
+    ReadLeftRight(hum_in, iperm, f, std::min(window, n_face - f), lr);
+    for (hsize_t i = 0; i < lr.size(); ++i) {
+      start[lr[i].left + 1]++;
+      if (f + i < hum_in.nInternalFace()) start[lr[i].right + 1]++;
+    }
+  }
+  for (hsize_t c = 0; c < n_cell; ++c)
+    start[c + 1] += start[c];
+  /// A second sweep drops each face in the next slot of its cells,
+  /// the faces of a cell come in increasing face ID order as from
+  /// cellCSR::build. start[c] runs up to the start of cell c + 1
+  std::vector<uintT> faces(start[n_cell]);
+  for (hsize_t f = 0; f < n_face; f += window) {
+    ReadLeftRight(hum_in, iperm, f, std::min(window, n_face - f), lr);
+    for (hsize_t i = 0; i < lr.size(); ++i) {
+      faces[start[lr[i].left]++] = f + i;
+      if (f + i < hum_in.nInternalFace())
+        faces[start[lr[i].right]++] = f + i;
+    }
+  }
+  for (hsize_t c = n_cell; c > 0; --c)
+    start[c] = start[c - 1];
+  start[0] = 0;
+  /// Written window cells at a time
+  cellCSR<uintT> cells;
+  for (hsize_t c = 0; c < n_cell; c += window) {
+    hsize_t n = std::min(window, n_cell - c);
+    cells.offsets.assign(start.begin() + c, start.begin() + c + n + 1);
+    cells.faces.assign(faces.begin() + start[c], faces.begin() + start[c + n]);
+    out.write(cells, c);
+  }
+}
+
+template<typename uintT>
+void relabelNodes<uintT>
+::operator()(faceSpan<uintT> span, hsize_t) const {
+  /// The flat node array of the whole window
+  hsize_t n_adjncy = span.offsets[span.size] - span.offsets[0];
+  for (hsize_t i = 0; i < n_adjncy; ++i)
+    span.nodes[i] = iperm[span.nodes[i]];
+}
+
+template<typename uintT>
+void relabelCells<uintT>
+::operator()(streamSpan< leftRight<uintT> > lr, hsize_t offset) const {
+  for (size_t i = 0; i < lr.size(); ++i) {
+    lr[i].left = iperm[ lr[i].left ];
+    if (offset + i < n_internal)
+      lr[i].right = iperm[ lr[i].right ];
   }
-  /// Patch faces
-  while (!fs_lr.isEofPatch()) {
-    while (!fs_lr.isEofPatchFace()) {
-      fs_lr.PatchFaceData() = iperm[ fs_lr.PatchFaceData() ];
-      fs_lr.IncrementPatchFace();
+}
+
+template<typename floatT, typename uintT>
+centroidStages<floatT, uintT>
+::centroidStages(ihstream &in, const mappedSpan< node<floatT> > &nodes,
+  hsize_t window_size, std::vector< node<double> > &centroid,
+  std::vector<uintT> &count)
+: _hum_in(in), _nodes(nodes), _window(window_size), _offset(0),
+_centroid(centroid), _count(count) {
+  /* empty */
+}
+
+template<typename floatT, typename uintT>
+bool centroidStages<floatT, uintT>
+::read(chunkType &c) {
+  if (_offset >= _hum_in.nFace()) return false;
+  c.offset = _offset;
+  c.size = std::min(_window, _hum_in.nFace() - _offset);
+  c.zip.read(_hum_in, c.offset, c.size);
+  _offset += c.size;
+  return true;
+}
+
+template<typename floatT, typename uintT>
+void centroidStages<floatT, uintT>
+::transform(chunkType &c) {
+  const faceCSR<uintT> &faces = c.zip.faces;
+  c.centroid.resize(c.size);
+  for (hsize_t i = 0; i < c.size; ++i) {
+    node<double> face_centroid = node<double>();
+    const uintT *ids = faces.nodesOf(i);
+    for (unsigned j = 0; j < faces.count(i); ++j)
+      for (unsigned k = 0; k < 3; ++k)
+        face_centroid.xyz[k] += _nodes[ids[j]].xyz[k];
+    face_centroid.scale(1.0 / double(faces.count(i)));
+    c.centroid[i] = face_centroid;
+  }
+}
+
+template<typename floatT, typename uintT>
+void centroidStages<floatT, uintT>
+::write(chunkType &c) {
+  for (hsize_t i = 0; i < c.size; ++i) {
+    const uintT &left = c.zip.lr[i].left;
+    _centroid[left] += c.centroid[i];
+    _count[left]++;
+    /// Boundary faces have no right cell
+    if (c.offset + i >= _hum_in.nInternalFace()) continue;
+    const uintT &right = c.zip.lr[i].right;
+    _centroid[right] += c.centroid[i];
+    _count[right]++;
+  }
+}
+
+template<typename floatT, typename uintT>
+void ReorderCopy(const char *hum_file, const char *out_file,
+  bool is_node, bool is_cell, bool in_memory, const copySettings &set) {
+  std::vector< node<floatT> > nodes;
+  std::vector<uintT> node_iperm, cell_iperm;
+  /// The box is copied at full precision whatever the nodes are
+  node<double> min, max;
+  struct timeval begin, end, total;
+  double elapsed;
+  std::cout << " ===================================================\n";
+  std::cout << " ====  Out-of-place re-ordering and re-numbering ===\n";
+  std::cout << " ===================================================\n";
+  gettimeofday(&total, NULL);
+  /// The input is only read, a failed run leaves it intact
+  ihstream hum_in(hum_file, false, in_memory);
+  hum_in.set_parallel_inflate(true);
+  /// Windows are read with pread while the output is written
+  hum_in.set_concurrent_read(true);
+  if (hum_in.nField() > 0 || hum_in.nNodeStep() > 0)
+    std::cerr << "Warning: fields and node steps are not copied\n";
+  if (is_cell == true)
+    CachedCellPerm<floatT>(hum_in, cell_iperm, set.window, set.cache);
+  if (is_node == true)
+    NodePerm(hum_in, nodes, node_iperm);
+  else {
+    nodes.resize(hum_in.nNode());
+    hum_in.read(&nodes[0]);
+  }
+
+  /// Fresh file, laid out as set (an existing one would be reopened)
+  std::remove(out_file);
+  ohstream hum_out(out_file);
+  hum_out.set_deflate((set.deflate > 0) ? set.chunk : 0, set.deflate);
+  hum_out.set_packing((set.pack == true) ? set.chunk : 0);
+  hum_out.set_face_csr(hum_in.is_face_csr());
+  hum_out.set_size(hum_in.nNode(), hum_in.nFace(), hum_in.nFaceAdjncy());
+  hum_out.write_mesh_size<uintT>(hum_in.nCell(), hum_in.nInternalFace());
+  hum_in.read(min, max);
+  hum_out.write(min, max);
+
+  /// Re-order nodes
+  gettimeofday(&begin, NULL);
+  std::cout << "Node re-ordering ... ";
+  if (is_node == true)
+    PermuteNodes(nodes, node_iperm);
+  hum_out.write(&nodes[0]);
+  nodes.clear();
+  gettimeofday(&end, NULL);
+  elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
+    + double( end.tv_usec - begin.tv_usec) / 1.0e3;
+  std::cout << "(done) " << elapsed << " ms\n";
+
+  /// Faces and left/right cells, window k + 1 is read while
+  /// window k is renumbered and written
+  gettimeofday(&begin, NULL);
+  std::cout << "Face re-numbering (read-ahead streaming) ... ";
+  bool is_overlap = hum_in.get_reader().isOpen();
+  faceWindow<uintT> win[2];
+  for (unsigned i = 0; i < 2; ++i) win[i].hum_in = &hum_in;
+  win[0].offset = 0;
+  win[0].size = std::min(set.window, hum_in.nFace());
+  ReadFaceWindow<uintT>(&win[0]);
+  for (unsigned k = 0; win[k % 2].size > 0; ++k) {
+    faceWindow<uintT> &cur = win[k % 2];
+    faceWindow<uintT> &next = win[(k + 1) % 2];
+    next.offset = cur.offset + cur.size;
+    next.size = std::min(set.window, hum_in.nFace() - next.offset);
+    pthread_t thread;
+    bool is_ahead = (is_overlap == true && next.size > 0 &&
+      pthread_create(&thread, NULL, ReadFaceWindow<uintT>, &next) == 0);
+    if (is_node == true && hum_in.is_face_csr() == true) {
+      hsize_t n_adjncy = cur.csr.offsets[cur.size] - cur.csr.offsets[0];
+      for (hsize_t i = 0; i < n_adjncy; ++i)
+        cur.csr.nodes[i] = node_iperm[cur.csr.nodes[i]];
+    } else if (is_node == true)
+      for (hsize_t i = 0; i < cur.size; ++i)
+        for (unsigned j = 0; j < cur.faces[i].bField; ++j)
+          cur.faces[i].entityID[j] = node_iperm[cur.faces[i].entityID[j]];
+    /// Boundary faces have no right cell
+    if (is_cell == true)
+      for (hsize_t i = 0; i < cur.size; ++i) {
+        cur.lr[i].left = cell_iperm[cur.lr[i].left];
+        if (cur.offset + i < hum_in.nInternalFace())
+          cur.lr[i].right = cell_iperm[cur.lr[i].right];
+      }
+    {
+      /// HDF5 calls of this thread wait for those of the reads
+      concurrent::hdf5Lock lock(hum_in.get_reader());
+      if (hum_in.is_face_csr() == true)
+        hum_out.write(cur.csr, cur.offset);
+      else
+        hum_out.write(&cur.faces[0], cur.offset, 1, cur.size);
+      hum_out.write(&cur.lr[0], cur.offset, 1, cur.size);
     }
-    fs_lr.IncrementPatch();
+    if (is_ahead == true)
+      pthread_join(thread, NULL);
+    else
+      ReadFaceWindow<uintT>(&next);
   }
   gettimeofday(&end, NULL);
   elapsed = double( end.tv_sec - begin.tv_sec) * 1.0e3
     + double( end.tv_usec - begin.tv_usec) / 1.0e3;
   std::cout << "(done) " << elapsed << " ms\n";
-#endif
-}
 
+  /// Patches are unchanged (faces keep their order)
+  for (hsize_t i = 0; i < hum_in.nPatch(); ++i) {
+    std::string name = hum_in.get_patch_name(i);
+    patchBC<hsize_t> patch = hum_in.get_patch_info(i);
+    hum_out.write(name, patch);
+  }
+  /// Polyhedral cells move with their new IDs
+  if (hum_in.is_poly_cell() == true)
+    WriteCellFaces<uintT>(hum_in, hum_out,
+    (is_cell == true) ? &cell_iperm[0] : (const uintT *) NULL, set.window);
+  hum_out.close();
+  hum_in.close();
+  gettimeofday(&end, NULL);
+  elapsed = double( end.tv_sec - total.tv_sec) * 1.0e3
+    + double( end.tv_usec - total.tv_usec) / 1.0e3;
+  std::cout << "Total " << elapsed << " ms\n";
+}